@@ -26,6 +26,8 @@
 #include <assert.h>
 #ifdef HAVE_W32_SYSTEM
 #include <process.h>
+#else
+#include <poll.h>
 #endif
 #include "assuan-defs.h"
 
@@ -43,6 +45,20 @@ writen (assuan_context_t ctx, const char *buffer, size_t length)
         {
           if (errno == EINTR)
             continue;
+#ifndef HAVE_W32_SYSTEM
+          if (errno == EAGAIN)
+            {
+              /* The descriptor is non-blocking during a transaction
+                 started with assuan_transact_start; writes still
+                 block.  */
+              struct pollfd pfd;
+
+              pfd.fd = ctx->outbound.fd;
+              pfd.events = POLLOUT;
+              if (poll (&pfd, 1, -1) >= 0 || errno == EINTR)
+                continue;
+            }
+#endif
           return -1; /* write error */
         }
       length -= nwritten;
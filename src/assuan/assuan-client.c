@@ -23,6 +23,9 @@
 #include <errno.h>
 #include <unistd.h>
 #include <assert.h>
+#ifndef HAVE_W32_SYSTEM
+#include <fcntl.h>
+#endif
 
 #include "assuan-defs.h"
 
@@ -31,28 +34,16 @@
 #define xtoi_2(p)   ((xtoi_1(p) * 16) + xtoi_1((p)+1))
 
 
-assuan_error_t
-_assuan_read_from_server (assuan_context_t ctx, int *okay, int *off)
+/* Classify the line just read from the server.  */
+static assuan_error_t
+parse_server_line (assuan_context_t ctx, int *okay, int *off)
 {
-  char *line;
-  int linelen;
-  assuan_error_t rc;
+  char *line = ctx->inbound.line;
+  int linelen = ctx->inbound.linelen;
+  assuan_error_t rc = 0;
 
   *okay = 0;
   *off = 0;
-  do 
-    {
-      do
-	{
-	  rc = _assuan_read_line (ctx);
-	}
-      while (_assuan_error_is_eagain (rc));
-      if (rc)
-        return rc;
-      line = ctx->inbound.line;
-      linelen = ctx->inbound.linelen;
-    }    
-  while (*line == '#' || !linelen);
 
   if (linelen >= 1
       && line[0] == 'D' && line[1] == ' ')
@@ -111,55 +102,41 @@ _assuan_read_from_server (assuan_context_t ctx, int *okay, int *off)
 }
 
 
-
-/**
- * assuan_transact:
- * @ctx: The Assuan context
- * @command: Command line to be send to the server
- * @data_cb: Callback function for data lines
- * @data_cb_arg: first argument passed to @data_cb
- * @inquire_cb: Callback function for a inquire response
- * @inquire_cb_arg: first argument passed to @inquire_cb
- * @status_cb: Callback function for a status response
- * @status_cb_arg: first argument passed to @status_cb
- * 
- * FIXME: Write documentation
- * 
- * Return value: 0 on success or error code.  The error code may be
- * the one one returned by the server in error lines or from the
- * callback functions.  Take care: When a callback returns an error
- * this function returns immediately with an error and thus the caller
- * will altter return an Assuan error (write erro in most cases).
- **/
 assuan_error_t
-assuan_transact (assuan_context_t ctx,
-                 const char *command,
-                 int (*data_cb)(void *, const void *, size_t),
-                 void *data_cb_arg,
-                 int (*inquire_cb)(void*, const char *),
-                 void *inquire_cb_arg,
-                 int (*status_cb)(void*, const char *),
-                 void *status_cb_arg)
+_assuan_read_from_server (assuan_context_t ctx, int *okay, int *off)
 {
   assuan_error_t rc;
-  int okay, off;
-  char *line;
-  int linelen;
 
-  rc = assuan_write_line (ctx, command);
-  if (rc)
-    return rc;
+  *okay = 0;
+  *off = 0;
+  do 
+    {
+      do
+	{
+	  rc = _assuan_read_line (ctx);
+	}
+      while (_assuan_error_is_eagain (rc));
+      if (rc)
+        return rc;
+    }    
+  while (*ctx->inbound.line == '#' || !ctx->inbound.linelen);
 
-  if (*command == '#' || !*command)
-    return 0; /* Don't expect a response for a comment line.  */
+  return parse_server_line (ctx, okay, off);
+}
 
- again:
-  rc = _assuan_read_from_server (ctx, &okay, &off);
-  if (rc)
-    return rc; /* error reading from server */
 
-  line = ctx->inbound.line + off;
-  linelen = ctx->inbound.linelen - off;
+/* Act on the response line of class OKAY at offset OFF of the line
+   just read from the server, for the transaction PARM.  Sets *DONE
+   when the transaction is complete.  */
+static assuan_error_t
+handle_response (assuan_context_t ctx, struct transact_parm_s *parm,
+                 int okay, int off, int *done)
+{
+  char *line = ctx->inbound.line + off;
+  int linelen = ctx->inbound.linelen - off;
+  assuan_error_t rc = 0;
+
+  *done = 0;
 
   if (!okay)
     {
@@ -168,10 +145,18 @@ assuan_transact (assuan_context_t ctx,
         rc = _assuan_error (ASSUAN_Server_Fault);
       else if (rc > 0 && rc <= 405)
         rc = _assuan_error (rc);
+      if (parm->rc)
+        rc = parm->rc;
+      *done = 1;
+    }
+  else if (okay == 1)
+    {
+      rc = parm->rc;
+      *done = 1;
     }
   else if (okay == 2)
     {
-      if (!data_cb)
+      if (!parm->data_cb)
         rc = _assuan_error (ASSUAN_No_Data_Callback);
       else 
         {
@@ -190,47 +175,261 @@ assuan_transact (assuan_context_t ctx,
                 *d++ = *s++;
             }
           *d = 0; /* add a hidden string terminator */
-          rc = data_cb (data_cb_arg, line, d - line);
-          if (!rc)
-            goto again;
+          rc = parm->data_cb (parm->data_cb_arg, line, d - line);
         }
     }
   else if (okay == 3)
     {
-      if (!inquire_cb)
+      if (!parm->inquire_cb)
         {
-          assuan_write_line (ctx, "END"); /* get out of inquire mode */
-          _assuan_read_from_server (ctx, &okay, &off); /* dummy read */
-          rc = _assuan_error (ASSUAN_No_Inquire_Callback);
+          /* Get out of inquire mode; the final response is
+             replaced by the error.  */
+          rc = assuan_write_line (ctx, "END");
+          parm->rc = _assuan_error (ASSUAN_No_Inquire_Callback);
         }
       else
         {
-          rc = inquire_cb (inquire_cb_arg, line);
+          rc = parm->inquire_cb (parm->inquire_cb_arg, line);
           if (!rc)
             rc = assuan_send_data (ctx, NULL, 0); /* flush and send END */
-          if (!rc)
-            goto again;
         }
     }
   else if (okay == 4)
     {
-      if (status_cb)
-        rc = status_cb (status_cb_arg, line);
-      if (!rc)
-        goto again;
+      if (parm->status_cb)
+        rc = parm->status_cb (parm->status_cb_arg, line);
     }
   else if (okay == 5)
     {
-      if (!data_cb)
+      if (!parm->data_cb)
         rc = _assuan_error (ASSUAN_No_Data_Callback);
       else 
-        {
-          rc = data_cb (data_cb_arg, NULL, 0);
-          if (!rc)
-            goto again;
-        }
+        rc = parm->data_cb (parm->data_cb_arg, NULL, 0);
     }
 
+  if (rc)
+    *done = 1;
+
   return rc;
 }
 
+/* Initialize PARM for a new transaction.  */
+static void
+setup_transact (struct transact_parm_s *parm,
+                int (*data_cb)(void *, const void *, size_t),
+                void *data_cb_arg,
+                int (*inquire_cb)(void*, const char *),
+                void *inquire_cb_arg,
+                int (*status_cb)(void*, const char *),
+                void *status_cb_arg)
+{
+  parm->rc = 0;
+  parm->data_cb = data_cb;
+  parm->data_cb_arg = data_cb_arg;
+  parm->inquire_cb = inquire_cb;
+  parm->inquire_cb_arg = inquire_cb_arg;
+  parm->status_cb = status_cb;
+  parm->status_cb_arg = status_cb_arg;
+}
+
+
+
+/**
+ * assuan_transact:
+ * @ctx: The Assuan context
+ * @command: Command line to be send to the server
+ * @data_cb: Callback function for data lines
+ * @data_cb_arg: first argument passed to @data_cb
+ * @inquire_cb: Callback function for a inquire response
+ * @inquire_cb_arg: first argument passed to @inquire_cb
+ * @status_cb: Callback function for a status response
+ * @status_cb_arg: first argument passed to @status_cb
+ * 
+ * FIXME: Write documentation
+ * 
+ * Return value: 0 on success or error code.  The error code may be
+ * the one one returned by the server in error lines or from the
+ * callback functions.  Take care: When a callback returns an error
+ * this function returns immediately with an error and thus the caller
+ * will altter return an Assuan error (write erro in most cases).
+ **/
+assuan_error_t
+assuan_transact (assuan_context_t ctx,
+                 const char *command,
+                 int (*data_cb)(void *, const void *, size_t),
+                 void *data_cb_arg,
+                 int (*inquire_cb)(void*, const char *),
+                 void *inquire_cb_arg,
+                 int (*status_cb)(void*, const char *),
+                 void *status_cb_arg)
+{
+  struct transact_parm_s parm;
+  assuan_error_t rc;
+  int okay, off, done;
+
+  if (ctx->transact.active)
+    return _assuan_error (ASSUAN_Nested_Commands);
+
+  rc = assuan_write_line (ctx, command);
+  if (rc)
+    return rc;
+
+  if (*command == '#' || !*command)
+    return 0; /* Don't expect a response for a comment line.  */
+
+  setup_transact (&parm, data_cb, data_cb_arg, inquire_cb, inquire_cb_arg,
+                  status_cb, status_cb_arg);
+
+  do
+    {
+      rc = _assuan_read_from_server (ctx, &okay, &off);
+      if (rc)
+        return rc; /* error reading from server */
+
+      rc = handle_response (ctx, &parm, okay, off, &done);
+    }
+  while (!done);
+
+  return rc;
+}
+
+
+
+/* Restore the descriptor of CTX after a non-blocking transaction.  */
+static void
+finish_transact (assuan_context_t ctx)
+{
+#ifndef HAVE_W32_SYSTEM
+  fcntl (ctx->inbound.fd, F_SETFL, ctx->transact.fdflags);
+#endif
+  ctx->transact.active = 0;
+}
+
+/**
+ * assuan_transact_start:
+ * @ctx: The Assuan context
+ * @command: Command line to be send to the server
+ *
+ * The other arguments are as for assuan_transact.
+ *
+ * Start a transaction like assuan_transact but return right after
+ * sending the command.  The caller then waits for the descriptor
+ * returned by assuan_transact_fd to become readable and calls
+ * assuan_transact_next, which runs the callbacks for the responses
+ * received so far, until the transaction is done.  This allows to
+ * run transactions with several servers from a single thread.  Only
+ * reading from the server is non-blocking; the callbacks run inline
+ * and data is written as with assuan_transact.
+ *
+ * Return value: 0 on success or error code.
+ **/
+assuan_error_t
+assuan_transact_start (assuan_context_t ctx,
+                       const char *command,
+                       int (*data_cb)(void *, const void *, size_t),
+                       void *data_cb_arg,
+                       int (*inquire_cb)(void*, const char *),
+                       void *inquire_cb_arg,
+                       int (*status_cb)(void*, const char *),
+                       void *status_cb_arg)
+{
+  assuan_error_t rc;
+
+  if (!ctx || !command || ctx->is_server)
+    return _assuan_error (ASSUAN_Invalid_Value);
+  if (ctx->transact.active)
+    return _assuan_error (ASSUAN_Nested_Commands);
+
+  if (*command == '#' || !*command)
+    return assuan_write_line (ctx, command); /* No response expected.  */
+
+#ifndef HAVE_W32_SYSTEM
+  ctx->transact.fdflags = fcntl (ctx->inbound.fd, F_GETFL);
+  if (ctx->transact.fdflags == -1
+      || fcntl (ctx->inbound.fd, F_SETFL,
+                ctx->transact.fdflags | O_NONBLOCK) == -1)
+    {
+      ctx->os_errno = errno;
+      return _assuan_error (ASSUAN_General_Error);
+    }
+#else
+  return _assuan_error (ASSUAN_Not_Implemented);
+#endif
+
+  rc = assuan_write_line (ctx, command);
+  if (rc)
+    {
+      finish_transact (ctx);
+      return rc;
+    }
+
+  setup_transact (&ctx->transact.parm, data_cb, data_cb_arg,
+                  inquire_cb, inquire_cb_arg, status_cb, status_cb_arg);
+  ctx->transact.active = 1;
+
+  return 0;
+}
+
+/**
+ * assuan_transact_fd:
+ * @ctx: The Assuan context
+ *
+ * Return value: The descriptor to wait on for readability while a
+ * transaction started with assuan_transact_start is in progress.
+ **/
+assuan_fd_t
+assuan_transact_fd (assuan_context_t ctx)
+{
+  return ctx ? ctx->inbound.fd : ASSUAN_INVALID_FD;
+}
+
+/**
+ * assuan_transact_next:
+ * @ctx: The Assuan context
+ * @done: Set when the transaction is complete
+ *
+ * Process the responses available for the transaction started on CTX
+ * with assuan_transact_start, without blocking.  Once *DONE is set,
+ * the return value is the result of the transaction, as it would have
+ * been returned by assuan_transact, and a new transaction may be
+ * started.  Without a transaction in progress, *DONE is set and 0
+ * returned.
+ *
+ * Return value: 0 on success or error code.
+ **/
+assuan_error_t
+assuan_transact_next (assuan_context_t ctx, int *done)
+{
+  assuan_error_t rc;
+  int okay, off;
+
+  *done = 1;
+  if (!ctx || !ctx->transact.active)
+    return 0;
+
+  *done = 0;
+  for (;;)
+    {
+      rc = _assuan_read_line (ctx);
+      if (_assuan_error_is_wouldblock (rc))
+        return 0; /* Partial lines are kept for the next call.  */
+      if (rc)
+        break;
+
+      if (*ctx->inbound.line == '#' || !ctx->inbound.linelen)
+        continue;
+
+      rc = parse_server_line (ctx, &okay, &off);
+      if (rc)
+        break;
+
+      rc = handle_response (ctx, &ctx->transact.parm, okay, off, done);
+      if (*done)
+        break;
+    }
+
+  finish_transact (ctx);
+  *done = 1;
+
+  return rc;
+}
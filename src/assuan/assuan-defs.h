@@ -79,6 +79,18 @@ struct assuan_io
 extern struct assuan_io_hooks _assuan_io_hooks;
 
 
+/* State of a client transaction.  */
+struct transact_parm_s
+{
+  assuan_error_t rc;   /* Error to return on completion.  */
+  int (*data_cb)(void *, const void *, size_t);
+  void *data_cb_arg;
+  int (*inquire_cb)(void*, const char *);
+  void *inquire_cb_arg;
+  int (*status_cb)(void*, const char *);
+  void *status_cb_arg;
+};
+
 /* The context we use with most functions. */
 struct assuan_context_s
 {
@@ -104,6 +116,13 @@ struct assuan_context_s
   void *inquire_cb_data;
   void *inquire_membuf;
 
+  /* The following members are used by assuan_transact_start.  */
+  struct {
+    int active;          /* A transaction is in progress.  */
+    int fdflags;         /* Saved file status flags of inbound.fd.  */
+    struct transact_parm_s parm;
+  } transact;
+
   char *hello_line;
   char *okay_line;    /* See assuan_set_okay_line() */
 
@@ -176,6 +195,10 @@ struct assuan_context_s
   struct cmdtbl_s *cmdtbl;
   size_t cmdtbl_used; /* used entries */
   size_t cmdtbl_size; /* allocated size of table */
+  /* Open addressing index into CMDTBL keyed by the case folded
+     command name; entries are table indices plus one.  */
+  int *cmdtbl_hash;
+  size_t cmdtbl_hash_size; /* Power of two.  */
 
   void (*bye_notify_fnc)(assuan_context_t);
   void (*reset_notify_fnc)(assuan_context_t);
@@ -203,12 +226,18 @@ struct assuan_context_s
 
   /* io routines.  */
   struct assuan_io *io;
+
+  /* State of a trace being recorded or replayed, or NULL.  */
+  struct assuan_trace_s *trace;
 };
 
 /*-- assuan-pipe-server.c --*/
 int _assuan_new_context (assuan_context_t *r_ctx);
 void _assuan_release_context (assuan_context_t ctx);
 
+/*-- assuan-trace.c --*/
+void _assuan_trace_release (assuan_context_t ctx);
+
 /*-- assuan-uds.c --*/
 void _assuan_uds_close_fds (assuan_context_t ctx);
 void _assuan_uds_deinit (assuan_context_t ctx);
@@ -217,6 +246,7 @@ void _assuan_init_uds_io (assuan_context_t ctx);
 
 /*-- assuan-handler.c --*/
 int _assuan_register_std_commands (assuan_context_t ctx);
+int _assuan_serve_next (assuan_context_t ctx);
 
 /*-- assuan-buffer.c --*/
 assuan_error_t _assuan_read_line (assuan_context_t ctx);
@@ -240,6 +270,8 @@ void _assuan_inquire_release (assuan_context_t ctx);
 assuan_error_t _assuan_error (int oldcode);
 /* Check if ERR means EAGAIN.  */
 int _assuan_error_is_eagain (assuan_error_t err);
+/* Check if ERR means EAGAIN, without waiting.  */
+int _assuan_error_is_wouldblock (assuan_error_t err);
 
 /* Extract the error code from A.  This works for both the old and the
    new style error codes.  This needs to be used whenever an error
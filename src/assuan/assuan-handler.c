@@ -258,6 +258,77 @@ static struct {
 };
 
 
+/* Return the hash of the command name NAME, ignoring case.  */
+static unsigned int
+hash_command_name (const char *name)
+{
+  unsigned int h = 5381;
+
+  for (; *name; name++)
+    h = h * 33 + ((*name >= 'a' && *name <= 'z')? (*name&~0x20):*name);
+  return h;
+}
+
+/* Enter the command table entry IDX, named NAME, into the index.  */
+static void
+hash_command (assuan_context_t ctx, const char *name, size_t idx)
+{
+  size_t mask = ctx->cmdtbl_hash_size - 1;
+  size_t i;
+
+  for (i = hash_command_name (name) & mask; ctx->cmdtbl_hash[i];
+       i = (i + 1) & mask)
+    ;
+  ctx->cmdtbl_hash[i] = idx + 1;
+}
+
+/* Rebuild the index of the command table with SIZE slots.  */
+static int
+rehash_commands (assuan_context_t ctx, size_t size)
+{
+  int *x;
+  size_t i;
+
+  x = xtrycalloc (size, sizeof *x);
+  if (!x)
+    return _assuan_error (ASSUAN_Out_Of_Core);
+  xfree (ctx->cmdtbl_hash);
+  ctx->cmdtbl_hash = x;
+  ctx->cmdtbl_hash_size = size;
+  for (i=0; i < ctx->cmdtbl_used; i++)
+    hash_command (ctx, ctx->cmdtbl[i].name, i);
+  return 0;
+}
+
+/* Return the index of the command NAME in the command table or -1.
+   As with a scan of the table, an exact match takes precedence over
+   a case insensitive one and earlier entries over later ones; the
+   probe sequence of a name visits its entries in the order they have
+   been registered.  */
+static int
+lookup_command (assuan_context_t ctx, const char *name)
+{
+  size_t mask = ctx->cmdtbl_hash_size - 1;
+  size_t i;
+  int idx, found = -1;
+
+  if (!ctx->cmdtbl_hash)
+    return -1;
+
+  for (i = hash_command_name (name) & mask; (idx = ctx->cmdtbl_hash[i]);
+       i = (i + 1) & mask)
+    {
+      const char *s = ctx->cmdtbl[idx - 1].name;
+
+      if (!strcmp (name, s))
+        return idx - 1;
+      if (found == -1 && !my_strcasecmp (name, s))
+        found = idx - 1;
+    }
+  return found;
+}
+
+
 /**
  * assuan_register_command:
  * @ctx: the server context
@@ -313,13 +384,22 @@ assuan_register_command (assuan_context_t ctx,
     {
       struct cmdtbl_s *x;
 
-      x = xtryrealloc ( ctx->cmdtbl, (ctx->cmdtbl_size+10) * sizeof *x);
+      x = xtryrealloc ( ctx->cmdtbl, (ctx->cmdtbl_size+50) * sizeof *x);
       if (!x)
         return _assuan_error (ASSUAN_Out_Of_Core);
       ctx->cmdtbl = x;
       ctx->cmdtbl_size += 50;
     }
 
+  if ((ctx->cmdtbl_used + 1) * 2 > ctx->cmdtbl_hash_size)
+    {
+      int rc = rehash_commands (ctx, ctx->cmdtbl_hash_size
+                                     ? ctx->cmdtbl_hash_size * 2 : 64);
+      if (rc)
+        return rc;
+    }
+  hash_command (ctx, cmd_name, ctx->cmdtbl_used);
+
   ctx->cmdtbl[ctx->cmdtbl_used].name = cmd_name;
   ctx->cmdtbl[ctx->cmdtbl_used].handler = handler;
   ctx->cmdtbl_used++;
@@ -449,7 +529,6 @@ static int
 dispatch_command (assuan_context_t ctx, char *line, int linelen)
 {
   char *p;
-  const char *s;
   int shift, i;
 
   /* Note that as this function is invoked by assuan_process_next as
@@ -475,25 +554,14 @@ dispatch_command (assuan_context_t ctx, char *line, int linelen)
     }
   shift = p - line;
 
-  for (i=0; (s=ctx->cmdtbl[i].name); i++)
-    {
-      if (!strcmp (line, s))
-        break;
-    }
-  if (!s)
-    { /* and try case insensitive */
-      for (i=0; (s=ctx->cmdtbl[i].name); i++)
-        {
-          if (!my_strcasecmp (line, s))
-            break;
-        }
-    }
-  if (!s)
+  i = lookup_command (ctx, line);
+  if (i == -1)
     return PROCESS_DONE (ctx, set_error (ctx, Unknown_Command, NULL));
   line += shift;
   linelen -= shift;
 
-/*    fprintf (stderr, "DBG-assuan: processing %s `%s'\n", s, line); */
+/*    fprintf (stderr, "DBG-assuan: processing %s `%s'\n",
+               ctx->cmdtbl[i].name, line); */
   return ctx->cmdtbl[i].handler (ctx, line);
 }
 
@@ -546,19 +614,18 @@ assuan_process_done (assuan_context_t ctx, int rc)
           const char *text = ctx->err_no == rc? ctx->err_str:NULL;
 	  
 #if defined(HAVE_W32_SYSTEM)
-          unsigned int source, code;
+          unsigned int source;
           char ebuf[50];
           const char *esrc;
 	  
           source = ((rc >> 24) & 0xff);
-          code = (rc & 0x00ffffff);
           if (source
               && !_assuan_gpg_strerror_r (rc, ebuf, sizeof ebuf)
               && (esrc=_assuan_gpg_strsource (rc)))
             {
               /* Assume this is an libgpg-error.  */
               sprintf (errline, "ERR %d %.50s <%.30s>%s%.100s",
-                       code, ebuf, esrc,
+                       rc, ebuf, esrc,
                        text? " - ":"", text?text:"");
             }
           else
@@ -573,7 +640,7 @@ assuan_process_done (assuan_context_t ctx, int rc)
              weak attribute properly but it works with the weak
              pragma. */
 
-          unsigned int source, code;
+          unsigned int source;
 
           int gpg_strerror_r (unsigned int err, char *buf, size_t buflen)
             __attribute__ ((weak));
@@ -585,7 +652,6 @@ assuan_process_done (assuan_context_t ctx, int rc)
 #endif
 
           source = ((rc >> 24) & 0xff);
-          code = (rc & 0x00ffffff);
           if (source && gpg_strsource && gpg_strerror_r)
             {
               /* Assume this is an libgpg-error. */
@@ -593,7 +659,7 @@ assuan_process_done (assuan_context_t ctx, int rc)
 	      
               gpg_strerror_r (rc, ebuf, sizeof ebuf );
               sprintf (errline, "ERR %d %.50s <%.30s>%s%.100s",
-                       code,
+                       rc,
                        ebuf,
                        gpg_strsource (rc),
                        text? " - ":"", text?text:"");
@@ -630,8 +696,8 @@ process_next (assuan_context_t ctx)
      required to write full lines without blocking long after starting
      a partial line.  */
   rc = _assuan_read_line (ctx);
-  if (_assuan_error_is_eagain (rc))
-    return 0;
+  if (_assuan_error_is_wouldblock (rc))
+    return 0; /* The caller waits for the FD to become readable.  */
   if (rc)
     return rc;
   if (*ctx->inbound.line == '#' || !ctx->inbound.linelen)
@@ -694,6 +760,28 @@ assuan_process_next (assuan_context_t ctx)
 }
 
 
+/* Like assuan_process_next, but also acknowledge commands whose
+   handlers return without calling assuan_process_done, so that
+   handlers written for assuan_process can be used unchanged.  A
+   command waiting for an assuan_inquire_ext response is left
+   open.  Returns an error only if the connection is to be closed.  */
+int
+_assuan_serve_next (assuan_context_t ctx)
+{
+  int rc;
+
+  do
+    {
+      rc = process_next (ctx);
+      if (ctx->in_command && !ctx->in_inquire)
+        rc = assuan_process_done (ctx, rc);
+    }
+  while (!rc && assuan_pending_line (ctx));
+
+  return rc;
+}
+
+
 
 static int
 process_request (assuan_context_t ctx)
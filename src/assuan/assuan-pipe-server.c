@@ -168,9 +168,11 @@ _assuan_release_context (assuan_context_t ctx)
   if (ctx)
     {
       _assuan_inquire_release (ctx);
+      _assuan_trace_release (ctx);
       xfree (ctx->hello_line);
       xfree (ctx->okay_line);
       xfree (ctx->cmdtbl);
+      xfree (ctx->cmdtbl_hash);
       xfree (ctx);
     }
 }
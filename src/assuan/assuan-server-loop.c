@@ -0,0 +1,332 @@
+/* assuan-server-loop.c - Serve many socket clients from one thread.
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of Assuan.
+ *
+ * Assuan is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * Assuan is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* A server loop accepts connections on a listening socket and keeps
+   one server context per client.  All descriptors are watched with a
+   single epoll set; whenever a client is readable, the lines received
+   so far are run through the context's input buffer and the complete
+   ones are dispatched.  Command handlers run inline, so they should
+   not block for long; inquiries should be done with
+   assuan_inquire_ext.  Responses are written as with assuan_process,
+   waiting for a client which does not read them.  */
+
+#include <config.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#ifdef HAVE_SYS_EPOLL_H
+# include <fcntl.h>
+# include <sys/socket.h>
+# include <sys/epoll.h>
+#endif
+
+#include "assuan-defs.h"
+
+/* Number of events fetched with one call to epoll_wait.  */
+#define MAX_EVENTS 64
+
+struct server_client
+{
+  struct server_client *next;
+  struct server_client *prev;
+  assuan_context_t ctx;
+};
+
+struct assuan_server_loop_s
+{
+  int epfd;
+  assuan_fd_t listen_fd;
+  unsigned int flags;
+  int (*setup_cb) (void *opaque, assuan_context_t ctx);
+  void (*release_cb) (void *opaque, assuan_context_t ctx);
+  void *opaque;
+
+  struct server_client *clients;
+  int accept_paused;  /* The listening socket is not watched because
+                         we ran out of descriptors.  */
+  volatile sig_atomic_t stop;
+};
+
+
+#ifdef HAVE_SYS_EPOLL_H
+/* Start or stop watching the listening socket of LOOP.  */
+static int
+watch_listen_fd (assuan_server_loop_t loop, int on)
+{
+  struct epoll_event ev;
+
+  memset (&ev, 0, sizeof ev);
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  return epoll_ctl (loop->epfd, on ? EPOLL_CTL_ADD : EPOLL_CTL_DEL,
+                    loop->listen_fd, &ev);
+}
+
+
+/* Release CLIENT of LOOP and close its connection.  */
+static void
+drop_client (assuan_server_loop_t loop, struct server_client *client)
+{
+  assuan_context_t ctx = client->ctx;
+
+  if (ctx->inbound.fd != ASSUAN_INVALID_FD)
+    epoll_ctl (loop->epfd, EPOLL_CTL_DEL, ctx->inbound.fd, NULL);
+  if (loop->release_cb)
+    loop->release_cb (loop->opaque, ctx);
+  assuan_deinit_server (ctx);
+
+  if (client->prev)
+    client->prev->next = client->next;
+  else
+    loop->clients = client->next;
+  if (client->next)
+    client->next->prev = client->prev;
+  xfree (client);
+
+  if (loop->accept_paused && !watch_listen_fd (loop, 1))
+    loop->accept_paused = 0;
+}
+
+
+/* Set up a server context for the accepted connection FD and send
+   the greeting.  Failures only affect this client.  */
+static void
+add_client (assuan_server_loop_t loop, int fd)
+{
+  struct server_client *client;
+  assuan_context_t ctx = NULL;
+  struct epoll_event ev;
+  int rc;
+
+  client = xtrycalloc (1, sizeof *client);
+  if (!client)
+    rc = _assuan_error (ASSUAN_Out_Of_Core);
+  else
+    rc = assuan_init_socket_server_ext (&ctx, fd, 2 | (loop->flags & 1));
+  if (!rc && loop->setup_cb)
+    rc = loop->setup_cb (loop->opaque, ctx);
+  if (!rc)
+    rc = assuan_accept (ctx);
+  if (!rc)
+    {
+      memset (&ev, 0, sizeof ev);
+      ev.events = EPOLLIN;
+      ev.data.ptr = client;
+      if (epoll_ctl (loop->epfd, EPOLL_CTL_ADD, fd, &ev))
+        rc = _assuan_error (ASSUAN_General_Error);
+    }
+  if (rc)
+    {
+      _assuan_log_printf ("server loop: dropping new client: %s\n",
+                          assuan_strerror (rc));
+      if (ctx)
+        {
+          /* The descriptor belongs to the context once accepted.  */
+          if (ctx->inbound.fd == ASSUAN_INVALID_FD)
+            close (fd);
+          if (loop->release_cb && loop->setup_cb)
+            loop->release_cb (loop->opaque, ctx);
+          assuan_deinit_server (ctx);
+        }
+      else
+        close (fd);
+      xfree (client);
+      return;
+    }
+
+  client->ctx = ctx;
+  client->next = loop->clients;
+  if (loop->clients)
+    loop->clients->prev = client;
+  loop->clients = client;
+}
+
+
+/* Accept all pending connections of LOOP.  */
+static void
+accept_clients (assuan_server_loop_t loop)
+{
+  int fd;
+
+  for (;;)
+    {
+      fd = accept4 (loop->listen_fd, NULL, NULL,
+                    SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd != -1)
+        add_client (loop, fd);
+      else if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      else if (errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+      else
+        {
+          /* Typically EMFILE.  The listening socket stays readable,
+             so stop watching it until a client has gone.  */
+          _assuan_log_printf ("server loop: accept failed: %s\n",
+                              strerror (errno));
+          if (!watch_listen_fd (loop, 0))
+            loop->accept_paused = 1;
+          break;
+        }
+    }
+}
+#endif /*HAVE_SYS_EPOLL_H*/
+
+
+/**
+ * assuan_server_loop_new:
+ * @r_loop: Returns the new server loop
+ * @listen_fd: A socket already put into listen mode
+ * @flags: Bit 0 - use sendmsg/recvmsg to allow descriptor passing
+ * @setup_cb: Called for each new client context, e.g. to register
+ *            the commands; a non-zero return drops the client.
+ * @release_cb: Called before a context passed to @setup_cb is released.
+ * @opaque: First argument to @setup_cb and @release_cb
+ *
+ * Create a server loop for the connections on @listen_fd.  The
+ * socket is switched to non-blocking mode; it is not closed by
+ * assuan_server_loop_release.
+ *
+ * Return value: 0 on success or an error code.
+ **/
+assuan_error_t
+assuan_server_loop_new (assuan_server_loop_t *r_loop, assuan_fd_t listen_fd,
+                        unsigned int flags,
+                        int (*setup_cb) (void *opaque, assuan_context_t ctx),
+                        void (*release_cb) (void *opaque,
+                                            assuan_context_t ctx),
+                        void *opaque)
+{
+#ifdef HAVE_SYS_EPOLL_H
+  assuan_server_loop_t loop;
+  int fl;
+
+  *r_loop = NULL;
+  loop = xtrycalloc (1, sizeof *loop);
+  if (!loop)
+    return _assuan_error (ASSUAN_Out_Of_Core);
+  loop->listen_fd = listen_fd;
+  loop->flags = flags;
+  loop->setup_cb = setup_cb;
+  loop->release_cb = release_cb;
+  loop->opaque = opaque;
+
+  loop->epfd = epoll_create1 (EPOLL_CLOEXEC);
+  if (loop->epfd == -1)
+    {
+      xfree (loop);
+      return _assuan_error (ASSUAN_General_Error);
+    }
+
+  fl = fcntl (listen_fd, F_GETFL);
+  if (fl == -1 || fcntl (listen_fd, F_SETFL, fl | O_NONBLOCK) == -1
+      || watch_listen_fd (loop, 1))
+    {
+      close (loop->epfd);
+      xfree (loop);
+      return _assuan_error (ASSUAN_General_Error);
+    }
+
+  *r_loop = loop;
+  return 0;
+#else
+  *r_loop = NULL;
+  return _assuan_error (ASSUAN_Not_Implemented);
+#endif
+}
+
+
+/**
+ * assuan_server_loop_run:
+ * @loop: The server loop
+ *
+ * Accept and serve clients until assuan_server_loop_stop is called,
+ * from a command handler or a signal handler.  Clients still
+ * connected are kept and served by the next call.
+ *
+ * Return value: 0 after a stop or an error code.
+ **/
+assuan_error_t
+assuan_server_loop_run (assuan_server_loop_t loop)
+{
+#ifdef HAVE_SYS_EPOLL_H
+  struct epoll_event events[MAX_EVENTS];
+  struct server_client *client;
+  int i, n;
+
+  if (!loop)
+    return _assuan_error (ASSUAN_Invalid_Value);
+
+  while (!loop->stop)
+    {
+      n = epoll_wait (loop->epfd, events, MAX_EVENTS, -1);
+      if (n == -1)
+        {
+          if (errno == EINTR)
+            continue;
+          return _assuan_error (ASSUAN_General_Error);
+        }
+
+      /* A client has only one descriptor in the set and thus at most
+         one event per batch, so dropping it here is safe.  */
+      for (i = 0; i < n; i++)
+        {
+          client = events[i].data.ptr;
+          if (!client)
+            accept_clients (loop);
+          else if (_assuan_serve_next (client->ctx))
+            drop_client (loop, client);
+        }
+    }
+  loop->stop = 0;
+
+  return 0;
+#else
+  return _assuan_error (ASSUAN_Not_Implemented);
+#endif
+}
+
+
+/* Make assuan_server_loop_run return.  This may be called from a
+   signal handler.  */
+void
+assuan_server_loop_stop (assuan_server_loop_t loop)
+{
+  if (loop)
+    loop->stop = 1;
+}
+
+
+/* Close all client connections of LOOP and release it.  */
+void
+assuan_server_loop_release (assuan_server_loop_t loop)
+{
+#ifdef HAVE_SYS_EPOLL_H
+  if (!loop)
+    return;
+
+  while (loop->clients)
+    drop_client (loop, loop->clients);
+  close (loop->epfd);
+  xfree (loop);
+#endif
+}
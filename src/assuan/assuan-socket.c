@@ -165,7 +165,9 @@ _assuan_close (assuan_fd_t fd)
 
 /* Return a new socket.  Note that under W32 we consider a socket the
    same as an System Handle; all functions using such a handle know
-   about this dual use and act accordingly. */ 
+   about this dual use and act accordingly.  Elsewhere the socket is
+   close-on-exec, so that connections kept open across requests do
+   not leak into programs the application runs.  */
 assuan_fd_t
 _assuan_sock_new (int domain, int type, int proto)
 {
@@ -178,7 +180,18 @@ _assuan_sock_new (int domain, int type, int proto)
     errno = _assuan_sock_wsa2errno (WSAGetLastError ());
   return res;
 #else
-  return socket (domain, type, proto);
+  int fd;
+
+  fd = socket (domain, type, proto);
+  if (fd != -1 && fcntl (fd, F_SETFD, FD_CLOEXEC) == -1)
+    {
+      int saved_errno = errno;
+
+      close (fd);
+      errno = saved_errno;
+      return ASSUAN_INVALID_FD;
+    }
+  return fd;
 #endif
 }
 
@@ -0,0 +1,505 @@
+/* assuan-trace.c - Record and replay the I/O of a connection.
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of Assuan.
+ *
+ * Assuan is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * Assuan is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* A trace is the sequence of chunks a client read from and wrote to
+   its server, each stamped with the time elapsed since the previous
+   one.  The file starts with the magic "ASNTRC01" and the start time
+   of the recording in microseconds since the epoch; each event
+   follows as
+
+     KIND  DELTA  LENGTH  DATA
+
+   where KIND is one byte ('R' for data read, 'W' for data written,
+   'C' for confidential data written, which is not recorded), DELTA
+   is the number of microseconds since the previous event and LENGTH
+   the number of bytes of DATA.  Numbers are stored as unsigned
+   LEB128.
+
+   Replaying a trace hands the recorded reads back to the client in
+   order, while the client's writes are merely checked against the
+   kind of the next event; their contents are not compared, as they
+   may legitimately differ (e.g. random challenges).  */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "assuan-defs.h"
+
+#define TRACE_MAGIC "ASNTRC01"
+
+#define TRACE_READ         'R'
+#define TRACE_WRITE        'W'
+#define TRACE_CONFIDENTIAL 'C'
+
+struct assuan_trace_s
+{
+  unsigned int flags;
+  struct timespec last;		/* Time of the previous event.  */
+
+  /* Recording.  */
+  FILE *fp;
+  struct assuan_io *io;		/* I/O functions of the connection.  */
+  int needpin;			/* Within a PIN inquiry.  */
+
+  /* Replay.  */
+  unsigned char *buffer;	/* The entire trace.  */
+  size_t buffer_len;
+  size_t pos;			/* Offset of the next event.  */
+  int have_event;		/* The fields below are valid.  */
+  int kind;
+  unsigned long delta;
+  const unsigned char *data;
+  size_t len;
+  size_t off;			/* Number of bytes of DATA consumed.  */
+};
+
+
+/* Return the number of microseconds since the previous event of
+   TRACE and make now the time of the previous event.  */
+static unsigned long
+trace_tick (struct assuan_trace_s *trace)
+{
+  struct timespec now;
+  unsigned long delta;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  delta = ((now.tv_sec - trace->last.tv_sec) * 1000000L
+	   + (now.tv_nsec - trace->last.tv_nsec) / 1000);
+  trace->last = now;
+
+  return delta;
+}
+
+static void
+put_number (FILE *fp, unsigned long long value)
+{
+  do
+    {
+      unsigned char c = value & 0x7f;
+
+      value >>= 7;
+      if (value)
+	c |= 0x80;
+      putc (c, fp);
+    }
+  while (value);
+}
+
+/* Parse a number at *POS from TRACE into *VALUE.  Returns -1 if the
+   trace ends prematurely.  */
+static int
+get_number (struct assuan_trace_s *trace, size_t *pos,
+	    unsigned long long *value)
+{
+  unsigned int shift;
+  unsigned char c;
+
+  *value = 0;
+  for (shift = 0; shift < 64; shift += 7)
+    {
+      if (*pos >= trace->buffer_len)
+	return -1;
+      c = trace->buffer[(*pos)++];
+      *value |= (unsigned long long) (c & 0x7f) << shift;
+      if (!(c & 0x80))
+	return 0;
+    }
+
+  return -1;
+}
+
+
+/* Recording.  */
+
+/* Return true if the chunk BUFFER of LENGTH bytes contains the line
+   LINE.  */
+static int
+has_line (const char *buffer, size_t length, const char *line)
+{
+  size_t n = strlen (line);
+  size_t i;
+
+  for (i = 0; i + n <= length; i++)
+    if ((!i || buffer[i - 1] == '\n') && !memcmp (buffer + i, line, n))
+      return 1;
+
+  return 0;
+}
+
+static void
+record_event (struct assuan_trace_s *trace, int kind,
+	      const void *buffer, size_t length)
+{
+  putc (kind, trace->fp);
+  put_number (trace->fp, trace_tick (trace));
+  put_number (trace->fp, length);
+  if (length)
+    fwrite (buffer, length, 1, trace->fp);
+}
+
+static ssize_t
+record_read (assuan_context_t ctx, void *buffer, size_t size)
+{
+  struct assuan_trace_s *trace = ctx->trace;
+  ssize_t n;
+
+  n = trace->io->readfnc (ctx, buffer, size);
+  if (n > 0)
+    {
+      record_event (trace, TRACE_READ, buffer, n);
+      if (has_line (buffer, n, "INQUIRE NEEDPIN"))
+	trace->needpin = 1;
+    }
+
+  return n;
+}
+
+static ssize_t
+record_write (assuan_context_t ctx, const void *buffer, size_t size)
+{
+  struct assuan_trace_s *trace = ctx->trace;
+  const char *p = buffer;
+  ssize_t n;
+
+  n = trace->io->writefnc (ctx, buffer, size);
+  if (n > 0)
+    {
+      /* The D lines answering a PIN inquiry are only flushed when the
+	 inquiry is terminated, by then the confidential flag has been
+	 cleared already.  */
+      if (ctx->confidential
+	  || (trace->needpin && n >= 2 && p[0] == 'D' && p[1] == ' '))
+	record_event (trace, TRACE_CONFIDENTIAL, NULL, 0);
+      else
+	{
+	  if (trace->needpin && n >= 3
+	      && (!memcmp (p, "END", 3) || !memcmp (p, "CAN", 3)))
+	    trace->needpin = 0;
+	  record_event (trace, TRACE_WRITE, buffer, n);
+	}
+    }
+
+  return n;
+}
+
+static assuan_error_t
+record_sendfd (assuan_context_t ctx, assuan_fd_t fd)
+{
+  if (!ctx->trace->io->sendfd)
+    return _assuan_error (ASSUAN_Not_Implemented);
+
+  return ctx->trace->io->sendfd (ctx, fd);
+}
+
+static assuan_error_t
+record_receivefd (assuan_context_t ctx, assuan_fd_t *fd)
+{
+  if (!ctx->trace->io->receivefd)
+    return _assuan_error (ASSUAN_Not_Implemented);
+
+  return ctx->trace->io->receivefd (ctx, fd);
+}
+
+
+/* Record all further I/O of the client context CTX into the trace
+   file FILENAME.  Data written while CTX is in confidential mode or
+   in answer to a PIN inquiry is not recorded.  The trace is completed
+   when CTX is released.  */
+assuan_error_t
+assuan_trace_record (assuan_context_t ctx, const char *filename)
+{
+  static struct assuan_io io = { record_read, record_write,
+				 record_sendfd, record_receivefd };
+  struct assuan_trace_s *trace;
+  struct timespec now;
+
+  if (!ctx || !filename || ctx->trace || ctx->is_server)
+    return _assuan_error (ASSUAN_Invalid_Value);
+
+  trace = xtrycalloc (1, sizeof *trace);
+  if (!trace)
+    return _assuan_error (ASSUAN_Out_Of_Core);
+
+  trace->fp = fopen (filename, "wb");
+  if (!trace->fp)
+    {
+      _assuan_log_printf ("can't create trace `%s': %s\n",
+                          filename, strerror (errno));
+      xfree (trace);
+      return _assuan_error (ASSUAN_General_Error);
+    }
+
+  clock_gettime (CLOCK_REALTIME, &now);
+  fwrite (TRACE_MAGIC, 8, 1, trace->fp);
+  put_number (trace->fp, ((unsigned long long) now.tv_sec * 1000000
+			  + now.tv_nsec / 1000));
+  trace_tick (trace);
+
+  trace->io = ctx->io;
+  ctx->trace = trace;
+  ctx->io = &io;
+
+  return 0;
+}
+
+
+/* Replay.  */
+
+/* Load the next event of TRACE.  Returns -1 at the end of the
+   trace.  */
+static int
+replay_next (struct assuan_trace_s *trace)
+{
+  unsigned long long delta, len;
+  size_t pos = trace->pos;
+  int kind;
+
+  if (pos >= trace->buffer_len)
+    return -1;
+
+  kind = trace->buffer[pos++];
+  if (get_number (trace, &pos, &delta) || get_number (trace, &pos, &len)
+      || len > trace->buffer_len - pos)
+    {
+      _assuan_log_printf ("trace corrupted at offset %lu\n",
+                          (unsigned long) trace->pos);
+      trace->pos = trace->buffer_len;
+      return -1;
+    }
+
+  trace->kind = kind;
+  trace->delta = delta;
+  trace->data = trace->buffer + pos;
+  trace->len = len;
+  trace->off = 0;
+  trace->have_event = 1;
+  trace->pos = pos + len;
+
+  return 0;
+}
+
+static ssize_t
+replay_read (assuan_context_t ctx, void *buffer, size_t size)
+{
+  struct assuan_trace_s *trace = ctx->trace;
+  size_t n;
+
+  if (!trace->have_event && replay_next (trace))
+    return 0;
+
+  if (trace->kind != TRACE_READ)
+    {
+      _assuan_log_printf ("trace out of sync: client reads instead of "
+                          "writing\n");
+      errno = EPROTO;
+      return -1;
+    }
+
+  /* The time before a read is the time the server took to answer.  */
+  if (!trace->off && (trace->flags & ASSUAN_TRACE_REALTIME) && trace->delta)
+    {
+      struct timespec ts;
+
+      ts.tv_sec = trace->delta / 1000000;
+      ts.tv_nsec = (trace->delta % 1000000) * 1000;
+      while (nanosleep (&ts, &ts) && errno == EINTR)
+	;
+    }
+
+  n = trace->len - trace->off;
+  if (n > size)
+    n = size;
+  memcpy (buffer, trace->data + trace->off, n);
+  trace->off += n;
+  if (trace->off == trace->len)
+    trace->have_event = 0;
+
+  return n;
+}
+
+static ssize_t
+replay_write (assuan_context_t ctx, const void *buffer, size_t size)
+{
+  struct assuan_trace_s *trace = ctx->trace;
+
+  /* Writes after the end of the trace, like the final BYE of a
+     trace recorded without one, are accepted.  */
+  if (!trace->have_event && replay_next (trace))
+    return size;
+
+  if (trace->kind == TRACE_READ)
+    {
+      _assuan_log_printf ("trace out of sync: client writes instead of "
+                          "reading\n");
+      errno = EPROTO;
+      return -1;
+    }
+
+  trace->have_event = 0;
+
+  return size;
+}
+
+static int
+replay_finish (assuan_context_t ctx)
+{
+  return 0;
+}
+
+static void
+replay_deinit (assuan_context_t ctx)
+{
+}
+
+/* Read the trace file FILENAME into a buffer to be stored at *BUFFER
+   and *LENGTH.  */
+static assuan_error_t
+load_trace (const char *filename, unsigned char **buffer, size_t *length)
+{
+  unsigned char *p, *tmp;
+  size_t n, size;
+  FILE *fp;
+
+  fp = fopen (filename, "rb");
+  if (!fp)
+    {
+      _assuan_log_printf ("can't open trace `%s': %s\n",
+                          filename, strerror (errno));
+      return _assuan_error (ASSUAN_General_Error);
+    }
+
+  p = NULL;
+  n = size = 0;
+  do
+    {
+      if (n == size)
+	{
+	  size = size ? 2 * size : 4096;
+	  tmp = xtryrealloc (p, size);
+	  if (!tmp)
+	    {
+	      xfree (p);
+	      fclose (fp);
+	      return _assuan_error (ASSUAN_Out_Of_Core);
+	    }
+	  p = tmp;
+	}
+      n += fread (p + n, 1, size - n, fp);
+    }
+  while (n == size);
+
+  if (ferror (fp))
+    {
+      _assuan_log_printf ("error reading trace `%s': %s\n",
+                          filename, strerror (errno));
+      xfree (p);
+      fclose (fp);
+      return _assuan_error (ASSUAN_Read_Error);
+    }
+  fclose (fp);
+
+  *buffer = p;
+  *length = n;
+
+  return 0;
+}
+
+/* Create a client context in *R_CTX, which talks to no server but
+   replays the trace file FILENAME instead.  The trace starts after
+   the initial handshake; no greeting is read.  With ASSUAN_TRACE_REALTIME
+   set in FLAGS, the replay waits as long before each read as the
+   server took to answer when the trace was recorded; otherwise
+   answers are available at once.  */
+assuan_error_t
+assuan_trace_replay (assuan_context_t *r_ctx, const char *filename,
+                     unsigned int flags)
+{
+  static struct assuan_io io = { replay_read, replay_write, NULL, NULL };
+  struct assuan_trace_s *trace;
+  assuan_context_t ctx;
+  unsigned long long start;
+  assuan_error_t err;
+
+  if (!r_ctx || !filename)
+    return _assuan_error (ASSUAN_Invalid_Value);
+  *r_ctx = NULL;
+
+  trace = xtrycalloc (1, sizeof *trace);
+  if (!trace)
+    return _assuan_error (ASSUAN_Out_Of_Core);
+  trace->flags = flags;
+
+  err = load_trace (filename, &trace->buffer, &trace->buffer_len);
+  if (err)
+    {
+      xfree (trace);
+      return err;
+    }
+
+  trace->pos = 8;
+  if (trace->buffer_len < 8 || memcmp (trace->buffer, TRACE_MAGIC, 8)
+      || get_number (trace, &trace->pos, &start))
+    {
+      _assuan_log_printf ("`%s' is not a trace\n", filename);
+      xfree (trace->buffer);
+      xfree (trace);
+      return _assuan_error (ASSUAN_Invalid_Value);
+    }
+
+  err = _assuan_new_context (&ctx);
+  if (err)
+    {
+      xfree (trace->buffer);
+      xfree (trace);
+      return err;
+    }
+  ctx->deinit_handler = replay_deinit;
+  ctx->finish_handler = replay_finish;
+  ctx->pid = (pid_t)-1;
+  ctx->trace = trace;
+  ctx->io = &io;
+
+  *r_ctx = ctx;
+
+  return 0;
+}
+
+
+/* Release the trace state of CTX, completing a recording.  */
+void
+_assuan_trace_release (assuan_context_t ctx)
+{
+  struct assuan_trace_s *trace = ctx->trace;
+
+  if (trace)
+    {
+      if (trace->fp && fclose (trace->fp))
+        _assuan_log_printf ("error writing trace: %s\n", strerror (errno));
+      xfree (trace->buffer);
+      xfree (trace);
+      ctx->trace = NULL;
+    }
+}
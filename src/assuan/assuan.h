@@ -110,6 +110,11 @@
   _ASSUAN_PREFIX(assuan_init_connected_socket_server)
 #define assuan_init_socket_server_ext \
   _ASSUAN_PREFIX(assuan_init_socket_server_ext)
+#define assuan_server_loop_new _ASSUAN_PREFIX(assuan_server_loop_new)
+#define assuan_server_loop_run _ASSUAN_PREFIX(assuan_server_loop_run)
+#define assuan_server_loop_stop _ASSUAN_PREFIX(assuan_server_loop_stop)
+#define assuan_server_loop_release \
+  _ASSUAN_PREFIX(assuan_server_loop_release)
 #define assuan_pipe_connect _ASSUAN_PREFIX(assuan_pipe_connect)
 #define assuan_pipe_connect_ext _ASSUAN_PREFIX(assuan_pipe_connect_ext)
 #define assuan_socket_connect _ASSUAN_PREFIX(assuan_socket_connect)
@@ -118,6 +123,9 @@
 #define assuan_get_pid _ASSUAN_PREFIX(assuan_get_pid)
 #define assuan_get_peercred _ASSUAN_PREFIX(assuan_get_peercred)
 #define assuan_transact _ASSUAN_PREFIX(assuan_transact)
+#define assuan_transact_start _ASSUAN_PREFIX(assuan_transact_start)
+#define assuan_transact_fd _ASSUAN_PREFIX(assuan_transact_fd)
+#define assuan_transact_next _ASSUAN_PREFIX(assuan_transact_next)
 #define assuan_inquire _ASSUAN_PREFIX(assuan_inquire)
 #define assuan_inquire_ext _ASSUAN_PREFIX(assuan_inquire_ext)
 #define assuan_read_line _ASSUAN_PREFIX(assuan_read_line)
@@ -138,6 +146,8 @@
 #define assuan_strerror _ASSUAN_PREFIX(assuan_strerror)
 #define assuan_set_assuan_err_source \
   _ASSUAN_PREFIX(assuan_set_assuan_err_source)
+#define assuan_trace_record _ASSUAN_PREFIX(assuan_trace_record)
+#define assuan_trace_replay _ASSUAN_PREFIX(assuan_trace_replay)
 #define assuan_set_assuan_log_stream \
   _ASSUAN_PREFIX(assuan_set_assuan_log_stream)
 #define assuan_get_assuan_log_stream \
@@ -165,6 +175,8 @@
 #define _assuan_domain_init _ASSUAN_PREFIX(_assuan_domain_init)
 #define _assuan_register_std_commands \
   _ASSUAN_PREFIX(_assuan_register_std_commands)
+#define _assuan_serve_next _ASSUAN_PREFIX(_assuan_serve_next)
+#define _assuan_trace_release _ASSUAN_PREFIX(_assuan_trace_release)
 #define _assuan_simple_read _ASSUAN_PREFIX(_assuan_simple_read)
 #define _assuan_simple_write _ASSUAN_PREFIX(_assuan_simple_write)
 #define _assuan_io_read _ASSUAN_PREFIX(_assuan_io_read)
@@ -188,6 +200,8 @@
 #define _assuan_write_line _ASSUAN_PREFIX(_assuan_write_line)
 #define _assuan_error _ASSUAN_PREFIX(_assuan_error)
 #define _assuan_error_is_eagain   _ASSUAN_PREFIX(_assuan_error_is_eagain)
+#define _assuan_error_is_wouldblock \
+  _ASSUAN_PREFIX(_assuan_error_is_wouldblock)
 #define _assuan_init_uds_io _ASSUAN_PREFIX(_assuan_init_uds_io)
 #define _assuan_uds_close_fds _ASSUAN_PREFIX(_assuan_uds_close_fds)
 #define _assuan_uds_deinit _ASSUAN_PREFIX(_assuan_uds_deinit)
@@ -504,6 +518,20 @@ int assuan_init_socket_server_ext (assuan_context_t *r_ctx, assuan_fd_t fd,
                                    unsigned int flags);
 void assuan_set_sock_nonce (assuan_context_t ctx, assuan_sock_nonce_t *nonce);
 
+/*-- assuan-server-loop.c --*/
+typedef struct assuan_server_loop_s *assuan_server_loop_t;
+
+assuan_error_t
+assuan_server_loop_new (assuan_server_loop_t *r_loop, assuan_fd_t listen_fd,
+                        unsigned int flags,
+                        int (*setup_cb) (void *opaque, assuan_context_t ctx),
+                        void (*release_cb) (void *opaque,
+                                            assuan_context_t ctx),
+                        void *opaque);
+assuan_error_t assuan_server_loop_run (assuan_server_loop_t loop);
+void assuan_server_loop_stop (assuan_server_loop_t loop);
+void assuan_server_loop_release (assuan_server_loop_t loop);
+
 /*-- assuan-pipe-connect.c --*/
 assuan_error_t assuan_pipe_connect (assuan_context_t *ctx,
                                     const char *name,
@@ -540,6 +568,15 @@ assuan_error_t assuan_get_peercred (assuan_context_t ctx,
                                     pid_t *pid, uid_t *uid, gid_t *gid);
 #endif
 
+/*-- assuan-trace.c --*/
+#define ASSUAN_TRACE_REALTIME 1  /* Replay with the recorded delays.  */
+
+assuan_error_t assuan_trace_record (assuan_context_t ctx,
+                                    const char *filename);
+assuan_error_t assuan_trace_replay (assuan_context_t *ctx,
+                                    const char *filename,
+                                    unsigned int flags);
+
 /*-- assuan-client.c --*/
 assuan_error_t 
 assuan_transact (assuan_context_t ctx,
@@ -550,6 +587,17 @@ assuan_transact (assuan_context_t ctx,
                  void *inquire_cb_arg,
                  assuan_error_t (*status_cb)(void*, const char *),
                  void *status_cb_arg);
+assuan_error_t
+assuan_transact_start (assuan_context_t ctx,
+                       const char *command,
+                       assuan_error_t (*data_cb)(void *, const void *, size_t),
+                       void *data_cb_arg,
+                       assuan_error_t (*inquire_cb)(void*, const char *),
+                       void *inquire_cb_arg,
+                       assuan_error_t (*status_cb)(void*, const char *),
+                       void *status_cb_arg);
+assuan_fd_t assuan_transact_fd (assuan_context_t ctx);
+assuan_error_t assuan_transact_next (assuan_context_t ctx, int *done);
 
 
 /*-- assuan-inquire.c --*/
@@ -23,6 +23,8 @@
 #include <gcrypt.h>
 
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 
 #define PAM_SM_AUTH
 #include <security/pam_modules.h>
@@ -33,6 +35,7 @@
 
 #include "scd/scd.h"
 #include "util/support.h"
+#include "util/secarena.h"
 #include "auth-support/ctx.h"
 #include "auth-support/wait-for-card.h"
 
@@ -41,22 +44,51 @@
 
 
 
-#if 0
-/* Currently, the localdb method doesn't require a special cookie. */
+/* The cookie of the localdb method holds what has been looked up
+   ahead of time by auth_method_localdb_prefetch.  */
+struct localdb_ctx_s
+{
+  char *serialno;		/* Serial number of the user's card.  */
+  gcry_sexp_t key;		/* Key of the card SERIALNO or NULL.  */
+};
+
+typedef struct localdb_ctx_s *localdb_ctx_t;
 
+/* Initialize this authentication method; create a method specific
+   cookie, which is stored in *OPAQUE.  Returns proper error code.  */
 static gpg_error_t
-auth_method_localdb_init (void **cookie)
+auth_method_localdb_init (void **opaque)
 {
-  *cookie = NULL;
+  localdb_ctx_t cookie;
+
+  cookie = xtrymalloc (sizeof (*cookie));
+  if (!cookie)
+    return gpg_error_from_errno (errno);
+
+  cookie->serialno = NULL;
+  cookie->key = NULL;
+  *opaque = cookie;
+
   return 0;
 }
 
+/* Release any resources associated with this authentication
+   method.  Takes care of releasing the cookie.  */
 static void
-auth_method_localdb_deinit (void *cookie)
+auth_method_localdb_deinit (void *opaque)
 {
-  return;
+  localdb_ctx_t cookie = opaque;
+
+  if (cookie)
+    {
+      xfree (cookie->serialno);
+      gcry_sexp_release (cookie->key);
+      xfree (cookie);
+    }
 }
 
+#if 0
+
 static gpg_error_t
 auth_method_localdb_parsecb (ARGPARSE_ARGS *parg, void *cookie)
 {
@@ -71,9 +103,10 @@ auth_method_localdb_parsecb (ARGPARSE_ARGS *parg, void *cookie)
 /* Entry point for the local-db authentication method. Returns TRUE
    (1) if authentication succeeded and FALSE (0) otherwise. */
 static int
-auth_method_localdb_auth_do (poldi_ctx_t ctx,
+auth_method_localdb_auth_do (poldi_ctx_t ctx, localdb_ctx_t cookie,
 			     const char *username_desired, char **username_authenticated)
 {
+  struct challenge_params params;
   unsigned char *challenge;
   unsigned char *response;
   size_t challenge_n;
@@ -82,8 +115,10 @@ auth_method_localdb_auth_do (poldi_ctx_t ctx,
   gpg_error_t err;
   char *card_username;
   const char *username;
+  char *fpr;
 
   card_username = NULL;
+  fpr = NULL;
 
   challenge = NULL;
   response = NULL;
@@ -124,7 +159,7 @@ auth_method_localdb_auth_do (poldi_ctx_t ctx,
 
   /* Verify (again) that the given account is associated with the
      serial number.  */
-  err = usersdb_check (ctx->cardinfo.serialno, username);
+  err = usersdb_check (ctx->cardinfo.serialno, username, &fpr);
   if (err)
     {
       if (ctx->debug)
@@ -138,38 +173,63 @@ auth_method_localdb_auth_do (poldi_ctx_t ctx,
       goto out;
     }
 
-  /* Retrieve key belonging to card.  */
-  err = key_lookup_by_serialno (ctx, ctx->cardinfo.serialno, &key);
+  /* Retrieve key belonging to card: from the card itself if the users
+     database pins its fingerprint, from the key directory
+     otherwise.  */
+  log_set_context_field (ctx->loghandle, "phase", "key-lookup");
+  if (fpr)
+    err = key_lookup_by_fingerprint (ctx, fpr, &key);
+  else if (cookie->key && !strcmp (cookie->serialno, ctx->cardinfo.serialno))
+    {
+      /* Read while waiting for the card.  */
+      key = cookie->key;
+      cookie->key = NULL;
+      err = 0;
+    }
+  else
+    err = key_lookup_by_serialno (ctx, ctx->cardinfo.serialno, &key);
   if (err)
     goto out;
 
   /* Generate challenge.  */
-  err = challenge_generate (&challenge, &challenge_n);
+  log_set_context_field (ctx->loghandle, "phase", "challenge");
+  err = challenge_params_from_key (key, ctx->cardinfo.key3algo, &params);
   if (err)
     {
-      log_msg_error (ctx->loghandle,
-		     "failed to generate challenge: %s",
-		     gpg_strerror (err));
+      log_msg_error_code (ctx->loghandle, err,
+			  "unsupported key for card `%s': %s",
+			  ctx->cardinfo.serialno, gpg_strerror (err));
+      goto out;
+    }
+  err = challenge_generate (&params, &challenge, &challenge_n);
+  if (err)
+    {
+      log_msg_error_code (ctx->loghandle, err,
+			  "failed to generate challenge: %s",
+			  gpg_strerror (err));
       goto out;
     }
 
   /* Let card sign the challenge.  */
-  err = scd_pksign (ctx->scd, "OPENPGP.3",
+  log_set_context_field (ctx->loghandle, "phase", "pksign");
+  err = scd_pksign (ctx->scd, "OPENPGP.3", params.card_mdalgo,
 		    challenge, challenge_n,
 		    &response, &response_n);
   if (err)
     {
-      log_msg_error (ctx->loghandle,
-		     "failed to retrieve challenge signature from card: %s",
-		     gpg_strerror (err));
+      log_msg_error_code (ctx->loghandle, err,
+			  "failed to retrieve challenge signature from card: %s",
+			  gpg_strerror (err));
       goto out;
     }
 
   /* Verify response.  */
-  err = challenge_verify (key, challenge, challenge_n, response, response_n);
+  log_set_context_field (ctx->loghandle, "phase", "verify");
+  err = challenge_verify (key, &params,
+			  challenge, challenge_n, response, response_n);
   if (err)
     {
-      log_msg_error (ctx->loghandle, "failed to verify challenge");
+      log_msg_error_code (ctx->loghandle, err, "failed to verify challenge");
       goto out;
     }
 
@@ -184,7 +244,8 @@ auth_method_localdb_auth_do (poldi_ctx_t ctx,
   gcry_sexp_release (key);
 
   challenge_release (challenge);
-  xfree (response);
+  secarena_free (response);
+  xfree (fpr);
 
   if (err)
     xfree (card_username);
@@ -192,6 +253,126 @@ auth_method_localdb_auth_do (poldi_ctx_t ctx,
   return !err;
 }
 
+/* Reject cards whose serial number SERIALNO is not contained in the
+   users database, using the serial number filter; this requires no
+   further card access and, usually, no reading of the database.
+   COOKIE is the cookie for this authentication method.  CTX is the
+   Poldi context object.  Returns proper error code.  */
+static gpg_error_t
+auth_method_localdb_check_card (poldi_ctx_t ctx, void *cookie,
+				const char *serialno)
+{
+  gpg_error_t err;
+  int known;
+
+  err = usersdb_serialno_known (serialno, &known);
+  if (err)
+    {
+      /* Leave the decision to the regular checks.  */
+      if (ctx->debug)
+	log_msg_debug (ctx->loghandle, "serial number filter unavailable: %s",
+		       gpg_strerror (err));
+      return 0;
+    }
+
+  if (known && ctx->username)
+    {
+      /* A card of somebody else is of no use either; when waiting on
+	 several readers, this lets us pick the right one.  */
+      if (!usersdb_check (serialno, ctx->username, NULL))
+	return 0;
+
+      if (ctx->debug)
+	log_msg_debug (ctx->loghandle,
+		       "rejecting card %s: not registered for user `%s'",
+		       serialno, ctx->username);
+      if (!ctx->quiet)
+	conv_tell (ctx->conv, _("Card %s is not registered for user `%s'"),
+		   serialno, ctx->username);
+
+      return gpg_error (GPG_ERR_WRONG_CARD);
+    }
+  else if (known)
+    return 0;
+
+  if (ctx->debug)
+    log_msg_debug (ctx->loghandle,
+		   "rejecting card %s: not in users database", serialno);
+  if (!ctx->quiet)
+    conv_tell (ctx->conv, _("Card %s is not registered"), serialno);
+
+  return gpg_error (GPG_ERR_NOT_FOUND);
+}
+
+/* Check whether USERNAME has a card in the users database.  COOKIE
+   is the cookie for this authentication method.  CTX is the Poldi
+   context object.  Returns zero if so.  */
+static gpg_error_t
+auth_method_localdb_check_user (poldi_ctx_t ctx, void *cookie,
+				const char *username)
+{
+  gpg_error_t err;
+  char *serialno;
+
+  serialno = NULL;
+  err = usersdb_lookup_by_username (username, &serialno);
+  xfree (serialno);
+
+  /* Several cards are fine as well.  */
+  if (gpg_err_code (err) == GPG_ERR_AMBIGUOUS_NAME)
+    err = 0;
+
+  return err;
+}
+
+/* Look up the card of USERNAME, if it has only one, and read its key
+   from the key directory, while the card is being waited for.  The
+   serial number filter is loaded as well.  COOKIE is the cookie for
+   this authentication method.  CTX is the Poldi context object.
+   Returns proper error code.  */
+static gpg_error_t
+auth_method_localdb_prefetch (poldi_ctx_t ctx, void *opaque,
+			      const char *username)
+{
+  localdb_ctx_t cookie = opaque;
+  gpg_error_t err;
+  char *serialno;
+  char *fpr;
+  int known;
+
+  serialno = fpr = NULL;
+
+  if (!username)
+    return 0;
+
+  err = usersdb_lookup_by_username (username, &serialno);
+  if (err)
+    goto out;
+
+  err = usersdb_serialno_known (serialno, &known);
+  if (err)
+    goto out;
+
+  /* Keys pinned by fingerprint are read from the card.  */
+  err = usersdb_check (serialno, username, &fpr);
+  if (err || fpr)
+    goto out;
+
+  err = key_lookup_by_serialno (ctx, serialno, &cookie->key);
+  if (err)
+    goto out;
+
+  cookie->serialno = serialno;
+  serialno = NULL;
+
+ out:
+
+  xfree (serialno);
+  xfree (fpr);
+
+  return err;
+}
+
 /* Try to authenticate a user. The user's identity on the system is
    figured out during the authentication process.  COOKIE is the
    cookie for this authentication method.  CTX is the Poldi context
@@ -201,7 +382,7 @@ auth_method_localdb_auth_do (poldi_ctx_t ctx,
 static int
 auth_method_localdb_auth (poldi_ctx_t ctx, void *cookie, char **username)
 {
-  return auth_method_localdb_auth_do (ctx, NULL, username);
+  return auth_method_localdb_auth_do (ctx, cookie, NULL, username);
 }
 
 /* Try to authenticate a user as USERNAME.  COOKIE is the cookie for
@@ -210,7 +391,7 @@ auth_method_localdb_auth (poldi_ctx_t ctx, void *cookie, char **username)
 static int
 auth_method_localdb_auth_as (poldi_ctx_t ctx, void *cookie, const char *username)
 {
-  return auth_method_localdb_auth_do (ctx, username, NULL);
+  return auth_method_localdb_auth_do (ctx, cookie, username, NULL);
 }
 
 
@@ -218,11 +399,16 @@ auth_method_localdb_auth_as (poldi_ctx_t ctx, void *cookie, const char *username
 
 struct auth_method_s auth_method_localdb =
   {
-    NULL,
-    NULL,
+    auth_method_localdb_init,
+    auth_method_localdb_deinit,
     auth_method_localdb_auth,
     auth_method_localdb_auth_as,
     NULL,
     NULL,
-    NULL
+    NULL,
+    auth_method_localdb_check_card,
+    auth_method_localdb_check_user,
+    auth_method_localdb_prefetch
   };
+
+const struct auth_method_abi_s auth_method_localdb_abi = AUTH_METHOD_ABI_INIT;
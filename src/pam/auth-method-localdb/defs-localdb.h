@@ -25,6 +25,7 @@
 #define POLDI_LOCALDB_DIRECTORY POLDI_CONF_DIRECTORY    "/localdb"
 
 #define POLDI_USERS_DB_FILE     POLDI_LOCALDB_DIRECTORY "/users"
+#define POLDI_USERS_FILTER_FILE POLDI_LOCALDB_DIRECTORY "/users.bloom"
 #define POLDI_KEY_DIRECTORY     POLDI_LOCALDB_DIRECTORY "/keys"
 
 #endif
@@ -22,11 +22,15 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
 
 #include <gpg-error.h>
 #include <gcrypt.h>
 
 #include "util/support.h"
+#include "util/util.h"
 #include "util/filenames.h"
 #include "key-lookup.h"
 #include "defs-localdb.h"
@@ -98,3 +102,323 @@ key_lookup_by_serialno (poldi_ctx_t ctx, const char *serialno, gcry_sexp_t *key)
 }
 
 
+
+
+
+/* Number of keys in the cache of verified card keys.  */
+#define KEY_CACHE_SIZE 8
+
+/* Cache of keys read from cards and verified against their
+   fingerprint, shared by all authentications in the process.  */
+static struct
+{
+  unsigned char fpr[20];
+  gcry_sexp_t key;
+} key_cache[KEY_CACHE_SIZE];
+static unsigned int key_cache_next;
+static pthread_mutex_t key_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Store a copy of the cached key with fingerprint FPR in *KEY.
+   Returns GPG_ERR_NOT_FOUND if there is none.  */
+static gpg_error_t
+key_cache_get (const unsigned char *fpr, gcry_sexp_t *key)
+{
+  gpg_error_t err;
+  unsigned int i;
+
+  err = gpg_error (GPG_ERR_NOT_FOUND);
+
+  pthread_mutex_lock (&key_cache_lock);
+  for (i = 0; i < KEY_CACHE_SIZE; i++)
+    if (key_cache[i].key && !memcmp (key_cache[i].fpr, fpr, 20))
+      {
+	err = gcry_sexp_build (key, NULL, "%S", key_cache[i].key);
+	break;
+      }
+  pthread_mutex_unlock (&key_cache_lock);
+
+  return err;
+}
+
+/* Add a copy of the key KEY with fingerprint FPR to the cache,
+   replacing the oldest entry if the cache is full.  */
+static void
+key_cache_put (const unsigned char *fpr, gcry_sexp_t key)
+{
+  gcry_sexp_t key_copy;
+
+  if (gcry_sexp_build (&key_copy, NULL, "%S", key))
+    return;
+
+  pthread_mutex_lock (&key_cache_lock);
+  gcry_sexp_release (key_cache[key_cache_next].key);
+  memcpy (key_cache[key_cache_next].fpr, fpr, 20);
+  key_cache[key_cache_next].key = key_copy;
+  key_cache_next = (key_cache_next + 1) % KEY_CACHE_SIZE;
+  pthread_mutex_unlock (&key_cache_lock);
+}
+
+/* OpenPGP names (OIDs) of the curves supported for card keys.  */
+static const struct
+{
+  const char *name;
+  const char *alias;
+  unsigned char oid_n;
+  unsigned char oid[9];
+} curves[] =
+  {
+    { "NIST P-256", "1.2.840.10045.3.1.7", 8,
+      { 0x2a, 0x86, 0x48, 0xce, 0x3d, 0x03, 0x01, 0x07 } },
+    { "NIST P-384", "1.3.132.0.34", 5, { 0x2b, 0x81, 0x04, 0x00, 0x22 } },
+    { "NIST P-521", "1.3.132.0.35", 5, { 0x2b, 0x81, 0x04, 0x00, 0x23 } },
+    { "Ed25519", "1.3.6.1.4.1.11591.15.1", 9,
+      { 0x2b, 0x06, 0x01, 0x04, 0x01, 0xda, 0x47, 0x0f, 0x01 } }
+  };
+
+/* Convert the value of the element NAME of the key parameter list
+   LIST into the OpenPGP MPI format, stored in *BUF (allocated by
+   Libgcrypt) and *BUF_N.  If PREFIX is not zero and the value has
+   LEN bytes, PREFIX is prepended to it first, as done for EdDSA
+   points.  Returns proper error code.  */
+static gpg_error_t
+key_element_to_mpi (gcry_sexp_t list, const char *name,
+		    int prefix, size_t len,
+		    unsigned char **buf, size_t *buf_n)
+{
+  unsigned char point[1 + 32];
+  const char *data;
+  gcry_sexp_t l;
+  gcry_mpi_t mpi;
+  gpg_error_t err;
+  size_t n;
+
+  l = gcry_sexp_find_token (list, name, 0);
+  data = l ? gcry_sexp_nth_data (l, 1, &n) : NULL;
+  if (!data || !n)
+    {
+      gcry_sexp_release (l);
+      return gpg_error (GPG_ERR_BAD_PUBKEY);
+    }
+
+  if (prefix && n == len && len < sizeof (point))
+    {
+      point[0] = prefix;
+      memcpy (point + 1, data, n);
+      err = gcry_mpi_scan (&mpi, GCRYMPI_FMT_USG, point, n + 1, NULL);
+    }
+  else
+    err = gcry_mpi_scan (&mpi, GCRYMPI_FMT_USG, data, n, NULL);
+  gcry_sexp_release (l);
+  if (err)
+    return err;
+
+  err = gcry_mpi_aprint (GCRYMPI_FMT_PGP, buf, buf_n, mpi);
+  gcry_mpi_release (mpi);
+
+  return err;
+}
+
+gpg_error_t
+key_fingerprint (gcry_sexp_t key, unsigned long created, unsigned char *fpr)
+{
+  struct challenge_params params;
+  unsigned char *mpis[2];
+  size_t mpis_n[2];
+  unsigned char header[9];
+  const unsigned char *oid;
+  unsigned char oid_n;
+  gcry_sexp_t list, l;
+  const char *curve;
+  gcry_md_hd_t md;
+  gpg_error_t err;
+  size_t len, n;
+  unsigned int i;
+
+  memset (mpis, 0, sizeof (mpis));
+  memset (mpis_n, 0, sizeof (mpis_n));
+  oid = NULL;
+  oid_n = 0;
+  list = NULL;
+  md = NULL;
+
+  err = challenge_params_from_key (key, 0, &params);
+  if (err)
+    goto out;
+
+  if (params.pkalgo == GCRY_PK_RSA)
+    {
+      list = gcry_sexp_find_token (key, "rsa", 0);
+      header[8] = 1;
+      err = key_element_to_mpi (list, "n", 0, 0, &mpis[0], &mpis_n[0]);
+      if (!err)
+	err = key_element_to_mpi (list, "e", 0, 0, &mpis[1], &mpis_n[1]);
+    }
+  else
+    {
+      list = gcry_sexp_find_token (key, "public-key", 0);
+      l = list ? gcry_sexp_find_token (list, "curve", 0) : NULL;
+      curve = l ? gcry_sexp_nth_data (l, 1, &n) : NULL;
+      for (i = 0; curve && i < DIM (curves); i++)
+	if ((strlen (curves[i].name) == n
+	     && !strncasecmp (curve, curves[i].name, n))
+	    || (strlen (curves[i].alias) == n
+		&& !memcmp (curve, curves[i].alias, n)))
+	  {
+	    oid = curves[i].oid;
+	    oid_n = curves[i].oid_n;
+	    break;
+	  }
+      gcry_sexp_release (l);
+      if (!oid)
+	{
+	  err = gpg_error (GPG_ERR_UNKNOWN_CURVE);
+	  goto out;
+	}
+
+      /* OpenPGP marks native EdDSA points with a 0x40 prefix.  */
+      if (params.pkalgo == GCRY_PK_EDDSA)
+	{
+	  header[8] = 22;
+	  err = key_element_to_mpi (list, "q", 0x40, 32, &mpis[0], &mpis_n[0]);
+	}
+      else
+	{
+	  header[8] = 19;
+	  err = key_element_to_mpi (list, "q", 0, 0, &mpis[0], &mpis_n[0]);
+	}
+    }
+  if (err)
+    goto out;
+
+  /* Public key packet header: tag, length, version, creation time,
+     algorithm; followed by the curve OID for ECC keys and the key
+     material.  */
+  len = 6 + (oid ? 1 + oid_n : 0) + mpis_n[0] + mpis_n[1];
+  if (len > 0xffff)
+    {
+      err = gpg_error (GPG_ERR_BAD_PUBKEY);
+      goto out;
+    }
+  header[0] = 0x99;
+  header[1] = len >> 8;
+  header[2] = len;
+  header[3] = 4;
+  header[4] = created >> 24;
+  header[5] = created >> 16;
+  header[6] = created >> 8;
+  header[7] = created;
+
+  err = gcry_md_open (&md, GCRY_MD_SHA1, 0);
+  if (err)
+    goto out;
+  gcry_md_write (md, header, sizeof (header));
+  if (oid)
+    {
+      gcry_md_putc (md, oid_n);
+      gcry_md_write (md, oid, oid_n);
+    }
+  for (i = 0; i < DIM (mpis); i++)
+    gcry_md_write (md, mpis[i], mpis_n[i]);
+  memcpy (fpr, gcry_md_read (md, GCRY_MD_SHA1), 20);
+
+ out:
+
+  gcry_md_close (md);
+  for (i = 0; i < DIM (mpis); i++)
+    gcry_free (mpis[i]);
+  gcry_sexp_release (list);
+
+  return err;
+}
+
+gpg_error_t
+key_lookup_by_fingerprint (poldi_ctx_t ctx, const char *fpr, gcry_sexp_t *key)
+{
+  unsigned char fpr_pinned[20];
+  unsigned char fpr_key[20];
+  gcry_sexp_t key_sexp;
+  gpg_error_t err;
+  unsigned int i;
+
+  key_sexp = NULL;
+
+  for (i = 0; i < 40 && hexdigitp (fpr + i); i++)
+    ;
+  if (i != 40 || fpr[i])
+    {
+      log_msg_error (ctx->loghandle,
+		     "invalid fingerprint `%s' in users database", fpr);
+      err = gpg_error (GPG_ERR_INV_VALUE);
+      goto out;
+    }
+  for (i = 0; i < 20; i++)
+    fpr_pinned[i] = xtoi_2 (fpr + 2 * i);
+
+  /* The card must report the pinned key as its authentication key;
+     otherwise there is no point in reading it.  */
+  if (!ctx->cardinfo.fpr3valid
+      || memcmp (ctx->cardinfo.fpr3, fpr_pinned, 20))
+    {
+      log_msg_error (ctx->loghandle,
+		     "authentication key of card `%s' does not match "
+		     "the pinned fingerprint", ctx->cardinfo.serialno);
+      err = gpg_error (GPG_ERR_BAD_PUBKEY);
+      goto out;
+    }
+
+  err = key_cache_get (fpr_pinned, &key_sexp);
+  if (!err)
+    {
+      if (ctx->debug)
+	log_msg_debug (ctx->loghandle, "using cached key for fingerprint %s",
+		       fpr);
+      goto out;
+    }
+
+  if (!ctx->cardinfo.fpr3time)
+    {
+      log_msg_error (ctx->loghandle,
+		     "card `%s' does not report the creation time "
+		     "of its authentication key", ctx->cardinfo.serialno);
+      err = gpg_error (GPG_ERR_NO_DATA);
+      goto out;
+    }
+
+  err = scd_readkey (ctx->scd, "OPENPGP.3", &key_sexp);
+  if (err)
+    {
+      log_msg_error (ctx->loghandle,
+		     "failed to read key from card `%s': %s",
+		     ctx->cardinfo.serialno, gpg_strerror (err));
+      goto out;
+    }
+
+  err = key_fingerprint (key_sexp, ctx->cardinfo.fpr3time, fpr_key);
+  if (err)
+    {
+      log_msg_error (ctx->loghandle,
+		     "failed to compute fingerprint of key from card `%s': %s",
+		     ctx->cardinfo.serialno, gpg_strerror (err));
+      goto out;
+    }
+
+  if (memcmp (fpr_key, fpr_pinned, 20))
+    {
+      log_msg_error (ctx->loghandle,
+		     "key read from card `%s' does not match "
+		     "the pinned fingerprint", ctx->cardinfo.serialno);
+      err = gpg_error (GPG_ERR_BAD_PUBKEY);
+      goto out;
+    }
+
+  key_cache_put (fpr_pinned, key_sexp);
+
+ out:
+
+  if (err)
+    gcry_sexp_release (key_sexp);
+  else
+    *key = key_sexp;
+
+  return err;
+}
@@ -30,4 +30,19 @@
 gpg_error_t key_lookup_by_serialno (poldi_ctx_t ctx,
 				    const char *serialno, gcry_sexp_t *key);
 
+/* Read the authentication key from the card in CTX and store it in
+   *KEY, after checking that its OpenPGP fingerprint matches both FPR,
+   the fingerprint pinned in the users database (40 hex digits), and
+   the fingerprint reported by the card.  Verified keys are cached in
+   the process, so that the card is asked for the key only once.
+   Returns a proper error code.  */
+gpg_error_t key_lookup_by_fingerprint (poldi_ctx_t ctx,
+				       const char *fpr, gcry_sexp_t *key);
+
+/* Compute the OpenPGP (version 4) fingerprint of the card key KEY,
+   which has been created at CREATED, and store it in FPR.  RSA,
+   ECDSA and EdDSA keys are supported.  Returns proper error code.  */
+gpg_error_t key_fingerprint (gcry_sexp_t key, unsigned long created,
+			     unsigned char *fpr);
+
 #endif
@@ -0,0 +1,379 @@
+/* serial-filter.c - Bloom filter of enrolled card serial numbers
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of Poldi.
+
+   Poldi is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   Poldi is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.  */
+
+/* See serial-filter.h for a description of the API implemented by
+   this file. */
+
+#include <poldi.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <gcrypt.h>
+
+#include "serial-filter.h"
+
+#define SERIAL_FILTER_MAGIC "PLDBLM01"
+#define SERIAL_FILTER_BYTEORDER 0x01020304
+
+/* Bits per serial number and number of hash functions; this gives a
+   false positive rate of about one percent.  */
+#define SERIAL_FILTER_BITS_PER_KEY 10
+#define SERIAL_FILTER_HASHES 7
+
+/* On-disk header of a filter; native byte order is used, as for the
+   CRL index.  */
+struct serial_filter_header
+{
+  char magic[8];
+  uint32_t byteorder;
+  uint32_t nhashes;
+  uint64_t nbits;
+  uint64_t count;
+  uint64_t source_mtime;
+  uint64_t source_size;
+  unsigned char reserved[16];
+};
+
+struct serial_filter_s
+{
+  void *image;			/* Mapped file or allocated image.  */
+  size_t image_len;
+  int mapped;			/* True if IMAGE is a mapping.  */
+  const unsigned char *bits;	/* Start of the bit array.  */
+  uint64_t nbits;
+  unsigned int nhashes;
+  uint64_t source_mtime;
+  uint64_t source_size;
+};
+
+
+
+/* Compute the two base hashes of SERIALNO, from which the bit
+   positions are derived by double hashing.  */
+static void
+serial_hash (const char *serialno, uint64_t *h1, uint64_t *h2)
+{
+  unsigned char digest[32];
+
+  gcry_md_hash_buffer (GCRY_MD_SHA256, digest, serialno, strlen (serialno));
+  memcpy (h1, digest, sizeof (*h1));
+  memcpy (h2, digest + 8, sizeof (*h2));
+
+  /* An even step would visit only half of the positions for an even
+     number of bits.  */
+  *h2 |= 1;
+}
+
+gpg_error_t
+serial_filter_build (const char **serialnos, size_t count,
+		     unsigned long long source_mtime,
+		     unsigned long long source_size,
+		     void **image, size_t *image_len)
+{
+  struct serial_filter_header header;
+  unsigned char *image_new, *bits;
+  uint64_t nbits, h1, h2, bit;
+  size_t i, len;
+  unsigned int j;
+
+  /* Round up to whole 64 bit words; at least one word.  */
+  nbits = (uint64_t) count * SERIAL_FILTER_BITS_PER_KEY;
+  nbits = (nbits + 63) & ~(uint64_t) 63;
+  if (!nbits)
+    nbits = 64;
+
+  len = sizeof (header) + nbits / 8;
+  image_new = xtrymalloc (len);
+  if (!image_new)
+    return gpg_error_from_syserror ();
+
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, SERIAL_FILTER_MAGIC, sizeof (header.magic));
+  header.byteorder = SERIAL_FILTER_BYTEORDER;
+  header.nhashes = SERIAL_FILTER_HASHES;
+  header.nbits = nbits;
+  header.count = count;
+  header.source_mtime = source_mtime;
+  header.source_size = source_size;
+  memcpy (image_new, &header, sizeof (header));
+
+  bits = image_new + sizeof (header);
+  memset (bits, 0, nbits / 8);
+  for (i = 0; i < count; i++)
+    {
+      serial_hash (serialnos[i], &h1, &h2);
+      for (j = 0; j < SERIAL_FILTER_HASHES; j++)
+	{
+	  bit = (h1 + j * h2) % nbits;
+	  bits[bit / 8] |= 1 << (bit % 8);
+	}
+    }
+
+  *image = image_new;
+  *image_len = len;
+
+  return 0;
+}
+
+gpg_error_t
+serial_filter_write (const char *filename, const void *image, size_t image_len)
+{
+  gpg_error_t err;
+  char *tmpname;
+  const char *p;
+  ssize_t ret;
+  size_t off;
+  int fd;
+
+  fd = -1;
+  err = 0;
+
+  tmpname = xtrymalloc (strlen (filename) + 8);
+  if (!tmpname)
+    return gpg_error_from_syserror ();
+  sprintf (tmpname, "%s.XXXXXX", filename);
+
+  fd = mkstemp (tmpname);
+  if (fd == -1)
+    {
+      err = gpg_error_from_syserror ();
+      goto out;
+    }
+
+  for (p = image, off = 0; off < image_len; off += ret)
+    {
+      ret = write (fd, p + off, image_len - off);
+      if (ret == -1)
+	{
+	  if (errno == EINTR)
+	    {
+	      ret = 0;
+	      continue;
+	    }
+	  err = gpg_error_from_syserror ();
+	  goto out;
+	}
+    }
+
+  if (fchmod (fd, 0644) || fsync (fd))
+    {
+      err = gpg_error_from_syserror ();
+      goto out;
+    }
+
+  if (close (fd))
+    {
+      fd = -1;
+      err = gpg_error_from_syserror ();
+      goto out;
+    }
+  fd = -1;
+
+  if (rename (tmpname, filename))
+    err = gpg_error_from_syserror ();
+
+ out:
+
+  if (fd != -1)
+    close (fd);
+  if (err)
+    unlink (tmpname);
+  xfree (tmpname);
+
+  return err;
+}
+
+/* Check the image of FILTER and fill in the derived fields.  */
+static gpg_error_t
+filter_setup (serial_filter_t filter)
+{
+  struct serial_filter_header header;
+
+  if (filter->image_len < sizeof (header))
+    return gpg_error (GPG_ERR_INV_DATA);
+
+  memcpy (&header, filter->image, sizeof (header));
+
+  if (memcmp (header.magic, SERIAL_FILTER_MAGIC, sizeof (header.magic))
+      || header.byteorder != SERIAL_FILTER_BYTEORDER
+      || !header.nhashes || header.nhashes > 32
+      || !header.nbits || header.nbits % 8
+      || header.nbits / 8 != filter->image_len - sizeof (header))
+    return gpg_error (GPG_ERR_INV_DATA);
+
+  filter->bits = (const unsigned char *) filter->image + sizeof (header);
+  filter->nbits = header.nbits;
+  filter->nhashes = header.nhashes;
+  filter->source_mtime = header.source_mtime;
+  filter->source_size = header.source_size;
+
+  return 0;
+}
+
+gpg_error_t
+serial_filter_open (serial_filter_t *filter, const char *filename)
+{
+  serial_filter_t filter_new;
+  struct stat statbuf;
+  gpg_error_t err;
+  void *image;
+  int fd;
+
+  filter_new = NULL;
+  image = MAP_FAILED;
+  err = 0;
+
+  fd = open (filename, O_RDONLY | O_NOFOLLOW);
+  if (fd == -1)
+    {
+      err = gpg_error_from_syserror ();
+      goto out;
+    }
+
+  if (fstat (fd, &statbuf))
+    {
+      err = gpg_error_from_syserror ();
+      goto out;
+    }
+
+  /* A forged filter could lock out enrolled cards.  */
+  if ((statbuf.st_uid && statbuf.st_uid != geteuid ())
+      || (statbuf.st_mode & (S_IWGRP | S_IWOTH))
+      || !S_ISREG (statbuf.st_mode))
+    {
+      err = gpg_error (GPG_ERR_BAD_DATA);
+      goto out;
+    }
+
+  if (statbuf.st_size < sizeof (struct serial_filter_header))
+    {
+      err = gpg_error (GPG_ERR_INV_DATA);
+      goto out;
+    }
+
+  image = mmap (NULL, statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (image == MAP_FAILED)
+    {
+      err = gpg_error_from_syserror ();
+      goto out;
+    }
+
+  filter_new = xtrymalloc (sizeof (*filter_new));
+  if (!filter_new)
+    {
+      err = gpg_error_from_syserror ();
+      goto out;
+    }
+
+  filter_new->image = image;
+  filter_new->image_len = statbuf.st_size;
+  filter_new->mapped = 1;
+
+  err = filter_setup (filter_new);
+  if (err)
+    goto out;
+
+  *filter = filter_new;
+
+ out:
+
+  if (fd != -1)
+    close (fd);
+  if (err)
+    {
+      if (image != MAP_FAILED)
+	munmap (image, statbuf.st_size);
+      xfree (filter_new);
+    }
+
+  return err;
+}
+
+gpg_error_t
+serial_filter_open_mem (serial_filter_t *filter, void *image, size_t image_len)
+{
+  serial_filter_t filter_new;
+  gpg_error_t err;
+
+  filter_new = xtrymalloc (sizeof (*filter_new));
+  if (!filter_new)
+    return gpg_error_from_syserror ();
+
+  filter_new->image = image;
+  filter_new->image_len = image_len;
+  filter_new->mapped = 0;
+
+  err = filter_setup (filter_new);
+  if (err)
+    xfree (filter_new);
+  else
+    *filter = filter_new;
+
+  return err;
+}
+
+void
+serial_filter_close (serial_filter_t filter)
+{
+  if (filter)
+    {
+      if (filter->mapped)
+	munmap (filter->image, filter->image_len);
+      else
+	xfree (filter->image);
+      xfree (filter);
+    }
+}
+
+int
+serial_filter_is_current (serial_filter_t filter,
+			  unsigned long long source_mtime,
+			  unsigned long long source_size)
+{
+  return (filter->source_mtime == source_mtime
+	  && filter->source_size == source_size);
+}
+
+int
+serial_filter_lookup (serial_filter_t filter, const char *serialno)
+{
+  uint64_t h1, h2, bit;
+  unsigned int j;
+
+  serial_hash (serialno, &h1, &h2);
+  for (j = 0; j < filter->nhashes; j++)
+    {
+      bit = (h1 + j * h2) % filter->nbits;
+      if (!(filter->bits[bit / 8] & (1 << (bit % 8))))
+	return 0;
+    }
+
+  return 1;
+}
+
+/* END */
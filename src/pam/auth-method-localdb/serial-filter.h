@@ -0,0 +1,77 @@
+/* serial-filter.h - Bloom filter of enrolled card serial numbers
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of Poldi.
+
+   Poldi is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   Poldi is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.  */
+
+#ifndef SERIAL_FILTER_H
+#define SERIAL_FILTER_H
+
+#include <stddef.h>
+
+#include <gpg-error.h>
+
+/* A serial filter is a Bloom filter over the card serial numbers
+   contained in the users database.  It answers the question whether
+   a card might be enrolled without reading the database: a negative
+   answer is definite, a positive one is wrong for about one percent
+   of unknown cards.  Like the CRL index of the x509 method, a filter
+   is a small header followed by the bit array, so that it can be
+   written to a file and memory-mapped.  */
+
+typedef struct serial_filter_s *serial_filter_t;
+
+/* Build a new filter image for the COUNT serial numbers SERIALNOS,
+   stamped with the modification time and size of the users database
+   it has been built from.  The newly allocated image is stored in
+   *IMAGE, it's length in *IMAGE_LEN.  Returns proper error code.  */
+gpg_error_t serial_filter_build (const char **serialnos, size_t count,
+				 unsigned long long source_mtime,
+				 unsigned long long source_size,
+				 void **image, size_t *image_len);
+
+/* Atomically write the filter image IMAGE/IMAGE_LEN to the file
+   FILENAME.  Returns proper error code.  */
+gpg_error_t serial_filter_write (const char *filename,
+				 const void *image, size_t image_len);
+
+/* Open the filter file FILENAME by mapping it into memory and store a
+   new filter object in *FILTER.  The file must be owned by root or
+   by us and must not be writable by others.  Returns proper error
+   code.  */
+gpg_error_t serial_filter_open (serial_filter_t *filter, const char *filename);
+
+/* Create a filter object for the in-memory image IMAGE/IMAGE_LEN as
+   returned by serial_filter_build and store it in *FILTER.  On
+   success, the filter takes ownership of IMAGE.  Returns proper error
+   code.  */
+gpg_error_t serial_filter_open_mem (serial_filter_t *filter,
+				    void *image, size_t image_len);
+
+/* Release the filter FILTER.  FILTER being NULL is okay.  */
+void serial_filter_close (serial_filter_t filter);
+
+/* Return true if FILTER has been built from a users database with
+   modification time SOURCE_MTIME and size SOURCE_SIZE.  */
+int serial_filter_is_current (serial_filter_t filter,
+			      unsigned long long source_mtime,
+			      unsigned long long source_size);
+
+/* Return false if the card serial number SERIALNO is certainly not
+   contained in FILTER, true if it might be.  */
+int serial_filter_lookup (serial_filter_t filter, const char *serialno);
+
+#endif
@@ -23,24 +23,34 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include <gcrypt.h>
 
 #include "usersdb.h"
+#include "serial-filter.h"
 #include "defs-localdb.h"
 
 
+/* The users database and the filter file next to it.  */
+static const char *usersdb_file = POLDI_USERS_DB_FILE;
+static const char *usersdb_filter_file = POLDI_USERS_FILTER_FILE;
+
 
 /* This is the type for callbacks functions, which need to be passed
    to usersdb_process().  The callback function receives one
-   (SERIALNO, USERNAME) pair per invocation.  OPAQUE is the opaque
-   arugment passed to usersdb_process().  The return code of such a
+   (SERIALNO, USERNAME) pair per invocation, together with the
+   fingerprint FPR pinned for the entry, which is NULL if the entry
+   has none.  OPAQUE is the opaque arugment passed to
+   usersdb_process().  The return code of such a
    callback functions has the following meanings:
 
    0: Continue processing the users database.
    1: Stop processing.  */
 typedef int (*usersdb_cb_t) (const char *serialno, const char *username,
-			     void *opaque);
+			     const char *fpr, void *opaque);
 
 /* This functions processes the users database.  For each read pair of
    a card serial number and a account, the callback function specified
@@ -55,6 +65,7 @@ usersdb_process (usersdb_cb_t cb, void *opaque)
   char *line;
   char *line_serialno;
   char *line_username;
+  char *line_fpr;
   size_t line_n;
   ssize_t ret;
   int cb_ret;
@@ -66,7 +77,7 @@ usersdb_process (usersdb_cb_t cb, void *opaque)
   err = 0;
 
   /* Open users database.  */
-  usersdb = fopen (POLDI_USERS_DB_FILE, "r");
+  usersdb = fopen (usersdb_file, "r");
   if (! usersdb)
     {
       err = gpg_error_from_syserror ();
@@ -108,8 +119,12 @@ usersdb_process (usersdb_cb_t cb, void *opaque)
 	/* Ignore this incomplete entry.  */
 	goto skip;
 
+      /* Extract optional third token: the fingerprint of the card's
+	 authentication key.  */
+      line_fpr = strtok_r (NULL, delimiters, &save_ptr);
+
       /* Looks like a valid entry, pass to callback function.  */
-      cb_ret = (*cb) (line_serialno, line_username, opaque);
+      cb_ret = (*cb) (line_serialno, line_username, line_fpr, opaque);
       if (cb_ret)
 	/* Callback functions wants us to stop.  */
 	break;
@@ -121,7 +136,7 @@ usersdb_process (usersdb_cb_t cb, void *opaque)
     goto out;
 
   /* Finalize.  */
-  (*cb) (NULL, NULL, opaque);
+  (*cb) (NULL, NULL, NULL, opaque);
 
  out:
 
@@ -149,11 +164,17 @@ typedef struct check_cb_s
 
   /* If found, this is set to TRUE by the callback function.  */
   int match;
+
+  /* Copy of the pinned fingerprint of the matching entry, if
+     any.  */
+  char *fpr;
+  gpg_error_t err;
 } *check_cb_t;
 
 /* Callback function.  */
 static int
-usersdb_check_cb (const char *serialno, const char *username, void *opaque)
+usersdb_check_cb (const char *serialno, const char *username,
+		  const char *fpr, void *opaque)
 {
   check_cb_t ctx = opaque;
 
@@ -169,6 +190,12 @@ usersdb_check_cb (const char *serialno, const char *username, void *opaque)
 	  /* The current entry is exactly the one we were looking
 	     for.  */
 	  ctx->match = 1;
+	  if (fpr)
+	    {
+	      ctx->fpr = xtrystrdup (fpr);
+	      if (!ctx->fpr)
+		ctx->err = gpg_error_from_syserror ();
+	    }
 	  return 1;
 	}
     }
@@ -177,11 +204,13 @@ usersdb_check_cb (const char *serialno, const char *username, void *opaque)
 }
 
 /* This functions figures out wether the provided (SERIALNO, USERNAME)
-   pair is contained in the users database.  */
+   pair is contained in the users database.  If FPR is not NULL, the
+   fingerprint pinned for the entry is stored in *FPR (newly
+   allocated), or NULL if the entry has none.  */
 gpg_error_t
-usersdb_check (const char *serialno, const char *username)
+usersdb_check (const char *serialno, const char *username, char **fpr)
 {
-  struct check_cb_s ctx = { serialno, username, 0 };
+  struct check_cb_s ctx = { serialno, username, 0, NULL, 0 };
   gpg_error_t err;
 
   err = usersdb_process (usersdb_check_cb, &ctx);
@@ -189,11 +218,20 @@ usersdb_check (const char *serialno, const char *username)
     {
       /* Now we have a result in CTX.  */
 
-      if (! ctx.match)
+      if (ctx.err)
+	err = ctx.err;
+      else if (! ctx.match)
 	err = gpg_error (GPG_ERR_NOT_FOUND); /* FIXME: not the best
 						return code...  */
     }
 
+  if (!err && fpr)
+    {
+      *fpr = ctx.fpr;
+      ctx.fpr = NULL;
+    }
+  xfree (ctx.fpr);
+
   return err;
 }
 
@@ -215,7 +253,8 @@ typedef struct lookup_cb_s
 } *lookup_cb_t;
 
 static int
-usersdb_lookup_cb (const char *serialno, const char *username, void *opaque)
+usersdb_lookup_cb (const char *serialno, const char *username,
+		   const char *fpr, void *opaque)
 {
   lookup_cb_t ctx = opaque;
   char *str;
@@ -375,4 +414,192 @@ usersdb_lookup_by_username (const char *username, char **serialno)
   return err;
 }
 
+
+
+/*
+ * Serial number filter.
+ */
+
+/* The filter for the current users database, shared by all
+   authentications in the process.  */
+static pthread_mutex_t filter_lock = PTHREAD_MUTEX_INITIALIZER;
+static serial_filter_t filter_cached;
+
+/* Serial numbers collected from the users database.  */
+typedef struct collect_cb_s
+{
+  char **serialnos;
+  size_t count;
+  size_t size;
+  gpg_error_t err;
+} *collect_cb_t;
+
+static int
+usersdb_collect_cb (const char *serialno, const char *username,
+		    const char *fpr, void *opaque)
+{
+  collect_cb_t ctx = opaque;
+  char **serialnos_new;
+
+  if (! serialno)
+    return 0;
+
+  if (ctx->count == ctx->size)
+    {
+      ctx->size = ctx->size ? 2 * ctx->size : 64;
+      serialnos_new = xtryrealloc (ctx->serialnos,
+				   ctx->size * sizeof (*ctx->serialnos));
+      if (! serialnos_new)
+	{
+	  ctx->err = gpg_error_from_syserror ();
+	  return 1;
+	}
+      ctx->serialnos = serialnos_new;
+    }
+
+  ctx->serialnos[ctx->count] = xtrystrdup (serialno);
+  if (! ctx->serialnos[ctx->count])
+    {
+      ctx->err = gpg_error_from_syserror ();
+      return 1;
+    }
+  ctx->count++;
+
+  return 0;
+}
+
+/* Modification time (in nanoseconds) and size of the users database,
+   which identify the version of the database a filter is built
+   from.  */
+static gpg_error_t
+usersdb_stamp (unsigned long long *mtime, unsigned long long *size)
+{
+  struct stat statbuf;
+
+  if (stat (usersdb_file, &statbuf))
+    return gpg_error_from_syserror ();
+
+  *mtime = ((unsigned long long) statbuf.st_mtim.tv_sec * 1000000000
+	    + statbuf.st_mtim.tv_nsec);
+  *size = statbuf.st_size;
+
+  return 0;
+}
+
+/* Build a filter from the users database, which has the modification
+   time MTIME and size SIZE, and store it in *FILTER.  The filter is
+   also written to the filter file, if possible; *CURRENT is set to
+   false if the database changed while being read.  */
+static gpg_error_t
+usersdb_build_filter (unsigned long long mtime, unsigned long long size,
+		      serial_filter_t *filter, int *current)
+{
+  struct collect_cb_s ctx = { NULL, 0, 0, 0 };
+  unsigned long long mtime_after, size_after;
+  size_t image_len;
+  gpg_error_t err;
+  void *image;
+  size_t i;
+
+  image = NULL;
+  mtime_after = size_after = 0;
+
+  err = usersdb_process (usersdb_collect_cb, &ctx);
+  if (! err)
+    err = ctx.err;
+  if (err)
+    goto out;
+
+  err = serial_filter_build ((const char **) ctx.serialnos, ctx.count,
+			     mtime, size, &image, &image_len);
+  if (err)
+    goto out;
+
+  /* A filter which might be missing recently added cards must not
+     outlive this authentication.  */
+  *current = (! usersdb_stamp (&mtime_after, &size_after)
+	      && mtime_after == mtime && size_after == size);
+  if (*current)
+    /* Failing to store the filter only costs time.  */
+    serial_filter_write (usersdb_filter_file, image, image_len);
+
+  err = serial_filter_open_mem (filter, image, image_len);
+  if (! err)
+    image = NULL;
+
+ out:
+
+  xfree (image);
+  for (i = 0; i < ctx.count; i++)
+    xfree (ctx.serialnos[i]);
+  xfree (ctx.serialnos);
+
+  return err;
+}
+
+gpg_error_t
+usersdb_serialno_known (const char *serialno, int *known)
+{
+  unsigned long long mtime, size;
+  serial_filter_t filter;
+  gpg_error_t err;
+  int current;
+
+  filter = NULL;
+  mtime = size = 0;
+  current = 0;
+
+  err = usersdb_stamp (&mtime, &size);
+  if (err)
+    return err;
+
+  pthread_mutex_lock (&filter_lock);
+
+  if (filter_cached && ! serial_filter_is_current (filter_cached, mtime, size))
+    {
+      serial_filter_close (filter_cached);
+      filter_cached = NULL;
+    }
+
+  if (! filter_cached
+      && ! serial_filter_open (&filter_cached, usersdb_filter_file)
+      && ! serial_filter_is_current (filter_cached, mtime, size))
+    {
+      serial_filter_close (filter_cached);
+      filter_cached = NULL;
+    }
+
+  if (! filter_cached)
+    {
+      err = usersdb_build_filter (mtime, size, &filter, &current);
+      if (err)
+	goto out;
+      if (current)
+	{
+	  filter_cached = filter;
+	  filter = NULL;
+	}
+    }
+
+  *known = serial_filter_lookup (filter ? filter : filter_cached, serialno);
+
+ out:
+
+  pthread_mutex_unlock (&filter_lock);
+  serial_filter_close (filter);
+
+  return err;
+}
+
+void
+usersdb_set_files (const char *db_file, const char *filter_file)
+{
+  pthread_mutex_lock (&filter_lock);
+  usersdb_file = db_file;
+  usersdb_filter_file = filter_file;
+  serial_filter_close (filter_cached);
+  filter_cached = NULL;
+  pthread_mutex_unlock (&filter_lock);
+}
+
 /* END */
@@ -23,8 +23,12 @@
 #include <poldi.h>
 
 /* This functions figures out wether the provided (SERIALNO, USERNAME)
-   pair is contained in the users database.  */
-gpg_error_t usersdb_check (const char *serialno, const char *username);
+   pair is contained in the users database.  If FPR is not NULL, the
+   fingerprint of the card's authentication key pinned for the entry
+   (the optional third column) is stored in *FPR (newly allocated),
+   or NULL if the entry has none.  */
+gpg_error_t usersdb_check (const char *serialno, const char *username,
+			   char **fpr);
 
 /* This function tries to lookup a username by it's serial number;
    this is only possible in case the specified serial number SERIALNO
@@ -40,4 +44,17 @@ gpg_error_t usersdb_lookup_by_serialno (const char *serialno, char **username);
    error code.  */
 gpg_error_t usersdb_lookup_by_username (const char *username, char **serialno);
 
+/* This function checks quickly whether the card serial number
+   SERIALNO may be contained in the users database, by means of a
+   Bloom filter of all serial numbers.  The filter is kept next to the
+   database and rebuilt when the database changes.  *KNOWN is set to
+   false if SERIALNO is certainly not contained in the database, to
+   true otherwise.  Returns proper error code.  */
+gpg_error_t usersdb_serialno_known (const char *serialno, int *known);
+
+/* Use the users database DB_FILE and the filter file FILTER_FILE
+   instead of the installed ones and forget the filter in use.  Meant
+   for tests only.  */
+void usersdb_set_files (const char *db_file, const char *filter_file);
+
 #endif /* INCLUDED_USERSDB_H */
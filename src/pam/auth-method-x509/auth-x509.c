@@ -29,9 +29,12 @@
 
 #include "scd/scd.h"
 #include "dirmngr.h"
+#include "dirmngr-pool.h"
+#include "x509-offline.h"
 #include "conv.h"
 #include "util/util.h"
 #include "util/support.h"
+#include "util/secarena.h"
 #include "auth-support/ctx.h"
 #include "auth-support/getpin-cb.h"
 #include "auth-methods.h"
@@ -41,10 +44,31 @@
 
 
 
+/* Default number of dirmngr sessions kept open per process.  */
+#define DIRMNGR_POOL_SIZE_DEFAULT 4
+
+/* Supported certificate validation backends. */
+enum x509_validation
+  {
+    x509_validation_dirmngr,	/* Ask Dirmngr (default).  */
+    x509_validation_offline	/* Use local CA bundle and CRL.  */
+  };
+
 struct x509_ctx_s
 {
   char *x509_domain;
   char *dirmngr_socket;
+  unsigned int dirmngr_pool_size; /* Zero disables pooling.  */
+  dirmngr_pool_t dirmngr_pool;	/* Process-wide pool for
+				   DIRMNGR_SOCKET, looked up on demand. */
+  enum x509_validation validation;
+  char *ca_bundle;
+  char *crl_file;
+  char *crl_index;
+
+  /* Set up by auth_method_x509_prefetch while waiting for the card.  */
+  dirmngr_ctx_t dirmngr;	/* Dirmngr session or NULL.  */
+  x509_offline_t offline;	/* Offline validation context or NULL.  */
 };
 
 typedef struct x509_ctx_s *x509_ctx_t;
@@ -64,6 +88,14 @@ auth_method_x509_init (void **opaque)
     {
       cookie->x509_domain = NULL;
       cookie->dirmngr_socket = NULL;
+      cookie->dirmngr_pool_size = DIRMNGR_POOL_SIZE_DEFAULT;
+      cookie->dirmngr_pool = NULL;
+      cookie->validation = x509_validation_dirmngr;
+      cookie->ca_bundle = NULL;
+      cookie->crl_file = NULL;
+      cookie->crl_index = NULL;
+      cookie->dirmngr = NULL;
+      cookie->offline = NULL;
       err = 0;
     }
 
@@ -81,8 +113,18 @@ auth_method_x509_deinit (void *opaque)
 
   if (cookie)
     {
+      /* A session still held here has been abandoned in an unknown
+	 state; do not return it for reuse.  */
+      if (cookie->dirmngr_pool)
+	dirmngr_pool_release (cookie->dirmngr_pool, cookie->dirmngr, 1);
+      else
+	dirmngr_disconnect (cookie->dirmngr);
+      x509_offline_destroy (cookie->offline);
       xfree (cookie->x509_domain);
       xfree (cookie->dirmngr_socket);
+      xfree (cookie->ca_bundle);
+      xfree (cookie->crl_file);
+      xfree (cookie->crl_index);
       xfree (opaque);
     }
 }
@@ -92,7 +134,12 @@ enum opt_ids
   {
     opt_none,
     opt_dirmngr_socket,
-    opt_x509_domain
+    opt_dirmngr_pool_size,
+    opt_x509_domain,
+    opt_x509_validation,
+    opt_x509_ca_bundle,
+    opt_x509_crl_file,
+    opt_x509_crl_index
   };
 
 /* Option specifications. */
@@ -100,11 +147,46 @@ static simpleparse_opt_spec_t x509_opt_specs[] =
   {
     { opt_dirmngr_socket, "dirmngr-socket",
       0, SIMPLEPARSE_ARG_REQUIRED, 0, N_("Specify local socket for dirmngr access") },
+    { opt_dirmngr_pool_size, "dirmngr-pool-size",
+      0, SIMPLEPARSE_ARG_REQUIRED, 0, N_("Specify number of dirmngr sessions to keep open") },
     { opt_x509_domain, "x509-domain",
       0, SIMPLEPARSE_ARG_REQUIRED, 0, N_("Specify X509 domain for this host") },
+    { opt_x509_validation, "x509-validation",
+      0, SIMPLEPARSE_ARG_REQUIRED, 0, N_("Specify certificate validation backend (dirmngr, offline)") },
+    { opt_x509_ca_bundle, "x509-ca-bundle",
+      0, SIMPLEPARSE_ARG_REQUIRED, 0, N_("Specify trusted CA certificates for offline validation") },
+    { opt_x509_crl_file, "x509-crl-file",
+      0, SIMPLEPARSE_ARG_REQUIRED, 0, N_("Specify CRL for offline validation") },
+    { opt_x509_crl_index, "x509-crl-index",
+      0, SIMPLEPARSE_ARG_REQUIRED, 0, N_("Specify file for caching the compiled CRL") },
     { 0 }
   };
 
+/* Duplicate the option argument ARG of option NAME into *VALUE,
+   replacing a previous value.  Returns proper error code.  */
+static gpg_error_t
+dup_option_string (poldi_ctx_t ctx, const char *name, const char *arg,
+		   char **value)
+{
+  char *value_new;
+
+  value_new = xtrystrdup (arg);
+  if (!value_new)
+    {
+      gpg_error_t err = gpg_error_from_syserror ();
+
+      log_msg_error (ctx->loghandle,
+		     "failed to duplicate %s option string (length: %zu): %s",
+		     name, strlen (arg), gpg_strerror (err));
+      return err;
+    }
+
+  xfree (*value);
+  *value = value_new;
+
+  return 0;
+}
+
 /* Callback for simpleparse, implements x509-specific options. */
 static gpg_error_t
 auth_method_x509_parsecb (void *opaque, simpleparse_opt_spec_t spec, const char *arg)
@@ -114,8 +196,49 @@ auth_method_x509_parsecb (void *opaque, simpleparse_opt_spec_t spec, const char
   poldi_ctx_t ctx = cookie->poldi_ctx;
   gpg_err_code_t err = GPG_ERR_NO_ERROR;
 
-  if (!strcmp (spec.long_opt, "x509-domain"))
+  switch (spec.id)
     {
+    case opt_x509_validation:
+      if (!strcmp (arg, "dirmngr"))
+	x509_ctx->validation = x509_validation_dirmngr;
+      else if (!strcmp (arg, "offline"))
+	x509_ctx->validation = x509_validation_offline;
+      else
+	{
+	  log_msg_error (ctx->loghandle,
+			 "unknown x509 validation backend `%s'", arg);
+	  err = GPG_ERR_INV_VALUE;
+	}
+      break;
+
+    case opt_dirmngr_pool_size:
+      {
+	char *endp;
+	unsigned long size;
+
+	errno = 0;
+	size = strtoul (arg, &endp, 10);
+	if (errno || *endp || endp == arg || size > 64)
+	  {
+	    log_msg_error (ctx->loghandle,
+			   "invalid dirmngr pool size `%s'", arg);
+	    err = GPG_ERR_INV_VALUE;
+	  }
+	else
+	  x509_ctx->dirmngr_pool_size = size;
+      }
+      break;
+
+    case opt_x509_ca_bundle:
+      return dup_option_string (ctx, spec.long_opt, arg, &x509_ctx->ca_bundle);
+
+    case opt_x509_crl_file:
+      return dup_option_string (ctx, spec.long_opt, arg, &x509_ctx->crl_file);
+
+    case opt_x509_crl_index:
+      return dup_option_string (ctx, spec.long_opt, arg, &x509_ctx->crl_index);
+
+    case opt_x509_domain:
       x509_ctx->x509_domain = xtrystrdup (arg);
       if (!x509_ctx->x509_domain)
 	{
@@ -125,9 +248,9 @@ auth_method_x509_parsecb (void *opaque, simpleparse_opt_spec_t spec, const char
 			 strlen (arg), strerror (errno));
 	  err = gpg_error_from_syserror ();
 	}
-    }
-  else if (!strcmp (spec.long_opt, "dirmngr-socket"))
-    {
+      break;
+
+    case opt_dirmngr_socket:
       x509_ctx->dirmngr_socket = xtrystrdup (arg);
       if (!x509_ctx->dirmngr_socket)
 	{
@@ -137,6 +260,7 @@ auth_method_x509_parsecb (void *opaque, simpleparse_opt_spec_t spec, const char
 			 strlen (arg), strerror (errno));
 	  err = gpg_error_from_syserror ();
 	}
+      break;
     }
 
   return gpg_error (err);
@@ -187,33 +311,6 @@ extract_public_key_from_cert (poldi_ctx_t ctx, ksba_cert_t cert, gcry_sexp_t *pu
   return err;
 }
 
-/* This functions checks if RESPONSE/RESPONSE_N contains a valid
-   signature for the data CHALLENGE/CHALLENGE_N, created by the
-   private key belonging to the certificate CERT.  Returns zero if the
-   signature verification succeeded, an error code otherwise. */
-static gpg_error_t
-verify_challenge_sig (poldi_ctx_t ctx, ksba_cert_t cert,
-		      void *challenge, size_t challenge_n,
-		      void *response, size_t response_n)
-{
-  gcry_sexp_t pubkey;
-  gpg_error_t err;
-
-  pubkey = NULL;
-
-  err = extract_public_key_from_cert (ctx, cert, &pubkey);
-  if (err)
-    goto out;
-
-  err = challenge_verify (pubkey, challenge, challenge_n,
-			  response, response_n);
-
- out:
-
-  gcry_sexp_release (pubkey);
-
-  return err;
-}
 
 /* Extract the certificate contained in the file FILENAME, store it in
    *CERTIFICATE.  Return proper error code.  */
@@ -412,13 +509,72 @@ extract_username_from_cert (poldi_ctx_t ctx, ksba_cert_t cert,
   return err;
 }
 
+/* Connect to Dirmngr as configured in COOKIE, unless *DIRMNGR is
+   already connected.  If pooling is enabled, the session is taken
+   from the process-wide pool for the configured socket.  Returns
+   proper error code.  */
+static gpg_error_t
+require_dirmngr (poldi_ctx_t ctx, x509_ctx_t cookie, dirmngr_ctx_t *dirmngr)
+{
+  gpg_error_t err;
+
+  if (*dirmngr)
+    return 0;
+
+  if (!cookie->dirmngr_socket)
+    {
+      log_msg_error (ctx->loghandle,
+		     "dirmngr access required, but no dirmngr-socket configured");
+      return gpg_error (GPG_ERR_CONFIGURATION);
+    }
+
+  if (!cookie->dirmngr_pool_size)
+    {
+      err = dirmngr_connect (dirmngr, cookie->dirmngr_socket, 0,
+			     ctx->loghandle);
+      if (err)
+	log_msg_error (ctx->loghandle, "failed to connect to dirmngr: %s",
+		       gpg_strerror (err));
+      return err;
+    }
+
+  if (!cookie->dirmngr_pool)
+    {
+      err = dirmngr_pool_get (&cookie->dirmngr_pool, cookie->dirmngr_socket,
+			      cookie->dirmngr_pool_size);
+      if (err)
+	{
+	  log_msg_error (ctx->loghandle,
+			 "failed to set up dirmngr pool: %s",
+			 gpg_strerror (err));
+	  return err;
+	}
+    }
+
+  return dirmngr_pool_acquire (cookie->dirmngr_pool, ctx->loghandle, dirmngr);
+}
+
+/* Counterpart to require_dirmngr: return DIRMNGR to the pool or
+   disconnect.  BROKEN is true if the last transaction on DIRMNGR
+   failed, in which case the session might still be out of step with
+   Dirmngr and is not reused.  DIRMNGR being NULL is okay.  */
+static void
+release_dirmngr (x509_ctx_t cookie, dirmngr_ctx_t dirmngr, int broken)
+{
+  if (cookie->dirmngr_pool)
+    dirmngr_pool_release (cookie->dirmngr_pool, dirmngr, broken);
+  else
+    dirmngr_disconnect (dirmngr);
+}
+
 /* Lookup the certificate identified by URL (supported schemes are
-   "ldap://" and "file://") through the dirmngr connection identified
-   by DIRMNGR and store the certificate in *CERTIFICATE. CTX is the
-   Poldi context to use. Returns proper error code. */
+   "ldap://" and "file://") and store the certificate in *CERTIFICATE.
+   For "ldap://" URLs the dirmngr connection *DIRMNGR is used, which
+   is established on demand.  CTX is the Poldi context to use.
+   Returns proper error code. */
 static gpg_error_t
-lookup_cert (poldi_ctx_t ctx, dirmngr_ctx_t dirmngr, const char *url,
-	     ksba_cert_t *certificate)
+lookup_cert (poldi_ctx_t ctx, x509_ctx_t cookie, dirmngr_ctx_t *dirmngr,
+	     const char *url, ksba_cert_t *certificate)
 {
   ksba_cert_t cert;
   gpg_error_t err;
@@ -433,7 +589,11 @@ lookup_cert (poldi_ctx_t ctx, dirmngr_ctx_t dirmngr, const char *url,
     }
 
   if (strncmp (url, "ldap://", 7) == 0)
-    err = dirmngr_lookup_url (dirmngr, url, &cert);
+    {
+      err = require_dirmngr (ctx, cookie, dirmngr);
+      if (!err)
+	err = dirmngr_lookup_url (*dirmngr, url, &cert);
+    }
   else if (strncmp (ctx->cardinfo.pubkey_url, "file://", 7) == 0)
     err = lookup_cert_from_file (ctx->cardinfo.pubkey_url + 7, &cert);
   else
@@ -464,25 +624,39 @@ auth_method_x509_auth_do (poldi_ctx_t ctx, x509_ctx_t cookie,
 			  const char *username_desired,
 			  char **username_authenticated)
 {
+  struct challenge_params params;
   unsigned char *challenge;
   unsigned char *response;
   size_t challenge_n;
   size_t response_n;
+  gcry_sexp_t pubkey;
   gpg_error_t err;
   char *card_username;
   ksba_cert_t cert;
   dirmngr_ctx_t dirmngr;
-
-  dirmngr = NULL;
+  int dirmngr_broken;
+  x509_offline_t offline;
+
+  /* Take what has been set up while waiting for the card.  */
+  dirmngr = cookie->dirmngr;
+  cookie->dirmngr = NULL;
+  offline = cookie->offline;
+  cookie->offline = NULL;
   challenge = NULL;
   response = NULL;
   card_username = NULL;
   cert = NULL;
+  pubkey = NULL;
+  dirmngr_broken = 0;
   err = 0;
 
   /*** Sanity checks. ***/
 
-  if (! (cookie->x509_domain && cookie->dirmngr_socket))
+  if (! (cookie->x509_domain
+	 && ((cookie->validation == x509_validation_dirmngr
+	      && cookie->dirmngr_socket)
+	     || (cookie->validation == x509_validation_offline
+		 && cookie->ca_bundle))))
     {
       err = gpg_error (GPG_ERR_CONFIGURATION);
       log_msg_error (ctx->loghandle,
@@ -490,11 +664,9 @@ auth_method_x509_auth_do (poldi_ctx_t ctx, x509_ctx_t cookie,
       goto out;
     }
 
-  /*** Connect to Dirmngr. ***/
-
-  err = dirmngr_connect (&dirmngr, cookie->dirmngr_socket, 0, ctx->loghandle);
-  if (err)
-    goto out;
+  /* Dirmngr is only connected to when actually needed: for
+     validation through Dirmngr and for fetching certificates from
+     LDAP.  */
 
   // /*** Receive card info. ***/
 
@@ -504,12 +676,14 @@ auth_method_x509_auth_do (poldi_ctx_t ctx, x509_ctx_t cookie,
 
   /*** Fetch certificate. ***/
 
-  err = lookup_cert (ctx, dirmngr, ctx->cardinfo.pubkey_url, &cert);
+  log_set_context_field (ctx->loghandle, "phase", "cert-lookup");
+  err = lookup_cert (ctx, cookie, &dirmngr, ctx->cardinfo.pubkey_url, &cert);
   if (err)
     {
-      log_msg_error (ctx->loghandle,
-		     "failed to look up certificate `%s': %s",
-		     ctx->cardinfo.pubkey_url, gpg_strerror (err));
+      dirmngr_broken = 1;
+      log_msg_error_code (ctx->loghandle, err,
+			  "failed to look up certificate `%s': %s",
+			  ctx->cardinfo.pubkey_url, gpg_strerror (err));
       goto out;
     }
 
@@ -518,7 +692,26 @@ auth_method_x509_auth_do (poldi_ctx_t ctx, x509_ctx_t cookie,
   /* FIXME: implement mechanism which allows for specifying the
      issuer? -mo */
 
-  err = dirmngr_validate (dirmngr, cert);
+  log_set_context_field (ctx->loghandle, "phase", "cert-validate");
+  if (cookie->validation == x509_validation_offline)
+    {
+      if (!offline)
+	err = x509_offline_create (&offline, cookie->ca_bundle,
+				   cookie->crl_file, cookie->crl_index,
+				   ctx->loghandle);
+      if (!err)
+	err = x509_offline_validate (offline, cert);
+    }
+  else
+    {
+      err = require_dirmngr (ctx, cookie, &dirmngr);
+      if (!err)
+	{
+	  err = dirmngr_validate (dirmngr, cert);
+	  if (err)
+	    dirmngr_broken = 1;
+	}
+    }
   if (err)
     goto out;
 
@@ -545,34 +738,52 @@ auth_method_x509_auth_do (poldi_ctx_t ctx, x509_ctx_t cookie,
 
   /*** Generate challenge. ***/
 
-  err = challenge_generate (&challenge, &challenge_n);
+  /* The type of the certified key determines how the challenge is
+     to be signed.  */
+  log_set_context_field (ctx->loghandle, "phase", "challenge");
+  err = extract_public_key_from_cert (ctx, cert, &pubkey);
+  if (err)
+    goto out;
+  err = challenge_params_from_key (pubkey, ctx->cardinfo.key3algo, &params);
   if (err)
     {
-      log_msg_error (ctx->loghandle, "failed to generate challenge: %s",
-		     gpg_strerror (err));
+      log_msg_error_code (ctx->loghandle, err,
+			  "unsupported key in certificate: %s",
+			  gpg_strerror (err));
+      goto out;
+    }
+  err = challenge_generate (&params, &challenge, &challenge_n);
+  if (err)
+    {
+      log_msg_error_code (ctx->loghandle, err,
+			  "failed to generate challenge: %s",
+			  gpg_strerror (err));
       goto out;
     }
 
   /*** Let card sign the challenge. ***/
-  err = scd_pksign (ctx->scd, "OPENPGP.3",
+  log_set_context_field (ctx->loghandle, "phase", "pksign");
+  err = scd_pksign (ctx->scd, "OPENPGP.3", params.card_mdalgo,
 		    challenge, challenge_n,
 		    &response, &response_n);
   if (err)
     {
-      log_msg_error (ctx->loghandle,
-		     "failed to retrieve challenge signature from card: %s",
-		     gpg_strerror (err));
+      log_msg_error_code (ctx->loghandle, err,
+			  "failed to retrieve challenge signature from card: %s",
+			  gpg_strerror (err));
       goto out;
     }
 
   /*** Verify challenge signature against certificate. ***/
 
-  err = verify_challenge_sig (ctx, cert,
-			      challenge, challenge_n,
-			      response, response_n);
+  log_set_context_field (ctx->loghandle, "phase", "verify");
+  err = challenge_verify (pubkey, &params,
+			  challenge, challenge_n,
+			  response, response_n);
   if (err)
     {
-      log_msg_error (ctx->loghandle, "failed to verify challenge signature");
+      log_msg_error_code (ctx->loghandle, err,
+			  "failed to verify challenge signature");
       goto out;
     }
 
@@ -584,21 +795,53 @@ auth_method_x509_auth_do (poldi_ctx_t ctx, x509_ctx_t cookie,
  out:
 
   /* Release resources.  */
-  dirmngr_disconnect (dirmngr);
+  release_dirmngr (cookie, dirmngr, dirmngr_broken);
+  x509_offline_destroy (offline);
   ksba_cert_release (cert);
+  gcry_sexp_release (pubkey);
+  challenge_release (challenge);
+  secarena_free (response);
 
   if (err)
     xfree (card_username);
 
   /* Log result.  */
   if (err)
-    log_msg_error (ctx->loghandle, "failure: %s", gpg_strerror (err));
+    log_msg_error_code (ctx->loghandle, err, "failure: %s", gpg_strerror (err));
   else if (ctx->debug)
     log_msg_debug (ctx->loghandle, "success");
 
   return !err;
 }
 
+/* Set up certificate validation while the card is being waited for:
+   load the CA bundle and the CRL or connect to Dirmngr, which is
+   needed for validation anyway.  COOKIE is the cookie for this
+   authentication method.  CTX is the Poldi context object.  Returns
+   proper error code.  */
+static gpg_error_t
+auth_method_x509_prefetch (poldi_ctx_t ctx, void *opaque,
+			   const char *username)
+{
+  x509_ctx_t cookie = opaque;
+
+  if (cookie->validation == x509_validation_offline)
+    {
+      if (!cookie->ca_bundle)
+	return 0;
+      return x509_offline_create (&cookie->offline, cookie->ca_bundle,
+				  cookie->crl_file, cookie->crl_index,
+				  ctx->loghandle);
+    }
+
+  /* Pooled sessions are open already; holding one of them during the
+     card wait would only keep it from other authentications.  */
+  if (!cookie->dirmngr_socket || cookie->dirmngr_pool_size)
+    return 0;
+
+  return require_dirmngr (ctx, cookie, &cookie->dirmngr);
+}
+
 /* Try to authenticate a user. The user's identity on the system is
    figured out during the authentication process.  COOKIE is the
    cookie for this authentication method.  CTX is the Poldi context
@@ -630,5 +873,10 @@ struct auth_method_s auth_method_x509 =
     auth_method_x509_auth_as,
     x509_opt_specs,
     auth_method_x509_parsecb,
-    POLDI_CONF_DIRECTORY "/" "poldi-x509.conf"
+    POLDI_CONF_DIRECTORY "/" "poldi-x509.conf",
+    NULL,
+    NULL,
+    auth_method_x509_prefetch
   };
+
+const struct auth_method_abi_s auth_method_x509_abi = AUTH_METHOD_ABI_INIT;
@@ -0,0 +1,430 @@
+/* crl-index.c - Sorted revoked-serial index for offline CRL checks
+ *	Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of Poldi.
+ *
+ * Poldi is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Poldi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* See crl-index.h for a description of the CRL index API implemented
+   by this file. */
+
+#include <poldi.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <assert.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "crl-index.h"
+
+#define CRL_INDEX_MAGIC "PLDCRLI1"
+#define CRL_INDEX_BYTEORDER 0x01020304
+
+/* On-disk header of an index.  The index is only meant to be used on
+   the host it has been created on, therefore native byte order is
+   used; the BYTEORDER field allows for detecting foreign files.  */
+struct crl_index_header
+{
+  char magic[8];
+  uint32_t byteorder;
+  uint32_t serial_len;
+  uint64_t count;
+  int64_t this_update;
+  int64_t next_update;
+  uint64_t source_mtime;
+  uint64_t source_size;
+  unsigned char issuer_hash[CRL_INDEX_ISSUER_HASH_LEN];
+  unsigned char reserved[20];
+};
+
+struct crl_index_s
+{
+  void *image;			/* Mapped file or allocated image.  */
+  size_t image_len;
+  int mapped;			/* True if IMAGE is a mapping.  */
+  const unsigned char *slots;	/* Start of the sorted serials.  */
+  size_t count;			/* Number of serials.  */
+  struct crl_index_info info;
+};
+
+
+
+/* Convert the serial number SERIAL/SERIAL_LEN (big-endian, as
+   contained in certificates) into the fixed-size slot representation
+   used by the index; the result is written to SLOT, which must be
+   CRL_INDEX_SERIAL_LEN bytes long.  Returns proper error code.  */
+gpg_error_t
+crl_index_serial_to_slot (const unsigned char *serial, size_t serial_len,
+			  unsigned char *slot)
+{
+  /* Leading zero bytes do not change the value; strip them so that
+     equal numbers map to equal slots.  */
+  while (serial_len && !*serial)
+    {
+      serial++;
+      serial_len--;
+    }
+
+  if (serial_len > CRL_INDEX_SERIAL_LEN)
+    return gpg_error (GPG_ERR_TOO_LARGE);
+
+  memset (slot, 0, CRL_INDEX_SERIAL_LEN - serial_len);
+  memcpy (slot + CRL_INDEX_SERIAL_LEN - serial_len, serial, serial_len);
+
+  return 0;
+}
+
+static int
+compare_slots (const void *a, const void *b)
+{
+  return memcmp (a, b, CRL_INDEX_SERIAL_LEN);
+}
+
+/* Build a new index image from the COUNT serial slots contained in
+   SLOTS and the CRL description INFO.  SLOTS is sorted in place.
+   The newly allocated image is stored in *IMAGE, it's length in
+   *IMAGE_LEN.  Returns proper error code.  */
+gpg_error_t
+crl_index_build (unsigned char *slots, size_t count,
+		 const struct crl_index_info *info,
+		 void **image, size_t *image_len)
+{
+  struct crl_index_header header;
+  unsigned char *image_new;
+  size_t i, n;
+
+  if (count)
+    qsort (slots, count, CRL_INDEX_SERIAL_LEN, compare_slots);
+
+  /* Drop duplicates; CRLs are not supposed to contain any, but the
+     binary search does not care and this keeps the image small.  */
+  for (i = n = 0; i < count; i++)
+    if (!n || memcmp (slots + (n - 1) * CRL_INDEX_SERIAL_LEN,
+		      slots + i * CRL_INDEX_SERIAL_LEN, CRL_INDEX_SERIAL_LEN))
+      {
+	if (n != i)
+	  memcpy (slots + n * CRL_INDEX_SERIAL_LEN,
+		  slots + i * CRL_INDEX_SERIAL_LEN, CRL_INDEX_SERIAL_LEN);
+	n++;
+      }
+
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, CRL_INDEX_MAGIC, sizeof (header.magic));
+  header.byteorder = CRL_INDEX_BYTEORDER;
+  header.serial_len = CRL_INDEX_SERIAL_LEN;
+  header.count = n;
+  header.this_update = info->this_update;
+  header.next_update = info->next_update;
+  header.source_mtime = info->source_mtime;
+  header.source_size = info->source_size;
+  memcpy (header.issuer_hash, info->issuer_hash, sizeof (header.issuer_hash));
+
+  image_new = xtrymalloc (sizeof (header) + n * CRL_INDEX_SERIAL_LEN);
+  if (!image_new)
+    return gpg_error_from_syserror ();
+
+  memcpy (image_new, &header, sizeof (header));
+  if (n)
+    memcpy (image_new + sizeof (header), slots, n * CRL_INDEX_SERIAL_LEN);
+
+  *image = image_new;
+  *image_len = sizeof (header) + n * CRL_INDEX_SERIAL_LEN;
+
+  return 0;
+}
+
+/* Atomically write the index image IMAGE/IMAGE_LEN to the file
+   FILENAME.  Returns proper error code.  */
+gpg_error_t
+crl_index_write (const char *filename, const void *image, size_t image_len)
+{
+  gpg_error_t err;
+  char *tmpname;
+  const char *p;
+  ssize_t ret;
+  size_t off;
+  int fd;
+
+  fd = -1;
+  err = 0;
+
+  tmpname = xtrymalloc (strlen (filename) + 8);
+  if (!tmpname)
+    return gpg_error_from_syserror ();
+  sprintf (tmpname, "%s.XXXXXX", filename);
+
+  fd = mkstemp (tmpname);
+  if (fd == -1)
+    {
+      err = gpg_error_from_syserror ();
+      goto out;
+    }
+
+  for (p = image, off = 0; off < image_len; off += ret)
+    {
+      ret = write (fd, p + off, image_len - off);
+      if (ret == -1)
+	{
+	  if (errno == EINTR)
+	    {
+	      ret = 0;
+	      continue;
+	    }
+	  err = gpg_error_from_syserror ();
+	  goto out;
+	}
+    }
+
+  if (fchmod (fd, 0644) || fsync (fd))
+    {
+      err = gpg_error_from_syserror ();
+      goto out;
+    }
+
+  if (close (fd))
+    {
+      fd = -1;
+      err = gpg_error_from_syserror ();
+      goto out;
+    }
+  fd = -1;
+
+  if (rename (tmpname, filename))
+    err = gpg_error_from_syserror ();
+
+ out:
+
+  if (fd != -1)
+    close (fd);
+  if (err)
+    unlink (tmpname);
+  xfree (tmpname);
+
+  return err;
+}
+
+/* Check the image of INDEX and fill in the derived fields.  */
+static gpg_error_t
+index_setup (crl_index_t index)
+{
+  struct crl_index_header header;
+
+  if (index->image_len < sizeof (header))
+    return gpg_error (GPG_ERR_INV_DATA);
+
+  memcpy (&header, index->image, sizeof (header));
+
+  if (memcmp (header.magic, CRL_INDEX_MAGIC, sizeof (header.magic))
+      || header.byteorder != CRL_INDEX_BYTEORDER
+      || header.serial_len != CRL_INDEX_SERIAL_LEN)
+    return gpg_error (GPG_ERR_INV_DATA);
+
+  if (header.count > (index->image_len - sizeof (header)) / CRL_INDEX_SERIAL_LEN)
+    return gpg_error (GPG_ERR_INV_DATA);
+
+  index->slots = (const unsigned char *) index->image + sizeof (header);
+  index->count = header.count;
+  index->info.this_update = header.this_update;
+  index->info.next_update = header.next_update;
+  index->info.source_mtime = header.source_mtime;
+  index->info.source_size = header.source_size;
+  memcpy (index->info.issuer_hash, header.issuer_hash,
+	  sizeof (index->info.issuer_hash));
+
+  return 0;
+}
+
+/* Open the index file FILENAME by mapping it into memory and store a
+   new index object in *INDEX.  Returns proper error code.  */
+gpg_error_t
+crl_index_open (crl_index_t *index, const char *filename)
+{
+  crl_index_t index_new;
+  struct stat statbuf;
+  gpg_error_t err;
+  void *image;
+  int fd;
+
+  index_new = NULL;
+  image = MAP_FAILED;
+  err = 0;
+
+  fd = open (filename, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+  if (fd == -1)
+    {
+      err = gpg_error_from_syserror ();
+      goto out;
+    }
+
+  if (fstat (fd, &statbuf))
+    {
+      err = gpg_error_from_syserror ();
+      goto out;
+    }
+
+  /* A forged index could hide revoked certificates.  */
+  if ((statbuf.st_uid && statbuf.st_uid != geteuid ())
+      || (statbuf.st_mode & (S_IWGRP | S_IWOTH))
+      || !S_ISREG (statbuf.st_mode))
+    {
+      err = gpg_error (GPG_ERR_BAD_DATA);
+      goto out;
+    }
+
+  if (statbuf.st_size < sizeof (struct crl_index_header))
+    {
+      err = gpg_error (GPG_ERR_INV_DATA);
+      goto out;
+    }
+
+  image = mmap (NULL, statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (image == MAP_FAILED)
+    {
+      err = gpg_error_from_syserror ();
+      goto out;
+    }
+
+  index_new = xtrymalloc (sizeof (*index_new));
+  if (!index_new)
+    {
+      err = gpg_error_from_syserror ();
+      goto out;
+    }
+
+  index_new->image = image;
+  index_new->image_len = statbuf.st_size;
+  index_new->mapped = 1;
+
+  err = index_setup (index_new);
+  if (err)
+    goto out;
+
+  *index = index_new;
+
+ out:
+
+  if (fd != -1)
+    close (fd);
+  if (err)
+    {
+      if (image != MAP_FAILED)
+	munmap (image, statbuf.st_size);
+      xfree (index_new);
+    }
+
+  return err;
+}
+
+/* Create an index object for the in-memory image IMAGE/IMAGE_LEN as
+   returned by crl_index_build and store it in *INDEX.  On success,
+   the index takes ownership of IMAGE.  Returns proper error code.  */
+gpg_error_t
+crl_index_open_mem (crl_index_t *index, void *image, size_t image_len)
+{
+  crl_index_t index_new;
+  gpg_error_t err;
+
+  index_new = xtrymalloc (sizeof (*index_new));
+  if (!index_new)
+    return gpg_error_from_syserror ();
+
+  index_new->image = image;
+  index_new->image_len = image_len;
+  index_new->mapped = 0;
+
+  err = index_setup (index_new);
+  if (err)
+    xfree (index_new);
+  else
+    *index = index_new;
+
+  return err;
+}
+
+/* Release the index INDEX.  INDEX being NULL is okay.  */
+void
+crl_index_close (crl_index_t index)
+{
+  if (index)
+    {
+      if (index->mapped)
+	munmap (index->image, index->image_len);
+      else
+	xfree (index->image);
+      xfree (index);
+    }
+}
+
+/* Return the description of the CRL the index INDEX was built
+   from.  */
+const struct crl_index_info *
+crl_index_get_info (crl_index_t index)
+{
+  assert (index);
+
+  return &index->info;
+}
+
+/* Return the number of revoked serial numbers contained in INDEX.  */
+size_t
+crl_index_count (crl_index_t index)
+{
+  assert (index);
+
+  return index->count;
+}
+
+/* Return true if the serial number SERIAL/SERIAL_LEN is listed in
+   INDEX as revoked.  */
+int
+crl_index_lookup (crl_index_t index,
+		  const unsigned char *serial, size_t serial_len)
+{
+  unsigned char slot[CRL_INDEX_SERIAL_LEN];
+  size_t lo, hi, mid;
+  int cmp;
+
+  assert (index);
+
+  if (crl_index_serial_to_slot (serial, serial_len, slot))
+    /* Too large to be contained in the index.  */
+    return 0;
+
+  lo = 0;
+  hi = index->count;
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      cmp = memcmp (slot, index->slots + mid * CRL_INDEX_SERIAL_LEN,
+		    CRL_INDEX_SERIAL_LEN);
+      if (!cmp)
+	return 1;
+      else if (cmp < 0)
+	hi = mid;
+      else
+	lo = mid + 1;
+    }
+
+  return 0;
+}
+
+/* END */
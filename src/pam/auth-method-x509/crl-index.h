@@ -0,0 +1,97 @@
+/* crl-index.h - Sorted revoked-serial index for offline CRL checks
+ *	Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of Poldi.
+ *
+ * Poldi is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Poldi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CRL_INDEX_H
+#define CRL_INDEX_H
+
+#include <gpg-error.h>
+#include <time.h>
+
+/* A CRL index is a compiled form of a CRL: a small header followed
+   by the serial numbers of all revoked certificates, each stored as
+   a fixed-size, zero-padded big-endian number and sorted in
+   ascending order.  This allows for memory-mapping the index and
+   checking a serial number by means of a binary search.  */
+
+/* Size of a single serial number slot in bytes.  RFC 5280 limits
+   serial numbers to 20 octets; we leave some room for broken CAs.  */
+#define CRL_INDEX_SERIAL_LEN 32
+
+/* Size of the issuer hash (SHA-1 over the issuer DN string).  */
+#define CRL_INDEX_ISSUER_HASH_LEN 20
+
+typedef struct crl_index_s *crl_index_t;
+
+/* Description of the CRL an index is built from.  */
+struct crl_index_info
+{
+  time_t this_update;		/* thisUpdate field of the CRL.  */
+  time_t next_update;		/* nextUpdate field of the CRL.  */
+  unsigned long long source_mtime; /* Modification time (in ns) and */
+  unsigned long long source_size;  /* size of the CRL file.  */
+  unsigned char issuer_hash[CRL_INDEX_ISSUER_HASH_LEN];
+};
+
+/* Convert the serial number SERIAL/SERIAL_LEN (big-endian, as
+   contained in certificates) into the fixed-size slot representation
+   used by the index; the result is written to SLOT, which must be
+   CRL_INDEX_SERIAL_LEN bytes long.  Returns proper error code.  */
+gpg_error_t crl_index_serial_to_slot (const unsigned char *serial,
+				      size_t serial_len,
+				      unsigned char *slot);
+
+/* Build a new index image from the COUNT serial slots contained in
+   SLOTS and the CRL description INFO.  SLOTS is sorted in place.
+   The newly allocated image is stored in *IMAGE, it's length in
+   *IMAGE_LEN.  Returns proper error code.  */
+gpg_error_t crl_index_build (unsigned char *slots, size_t count,
+			     const struct crl_index_info *info,
+			     void **image, size_t *image_len);
+
+/* Atomically write the index image IMAGE/IMAGE_LEN to the file
+   FILENAME.  Returns proper error code.  */
+gpg_error_t crl_index_write (const char *filename,
+			     const void *image, size_t image_len);
+
+/* Open the index file FILENAME by mapping it into memory and store a
+   new index object in *INDEX.  Returns proper error code.  */
+gpg_error_t crl_index_open (crl_index_t *index, const char *filename);
+
+/* Create an index object for the in-memory image IMAGE/IMAGE_LEN as
+   returned by crl_index_build and store it in *INDEX.  On success,
+   the index takes ownership of IMAGE.  Returns proper error code.  */
+gpg_error_t crl_index_open_mem (crl_index_t *index,
+				void *image, size_t image_len);
+
+/* Release the index INDEX.  INDEX being NULL is okay.  */
+void crl_index_close (crl_index_t index);
+
+/* Return the description of the CRL the index INDEX was built
+   from.  */
+const struct crl_index_info *crl_index_get_info (crl_index_t index);
+
+/* Return the number of revoked serial numbers contained in INDEX.  */
+size_t crl_index_count (crl_index_t index);
+
+/* Return true if the serial number SERIAL/SERIAL_LEN is listed in
+   INDEX as revoked.  */
+int crl_index_lookup (crl_index_t index,
+		      const unsigned char *serial, size_t serial_len);
+
+#endif
@@ -0,0 +1,432 @@
+/* dirmngr-pool.c - Pool of persistent dirmngr connections for Poldi
+ *	Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of Poldi.
+ *
+ * Poldi is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Poldi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* See dirmngr-pool.h for a description of the dirmngr pool API
+   implemented by this file. */
+
+#include <poldi.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "dirmngr.h"
+#include "dirmngr-pool.h"
+
+#include <util/simplelog.h>
+
+/* Idle sessions older than this (in seconds) are checked with NOP
+   before being handed out.  */
+#define POOL_CHECK_INTERVAL 5
+
+/* Bounds for the reconnect backoff, in milliseconds.  */
+#define POOL_BACKOFF_MIN 100
+#define POOL_BACKOFF_MAX 10000
+
+/* Maximum time (in seconds) to wait for a busy pool.  */
+#define POOL_WAIT_TIMEOUT 60
+
+/* A caller queued for a session.  */
+struct pool_waiter
+{
+  struct pool_waiter *next;
+  pthread_cond_t cond;
+  int granted;			/* True once a session or slot has
+				   been handed over.  */
+  dirmngr_ctx_t ctx;		/* Handed over session; NULL means
+				   the waiter has to connect.  */
+  time_t idle_since;
+};
+
+/* This is a "dirmngr pool". */
+struct dirmngr_pool_s
+{
+  struct dirmngr_pool_s *next;	/* Next pool in registry.  */
+  char *sock;			/* Socket name of dirmngr.  */
+  unsigned int size;		/* Maximum number of sessions.  */
+  pid_t pid;			/* Process owning the sessions.  */
+
+  pthread_mutex_t lock;		/* Protects all fields below.  */
+  unsigned int total;		/* Sessions open or being opened.  */
+  dirmngr_ctx_t *idle;		/* Stack of idle sessions.  */
+  time_t *idle_since;		/* Time each idle session was released. */
+  unsigned int idle_n;
+  struct pool_waiter *waiters;	/* FIFO queue of waiting callers.  */
+  struct pool_waiter **waiters_tail;
+  unsigned int backoff;		/* Current backoff in milliseconds.  */
+  struct timespec retry_at;	/* No connection attempts before.  */
+};
+
+/* Registry of all pools of this process.  */
+static pthread_mutex_t pool_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static dirmngr_pool_t pool_registry;
+
+
+
+/* Lookup the pool for the dirmngr socket SOCK, creating it if
+   necessary, and store it in *POOL.  SIZE is the maximum number of
+   connections kept open; it only takes effect when the pool is
+   created.  Returns proper error code.  */
+gpg_error_t
+dirmngr_pool_get (dirmngr_pool_t *pool, const char *sock, unsigned int size)
+{
+  dirmngr_pool_t p;
+  gpg_error_t err;
+
+  assert (sock);
+  assert (size);
+
+  err = 0;
+
+  pthread_mutex_lock (&pool_registry_lock);
+
+  for (p = pool_registry; p; p = p->next)
+    if (!strcmp (p->sock, sock))
+      break;
+  if (p)
+    goto out;
+
+  p = xtrymalloc (sizeof (*p));
+  if (!p)
+    {
+      err = gpg_error_from_syserror ();
+      goto out;
+    }
+  memset (p, 0, sizeof (*p));
+
+  p->sock = xtrystrdup (sock);
+  p->idle = xtrymalloc (sizeof (*p->idle) * size);
+  p->idle_since = xtrymalloc (sizeof (*p->idle_since) * size);
+  if (!p->sock || !p->idle || !p->idle_since)
+    {
+      err = gpg_error_from_syserror ();
+      xfree (p->sock);
+      xfree (p->idle);
+      xfree (p->idle_since);
+      xfree (p);
+      p = NULL;
+      goto out;
+    }
+
+  p->size = size;
+  p->pid = getpid ();
+  pthread_mutex_init (&p->lock, NULL);
+  p->waiters_tail = &p->waiters;
+
+  p->next = pool_registry;
+  pool_registry = p;
+
+ out:
+
+  pthread_mutex_unlock (&pool_registry_lock);
+
+  if (!err)
+    *pool = p;
+
+  return err;
+}
+
+/* Make sure POOL's state belongs to the current process.  After a
+   fork, the child must not use the sessions of its parent, since the
+   sockets are shared; they are dropped without being closed
+   properly, which would otherwise disturb the parent's sessions.
+   Must be called with the pool locked.  */
+static void
+pool_check_owner (dirmngr_pool_t pool)
+{
+  if (pool->pid == getpid ())
+    return;
+
+  pool->pid = getpid ();
+  pool->total = 0;
+  pool->idle_n = 0;
+  pool->waiters = NULL;
+  pool->waiters_tail = &pool->waiters;
+  pool->backoff = 0;
+}
+
+/* Hand over the session CTX (or, if CTX is NULL, the right to open a
+   new session) to the first queued waiter.  Returns false if nobody
+   is waiting.  Must be called with the pool locked.  */
+static int
+pool_hand_over (dirmngr_pool_t pool, dirmngr_ctx_t ctx, time_t idle_since)
+{
+  struct pool_waiter *waiter = pool->waiters;
+
+  if (!waiter)
+    return 0;
+
+  pool->waiters = waiter->next;
+  if (!pool->waiters)
+    pool->waiters_tail = &pool->waiters;
+
+  waiter->ctx = ctx;
+  waiter->idle_since = idle_since;
+  waiter->granted = 1;
+  pthread_cond_signal (&waiter->cond);
+
+  return 1;
+}
+
+/* Remove WAITER from the queue of POOL.  Must be called with the pool
+   locked.  */
+static void
+pool_dequeue (dirmngr_pool_t pool, struct pool_waiter *waiter)
+{
+  struct pool_waiter **p;
+
+  for (p = &pool->waiters; *p; p = &(*p)->next)
+    if (*p == waiter)
+      {
+	*p = waiter->next;
+	if (!*p)
+	  pool->waiters_tail = p;
+	break;
+      }
+}
+
+/* Give up a session slot of POOL, which is not backed by an open
+   session.  Must be called with the pool locked.  */
+static void
+pool_drop_slot (dirmngr_pool_t pool)
+{
+  if (!pool_hand_over (pool, NULL, 0) && pool->total)
+    pool->total--;
+}
+
+/* Wait for a session or a session slot of POOL as described for
+   pool_hand_over and store it in *CTX and *IDLE_SINCE.  Must be
+   called with the pool locked.  Returns proper error code.  */
+static gpg_error_t
+pool_wait (dirmngr_pool_t pool, dirmngr_ctx_t *ctx, time_t *idle_since)
+{
+  struct pool_waiter waiter;
+  struct timespec deadline;
+  int ret;
+
+  memset (&waiter, 0, sizeof (waiter));
+  pthread_cond_init (&waiter.cond, NULL);
+  *pool->waiters_tail = &waiter;
+  pool->waiters_tail = &waiter.next;
+
+  clock_gettime (CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += POOL_WAIT_TIMEOUT;
+
+  ret = 0;
+  while (!waiter.granted && ret != ETIMEDOUT)
+    ret = pthread_cond_timedwait (&waiter.cond, &pool->lock, &deadline);
+  if (!waiter.granted)
+    pool_dequeue (pool, &waiter);
+
+  pthread_cond_destroy (&waiter.cond);
+
+  if (!waiter.granted)
+    return gpg_error (GPG_ERR_TIMEOUT);
+
+  *ctx = waiter.ctx;
+  *idle_since = waiter.idle_since;
+
+  return 0;
+}
+
+/* Open a new session for POOL, honoring the reconnect backoff, and
+   store it in *CTX.  Returns proper error code.  */
+static gpg_error_t
+pool_connect (dirmngr_pool_t pool, log_handle_t log_handle,
+	      dirmngr_ctx_t *ctx)
+{
+  struct timespec now;
+  gpg_error_t err;
+  int backoff;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+
+  pthread_mutex_lock (&pool->lock);
+  backoff = (pool->backoff
+	     && (now.tv_sec < pool->retry_at.tv_sec
+		 || (now.tv_sec == pool->retry_at.tv_sec
+		     && now.tv_nsec < pool->retry_at.tv_nsec)));
+  pthread_mutex_unlock (&pool->lock);
+
+  if (backoff)
+    {
+      log_msg_debug (log_handle,
+		     "not connecting to dirmngr, waiting for backoff");
+      return gpg_error (GPG_ERR_NO_DIRMNGR);
+    }
+
+  err = dirmngr_connect (ctx, pool->sock, 0, log_handle);
+
+  pthread_mutex_lock (&pool->lock);
+  if (err)
+    {
+      if (pool->backoff)
+	pool->backoff *= 2;
+      else
+	pool->backoff = POOL_BACKOFF_MIN;
+      if (pool->backoff > POOL_BACKOFF_MAX)
+	pool->backoff = POOL_BACKOFF_MAX;
+
+      pool->retry_at = now;
+      pool->retry_at.tv_sec += pool->backoff / 1000;
+      pool->retry_at.tv_nsec += (pool->backoff % 1000) * 1000000L;
+      if (pool->retry_at.tv_nsec >= 1000000000L)
+	{
+	  pool->retry_at.tv_sec++;
+	  pool->retry_at.tv_nsec -= 1000000000L;
+	}
+    }
+  else
+    pool->backoff = 0;
+  pthread_mutex_unlock (&pool->lock);
+
+  if (err)
+    log_msg_error (log_handle, "failed to connect to dirmngr: %s",
+		   gpg_strerror (err));
+
+  return err;
+}
+
+/* Acquire a dirmngr session from POOL, connecting to dirmngr if
+   necessary, and store it in *CTX.  LOG_HANDLE is installed as the
+   session's logging handle.  Blocks until a session becomes
+   available.  Returns proper error code.  */
+gpg_error_t
+dirmngr_pool_acquire (dirmngr_pool_t pool, log_handle_t log_handle,
+		      dirmngr_ctx_t *ctx)
+{
+  dirmngr_ctx_t session;
+  time_t idle_since;
+  gpg_error_t err;
+
+  assert (pool);
+
+  session = NULL;
+  idle_since = 0;
+  err = 0;
+
+  pthread_mutex_lock (&pool->lock);
+  pool_check_owner (pool);
+
+  /* Callers already queued up have precedence.  */
+  if (!pool->waiters && pool->idle_n)
+    {
+      pool->idle_n--;
+      session = pool->idle[pool->idle_n];
+      idle_since = pool->idle_since[pool->idle_n];
+    }
+  else if (!pool->waiters && pool->total < pool->size)
+    pool->total++;
+  else
+    err = pool_wait (pool, &session, &idle_since);
+
+  pthread_mutex_unlock (&pool->lock);
+
+  if (err)
+    {
+      log_msg_error (log_handle, "failed to acquire dirmngr session: %s",
+		     gpg_strerror (err));
+      return err;
+    }
+
+  /* From here on, we own a slot of the pool.  */
+
+  if (session)
+    {
+      dirmngr_set_log_handle (session, log_handle);
+
+      if (time (NULL) - idle_since >= POOL_CHECK_INTERVAL)
+	{
+	  err = dirmngr_ping (session);
+	  if (err)
+	    {
+	      log_msg_debug (log_handle,
+			     "dropping stale dirmngr session: %s",
+			     gpg_strerror (err));
+	      dirmngr_disconnect (session);
+	      session = NULL;
+	    }
+	}
+    }
+
+  if (!session)
+    {
+      err = pool_connect (pool, log_handle, &session);
+      if (err)
+	{
+	  pthread_mutex_lock (&pool->lock);
+	  pool_drop_slot (pool);
+	  pthread_mutex_unlock (&pool->lock);
+	  return err;
+	}
+    }
+
+  *ctx = session;
+
+  return 0;
+}
+
+/* Return the session CTX, acquired through dirmngr_pool_acquire, to
+   POOL.  If BROKEN is true, the session is closed instead of being
+   reused.  CTX being NULL is okay.  */
+void
+dirmngr_pool_release (dirmngr_pool_t pool, dirmngr_ctx_t ctx, int broken)
+{
+  time_t now;
+
+  assert (pool);
+
+  if (!ctx)
+    return;
+
+  if (!broken && dirmngr_reset (ctx))
+    broken = 1;
+
+  if (broken)
+    {
+      dirmngr_disconnect (ctx);
+      ctx = NULL;
+    }
+  else
+    /* The logging handle belongs to the caller.  */
+    dirmngr_set_log_handle (ctx, NULL);
+
+  now = time (NULL);
+
+  pthread_mutex_lock (&pool->lock);
+  pool_check_owner (pool);
+
+  if (!ctx)
+    pool_drop_slot (pool);
+  else if (!pool_hand_over (pool, ctx, now))
+    {
+      assert (pool->idle_n < pool->size);
+      pool->idle[pool->idle_n] = ctx;
+      pool->idle_since[pool->idle_n] = now;
+      pool->idle_n++;
+    }
+
+  pthread_mutex_unlock (&pool->lock);
+}
+
+/* END */
@@ -0,0 +1,65 @@
+/* dirmngr-pool.h - Pool of persistent dirmngr connections for Poldi
+ *	Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of Poldi.
+ *
+ * Poldi is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Poldi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DIRMNGR_POOL_H
+#define DIRMNGR_POOL_H
+
+#include <gpg-error.h>
+
+#include <util/simplelog.h>
+
+#include "dirmngr.h"
+
+/* A dirmngr pool keeps up to a fixed number of connections to a
+   single dirmngr socket open, so that a long-lived process running
+   many authentications does not need to set up a new Assuan session
+   for each of them.  Pools are process-wide objects, shared by all
+   authentications using the same socket; they are never released.
+
+   Sessions are handed out in FIFO order; when all sessions are busy,
+   callers queue up until a session is released.  Idle sessions are
+   checked with NOP before being handed out again and are RESET after
+   use.  Failing connection attempts are retried with exponential
+   backoff, during which acquiring a new session fails immediately.  */
+
+/* Handle for a dirmngr pool. */
+typedef struct dirmngr_pool_s *dirmngr_pool_t;
+
+/* Lookup the pool for the dirmngr socket SOCK, creating it if
+   necessary, and store it in *POOL.  SIZE is the maximum number of
+   connections kept open; it only takes effect when the pool is
+   created.  Returns proper error code.  */
+gpg_error_t dirmngr_pool_get (dirmngr_pool_t *pool,
+			      const char *sock, unsigned int size);
+
+/* Acquire a dirmngr session from POOL, connecting to dirmngr if
+   necessary, and store it in *CTX.  LOG_HANDLE is installed as the
+   session's logging handle.  Blocks until a session becomes
+   available.  Returns proper error code.  */
+gpg_error_t dirmngr_pool_acquire (dirmngr_pool_t pool,
+				  log_handle_t log_handle,
+				  dirmngr_ctx_t *ctx);
+
+/* Return the session CTX, acquired through dirmngr_pool_acquire, to
+   POOL.  If BROKEN is true, the session is closed instead of being
+   reused.  CTX being NULL is okay.  */
+void dirmngr_pool_release (dirmngr_pool_t pool, dirmngr_ctx_t ctx,
+			   int broken);
+
+#endif
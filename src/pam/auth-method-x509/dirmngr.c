@@ -107,6 +107,49 @@ dirmngr_connect (dirmngr_ctx_t *ctx,
   return err;
 }
 
+/* Create a dirmngr context in *CTX, which replays the trace file
+   FILENAME (see dirmngr_record) instead of talking to a dirmngr.  If
+   REALTIME is true, the answers are delayed as they were when
+   recording.  Returns proper error code.  */
+gpg_error_t
+dirmngr_connect_replay (dirmngr_ctx_t *ctx,
+			const char *filename,
+			int realtime,
+			log_handle_t log_handle)
+{
+  dirmngr_ctx_t context;
+  gpg_error_t err;
+
+  context = xtrymalloc (sizeof (*context));
+  if (!context)
+    return gpg_error_from_errno (errno);
+
+  *context = dirmngr_ctx_init;
+
+  err = assuan_trace_replay (&context->assuan, filename,
+			     realtime ? ASSUAN_TRACE_REALTIME : 0);
+  if (err)
+    {
+      xfree (context);
+      return err;
+    }
+
+  context->log_handle = log_handle;
+  *ctx = context;
+
+  return 0;
+}
+
+/* Record all further traffic between CTX and the dirmngr into the
+   trace file FILENAME.  Returns proper error code.  */
+gpg_error_t
+dirmngr_record (dirmngr_ctx_t ctx, const char *filename)
+{
+  assert (ctx);
+
+  return assuan_trace_record (ctx->assuan, filename);
+}
+
 /* Close the dirmngr connection associated with CTX and release all
    related resources. */
 void
@@ -120,6 +163,39 @@ dirmngr_disconnect (dirmngr_ctx_t ctx)
     }
 }
 
+/* Install LOG_HANDLE as the logging handle for the dirmngr context
+   CTX.  */
+void
+dirmngr_set_log_handle (dirmngr_ctx_t ctx, log_handle_t log_handle)
+{
+  assert (ctx);
+
+  ctx->log_handle = log_handle;
+}
+
+/* Check whether the dirmngr connection associated with CTX is still
+   alive by sending a NOP command.  Returns proper error code.  */
+gpg_error_t
+dirmngr_ping (dirmngr_ctx_t ctx)
+{
+  assert (ctx);
+
+  return assuan_transact (ctx->assuan, "NOP",
+			  NULL, NULL, NULL, NULL, NULL, NULL);
+}
+
+/* Reset the state of the dirmngr session associated with CTX, so
+   that it can be used for another transaction.  Returns proper error
+   code.  */
+gpg_error_t
+dirmngr_reset (dirmngr_ctx_t ctx)
+{
+  assert (ctx);
+
+  return assuan_transact (ctx->assuan, "RESET",
+			  NULL, NULL, NULL, NULL, NULL, NULL);
+}
+
 
 
 
@@ -149,13 +225,10 @@ inq_cert (void *opaque, const char *line)
 	   || (!strncmp (line, "SENDISSUERCERT", 14) && (line[14] == ' ' || !line[14])))
     {
       /* We don't support this but dirmngr might ask for it.  So
-	 simply ignore it by sending back an empty value. */
+	 simply ignore it by sending back an empty value; the END is
+	 sent by assuan_transact.  */
       log_msg_debug (parm->ctx->log_handle, "ignored inquiry from dirmngr: `%s'", line);
-      err = assuan_send_data (parm->ctx->assuan, NULL, 0);
-      if (err)
-	log_msg_error (parm->ctx->log_handle,
-		       "failed to send back empty value to dirmngr: %s",
-		       gpg_strerror (err));
+      err = 0;
     }
   else
     {
@@ -37,10 +37,39 @@ gpg_error_t dirmngr_connect (dirmngr_ctx_t *ctx,
 			     unsigned int flags,
 			     log_handle_t log_handle);
 
+/* Create a dirmngr context in *CTX, which replays the trace file
+   FILENAME (see dirmngr_record) instead of talking to a dirmngr.  If
+   REALTIME is true, the answers are delayed as they were when
+   recording.  Meant for benchmarks only.  Returns proper error
+   code.  */
+gpg_error_t dirmngr_connect_replay (dirmngr_ctx_t *ctx,
+				    const char *filename,
+				    int realtime,
+				    log_handle_t log_handle);
+
+/* Record all further traffic between CTX and the dirmngr into the
+   trace file FILENAME, which is completed when CTX is disconnected.
+   Returns proper error code.  */
+gpg_error_t dirmngr_record (dirmngr_ctx_t ctx, const char *filename);
+
 /* Close the dirmngr connection associated with CTX and release all
    related resources. */
 void dirmngr_disconnect (dirmngr_ctx_t ctx);
 
+/* Install LOG_HANDLE as the logging handle for the dirmngr context
+   CTX.  This is necessary for contexts which outlive the logging
+   handle they have been created with (see dirmngr-pool.h).  */
+void dirmngr_set_log_handle (dirmngr_ctx_t ctx, log_handle_t log_handle);
+
+/* Check whether the dirmngr connection associated with CTX is still
+   alive by sending a NOP command.  Returns proper error code.  */
+gpg_error_t dirmngr_ping (dirmngr_ctx_t ctx);
+
+/* Reset the state of the dirmngr session associated with CTX, so
+   that it can be used for another transaction.  Returns proper error
+   code.  */
+gpg_error_t dirmngr_reset (dirmngr_ctx_t ctx);
+
 /* Retrieve the certificate stored under the url URL through the
    dirmngr context CTX and store it in *CERTIFICATE.  Returns proper
    error code. */
@@ -0,0 +1,925 @@
+/* x509-offline.c - Offline X.509 certificate validation for Poldi
+ *	Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of Poldi.
+ *
+ * Poldi is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Poldi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* See x509-offline.h for a description of the offline validation API
+   implemented by this file. */
+
+#include <poldi.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <assert.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <gcrypt.h>
+#include <ksba.h>
+
+#include "util/util.h"
+#include "util/support.h"
+#include "crl-index.h"
+#include "x509-offline.h"
+
+/* Maximum length of a certificate chain we are willing to walk.  */
+#define MAX_CHAIN_LENGTH 8
+
+struct ca_cert_s
+{
+  ksba_cert_t cert;
+  char *subject;		/* Subject DN, allocated by libksba.  */
+};
+
+/* This is an "offline validation context". */
+struct x509_offline_s
+{
+  struct ca_cert_s *cas;	/* Trusted CA certificates. */
+  size_t cas_n;
+  crl_index_t crl;		/* Compiled CRL or NULL.  */
+  log_handle_t log_handle;	/* Handle for logging messages. */
+};
+
+/* Callback for objects found in PEM or DER files.  */
+typedef gpg_error_t (*der_object_cb_t) (void *opaque,
+					const void *der, size_t der_len);
+
+
+
+/*
+ * Helper functions.
+ */
+
+/* Decode the base64 encoded data contained in the string S (up to
+   the first '-') in place.  The number of decoded bytes is stored in
+   *LEN.  Returns proper error code.  */
+static gpg_error_t
+base64_decode_inplace (char *s, size_t *len)
+{
+  static const char alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  unsigned char *start = (unsigned char *) s;
+  unsigned char *d = start;
+  unsigned int val;
+  int bits;
+  const char *p;
+
+  val = 0;
+  bits = 0;
+  for (; *s && *s != '-' && *s != '='; s++)
+    {
+      if (ascii_isspace (*s))
+	continue;
+      p = strchr (alphabet, *s);
+      if (!p)
+	return gpg_error (GPG_ERR_INV_DATA);
+      val = (val << 6) | (p - alphabet);
+      bits += 6;
+      if (bits >= 8)
+	{
+	  bits -= 8;
+	  *d++ = (val >> bits) & 0xff;
+	}
+    }
+
+  *len = d - start;
+  return 0;
+}
+
+/* Read the file FILENAME and call CB for each object labeled LABEL
+   contained in it.  The file may either be a sequence of PEM blocks
+   or a single DER object.  Returns proper error code.  */
+static gpg_error_t
+process_der_file (const char *filename, const char *label,
+		  der_object_cb_t cb, void *opaque)
+{
+  char begin[64];
+  gpg_error_t err;
+  size_t data_len;
+  void *data;
+  char *p, *start, *end;
+  size_t len;
+  int found;
+
+  data = NULL;
+
+  err = file_to_binstring (filename, &data, &data_len);
+  if (err)
+    goto out;
+  if (!data)
+    {
+      err = gpg_error (GPG_ERR_NO_DATA);
+      goto out;
+    }
+
+  snprintf (begin, sizeof (begin), "-----BEGIN %s-----", label);
+
+  /* A DER object starts with a SEQUENCE tag; everything else is
+     expected to be PEM armored.  file_to_binstring NUL-terminates the
+     data, therefore it is fine to use string functions on it.  */
+  if (*(unsigned char *) data == 0x30)
+    {
+      err = (*cb) (opaque, data, data_len);
+      goto out;
+    }
+
+  found = 0;
+  for (p = data; (start = strstr (p, begin)); p = end)
+    {
+      start += strlen (begin);
+      end = strstr (start, "-----END ");
+      if (!end)
+	{
+	  err = gpg_error (GPG_ERR_INV_DATA);
+	  goto out;
+	}
+      *end++ = 0;
+
+      err = base64_decode_inplace (start, &len);
+      if (err)
+	goto out;
+
+      err = (*cb) (opaque, start, len);
+      if (err)
+	goto out;
+      found++;
+    }
+
+  if (!found)
+    err = gpg_error (GPG_ERR_NO_DATA);
+
+ out:
+
+  xfree (data);
+
+  return err;
+}
+
+/* Extract the value of the canonical S-Expression "(N:VALUE)" as
+   returned by libksba for serial numbers.  */
+static gpg_error_t
+parse_sexp_serial (ksba_const_sexp_t sexp,
+		   const unsigned char **value, size_t *value_len)
+{
+  const unsigned char *s = sexp;
+  size_t n;
+
+  if (!s || *s != '(')
+    return gpg_error (GPG_ERR_INV_SEXP);
+  s++;
+  for (n = 0; *s >= '0' && *s <= '9'; s++)
+    n = n * 10 + (*s - '0');
+  if (!n || *s != ':')
+    return gpg_error (GPG_ERR_INV_SEXP);
+  s++;
+
+  *value = s;
+  *value_len = n;
+
+  return 0;
+}
+
+/* Store the current time as ISO time string in ISOTIME.  */
+static void
+get_current_isotime (ksba_isotime_t isotime)
+{
+  time_t now = time (NULL);
+  struct tm tm;
+
+  gmtime_r (&now, &tm);
+  if (!strftime (isotime, sizeof (ksba_isotime_t), "%Y%m%dT%H%M%S", &tm))
+    isotime[0] = 0;
+}
+
+/* Convert the ISO time string ISOTIME into a time_t; returns
+   (time_t)-1 in case of an invalid or empty string.  */
+static time_t
+isotime_to_time (const ksba_isotime_t isotime)
+{
+  struct tm tm;
+
+  memset (&tm, 0, sizeof (tm));
+  if (sscanf (isotime, "%4d%2d%2dT%2d%2d%2d",
+	      &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+	      &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6)
+    return (time_t) -1;
+  tm.tm_year -= 1900;
+  tm.tm_mon -= 1;
+
+  return timegm (&tm);
+}
+
+static void
+hash_fnc (void *opaque, const void *data, size_t data_len)
+{
+  gcry_md_write (opaque, data, data_len);
+}
+
+/* Verify the signature SIG_VAL (as returned by libksba) over the
+   hash context MD, created with the algorithm specified by the OID
+   string ALGOID, against the public key of ISSUER.  Returns proper
+   error code.  */
+static gpg_error_t
+check_signature (ksba_cert_t issuer, const char *algoid,
+		 gcry_md_hd_t md, ksba_const_sexp_t sig_val)
+{
+  gcry_sexp_t s_sig, s_hash, s_pkey;
+  ksba_sexp_t pubkey;
+  const char *algo_name;
+  char name[16];
+  gpg_error_t err;
+  size_t n;
+  int algo;
+  int i;
+
+  s_sig = s_hash = s_pkey = NULL;
+  pubkey = NULL;
+
+  algo = algoid ? gcry_md_map_name (algoid) : 0;
+  if (!algo || !gcry_md_is_enabled (md, algo))
+    {
+      err = gpg_error (GPG_ERR_DIGEST_ALGO);
+      goto out;
+    }
+
+  /* Libgcrypt uses lowercase names in S-Expressions.  */
+  algo_name = gcry_md_algo_name (algo);
+  for (i = 0; algo_name[i] && i < sizeof (name) - 1; i++)
+    name[i] = (algo_name[i] >= 'A' && algo_name[i] <= 'Z')
+      ? algo_name[i] - 'A' + 'a' : algo_name[i];
+  name[i] = 0;
+
+  n = gcry_sexp_canon_len (sig_val, 0, NULL, NULL);
+  if (!n)
+    {
+      err = gpg_error (GPG_ERR_INV_SEXP);
+      goto out;
+    }
+  err = gcry_sexp_sscan (&s_sig, NULL, (const char *) sig_val, n);
+  if (err)
+    goto out;
+
+  pubkey = ksba_cert_get_public_key (issuer);
+  n = gcry_sexp_canon_len (pubkey, 0, NULL, NULL);
+  if (!n)
+    {
+      err = gpg_error (GPG_ERR_INV_SEXP);
+      goto out;
+    }
+  err = gcry_sexp_sscan (&s_pkey, NULL, (const char *) pubkey, n);
+  if (err)
+    goto out;
+
+  {
+    gcry_sexp_t rsa = gcry_sexp_find_token (s_pkey, "rsa", 0);
+
+    err = gcry_sexp_build (&s_hash, NULL,
+			   rsa
+			   ? "(data(flags pkcs1)(hash %s %b))"
+			   : "(data(hash %s %b))",
+			   name, (int) gcry_md_get_algo_dlen (algo),
+			   gcry_md_read (md, algo));
+    gcry_sexp_release (rsa);
+  }
+  if (err)
+    goto out;
+
+  err = gcry_pk_verify (s_sig, s_hash, s_pkey);
+
+ out:
+
+  ksba_free (pubkey);
+  gcry_sexp_release (s_sig);
+  gcry_sexp_release (s_hash);
+  gcry_sexp_release (s_pkey);
+
+  return err;
+}
+
+/* Verify that CERT has been signed by ISSUER.  Returns proper error
+   code.  */
+static gpg_error_t
+check_cert_signature (ksba_cert_t issuer, ksba_cert_t cert)
+{
+  const char *algoid;
+  ksba_sexp_t sig_val;
+  gcry_md_hd_t md;
+  gpg_error_t err;
+  int algo;
+
+  md = NULL;
+  sig_val = NULL;
+
+  algoid = ksba_cert_get_digest_algo (cert);
+  algo = algoid ? gcry_md_map_name (algoid) : 0;
+  if (!algo)
+    {
+      err = gpg_error (GPG_ERR_DIGEST_ALGO);
+      goto out;
+    }
+
+  err = gcry_md_open (&md, algo, 0);
+  if (err)
+    goto out;
+
+  err = ksba_cert_hash (cert, 1, hash_fnc, md);
+  if (err)
+    goto out;
+  gcry_md_final (md);
+
+  sig_val = ksba_cert_get_sig_val (cert);
+  err = check_signature (issuer, algoid, md, sig_val);
+
+ out:
+
+  ksba_free (sig_val);
+  gcry_md_close (md);
+
+  return err;
+}
+
+/* Check that CERT is valid at the time ISOTIME.  */
+static gpg_error_t
+check_cert_validity (ksba_cert_t cert, const ksba_isotime_t isotime)
+{
+  ksba_isotime_t not_before, not_after;
+  gpg_error_t err;
+
+  err = ksba_cert_get_validity (cert, 0, not_before);
+  if (!err)
+    err = ksba_cert_get_validity (cert, 1, not_after);
+  if (err)
+    return err;
+
+  if (*not_before && strcmp (isotime, not_before) < 0)
+    return gpg_error (GPG_ERR_CERT_TOO_YOUNG);
+  if (*not_after && strcmp (isotime, not_after) > 0)
+    return gpg_error (GPG_ERR_CERT_EXPIRED);
+
+  return 0;
+}
+
+/* Lookup the trusted CA certificate whose subject is SUBJECT.
+   Returns NULL if not found.  */
+static ksba_cert_t
+find_ca_cert (x509_offline_t offline, const char *subject)
+{
+  size_t i;
+
+  if (subject)
+    for (i = 0; i < offline->cas_n; i++)
+      if (!strcmp (offline->cas[i].subject, subject))
+	return offline->cas[i].cert;
+
+  return NULL;
+}
+
+/* Compute the issuer hash used by the CRL index for ISSUER.  */
+static void
+hash_issuer (const char *issuer, unsigned char *hash)
+{
+  gcry_md_hash_buffer (GCRY_MD_SHA1, hash, issuer, strlen (issuer));
+}
+
+
+
+/*
+ * Loading of CA certificates and CRLs.
+ */
+
+/* der_object_cb_t callback for adding a CA certificate. */
+static gpg_error_t
+add_ca_cb (void *opaque, const void *der, size_t der_len)
+{
+  x509_offline_t offline = opaque;
+  struct ca_cert_s *cas;
+  ksba_cert_t cert;
+  gpg_error_t err;
+  int is_ca;
+
+  cert = NULL;
+
+  err = ksba_cert_new (&cert);
+  if (err)
+    goto out;
+
+  err = ksba_cert_init_from_mem (cert, der, der_len);
+  if (err)
+    goto out;
+
+  err = ksba_cert_is_ca (cert, &is_ca, NULL);
+  if (err)
+    goto out;
+  if (!is_ca)
+    {
+      char *subject = ksba_cert_get_subject (cert, 0);
+
+      log_msg_info (offline->log_handle,
+		    "ignoring non-CA certificate `%s' in CA bundle",
+		    subject ? subject : "[none]");
+      ksba_free (subject);
+      goto out;
+    }
+
+  cas = xtryrealloc (offline->cas, sizeof (*cas) * (offline->cas_n + 1));
+  if (!cas)
+    {
+      err = gpg_error_from_syserror ();
+      goto out;
+    }
+  offline->cas = cas;
+
+  cas[offline->cas_n].subject = ksba_cert_get_subject (cert, 0);
+  if (!cas[offline->cas_n].subject)
+    {
+      err = gpg_error (GPG_ERR_BAD_CA_CERT);
+      goto out;
+    }
+  cas[offline->cas_n].cert = cert;
+  cert = NULL;
+  offline->cas_n++;
+
+ out:
+
+  ksba_cert_release (cert);
+
+  return err;
+}
+
+/* State for compiling a CRL.  */
+struct crl_compile_s
+{
+  x509_offline_t offline;
+  struct crl_index_info info;
+  void *image;			/* Resulting index image.  */
+  size_t image_len;
+};
+
+/* der_object_cb_t callback for compiling a CRL into an index
+   image.  */
+static gpg_error_t
+compile_crl_cb (void *opaque, const void *der, size_t der_len)
+{
+  struct crl_compile_s *parm = opaque;
+  x509_offline_t offline = parm->offline;
+  ksba_stop_reason_t stopreason;
+  ksba_reader_t reader;
+  ksba_crl_t crl;
+  gcry_md_hd_t md;
+  unsigned char *slots, *tmp;
+  size_t slots_n, slots_size;
+  ksba_isotime_t this_update, next_update;
+  ksba_sexp_t serial;
+  ksba_sexp_t sig_val;
+  ksba_cert_t issuer_cert;
+  char *issuer;
+  const unsigned char *value;
+  size_t value_len;
+  gpg_error_t err;
+
+  if (parm->image)
+    /* Only a single CRL per file is supported.  */
+    return gpg_error (GPG_ERR_CONFLICT);
+
+  reader = NULL;
+  crl = NULL;
+  md = NULL;
+  slots = NULL;
+  slots_n = slots_size = 0;
+  sig_val = NULL;
+  issuer = NULL;
+
+  err = ksba_reader_new (&reader);
+  if (!err)
+    err = ksba_reader_set_mem (reader, der, der_len);
+  if (!err)
+    err = ksba_crl_new (&crl);
+  if (!err)
+    err = ksba_crl_set_reader (crl, reader);
+  if (err)
+    goto out;
+
+  /* The digest algorithm is only known once the signed part has been
+     parsed; therefore we hash with all commonly used algorithms.  */
+  err = gcry_md_open (&md, 0, 0);
+  if (!err)
+    err = gcry_md_enable (md, GCRY_MD_SHA1);
+  if (!err)
+    err = gcry_md_enable (md, GCRY_MD_SHA256);
+  if (!err)
+    err = gcry_md_enable (md, GCRY_MD_SHA384);
+  if (!err)
+    err = gcry_md_enable (md, GCRY_MD_SHA512);
+  if (err)
+    goto out;
+  ksba_crl_set_hash_function (crl, hash_fnc, md);
+
+  do
+    {
+      err = ksba_crl_parse (crl, &stopreason);
+      if (err)
+	goto out;
+
+      if (stopreason == KSBA_SR_GOT_ITEM)
+	{
+	  err = ksba_crl_get_item (crl, &serial, NULL, NULL);
+	  if (err)
+	    goto out;
+
+	  if (slots_n == slots_size)
+	    {
+	      slots_size = slots_size ? slots_size * 2 : 256;
+	      tmp = xtryrealloc (slots, slots_size * CRL_INDEX_SERIAL_LEN);
+	      if (!tmp)
+		{
+		  err = gpg_error_from_syserror ();
+		  ksba_free (serial);
+		  goto out;
+		}
+	      slots = tmp;
+	    }
+
+	  err = parse_sexp_serial (serial, &value, &value_len);
+	  if (!err)
+	    err = crl_index_serial_to_slot (value, value_len,
+					    slots + slots_n * CRL_INDEX_SERIAL_LEN);
+	  ksba_free (serial);
+	  if (err)
+	    goto out;
+	  slots_n++;
+	}
+    }
+  while (stopreason != KSBA_SR_READY);
+
+  gcry_md_final (md);
+
+  /* Check the CRL's signature against the issuing CA.  */
+
+  err = ksba_crl_get_issuer (crl, &issuer);
+  if (err)
+    goto out;
+
+  issuer_cert = find_ca_cert (offline, issuer);
+  if (!issuer_cert)
+    {
+      log_msg_error (offline->log_handle,
+		     "issuer of CRL `%s' not found in CA bundle", issuer);
+      err = gpg_error (GPG_ERR_MISSING_CERT);
+      goto out;
+    }
+
+  sig_val = ksba_crl_get_sig_val (crl);
+  err = check_signature (issuer_cert, ksba_crl_get_digest_algo (crl),
+			 md, sig_val);
+  if (err)
+    {
+      log_msg_error (offline->log_handle,
+		     "failed to verify signature of CRL: %s",
+		     gpg_strerror (err));
+      goto out;
+    }
+
+  err = ksba_crl_get_update_times (crl, this_update, next_update);
+  if (err)
+    goto out;
+
+  parm->info.this_update = isotime_to_time (this_update);
+  parm->info.next_update = isotime_to_time (next_update);
+  hash_issuer (issuer, parm->info.issuer_hash);
+
+  err = crl_index_build (slots, slots_n, &parm->info,
+			 &parm->image, &parm->image_len);
+
+ out:
+
+  xfree (slots);
+  ksba_free (sig_val);
+  ksba_free (issuer);
+  gcry_md_close (md);
+  ksba_crl_release (crl);
+  ksba_reader_release (reader);
+
+  return err;
+}
+
+/* Make the compiled CRL available in OFFLINE.  In case the index file
+   INDEX_FILE is up to date with respect to CRL_FILE, it is simply
+   mapped into memory; otherwise CRL_FILE is compiled and the index
+   file is updated, if possible.  Returns proper error code.  */
+static gpg_error_t
+load_crl (x509_offline_t offline, const char *crl_file, const char *index_file)
+{
+  struct crl_compile_s parm;
+  unsigned long long mtime;
+  struct stat statbuf;
+  crl_index_t index;
+  gpg_error_t err;
+
+  index = NULL;
+  memset (&parm, 0, sizeof (parm));
+  parm.offline = offline;
+
+  if (stat (crl_file, &statbuf))
+    {
+      err = gpg_error_from_syserror ();
+      log_msg_error (offline->log_handle,
+		     "failed to access CRL file `%s': %s",
+		     crl_file, gpg_strerror (err));
+      goto out;
+    }
+
+  /* Seconds are too coarse to notice a CRL being replaced right after
+     the index has been built.  */
+  mtime = ((unsigned long long) statbuf.st_mtim.tv_sec * 1000000000
+	   + statbuf.st_mtim.tv_nsec);
+
+  /* Fast path: use existing index.  */
+  err = crl_index_open (&index, index_file);
+  if (!err)
+    {
+      const struct crl_index_info *info = crl_index_get_info (index);
+
+      if (info->source_mtime == mtime
+	  && info->source_size == statbuf.st_size)
+	goto out;
+
+      crl_index_close (index);
+      index = NULL;
+    }
+
+  /* Slow path: compile CRL.  */
+
+  parm.info.source_mtime = mtime;
+  parm.info.source_size = statbuf.st_size;
+
+  err = process_der_file (crl_file, "X509 CRL", compile_crl_cb, &parm);
+  if (err)
+    {
+      log_msg_error (offline->log_handle,
+		     "failed to compile CRL `%s': %s",
+		     crl_file, gpg_strerror (err));
+      goto out;
+    }
+
+  /* Failure to update the index is not fatal; we simply use the
+     compiled image from memory then.  */
+  err = crl_index_write (index_file, parm.image, parm.image_len);
+  if (err)
+    log_msg_debug (offline->log_handle,
+		   "failed to write CRL index `%s': %s",
+		   index_file, gpg_strerror (err));
+
+  err = crl_index_open_mem (&index, parm.image, parm.image_len);
+  if (err)
+    goto out;
+  parm.image = NULL;
+
+  log_msg_debug (offline->log_handle,
+		 "compiled CRL `%s' (%lu revoked certificates)",
+		 crl_file, (unsigned long) crl_index_count (index));
+
+ out:
+
+  xfree (parm.image);
+
+  if (err)
+    crl_index_close (index);
+  else
+    offline->crl = index;
+
+  return err;
+}
+
+static struct x509_offline_s x509_offline_init; /* For initialization
+						   purpose. */
+
+/* Create a new offline validation context, which uses the CA
+   certificates contained in CA_BUNDLE (PEM or DER) and the CRL
+   contained in CRL_FILE (PEM or DER).  CRL_INDEX is the file used
+   for caching the compiled CRL; it may be NULL, in which case
+   "CRL_FILE.idx" is used.  CRL_FILE may be NULL, in which case no
+   revocation checking is done.  The new context is stored in
+   *OFFLINE.  Returns proper error code.  */
+gpg_error_t
+x509_offline_create (x509_offline_t *offline,
+		     const char *ca_bundle,
+		     const char *crl_file,
+		     const char *crl_index,
+		     log_handle_t log_handle)
+{
+  x509_offline_t context;
+  char *index_file;
+  gpg_error_t err;
+
+  assert (ca_bundle);
+
+  index_file = NULL;
+
+  context = xtrymalloc (sizeof (*context));
+  if (!context)
+    {
+      err = gpg_error_from_syserror ();
+      goto out;
+    }
+
+  *context = x509_offline_init;
+  context->log_handle = log_handle;
+
+  err = process_der_file (ca_bundle, "CERTIFICATE", add_ca_cb, context);
+  if (err)
+    {
+      log_msg_error (log_handle, "failed to load CA bundle `%s': %s",
+		     ca_bundle, gpg_strerror (err));
+      goto out;
+    }
+
+  if (crl_file)
+    {
+      if (!crl_index)
+	{
+	  index_file = xtrymalloc (strlen (crl_file) + 5);
+	  if (!index_file)
+	    {
+	      err = gpg_error_from_syserror ();
+	      goto out;
+	    }
+	  sprintf (index_file, "%s.idx", crl_file);
+	  crl_index = index_file;
+	}
+
+      err = load_crl (context, crl_file, crl_index);
+      if (err)
+	goto out;
+    }
+
+  *offline = context;
+
+ out:
+
+  xfree (index_file);
+  if (err)
+    x509_offline_destroy (context);
+
+  return err;
+}
+
+/* Release all resources associated with OFFLINE.  */
+void
+x509_offline_destroy (x509_offline_t offline)
+{
+  size_t i;
+
+  if (offline)
+    {
+      for (i = 0; i < offline->cas_n; i++)
+	{
+	  ksba_cert_release (offline->cas[i].cert);
+	  ksba_free (offline->cas[i].subject);
+	}
+      xfree (offline->cas);
+      crl_index_close (offline->crl);
+      xfree (offline);
+    }
+}
+
+
+
+/* Check CERT against the compiled CRL of OFFLINE.  */
+static gpg_error_t
+check_revocation (x509_offline_t offline, ksba_cert_t cert)
+{
+  unsigned char issuer_hash[CRL_INDEX_ISSUER_HASH_LEN];
+  const struct crl_index_info *info;
+  const unsigned char *value;
+  size_t value_len;
+  ksba_sexp_t serial;
+  gpg_error_t err;
+  char *issuer;
+
+  serial = NULL;
+
+  info = crl_index_get_info (offline->crl);
+
+  issuer = ksba_cert_get_issuer (cert, 0);
+  if (!issuer)
+    return gpg_error (GPG_ERR_BAD_CERT);
+  hash_issuer (issuer, issuer_hash);
+  ksba_free (issuer);
+
+  if (memcmp (issuer_hash, info->issuer_hash, sizeof (issuer_hash)))
+    {
+      log_msg_error (offline->log_handle,
+		     "configured CRL does not cover the certificate's issuer");
+      err = gpg_error (GPG_ERR_NO_CRL_KNOWN);
+      goto out;
+    }
+
+  if (info->next_update != (time_t) -1 && info->next_update < time (NULL))
+    {
+      log_msg_error (offline->log_handle, "configured CRL is too old");
+      err = gpg_error (GPG_ERR_CRL_TOO_OLD);
+      goto out;
+    }
+
+  serial = ksba_cert_get_serial (cert);
+  err = parse_sexp_serial (serial, &value, &value_len);
+  if (err)
+    goto out;
+
+  if (crl_index_lookup (offline->crl, value, value_len))
+    err = gpg_error (GPG_ERR_CERT_REVOKED);
+
+ out:
+
+  ksba_free (serial);
+
+  return err;
+}
+
+/* Validate the certificate CERT through the offline validation
+   context OFFLINE: CERT must chain up to one of the trusted CA
+   certificates, all certificates in the chain must be valid at the
+   current time and CERT must not be listed in the CRL.  Returns zero
+   in case the certificate is considered valid, an appropriate error
+   code otherwise. */
+gpg_error_t
+x509_offline_validate (x509_offline_t offline, ksba_cert_t cert)
+{
+  ksba_isotime_t now;
+  ksba_cert_t subject, issuer;
+  char *issuer_dn;
+  gpg_error_t err;
+  int depth;
+
+  assert (offline);
+  assert (cert);
+
+  get_current_isotime (now);
+
+  /* Walk up the chain until we reach a self-signed CA.  All
+     certificates besides CERT itself must be contained in the CA
+     bundle.  */
+  subject = cert;
+  for (depth = 0; ; depth++)
+    {
+      if (depth >= MAX_CHAIN_LENGTH)
+	{
+	  err = gpg_error (GPG_ERR_BAD_CERT_CHAIN);
+	  goto out;
+	}
+
+      err = check_cert_validity (subject, now);
+      if (err)
+	goto out;
+
+      issuer_dn = ksba_cert_get_issuer (subject, 0);
+      issuer = find_ca_cert (offline, issuer_dn);
+      ksba_free (issuer_dn);
+      if (!issuer)
+	{
+	  err = gpg_error (GPG_ERR_MISSING_CERT);
+	  goto out;
+	}
+
+      err = check_cert_signature (issuer, subject);
+      if (err)
+	goto out;
+
+      if (issuer == subject)
+	/* Self-signed trusted CA reached.  */
+	break;
+
+      subject = issuer;
+    }
+
+  if (offline->crl)
+    err = check_revocation (offline, cert);
+
+ out:
+
+  if (err)
+    log_msg_error (offline->log_handle,
+		   "offline certificate validation failed: %s",
+		   gpg_strerror (err));
+
+  return err;
+}
+
+/* END */
@@ -0,0 +1,62 @@
+/* x509-offline.h - Offline X.509 certificate validation for Poldi
+ *	Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of Poldi.
+ *
+ * Poldi is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Poldi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef X509_OFFLINE_H
+#define X509_OFFLINE_H
+
+#include <gpg-error.h>
+#include <stdio.h>
+#include <ksba.h>
+
+#include <util/simplelog.h>
+
+/* This is an alternative to dirmngr_validate(), which does not need
+   a running Dirmngr: certificates are checked against a local CA
+   bundle and a local CRL file.  The CRL is compiled into a sorted
+   index (see crl-index.h), which is cached on disk next to the CRL
+   and memory-mapped on subsequent runs.  */
+
+/* Handle for offline validation. */
+typedef struct x509_offline_s *x509_offline_t;
+
+/* Create a new offline validation context, which uses the CA
+   certificates contained in CA_BUNDLE (PEM or DER) and the CRL
+   contained in CRL_FILE (PEM or DER).  CRL_INDEX is the file used
+   for caching the compiled CRL; it may be NULL, in which case
+   "CRL_FILE.idx" is used.  CRL_FILE may be NULL, in which case no
+   revocation checking is done.  The new context is stored in
+   *OFFLINE.  Returns proper error code.  */
+gpg_error_t x509_offline_create (x509_offline_t *offline,
+				 const char *ca_bundle,
+				 const char *crl_file,
+				 const char *crl_index,
+				 log_handle_t log_handle);
+
+/* Release all resources associated with OFFLINE.  */
+void x509_offline_destroy (x509_offline_t offline);
+
+/* Validate the certificate CERT through the offline validation
+   context OFFLINE: CERT must chain up to one of the trusted CA
+   certificates, all certificates in the chain must be valid at the
+   current time and CERT must not be listed in the CRL.  Returns zero
+   in case the certificate is considered valid, an appropriate error
+   code otherwise. */
+gpg_error_t x509_offline_validate (x509_offline_t offline, ksba_cert_t cert);
+
+#endif
@@ -54,6 +54,36 @@ typedef int (*auth_method_func_auth_t) (poldi_ctx_t ctx, void *cookie,
 typedef int (*auth_method_func_auth_as_t) (poldi_ctx_t ctx, void *cookie,
 					   const char *username);
 
+/* Check whether the card with the serial number SERIALNO can be used
+   for authentication at all, before any further information is read
+   from the card.  COOKIE is the cookie for this authentication
+   method. CTX is the Poldi context object; if its USERNAME is set,
+   the card should be rejected unless it might be usable for that
+   user.  Returns zero if the card might be usable, an error code
+   otherwise.  */
+typedef gpg_error_t (*auth_method_func_check_card_t) (poldi_ctx_t ctx,
+						      void *cookie,
+						      const char *serialno);
+
+/* Check whether USERNAME might be able to authenticate with a card
+   at all, before any card is accessed.  COOKIE is the cookie for this
+   authentication method. CTX is the Poldi context object.  Returns
+   zero if so, GPG_ERR_NOT_FOUND if USERNAME has no card and another
+   error code if this cannot be decided.  */
+typedef gpg_error_t (*auth_method_func_check_user_t) (poldi_ctx_t ctx,
+						      void *cookie,
+						      const char *username);
+
+/* Prepare the authentication of USERNAME, which may be NULL, while
+   the card is being waited for, e.g. by reading files or connecting
+   to services needed later.  This runs in a thread of its own; it
+   must neither access the card nor the PAM conversation and may only
+   change COOKIE, the cookie for this authentication method.  CTX is
+   the Poldi context object.  Failures are not fatal.  */
+typedef gpg_error_t (*auth_method_func_prefetch_t) (poldi_ctx_t ctx,
+						    void *cookie,
+						    const char *username);
+
 struct auth_method_parse_cookie
 {
   poldi_ctx_t poldi_ctx;
@@ -70,8 +100,35 @@ struct auth_method_s
   simpleparse_opt_spec_t *opt_specs;
   simpleparse_parse_cb_t parsecb;
   const char *config;
+  auth_method_func_check_card_t func_check_card; /* Optional.  */
+  auth_method_func_check_user_t func_check_user; /* Optional.  */
+  auth_method_func_prefetch_t func_prefetch; /* Optional.  */
 };
 
 typedef struct auth_method_s *auth_method_t;
 
+/* Version of the interface between pam_poldi.so and the plugins of
+   the authentication methods; to be incremented whenever the objects
+   passed between them change.  */
+#define AUTH_METHOD_ABI_VERSION 1
+
+/* Each plugin of a method NAME also defines `auth_method_NAME_abi',
+   initialized with AUTH_METHOD_ABI_INIT.  A plugin is only used if
+   this matches what pam_poldi.so has been built with, since both
+   share the Poldi context, the card information and the Scdaemon
+   connection.  */
+struct auth_method_abi_s
+{
+  unsigned int version;		/* AUTH_METHOD_ABI_VERSION.  */
+  const char *package_version;	/* Poldi version.  */
+  size_t ctx_size;		/* Size of struct poldi_ctx_s.  */
+  size_t method_size;		/* Size of struct auth_method_s.  */
+};
+
+#define AUTH_METHOD_ABI_INIT					\
+  {								\
+    AUTH_METHOD_ABI_VERSION, PACKAGE_VERSION,			\
+    sizeof (struct poldi_ctx_s), sizeof (struct auth_method_s)	\
+  }
+
 #endif
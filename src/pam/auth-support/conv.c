@@ -31,16 +31,29 @@
 #include <security/pam_modules.h>
 
 #include "util/util.h"
+#include "util/secarena.h"
 #include "conv.h"
 
 
 
+/* Maximum number of informational messages queued before they are
+   sent on their own.  Linux-PAM allows up to 32 messages per
+   conversation call.  */
+#define CONV_QUEUE_MAX 8
+
+/* Informational messages are not sent immediately: every call of the
+   conversation function may be a round trip to a remote client
+   (e.g. with ssh keyboard-interactive authentication).  Instead, they
+   are queued and sent together with the next prompt, or when the
+   queue is flushed explicitly.  */
 struct conv_s
 {
   const struct pam_conv *pam_conv;
+  char *queue[CONV_QUEUE_MAX];	/* Queued messages.  */
+  unsigned int queued;		/* Number of queued messages.  */
 };
 
-
+
 
 /* Create a new PAM conversation object based in PAM_CONV and store it
    in *CONV.  Returns proper error code. */
@@ -60,6 +73,7 @@ conv_create (conv_t *conv, const struct pam_conv *pam_conv)
     }
 
   conv_new->pam_conv = pam_conv;
+  conv_new->queued = 0;
   *conv = conv_new;
 
  out:
@@ -67,91 +81,131 @@ conv_create (conv_t *conv, const struct pam_conv *pam_conv)
   return err;
 }
 
+/* Release the queued messages of CONV.  */
+static void
+queue_clear (conv_t conv)
+{
+  unsigned int i;
+
+  for (i = 0; i < conv->queued; i++)
+    free (conv->queue[i]);
+  conv->queued = 0;
+}
+
 /* Destroy the conv object CONV.  */
 void
 conv_destroy (conv_t conv)
 {
   if (conv)
-    free (conv);
+    {
+      queue_clear (conv);
+      free (conv);
+    }
 }
 
-
 
-/* This function queries the PAM user for input through the
-   conversation function CONV; TEXT will be displayed as prompt, the
-   user's response will be stored in *RESPONSE.  Returns proper error
-   code.  */
+
+/* Overwrite the string S, which might contain a secret.  */
+static void
+wipe_string (char *s)
+{
+  volatile char *p = s;
+
+  while (*p)
+    *p++ = 0;
+}
+
+/* Release the NRESPONSES responses RESPONSES returned by a
+   conversation function, wiping them first.  */
+static void
+release_responses (struct pam_response *responses, unsigned int nresponses)
+{
+  unsigned int i;
+
+  if (!responses)
+    return;
+
+  for (i = 0; i < nresponses; i++)
+    if (responses[i].resp)
+      {
+	wipe_string (responses[i].resp);
+	free (responses[i].resp);
+      }
+  free (responses);
+}
+
+/* Send the messages queued in CONV through the conversation function,
+   followed by the prompt TEXT, unless TEXT is NULL.  If TEXT is not
+   NULL, the user's response to it is stored in *RESPONSE (newly
+   allocated); SECRET tells whether the response is to be echoed.  A
+   secret response is copied into the secure arena.
+   All messages are passed in a single call of the conversation
+   function.  Returns proper error code.  */
 static gpg_error_t
-ask_user (const struct pam_conv *conv, int secret,
-	  const char *text, char **response)
+converse (conv_t conv, int secret, const char *text, char **response)
 {
-  struct pam_message messages[1] = { { 0, text } };
-  const struct pam_message *pmessages[1] = { &messages[0] };
+  const struct pam_conv *pam_conv = conv->pam_conv;
+  struct pam_message messages[CONV_QUEUE_MAX + 1];
+  const struct pam_message *pmessages[CONV_QUEUE_MAX + 1];
   struct pam_response *responses = NULL;
   char *response_new;
+  unsigned int i, n;
   gpg_error_t err;
   int ret;
 
-  if (secret)
-    messages[0].msg_style = PAM_PROMPT_ECHO_OFF;
-  else
-    messages[0].msg_style = PAM_PROMPT_ECHO_ON;
-  
-  response_new = NULL;
+  for (n = 0; n < conv->queued; n++)
+    {
+      messages[n].msg_style = PAM_TEXT_INFO;
+      messages[n].msg = conv->queue[n];
+      pmessages[n] = &messages[n];
+    }
+  if (text)
+    {
+      messages[n].msg_style = secret ? PAM_PROMPT_ECHO_OFF : PAM_PROMPT_ECHO_ON;
+      messages[n].msg = text;
+      pmessages[n] = &messages[n];
+      n++;
+    }
+
+  if (!n)
+    return 0;
+
+  ret = (*pam_conv->conv) (n, pmessages, &responses, pam_conv->appdata_ptr);
+
+  /* The queued messages are gone in any case.  */
+  queue_clear (conv);
 
-  ret = (*conv->conv) (sizeof (messages) / (sizeof (*messages)), pmessages,
-		       &responses, conv->appdata_ptr);
   if (ret != PAM_SUCCESS)
     {
       err = gpg_error (GPG_ERR_INTERNAL);
       goto out;
     }
 
-  if (response)
+  if (text && response)
     {
-      response_new = strdup (responses[0].resp);
-      if (! response_new)
+      i = n - 1;
+      if (!responses || !responses[i].resp)
+	{
+	  err = gpg_error (GPG_ERR_NO_DATA);
+	  goto out;
+	}
+      if (secret)
+	response_new = secarena_strdup (responses[i].resp);
+      else
+	response_new = strdup (responses[i].resp);
+      if (!response_new)
 	{
 	  err = gpg_error_from_errno (errno);
 	  goto out;
 	}
+      *response = response_new;
     }
 
   err = 0;
-  if (response)
-    *response = response_new;
 
  out:
 
-  return err;
-}
-
-/* This function queries the PAM user for input through the
-   conversation function CONV; TEXT will be displayed as prompt, the
-   user's response will be stored in *RESPONSE.  Returns proper error
-   code.  */
-static gpg_error_t
-tell_user (const struct pam_conv *conv, const char *msg)
-{
-  struct pam_message messages[1] = { { PAM_TEXT_INFO, NULL } };
-  const struct pam_message *pmessages[1] = { &messages[0] };
-  struct pam_response *responses = NULL;
-  gpg_error_t err;
-  int ret;
-
-  messages[0].msg = msg;
-  
-  ret = (*conv->conv) (sizeof (messages) / (sizeof (*messages)), pmessages,
-		       &responses, conv->appdata_ptr);
-  if (ret != PAM_SUCCESS)
-    {
-      err = gpg_error (GPG_ERR_INTERNAL);
-      goto out;
-    }
-
-  err = 0;
-
- out:
+  release_responses (responses, n);
 
   return err;
 }
@@ -173,7 +227,15 @@ conv_tell (conv_t conv, const char *fmt, ...)
       goto out;
     }
 
-  err = tell_user (conv->pam_conv, msg);
+  if (conv->queued == CONV_QUEUE_MAX)
+    {
+      err = converse (conv, 0, NULL, NULL);
+      if (err)
+	goto out;
+    }
+
+  conv->queue[conv->queued++] = msg;
+  msg = NULL;
 
  out:
 
@@ -183,6 +245,12 @@ conv_tell (conv_t conv, const char *fmt, ...)
   return err;
 }
 
+gpg_error_t
+conv_flush (conv_t conv)
+{
+  return converse (conv, 0, NULL, NULL);
+}
+
 gpg_error_t
 conv_ask (conv_t conv, int ask_secret,
 	  char **response, const char *fmt, ...)
@@ -201,7 +269,7 @@ conv_ask (conv_t conv, int ask_secret,
       goto out;
     }
 
-  err = ask_user (conv->pam_conv, ask_secret, msg, response);
+  err = converse (conv, ask_secret, msg, response);
 
  out:
 
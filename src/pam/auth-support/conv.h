@@ -38,14 +38,24 @@ gpg_error_t conv_create (conv_t *conv, const struct pam_conv *pam_conv);
 void conv_destroy (conv_t conv);
 
 /* Pass the (format string) message FMT to the PAM user through the
-   PAM Poldi context CTX.  Return proper error code.  */
+   PAM Poldi context CTX.  The message is queued and sent along with
+   the next prompt or on the next call of conv_flush.  Return proper
+   error code.  */
 gpg_error_t conv_tell (conv_t conv, const char *fmt, ...);
 
+/* Send the messages queued in CONV to the PAM user now.  This must be
+   done before blocking for user action and before CONV is destroyed;
+   messages still queued on destruction are discarded.  Returns proper
+   error code.  */
+gpg_error_t conv_flush (conv_t conv);
+
 /* Use the PAM Poldi context CTX to pass the (format string) message
    FMT to the PAM user and query for a response, which is to be stored
-   in *RESPONSE (newly allocated).  Depending on the boolean value
-   ASK_SECRET, a secret response is queried (e.g. PIN).  Returns
-   proper error code.  */
+   in *RESPONSE (newly allocated).  Queued messages are sent in the
+   same conversation call.  Depending on the boolean value
+   ASK_SECRET, a secret response is queried (e.g. PIN); it is stored
+   in the secure arena and is to be released with secarena_free.
+   Returns proper error code.  */
 gpg_error_t conv_ask (conv_t conv, int ask_secret, char **response,
 		      const char *fmt, ...);
 
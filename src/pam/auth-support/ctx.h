@@ -25,9 +25,12 @@
 
 #include <util/simplelog.h>
 #include <util/simpleparse.h>
+#include <util/auditlog.h>
 
 #include "scd/scd.h"
 #include "auth-support/conv.h"
+#include "auth-support/throttle.h"
+#include "auth-support/readers.h"
 
 /* We use a "context" object in Poldi, since a PAM Module should not
    contain static variables.  (In theory) this allows for a
@@ -53,6 +56,8 @@ struct poldi_ctx_s
   /* Options. */
 
   char *logfile;
+  int log_async;		/* Write LOGFILE through a background
+				   thread.  */
   log_handle_t loghandle;	/* Our handle for simplelog.  */
   simpleparse_handle_t parsehandle; /* Handle for simpleparse.  */
   int auth_method;		/* The ID of the authentication method
@@ -69,11 +74,43 @@ struct poldi_ctx_s
 				   conversation with user. */
   int use_agent;		/* Use gpg-agent to connect scdaemon.  */
 
+  /* Authentication tickets.  */
+  unsigned int ticket_timeout;	/* Lifetime of tickets in seconds; zero
+				   disables tickets.  */
+  int ticket_scope_global;	/* Tickets are valid on all terminals,
+				   not only in the issuing session.  */
+  char *ticket_directory;	/* Directory for tickets.  */
+  char *state_directory;	/* Directory for failure counters and
+				   reader locks.  */
+
+  /* Throttling of failed authentications.  */
+  unsigned int throttle_delay;	/* Delay attempts after this many
+				   failures; zero disables delays.  */
+  unsigned int throttle_lockout; /* Reject attempts after this many
+				    failures; zero disables this.  */
+  unsigned int throttle_expire;	/* Forget failures after this many
+				   seconds.  */
+  throttle_t throttle;		/* The shared failure counters.  */
+
+  /* Audit log.  */
+  char *audit_log;		/* File name of the audit log or NULL.  */
+  unsigned int audit_commit_interval; /* Milliseconds to wait for a
+					 group commit.  */
+  char auth_id[17];		/* ID of this authentication attempt.  */
+  int phase;			/* Current phase or -1.  */
+  uint64_t phase_start;		/* Time it has been entered at, in
+				   microseconds.  */
+  uint32_t phase_us[AUDIT_PHASES]; /* Time spent per phase.  */
+
   /* Scdaemon. */
   char *scdaemon_program;	/* Path of Scdaemon program to execute.  */
   char *scdaemon_options;	/* Path of Scdaemon configuration file.  */
   scd_context_t scd;		/* Handle for the Scdaemon access
 				   layer.  */
+  char **readers;		/* Reader ports to wait on, each with a
+				   Scdaemon of its own, or NULL.  */
+  unsigned int nreaders;	/* Number of entries in READERS.  */
+  reader_set_t reader_set;	/* The readers while in use.  */
 
   pam_handle_t *pam_handle;	/* PAM handle. */
 
@@ -38,6 +38,7 @@
 #include "util/support.h"
 #include <util/defs.h>
 #include "util/util.h"
+#include "util/secarena.h"
 #include "util/simplelog.h"
 #include "auth-support/conv.h"
 
@@ -73,6 +74,8 @@ query_user (poldi_ctx_t ctx, const char *info, char *pin, size_t pin_size)
 	{
 	  log_msg_error (ctx->loghandle, "PIN too short");
 	  conv_tell (ctx->conv, "%s", _("PIN too short"));
+	  secarena_free (buffer);
+	  buffer = NULL;
 	}
       else
 	break;
@@ -90,6 +93,8 @@ query_user (poldi_ctx_t ctx, const char *info, char *pin, size_t pin_size)
 
  out:
 
+  secarena_free (buffer);
+
   return rc;
 }
 
@@ -105,6 +110,9 @@ keypad_mode_enter (poldi_ctx_t ctx, const char *info)
   int rc;
 
   rc = conv_tell (ctx->conv, info);
+  if (!rc)
+    /* The user has to act on the message before the card returns.  */
+    rc = conv_flush (ctx->conv);
 
   return rc;
 }
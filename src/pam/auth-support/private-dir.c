@@ -0,0 +1,70 @@
+/* private-dir.c - Directories private to Poldi
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of Poldi.
+
+   Poldi is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   Poldi is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.  */
+
+#include <poldi.h>
+
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <gpg-error.h>
+
+#include "private-dir.h"
+
+
+
+gpg_error_t
+open_private_directory (const char *dir, int create, int *dfd)
+{
+  struct stat statbuf;
+  gpg_error_t err;
+  int fd;
+
+  if (create && mkdir (dir, 0700) && errno != EEXIST)
+    return gpg_error_from_syserror ();
+
+  fd = open (dir, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (fd == -1)
+    {
+      if (errno == ENOENT)
+	return gpg_error (GPG_ERR_NOT_FOUND);
+      return gpg_error_from_syserror ();
+    }
+
+  if (fstat (fd, &statbuf))
+    {
+      err = gpg_error_from_syserror ();
+      close (fd);
+      return err;
+    }
+
+  if (statbuf.st_uid != geteuid () || (statbuf.st_mode & 077))
+    {
+      close (fd);
+      return gpg_error (GPG_ERR_EPERM);
+    }
+
+  *dfd = fd;
+
+  return 0;
+}
+
+/* END */
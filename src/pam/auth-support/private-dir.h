@@ -0,0 +1,32 @@
+/* private-dir.h - Directories private to Poldi
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of Poldi.
+
+   Poldi is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   Poldi is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.  */
+
+#ifndef POLDI_PRIVATE_DIR_H
+#define POLDI_PRIVATE_DIR_H
+
+#include <gpg-error.h>
+
+/* Open the directory DIR and store a descriptor for it in *DFD.  If
+   CREATE is true, the directory is created if necessary.  The
+   directory must be owned by us and must not be accessible by
+   others.  Returns GPG_ERR_NOT_FOUND if it does not exist, otherwise
+   proper error code.  */
+gpg_error_t open_private_directory (const char *dir, int create, int *dfd);
+
+#endif
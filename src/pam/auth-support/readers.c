@@ -0,0 +1,457 @@
+/* readers.c - Waiting for a card on several readers at once
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of Poldi.
+
+   Poldi is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   Poldi is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.  */
+
+#include <poldi.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include <gcrypt.h>
+#include <gpg-error.h>
+
+#include "private-dir.h"
+#include "readers.h"
+
+
+
+/* Interval in milliseconds at which the readers are asked for a
+   card.  */
+#define READER_POLL_INTERVAL 500
+
+/* Number of seconds a reader holding a card we cannot use is left to
+   other logins.  */
+#define READER_BACKOFF 5
+
+/* Number of seconds a reader's Scdaemon has to answer SERIALNO.  */
+#define READER_ANSWER_TIMEOUT 10
+
+struct reader
+{
+  char *port;			/* Reader port passed to Scdaemon.  */
+  int locked;			/* True if we may use the reader.  */
+  int lockfd;			/* Descriptor holding the lock or -1.  */
+  scd_context_t scd;		/* Scdaemon of the reader or NULL.  */
+  int probing;			/* True while a SERIALNO is running.  */
+  time_t retry_after;		/* Do not use reader before this time.  */
+};
+
+struct reader_set_s
+{
+  struct reader *readers;
+  unsigned int nreaders;
+  int dfd;			/* Lock directory or -1.  */
+  char *scd_path;
+  char *scd_options;
+  log_handle_t loghandle;
+};
+
+
+
+/* Try to take the lock of READER in SET.  Returns GPG_ERR_EAGAIN if
+   another process holds it.  */
+static gpg_error_t
+lock_reader (reader_set_t set, struct reader *reader)
+{
+  unsigned char digest[32];
+  char name[64];
+  gpg_error_t err;
+  int i, fd;
+
+  if (reader->locked)
+    return 0;
+
+  if (set->dfd == -1)
+    {
+      reader->locked = 1;
+      return 0;
+    }
+
+  /* Reader ports may contain any character, so use a hash in the
+     file name.  */
+  gcry_md_hash_buffer (GCRY_MD_SHA256, digest,
+		       reader->port, strlen (reader->port));
+  strcpy (name, "reader-");
+  for (i = 0; i < 8; i++)
+    sprintf (name + 7 + 2 * i, "%02x", digest[i]);
+  strcpy (name + 7 + 16, ".lock");
+
+  fd = openat (set->dfd, name,
+	       O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+  if (fd == -1)
+    return gpg_error_from_syserror ();
+
+  if (flock (fd, LOCK_EX | LOCK_NB))
+    {
+      if (errno == EWOULDBLOCK)
+	err = gpg_error (GPG_ERR_EAGAIN);
+      else
+	err = gpg_error_from_syserror ();
+      close (fd);
+      return err;
+    }
+
+  reader->lockfd = fd;
+  reader->locked = 1;
+
+  return 0;
+}
+
+/* Terminate the Scdaemon of READER and give up its lock.  */
+static void
+release_reader (struct reader *reader)
+{
+  scd_disconnect (reader->scd);
+  reader->scd = NULL;
+  reader->probing = 0;
+  if (reader->lockfd != -1)
+    close (reader->lockfd);
+  reader->lockfd = -1;
+  reader->locked = 0;
+}
+
+/* Like release_reader, but for a reader whose Scdaemon does not
+   answer; the Scdaemon is killed instead of waiting for it.  */
+static void
+abandon_reader (struct reader *reader)
+{
+  scd_abort (reader->scd);
+  reader->scd = NULL;
+  release_reader (reader);
+}
+
+
+
+gpg_error_t
+reader_set_create (reader_set_t *set,
+		   const char *const *ports, unsigned int nports,
+		   const char *lockdir, const char *scd_path,
+		   const char *scd_options, log_handle_t loghandle)
+{
+  reader_set_t set_new;
+  gpg_error_t err;
+  unsigned int i;
+
+  set_new = xtrymalloc (sizeof (*set_new));
+  if (!set_new)
+    return gpg_error_from_syserror ();
+  memset (set_new, 0, sizeof (*set_new));
+  set_new->dfd = -1;
+  set_new->loghandle = loghandle;
+
+  set_new->readers = xtrymalloc (nports * sizeof (*set_new->readers));
+  if (!set_new->readers)
+    {
+      err = gpg_error_from_syserror ();
+      goto out;
+    }
+  memset (set_new->readers, 0, nports * sizeof (*set_new->readers));
+  for (i = 0; i < nports; i++)
+    {
+      set_new->readers[i].lockfd = -1;
+      set_new->readers[i].port = xtrystrdup (ports[i]);
+      if (!set_new->readers[i].port)
+	{
+	  err = gpg_error_from_syserror ();
+	  goto out;
+	}
+      set_new->nreaders++;
+    }
+
+  if (scd_path)
+    {
+      set_new->scd_path = xtrystrdup (scd_path);
+      if (!set_new->scd_path)
+	{
+	  err = gpg_error_from_syserror ();
+	  goto out;
+	}
+    }
+  if (scd_options)
+    {
+      set_new->scd_options = xtrystrdup (scd_options);
+      if (!set_new->scd_options)
+	{
+	  err = gpg_error_from_syserror ();
+	  goto out;
+	}
+    }
+
+  /* Lock files writable by users would allow them to block readers;
+     without them, concurrent logins are not coordinated.  */
+  if (!geteuid ())
+    {
+      err = open_private_directory (lockdir, 1, &set_new->dfd);
+      if (err)
+	{
+	  log_msg_error (loghandle,
+			 "failed to open lock directory `%s': %s",
+			 lockdir, gpg_strerror (err));
+	  goto out;
+	}
+    }
+
+  *set = set_new;
+  err = 0;
+
+ out:
+
+  if (err)
+    reader_set_destroy (set_new);
+
+  return err;
+}
+
+void
+reader_set_destroy (reader_set_t set)
+{
+  unsigned int i;
+
+  if (!set)
+    return;
+
+  for (i = 0; i < set->nreaders; i++)
+    {
+      release_reader (&set->readers[i]);
+      xfree (set->readers[i].port);
+    }
+  if (set->dfd != -1)
+    close (set->dfd);
+  xfree (set->readers);
+  xfree (set->scd_path);
+  xfree (set->scd_options);
+  xfree (set);
+}
+
+/* Lock the unused readers of SET and send a SERIALNO to each reader
+   we hold; the descriptors to wait on are stored in PFD, the indices
+   of their readers in IDX.  Returns the number of readers asked.  If
+   readers are locked by others, *BUSY is set; *ERR is set to the last
+   error encountered.  */
+static unsigned int
+start_probes (reader_set_t set, struct pollfd *pfd, unsigned int *idx,
+	      int *busy, gpg_error_t *err)
+{
+  struct reader *reader;
+  unsigned int i, n;
+  gpg_error_t rc;
+  time_t now;
+
+  time (&now);
+  n = 0;
+  for (i = 0; i < set->nreaders; i++)
+    {
+      reader = &set->readers[i];
+      if (now < reader->retry_after)
+	{
+	  *busy = 1;
+	  continue;
+	}
+
+      rc = lock_reader (set, reader);
+      if (gpg_err_code (rc) == GPG_ERR_EAGAIN)
+	{
+	  *busy = 1;
+	  continue;
+	}
+      if (!rc && !reader->scd)
+	rc = scd_connect_reader (&reader->scd, set->scd_path,
+				 set->scd_options, reader->port,
+				 set->loghandle);
+      if (!rc)
+	rc = scd_serialno_start (reader->scd);
+      if (rc)
+	{
+	  log_msg_error (set->loghandle,
+			 "failed to use reader `%s': %s",
+			 reader->port, gpg_strerror (rc));
+	  release_reader (reader);
+	  reader->retry_after = now + READER_BACKOFF;
+	  *err = rc;
+	  continue;
+	}
+
+      reader->probing = 1;
+      pfd[n].fd = scd_get_fd (reader->scd);
+      pfd[n].events = POLLIN;
+      idx[n] = i;
+      n++;
+    }
+
+  return n;
+}
+
+gpg_error_t
+reader_set_wait (reader_set_t set, unsigned int timeout,
+		 reader_accept_cb_t accept_cb, void *opaque,
+		 scd_context_t *scd, char **serialno)
+{
+  struct pollfd *pfd;
+  unsigned int *idx;
+  struct reader *reader;
+  char *card, *winner_card;
+  unsigned int i, n, pending;
+  int winner, busy, first, done, ret;
+  gpg_error_t err, last_err;
+  time_t t0, t, deadline;
+
+  pfd = xtrymalloc (set->nreaders * sizeof (*pfd));
+  idx = xtrymalloc (set->nreaders * sizeof (*idx));
+  if (!pfd || !idx)
+    {
+      err = gpg_error_from_syserror ();
+      goto out;
+    }
+
+  time (&t0);
+  winner = -1;
+  winner_card = NULL;
+  first = 1;
+
+  while (1)
+    {
+      busy = 0;
+      last_err = 0;
+      n = start_probes (set, pfd, idx, &busy, &last_err);
+      if (first && !n && !busy)
+	{
+	  /* None of the readers is usable at all.  */
+	  err = last_err ? last_err : gpg_error (GPG_ERR_CARD_NOT_PRESENT);
+	  goto out;
+	}
+      first = 0;
+
+      /* Collect all answers, so that no Scdaemon is left with a
+	 command in progress; readers not answering in time, or before
+	 TIMEOUT expires, are given up.  */
+      time (&deadline);
+      deadline += READER_ANSWER_TIMEOUT;
+      if (timeout && t0 + timeout + 1 < deadline)
+	deadline = t0 + timeout + 1;
+      pending = n;
+      while (pending)
+	{
+	  time (&t);
+	  ret = poll (pfd, n, t < deadline ? (deadline - t) * 1000 : 0);
+	  if (ret == -1)
+	    {
+	      if (errno == EINTR)
+		continue;
+	      err = gpg_error_from_syserror ();
+	      goto out;
+	    }
+	  if (!ret)
+	    {
+	      for (i = 0; i < n; i++)
+		{
+		  if (pfd[i].fd == -1)
+		    continue;
+		  reader = &set->readers[idx[i]];
+		  log_msg_error (set->loghandle,
+				 "reader `%s' does not answer, giving up on it",
+				 reader->port);
+		  abandon_reader (reader);
+		  time (&reader->retry_after);
+		  reader->retry_after += READER_BACKOFF;
+		  pfd[i].fd = -1;
+		}
+	      pending = 0;
+	      break;
+	    }
+
+	  for (i = 0; i < n; i++)
+	    {
+	      if (pfd[i].fd == -1
+		  || !(pfd[i].revents & (POLLIN | POLLHUP | POLLERR)))
+		continue;
+	      reader = &set->readers[idx[i]];
+
+	      card = NULL;
+	      err = scd_serialno_next (reader->scd, &done, &card);
+	      if (!done)
+		continue;
+	      reader->probing = 0;
+	      pfd[i].fd = -1;
+	      pending--;
+
+	      if (gpg_err_code (err) == GPG_ERR_CARD_NOT_PRESENT)
+		/* Keep watching the empty reader.  */
+		continue;
+	      if (!err && winner == -1 && card
+		  && !(*accept_cb) (opaque, card))
+		{
+		  winner = idx[i];
+		  winner_card = card;
+		  continue;
+		}
+
+	      /* The card is not for us or the reader failed; leave it
+		 to others for a while.  */
+	      if (err)
+		log_msg_error (set->loghandle,
+			       "failed to use reader `%s': %s",
+			       reader->port, gpg_strerror (err));
+	      xfree (card);
+	      release_reader (reader);
+	      time (&reader->retry_after);
+	      reader->retry_after += READER_BACKOFF;
+	    }
+	}
+
+      if (winner != -1)
+	break;
+
+      if (timeout)
+	{
+	  time (&t);
+	  if ((t - t0) > timeout)
+	    {
+	      err = gpg_error (GPG_ERR_CARD_NOT_PRESENT);
+	      goto out;
+	    }
+	}
+
+      poll (NULL, 0, READER_POLL_INTERVAL);
+    }
+
+  /* Release all readers but the one used; its lock is kept until the
+     set is destroyed.  */
+  for (i = 0; i < set->nreaders; i++)
+    if ((int) i != winner)
+      release_reader (&set->readers[i]);
+
+  *scd = set->readers[winner].scd;
+  set->readers[winner].scd = NULL;
+  *serialno = winner_card;
+  err = 0;
+
+ out:
+
+  xfree (pfd);
+  xfree (idx);
+
+  return err;
+}
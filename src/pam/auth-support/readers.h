@@ -0,0 +1,76 @@
+/* readers.h - Waiting for a card on several readers at once
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of Poldi.
+
+   Poldi is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   Poldi is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.  */
+
+#ifndef POLDI_READERS_H
+#define POLDI_READERS_H
+
+#include <gpg-error.h>
+
+#include "util/simplelog.h"
+#include "scd/scd.h"
+
+/* A reader set is a number of card readers, each served by a
+   Scdaemon of its own, which are watched for a card at once.
+
+   Logins running concurrently are scheduled across the readers by
+   means of a lock file per reader in the lock directory: only the
+   holder of its lock talks to a reader.  A login keeps the readers
+   it watches locked while they are empty; when it finds a card it
+   cannot use, it releases the reader for a while, so that the login
+   waiting for this card picks it up.  The lock of the reader finally
+   used is held until the set is destroyed.  A reader whose Scdaemon
+   does not answer is given up as well, and its Scdaemon killed.
+
+   Like the state directory, the lock directory must be owned by
+   root; in processes not running as root, readers are used without
+   coordination.  */
+
+typedef struct reader_set_s *reader_set_t;
+
+/* Callback deciding whether the card SERIALNO is to be used; returns
+   zero if so.  */
+typedef gpg_error_t (*reader_accept_cb_t) (void *opaque,
+					   const char *serialno);
+
+/* Create a set of the NPORTS readers in PORTS, which are reader ports
+   as understood by Scdaemon's --reader-port option, in *SET.  The
+   Scdaemons are started from SCD_PATH with the configuration file
+   SCD_OPTIONS (either may be NULL) when needed.  LOCKDIR is the
+   directory for the lock files.  Returns proper error code.  */
+gpg_error_t reader_set_create (reader_set_t *set,
+			       const char *const *ports, unsigned int nports,
+			       const char *lockdir, const char *scd_path,
+			       const char *scd_options,
+			       log_handle_t loghandle);
+
+/* Release all readers of SET and SET itself.  SET being NULL is
+   okay.  */
+void reader_set_destroy (reader_set_t set);
+
+/* Wait until a card accepted by ACCEPT_CB is present in one of the
+   readers of SET, but no longer than TIMEOUT seconds if TIMEOUT is
+   not zero.  On success, the connection to the Scdaemon of the
+   reader is stored in *SCD and the serial number of the card in
+   *SERIALNO; the other readers are released.  Returns proper error
+   code.  */
+gpg_error_t reader_set_wait (reader_set_t set, unsigned int timeout,
+			     reader_accept_cb_t accept_cb, void *opaque,
+			     scd_context_t *scd, char **serialno);
+
+#endif
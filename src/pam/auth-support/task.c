@@ -0,0 +1,95 @@
+/* task.c - Running start-up steps concurrently
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of Poldi.
+
+   Poldi is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   Poldi is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.  */
+
+#include <poldi.h>
+
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include <gpg-error.h>
+
+#include "task.h"
+
+
+
+struct task_s
+{
+  task_func_t func;
+  void *opaque;
+  gpg_error_t err;		/* Result of FUNC.  */
+  int threaded;			/* True if THREAD has to be joined.  */
+  pthread_t thread;
+};
+
+static void *
+task_thread (void *arg)
+{
+  task_t task = arg;
+
+  task->err = (*task->func) (task->opaque);
+
+  return NULL;
+}
+
+gpg_error_t
+task_start (task_t *task, task_func_t func, void *opaque)
+{
+  sigset_t all, old;
+  task_t task_new;
+  int ret;
+
+  task_new = xtrymalloc (sizeof (*task_new));
+  if (!task_new)
+    return gpg_error_from_errno (errno);
+
+  task_new->func = func;
+  task_new->opaque = opaque;
+  task_new->err = 0;
+
+  /* Signals are meant for the application's threads, not for ours.  */
+  sigfillset (&all);
+  pthread_sigmask (SIG_SETMASK, &all, &old);
+  ret = pthread_create (&task_new->thread, NULL, task_thread, task_new);
+  pthread_sigmask (SIG_SETMASK, &old, NULL);
+
+  task_new->threaded = !ret;
+  if (!task_new->threaded)
+    task_new->err = (*func) (opaque);
+
+  *task = task_new;
+
+  return 0;
+}
+
+gpg_error_t
+task_join (task_t task)
+{
+  gpg_error_t err;
+
+  if (!task)
+    return 0;
+
+  if (task->threaded)
+    pthread_join (task->thread, NULL);
+  err = task->err;
+  xfree (task);
+
+  return err;
+}
@@ -0,0 +1,47 @@
+/* task.h - Running start-up steps concurrently
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of Poldi.
+
+   Poldi is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   Poldi is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.  */
+
+#ifndef POLDI_TASK_H
+#define POLDI_TASK_H
+
+#include <gpg-error.h>
+
+/* A task runs a single function in a thread of its own, so that
+   independent steps of an authentication, like starting Scdaemon and
+   reading the users database, overlap.  The function must neither
+   use the PAM conversation nor change the Poldi context except for
+   fields it owns until the task has been joined.  If no thread can be
+   created, the function is run right away by task_start instead; thus
+   callers need not handle this case.  */
+
+typedef struct task_s *task_t;
+
+/* Type of the function run by a task; OPAQUE is the argument passed
+   to task_start.  */
+typedef gpg_error_t (*task_func_t) (void *opaque);
+
+/* Run FUNC with the argument OPAQUE in the background and store the
+   handle for it in *TASK.  Returns proper error code.  */
+gpg_error_t task_start (task_t *task, task_func_t func, void *opaque);
+
+/* Wait for TASK to complete, release it and return the result of its
+   function.  TASK being NULL is okay.  */
+gpg_error_t task_join (task_t task);
+
+#endif
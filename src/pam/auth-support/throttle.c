@@ -0,0 +1,298 @@
+/* throttle.c - Shared counters of failed authentications
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of Poldi.
+
+   Poldi is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   Poldi is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.  */
+
+#include <poldi.h>
+
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <gcrypt.h>
+#include <gpg-error.h>
+
+#include "private-dir.h"
+#include "throttle.h"
+
+
+
+/* Magic identifying the layout of the table.  */
+#define THROTTLE_MAGIC "PLDTHR01"
+
+/* Number of slots in the table and maximum number of slots probed
+   for an identity.  */
+#define THROTTLE_SLOTS  1024
+#define THROTTLE_PROBES 8
+
+/* Counters of a single identity.  A slot with KEY being zero is free.
+   All fields are accessed atomically.  */
+struct throttle_slot
+{
+  uint64_t key;			/* Hash of the identity.  */
+  uint32_t failures;		/* Number of failures.  */
+  uint32_t pad;
+  int64_t last;			/* Time of the last failure.  */
+};
+
+/* Layout of the table.  A zero-filled file is a valid, empty
+   table.  */
+struct throttle_table
+{
+  char magic[8];
+  uint32_t nslots;
+  uint32_t pad;
+  struct throttle_slot slots[THROTTLE_SLOTS];
+};
+
+struct throttle_s
+{
+  struct throttle_table *table;
+};
+
+
+
+gpg_error_t
+throttle_open (const char *dir, throttle_t *throttle)
+{
+  struct throttle_table *table;
+  throttle_t throttle_new;
+  struct stat statbuf;
+  gpg_error_t err;
+  int dfd, fd;
+
+  dfd = fd = -1;
+  table = MAP_FAILED;
+
+  /* A table writable by users would allow them to lock out others.  */
+  if (geteuid ())
+    return gpg_error (GPG_ERR_EPERM);
+
+  err = open_private_directory (dir, 1, &dfd);
+  if (err)
+    goto out;
+
+  fd = openat (dfd, POLDI_THROTTLE_FILE,
+	       O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+  if (fd == -1)
+    {
+      err = gpg_error_from_syserror ();
+      goto out;
+    }
+
+  if (fstat (fd, &statbuf))
+    {
+      err = gpg_error_from_syserror ();
+      goto out;
+    }
+
+  if (statbuf.st_uid || (statbuf.st_mode & 077) || !S_ISREG (statbuf.st_mode))
+    {
+      err = gpg_error (GPG_ERR_EPERM);
+      goto out;
+    }
+
+  /* A new file is extended to a zero-filled table; processes racing
+     to do so agree on the result.  */
+  if (!statbuf.st_size && ftruncate (fd, sizeof (*table)))
+    {
+      err = gpg_error_from_syserror ();
+      goto out;
+    }
+  else if (statbuf.st_size && statbuf.st_size != sizeof (*table))
+    {
+      err = gpg_error (GPG_ERR_BAD_DATA);
+      goto out;
+    }
+
+  table = mmap (NULL, sizeof (*table), PROT_READ | PROT_WRITE,
+		MAP_SHARED, fd, 0);
+  if (table == MAP_FAILED)
+    {
+      err = gpg_error_from_syserror ();
+      goto out;
+    }
+
+  if (!table->nslots)
+    {
+      memcpy (table->magic, THROTTLE_MAGIC, sizeof (table->magic));
+      table->nslots = THROTTLE_SLOTS;
+    }
+  else if (memcmp (table->magic, THROTTLE_MAGIC, sizeof (table->magic))
+	   || table->nslots != THROTTLE_SLOTS)
+    {
+      err = gpg_error (GPG_ERR_BAD_DATA);
+      goto out;
+    }
+
+  throttle_new = xtrymalloc (sizeof (*throttle_new));
+  if (!throttle_new)
+    {
+      err = gpg_error_from_syserror ();
+      goto out;
+    }
+  throttle_new->table = table;
+
+  *throttle = throttle_new;
+
+ out:
+
+  if (err && table != MAP_FAILED)
+    munmap (table, sizeof (*table));
+  if (fd != -1)
+    close (fd);
+  if (dfd != -1)
+    close (dfd);
+
+  return err;
+}
+
+void
+throttle_close (throttle_t throttle)
+{
+  if (throttle)
+    {
+      munmap (throttle->table, sizeof (*throttle->table));
+      xfree (throttle);
+    }
+}
+
+/* Return the key of the identity ID of kind KIND.  */
+static uint64_t
+identity_key (throttle_kind_t kind, const char *id)
+{
+  unsigned char digest[32];
+  gcry_md_hd_t md;
+  unsigned char k;
+  uint64_t key;
+
+  k = kind;
+  if (gcry_md_open (&md, GCRY_MD_SHA256, 0))
+    return 1;
+  gcry_md_write (md, &k, 1);
+  gcry_md_write (md, id, strlen (id));
+  memcpy (digest, gcry_md_read (md, GCRY_MD_SHA256), sizeof (digest));
+  gcry_md_close (md);
+
+  memcpy (&key, digest, sizeof (key));
+
+  /* Zero marks free slots.  */
+  return key ? key : 1;
+}
+
+/* Return the slot of KEY in TABLE or NULL if there is none.  If CLAIM
+   is true, a slot is claimed for KEY if necessary.  */
+static struct throttle_slot *
+table_lookup (struct throttle_table *table, uint64_t key, int claim)
+{
+  struct throttle_slot *slot, *oldest;
+  uint64_t current;
+  unsigned int i;
+
+  oldest = NULL;
+  for (i = 0; i < THROTTLE_PROBES; i++)
+    {
+      slot = &table->slots[(key + i) % THROTTLE_SLOTS];
+      current = __atomic_load_n (&slot->key, __ATOMIC_ACQUIRE);
+      if (current == key)
+	return slot;
+      if (!current)
+	{
+	  if (!claim)
+	    return NULL;
+	  if (__atomic_compare_exchange_n (&slot->key, &current, key, 0,
+					   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+	      || current == key)
+	    return slot;
+	}
+      if (!oldest
+	  || (__atomic_load_n (&slot->last, __ATOMIC_RELAXED)
+	      < __atomic_load_n (&oldest->last, __ATOMIC_RELAXED)))
+	oldest = slot;
+    }
+
+  if (!claim)
+    return NULL;
+
+  /* The neighborhood is full; evict the entry with the oldest failure.
+     A failure recorded concurrently for the evicted identity may get
+     lost, which only weakens the throttle for it.  */
+  __atomic_store_n (&oldest->failures, 0, __ATOMIC_RELAXED);
+  __atomic_store_n (&oldest->last, 0, __ATOMIC_RELAXED);
+  __atomic_store_n (&oldest->key, key, __ATOMIC_RELEASE);
+
+  return oldest;
+}
+
+unsigned int
+throttle_failures (throttle_t throttle, throttle_kind_t kind,
+		   const char *id, unsigned int expire)
+{
+  struct throttle_slot *slot;
+  int64_t last;
+
+  slot = table_lookup (throttle->table, identity_key (kind, id), 0);
+  if (!slot)
+    return 0;
+
+  last = __atomic_load_n (&slot->last, __ATOMIC_RELAXED);
+  if (time (NULL) - last >= expire)
+    return 0;
+
+  return __atomic_load_n (&slot->failures, __ATOMIC_RELAXED);
+}
+
+void
+throttle_fail (throttle_t throttle, throttle_kind_t kind,
+	       const char *id, unsigned int expire)
+{
+  struct throttle_slot *slot;
+  int64_t now, last;
+
+  slot = table_lookup (throttle->table, identity_key (kind, id), 1);
+
+  /* Start over if the previous failures have expired; only one of
+     several processes doing so at the same time resets the
+     counter.  */
+  now = time (NULL);
+  last = __atomic_load_n (&slot->last, __ATOMIC_RELAXED);
+  if (now - last >= expire
+      && __atomic_compare_exchange_n (&slot->last, &last, now, 0,
+				      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    __atomic_store_n (&slot->failures, 0, __ATOMIC_RELAXED);
+
+  __atomic_add_fetch (&slot->failures, 1, __ATOMIC_RELAXED);
+  __atomic_store_n (&slot->last, now, __ATOMIC_RELAXED);
+}
+
+void
+throttle_clear (throttle_t throttle, throttle_kind_t kind, const char *id)
+{
+  struct throttle_slot *slot;
+
+  slot = table_lookup (throttle->table, identity_key (kind, id), 0);
+  if (slot)
+    __atomic_store_n (&slot->failures, 0, __ATOMIC_RELAXED);
+}
+
+/* END */
@@ -0,0 +1,73 @@
+/* throttle.h - Shared counters of failed authentications
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of Poldi.
+
+   Poldi is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   Poldi is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.  */
+
+#ifndef POLDI_THROTTLE_H
+#define POLDI_THROTTLE_H
+
+#include <gpg-error.h>
+
+/* The throttle table counts failed authentications per card and per
+   user with a card, so that repeated failures can be slowed down or
+   rejected before a card is accessed.  The table is a small file in
+   the state directory, which is mapped into memory by every PAM
+   process and updated with atomic operations only; no daemon and no
+   locks are involved.  Entries are identified by hashes of the
+   serial number resp. the username and serial number.
+
+   Like the state directory, the table must be owned by root; in
+   processes not running as root, the throttle is not available.  */
+
+/* Name of the table file in the state directory.  */
+#define POLDI_THROTTLE_FILE "failures"
+
+/* Kinds of identities counters are kept for.  */
+typedef enum
+  {
+    THROTTLE_SERIALNO,		/* A card, by serial number.  */
+    THROTTLE_USER		/* A user with a particular card;
+				   the ID names both.  */
+  } throttle_kind_t;
+
+typedef struct throttle_s *throttle_t;
+
+/* Map the throttle table in the directory DIR, creating it if
+   necessary, and store a handle for it in *THROTTLE.  Returns proper
+   error code.  */
+gpg_error_t throttle_open (const char *dir, throttle_t *throttle);
+
+/* Release THROTTLE.  THROTTLE being NULL is okay.  */
+void throttle_close (throttle_t throttle);
+
+/* Return the number of failures recorded for the identity ID of kind
+   KIND.  Failures older than EXPIRE seconds (counted from the most
+   recent one) are forgotten.  */
+unsigned int throttle_failures (throttle_t throttle, throttle_kind_t kind,
+				const char *id, unsigned int expire);
+
+/* Record a failure for the identity ID of kind KIND.  The count
+   starts over if the previous failure is older than EXPIRE
+   seconds.  */
+void throttle_fail (throttle_t throttle, throttle_kind_t kind,
+		    const char *id, unsigned int expire);
+
+/* Forget the failures recorded for the identity ID of kind KIND.  */
+void throttle_clear (throttle_t throttle, throttle_kind_t kind,
+		     const char *id);
+
+#endif
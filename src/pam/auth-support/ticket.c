@@ -0,0 +1,418 @@
+/* ticket.c - Short-lived authentication tickets for Poldi.
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of Poldi.
+
+   Poldi is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   Poldi is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.  */
+
+#include <poldi.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <gcrypt.h>
+#include <gpg-error.h>
+
+#include "util/util.h"
+#include "private-dir.h"
+#include "ticket.h"
+
+
+
+/* Name of the file holding the MAC key.  */
+#define TICKET_KEY_FILE "ticket.key"
+
+/* Size of the MAC key.  */
+#define TICKET_KEY_SIZE 32
+
+/* First word of a ticket.  */
+#define TICKET_MAGIC "poldi-ticket-1"
+
+/* Maximum size of a ticket file.  */
+#define TICKET_SIZE_MAX 512
+
+/* Number of bytes of the scope hash used in ticket names.  */
+#define TICKET_SCOPE_HASH_SIZE 16
+
+/* Length of a hex encoded HMAC SHA-256.  */
+#define TICKET_MAC_LENGTH 64
+
+
+
+/* Overwrite the LENGTH bytes at BUFFER, which contain a secret.  */
+static void
+wipe_buffer (void *buffer, size_t length)
+{
+  volatile unsigned char *p = buffer;
+
+  while (length--)
+    *p++ = 0;
+}
+
+/* Read the whole regular file NAME in the directory DFD, which must
+   not be larger than SIZE bytes, into BUFFER.  Store the number of
+   bytes read in *LENGTH.  Returns proper error code.  */
+static gpg_error_t
+read_file (int dfd, const char *name, void *buffer, size_t size,
+	   size_t *length)
+{
+  struct stat statbuf;
+  gpg_error_t err;
+  ssize_t ret;
+  int fd;
+
+  fd = openat (dfd, name, O_RDONLY | O_NOFOLLOW);
+  if (fd == -1)
+    {
+      if (errno == ENOENT)
+	return gpg_error (GPG_ERR_NOT_FOUND);
+      return gpg_error_from_syserror ();
+    }
+
+  if (fstat (fd, &statbuf))
+    {
+      err = gpg_error_from_syserror ();
+      goto out;
+    }
+  if (!S_ISREG (statbuf.st_mode) || statbuf.st_uid != geteuid ()
+      || statbuf.st_size > size)
+    {
+      err = gpg_error (GPG_ERR_INV_OBJ);
+      goto out;
+    }
+
+  do
+    ret = read (fd, buffer, size);
+  while (ret == -1 && errno == EINTR);
+  if (ret == -1)
+    {
+      err = gpg_error_from_syserror ();
+      goto out;
+    }
+
+  *length = ret;
+  err = 0;
+
+ out:
+
+  close (fd);
+
+  return err;
+}
+
+/* Atomically replace the file NAME in the directory DFD with the
+   LENGTH bytes at DATA.  If REPLACE is false, an existing file is
+   not replaced and GPG_ERR_EEXIST is returned.  Returns proper error
+   code.  */
+static gpg_error_t
+write_file (int dfd, const char *name, const void *data, size_t length,
+	    int replace)
+{
+  char tmpname[256];
+  gpg_error_t err;
+  ssize_t ret;
+  int fd;
+
+  snprintf (tmpname, sizeof (tmpname), "%s.%lu", name,
+	    (unsigned long) getpid ());
+
+  fd = openat (dfd, tmpname, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, 0600);
+  if (fd == -1)
+    return gpg_error_from_syserror ();
+
+  do
+    ret = write (fd, data, length);
+  while (ret == -1 && errno == EINTR);
+  if (ret != length || fsync (fd))
+    {
+      err = ret == -1 ? gpg_error_from_syserror () : gpg_error (GPG_ERR_EIO);
+      close (fd);
+      goto out;
+    }
+  close (fd);
+
+  if (replace)
+    ret = renameat (dfd, tmpname, dfd, name);
+  else
+    ret = linkat (dfd, tmpname, dfd, name, 0);
+  err = ret ? gpg_error_from_syserror () : 0;
+
+ out:
+
+  if (err || !replace)
+    unlinkat (dfd, tmpname, 0);
+
+  return err;
+}
+
+/* Load the MAC key from the directory DFD into KEY.  If CREATE is
+   true, a new key is generated if there is none yet.  Returns proper
+   error code.  */
+static gpg_error_t
+load_key (int dfd, unsigned char *key, int create)
+{
+  gpg_error_t err;
+  size_t length;
+  int tries;
+
+  for (tries = 0; tries < 2; tries++)
+    {
+      err = read_file (dfd, TICKET_KEY_FILE, key, TICKET_KEY_SIZE, &length);
+      if (!err)
+	return length == TICKET_KEY_SIZE ? 0 : gpg_error (GPG_ERR_INV_KEYLEN);
+      if (gpg_err_code (err) != GPG_ERR_NOT_FOUND || !create)
+	return err;
+
+      /* Create a new key; if another process got there first, use
+	 its key.  */
+      gcry_randomize (key, TICKET_KEY_SIZE, GCRY_STRONG_RANDOM);
+      err = write_file (dfd, TICKET_KEY_FILE, key, TICKET_KEY_SIZE, 0);
+      if (!err)
+	return 0;
+      if (gpg_err_code (err) != GPG_ERR_EEXIST)
+	return err;
+    }
+
+  return err;
+}
+
+/* Store the name of the ticket for the user UID and the scope SCOPE
+   in NAME, which is of size NAME_SIZE; the hex encoded hash of SCOPE
+   is stored in SCOPE_HEX, which must provide room for
+   2 * TICKET_SCOPE_HASH_SIZE + 1 bytes.  */
+static void
+ticket_name (uid_t uid, const char *scope, char *name, size_t name_size,
+	     char *scope_hex)
+{
+  unsigned char digest[32];
+  int i;
+
+  gcry_md_hash_buffer (GCRY_MD_SHA256, digest, scope, strlen (scope));
+  for (i = 0; i < TICKET_SCOPE_HASH_SIZE; i++)
+    sprintf (scope_hex + 2 * i, "%02x", digest[i]);
+
+  snprintf (name, name_size, "%lu-%s", (unsigned long) uid, scope_hex);
+}
+
+/* Compute the hex encoded HMAC of the LENGTH bytes at DATA with KEY
+   and store it in MAC, which must provide room for
+   TICKET_MAC_LENGTH + 1 bytes.  Returns proper error code.  */
+static gpg_error_t
+compute_mac (const unsigned char *key, const char *data, size_t length,
+	     char *mac)
+{
+  unsigned char *digest;
+  gcry_md_hd_t md;
+  gpg_error_t err;
+  int i;
+
+  err = gcry_md_open (&md, GCRY_MD_SHA256, GCRY_MD_FLAG_HMAC);
+  if (err)
+    return err;
+
+  err = gcry_md_setkey (md, key, TICKET_KEY_SIZE);
+  if (!err)
+    {
+      gcry_md_write (md, data, length);
+      digest = gcry_md_read (md, GCRY_MD_SHA256);
+      for (i = 0; i < TICKET_MAC_LENGTH / 2; i++)
+	sprintf (mac + 2 * i, "%02x", digest[i]);
+    }
+
+  gcry_md_close (md);
+
+  return err;
+}
+
+/* Compare the LENGTH bytes at A and B in constant time; return true
+   if they are equal.  */
+static int
+equal_const_time (const char *a, const char *b, size_t length)
+{
+  unsigned char diff = 0;
+  size_t i;
+
+  for (i = 0; i < length; i++)
+    diff |= a[i] ^ b[i];
+
+  return !diff;
+}
+
+gpg_error_t
+ticket_lookup (const char *dir, uid_t uid, const char *scope,
+	       char **serialno)
+{
+  char name[128], scope_hex[2 * TICKET_SCOPE_HASH_SIZE + 1];
+  char buffer[TICKET_SIZE_MAX + 1], mac[TICKET_MAC_LENGTH + 1];
+  char magic[32], ticket_scope[sizeof (scope_hex)], ticket_serialno[128];
+  unsigned char key[TICKET_KEY_SIZE];
+  unsigned long ticket_uid;
+  long long issued, expires;
+  char *serialno_new, *p;
+  gpg_error_t err;
+  size_t length;
+  time_t now;
+  int dfd;
+
+  dfd = -1;
+
+  err = open_private_directory (dir, 0, &dfd);
+  if (err)
+    goto out;
+
+  err = load_key (dfd, key, 0);
+  if (err)
+    goto out;
+
+  ticket_name (uid, scope, name, sizeof (name), scope_hex);
+  err = read_file (dfd, name, buffer, TICKET_SIZE_MAX, &length);
+  if (err)
+    goto out;
+  buffer[length] = 0;
+
+  /* The MAC is the last word of the line.  */
+  if (length && buffer[length - 1] == '\n')
+    buffer[--length] = 0;
+  p = strrchr (buffer, ' ');
+  if (!p || strlen (p + 1) != TICKET_MAC_LENGTH)
+    {
+      err = gpg_error (GPG_ERR_INV_OBJ);
+      goto out;
+    }
+
+  err = compute_mac (key, buffer, p - buffer, mac);
+  if (err)
+    goto out;
+  if (!equal_const_time (p + 1, mac, TICKET_MAC_LENGTH))
+    {
+      err = gpg_error (GPG_ERR_BAD_SIGNATURE);
+      goto out;
+    }
+  *p = 0;
+
+  if (sscanf (buffer, "%31s %lu %32s %lld %lld %127s",
+	      magic, &ticket_uid, ticket_scope,
+	      &issued, &expires, ticket_serialno) != 6
+      || strcmp (magic, TICKET_MAGIC))
+    {
+      err = gpg_error (GPG_ERR_INV_OBJ);
+      goto out;
+    }
+
+  /* The name already binds the ticket to user and scope, but do not
+     rely on that.  */
+  now = time (NULL);
+  if (ticket_uid != (unsigned long) uid || strcmp (ticket_scope, scope_hex)
+      || now < issued || now >= expires)
+    {
+      err = gpg_error (GPG_ERR_NOT_FOUND);
+      goto out;
+    }
+
+  serialno_new = xtrystrdup (ticket_serialno);
+  if (!serialno_new)
+    {
+      err = gpg_error_from_syserror ();
+      goto out;
+    }
+
+  *serialno = serialno_new;
+
+ out:
+
+  wipe_buffer (key, sizeof (key));
+  if (dfd != -1)
+    close (dfd);
+
+  return err;
+}
+
+gpg_error_t
+ticket_issue (const char *dir, uid_t uid, const char *scope,
+	      const char *serialno, unsigned int ttl)
+{
+  char name[128], scope_hex[2 * TICKET_SCOPE_HASH_SIZE + 1];
+  char buffer[TICKET_SIZE_MAX + 1];
+  unsigned char key[TICKET_KEY_SIZE];
+  gpg_error_t err;
+  time_t now;
+  int dfd, length;
+
+  dfd = -1;
+
+  if (strlen (serialno) >= 128 || strchr (serialno, ' '))
+    return gpg_error (GPG_ERR_INV_VALUE);
+
+  err = open_private_directory (dir, 1, &dfd);
+  if (err)
+    goto out;
+
+  err = load_key (dfd, key, 1);
+  if (err)
+    goto out;
+
+  ticket_name (uid, scope, name, sizeof (name), scope_hex);
+
+  now = time (NULL);
+  length = snprintf (buffer, sizeof (buffer), "%s %lu %s %lld %lld %s",
+		     TICKET_MAGIC, (unsigned long) uid, scope_hex,
+		     (long long) now, (long long) now + ttl, serialno);
+  if (length < 0 || length + 1 + TICKET_MAC_LENGTH + 1 > TICKET_SIZE_MAX)
+    {
+      err = gpg_error (GPG_ERR_TOO_LARGE);
+      goto out;
+    }
+
+  buffer[length++] = ' ';
+  err = compute_mac (key, buffer, length - 1, buffer + length);
+  if (err)
+    goto out;
+  length += TICKET_MAC_LENGTH;
+  buffer[length++] = '\n';
+
+  err = write_file (dfd, name, buffer, length, 1);
+
+ out:
+
+  wipe_buffer (key, sizeof (key));
+  if (dfd != -1)
+    close (dfd);
+
+  return err;
+}
+
+void
+ticket_remove (const char *dir, uid_t uid, const char *scope)
+{
+  char name[128], scope_hex[2 * TICKET_SCOPE_HASH_SIZE + 1];
+  int dfd;
+
+  if (open_private_directory (dir, 0, &dfd))
+    return;
+
+  ticket_name (uid, scope, name, sizeof (name), scope_hex);
+  unlinkat (dfd, name, 0);
+
+  close (dfd);
+}
+
+/* END */
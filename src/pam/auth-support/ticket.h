@@ -0,0 +1,57 @@
+/* ticket.h - Short-lived authentication tickets for Poldi.
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of Poldi.
+
+   Poldi is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   Poldi is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.  */
+
+#ifndef POLDI_TICKET_H
+#define POLDI_TICKET_H
+
+#include <sys/types.h>
+
+#include <gpg-error.h>
+
+/* A ticket records a successful card authentication of a user, much
+   like the timestamp files of sudo.  While a ticket is valid, a
+   further authentication of the same user in the same scope only
+   needs to check that the same card is still present.
+
+   Tickets are files in a directory, which must be owned by root and
+   must not be accessible by anyone else.  Each ticket is bound to the
+   user ID, a scope (e.g. the terminal and session), the serial number
+   of the card and an expiry time; it is protected by a MAC (HMAC
+   SHA-256) with a secret key, which is kept in the same directory and
+   created on first use.  */
+
+/* Look up the ticket of the user UID for the scope SCOPE in the
+   directory DIR.  If a valid ticket exists, store the serial number
+   of the card it was issued for in *SERIALNO (newly allocated) and
+   return zero; return GPG_ERR_NOT_FOUND if there is no valid
+   ticket.  */
+gpg_error_t ticket_lookup (const char *dir, uid_t uid, const char *scope,
+			   char **serialno);
+
+/* Issue a ticket, valid for TTL seconds, for the user UID, the scope
+   SCOPE and the card with serial number SERIALNO in the directory
+   DIR, replacing an existing one.  Returns proper error code.  */
+gpg_error_t ticket_issue (const char *dir, uid_t uid, const char *scope,
+			  const char *serialno, unsigned int ttl);
+
+/* Remove the ticket of the user UID for the scope SCOPE from the
+   directory DIR, if any.  */
+void ticket_remove (const char *dir, uid_t uid, const char *scope);
+
+#endif
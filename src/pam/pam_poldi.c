@@ -24,38 +24,56 @@
 #include <syslog.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <pwd.h>
 #include <assert.h>
+#include <dlfcn.h>
+#include <pthread.h>
 
 #define PAM_SM_AUTH
+#define PAM_SM_ACCOUNT
+#define PAM_SM_SESSION
 #include <security/pam_modules.h>
 #include <security/pam_appl.h>
 
 #include "util/simplelog.h"
 #include "util/simpleparse.h"
 #include "util/defs.h"
+#include "util/support.h"
 #include "scd/scd.h"
 
 #include "auth-support/wait-for-card.h"
 #include "auth-support/conv.h"
 #include "auth-support/getpin-cb.h"
+#include "auth-support/ticket.h"
+#include "auth-support/throttle.h"
+#include "auth-support/private-dir.h"
+#include "auth-support/readers.h"
+#include "auth-support/task.h"
 #include "auth-methods.h"
 
 
 
 /*** Auth methods declarations. ***/
 
-/* Declare authentication methods.  */
-extern struct auth_method_s auth_method_localdb;
-extern struct auth_method_s auth_method_x509;
+/* Authentication methods live in plugins of their own, so that e.g.
+   Libksba is only loaded in case the x509 method is used.  The plugin
+   for method NAME is POLDI_AUTH_METHOD_DIRECTORY/poldi-auth-NAME.so,
+   which defines the method as `auth_method_NAME' and its interface
+   version as `auth_method_NAME_abi'.
+
+   The support code is shared by pam_poldi.so and the plugins through
+   libpoldi-support.so in the same directory, so that process-wide
+   state like the secure memory arena or the rate limiter of the log
+   exists only once.  */
 
 /* List element type for AUTH_METHODS list below.  */
 struct auth_method
 {
   const char *name;
-  auth_method_t method;
+  auth_method_t method;		/* NULL until loaded.  */
 };
 
 /* List associating authenting method definitions with their
@@ -63,14 +81,92 @@ struct auth_method
 static struct auth_method auth_methods[] =
   {
 #ifdef ENABLE_AUTH_METHOD_LOCALDB
-    { "localdb", &auth_method_localdb },
+    { "localdb" },
 #endif
 #ifdef ENABLE_AUTH_METHOD_X509
-    { "x509", &auth_method_x509 },
+    { "x509" },
 #endif
     { NULL }
   };
 
+/* Protects the METHOD fields of AUTH_METHODS.  */
+static pthread_mutex_t auth_methods_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Load the plugin of the authentication method ID, unless it has been
+   loaded already.  Plugins are never unloaded; even when this module
+   is unloaded and loaded again by PAM, the plugin is still mapped and
+   opening it again is cheap.  Returns proper error code.  */
+static gpg_error_t
+auth_method_load (poldi_ctx_t ctx, int id)
+{
+  const char *name = auth_methods[id].name;
+  char filename[256];
+  char symbol[64];
+  const struct auth_method_abi_s *abi;
+  struct auth_method_abi_s abi_expected = AUTH_METHOD_ABI_INIT;
+  auth_method_t method;
+  gpg_error_t err;
+  void *handle;
+
+  err = 0;
+
+  pthread_mutex_lock (&auth_methods_lock);
+
+  if (auth_methods[id].method)
+    goto out;
+
+  snprintf (filename, sizeof (filename), "%s/poldi-auth-%s.so",
+	    POLDI_AUTH_METHOD_DIRECTORY, name);
+
+  handle = dlopen (filename, RTLD_NOW | RTLD_LOCAL);
+  if (!handle)
+    {
+      log_msg_error (ctx->loghandle,
+		     "failed to load authentication method `%s': %s",
+		     name, dlerror ());
+      err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+      goto out;
+    }
+
+  /* A plugin of a different build would misinterpret the objects
+     passed to it.  */
+  snprintf (symbol, sizeof (symbol), "auth_method_%s_abi", name);
+  abi = dlsym (handle, symbol);
+  if (!abi
+      || abi->version != abi_expected.version
+      || strcmp (abi->package_version, abi_expected.package_version)
+      || abi->ctx_size != abi_expected.ctx_size
+      || abi->method_size != abi_expected.method_size)
+    {
+      log_msg_error (ctx->loghandle,
+		     "failed to load authentication method `%s': %s",
+		     name, "plugin does not match this version of Poldi");
+      dlclose (handle);
+      err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+      goto out;
+    }
+
+  snprintf (symbol, sizeof (symbol), "auth_method_%s", name);
+  method = dlsym (handle, symbol);
+  if (!method)
+    {
+      log_msg_error (ctx->loghandle,
+		     "failed to load authentication method `%s': %s",
+		     name, dlerror ());
+      dlclose (handle);
+      err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+      goto out;
+    }
+
+  auth_methods[id].method = method;
+
+ out:
+
+  pthread_mutex_unlock (&auth_methods_lock);
+
+  return err;
+}
+
 
 
 /*** Option parsing. ***/
@@ -80,12 +176,25 @@ enum opt_ids
   {
     opt_none,
     opt_logfile,
+    opt_log_async,
+    opt_log_format,
+    opt_log_rate_limit,
     opt_auth_method,
     opt_debug,
     opt_scdaemon_program,
     opt_scdaemon_options,
     opt_modify_environment,
     opt_quiet,
+    opt_ticket_timeout,
+    opt_ticket_scope,
+    opt_ticket_directory,
+    opt_state_directory,
+    opt_throttle_delay,
+    opt_throttle_lockout,
+    opt_throttle_expire,
+    opt_audit_log,
+    opt_audit_commit_interval,
+    opt_reader
   };
 
 /* Full specifications for options. */
@@ -93,6 +202,12 @@ static simpleparse_opt_spec_t opt_specs[] =
   {
     { opt_logfile, "log-file",
       0, SIMPLEPARSE_ARG_REQUIRED, 0, "Specify file to user for logging" },
+    { opt_log_async, "log-async",
+      0, SIMPLEPARSE_ARG_NONE,     0, "Write log file through a background thread" },
+    { opt_log_format, "log-format",
+      0, SIMPLEPARSE_ARG_REQUIRED, 0, "Specify log format (text, json)" },
+    { opt_log_rate_limit, "log-rate-limit",
+      0, SIMPLEPARSE_ARG_REQUIRED, 0, "Limit log messages (LEVEL:RATE/BURST)" },
     { opt_auth_method, "auth-method",
       0, SIMPLEPARSE_ARG_REQUIRED, 0, "Specify authentication method" },
     { opt_debug, "debug",
@@ -105,6 +220,26 @@ static simpleparse_opt_spec_t opt_specs[] =
       0, SIMPLEPARSE_ARG_NONE, 0, "Set Poldi related variables in the PAM environment" },
     { opt_quiet, "quiet",
       0, SIMPLEPARSE_ARG_NONE, 0, "Be more quiet during PAM conversation with user" },
+    { opt_ticket_timeout, "ticket-timeout",
+      0, SIMPLEPARSE_ARG_REQUIRED, 0, "Specify lifetime of authentication tickets in seconds" },
+    { opt_ticket_scope, "ticket-scope",
+      0, SIMPLEPARSE_ARG_REQUIRED, 0, "Specify scope of authentication tickets (tty, global)" },
+    { opt_ticket_directory, "ticket-directory",
+      0, SIMPLEPARSE_ARG_REQUIRED, 0, "Specify directory for authentication tickets" },
+    { opt_state_directory, "state-directory",
+      0, SIMPLEPARSE_ARG_REQUIRED, 0, "Specify directory for failure counters and reader locks" },
+    { opt_throttle_delay, "throttle-delay",
+      0, SIMPLEPARSE_ARG_REQUIRED, 0, "Delay authentication after this many failures" },
+    { opt_throttle_lockout, "throttle-lockout",
+      0, SIMPLEPARSE_ARG_REQUIRED, 0, "Reject authentication after this many failures" },
+    { opt_throttle_expire, "throttle-expire",
+      0, SIMPLEPARSE_ARG_REQUIRED, 0, "Specify how long failures are remembered in seconds" },
+    { opt_audit_log, "audit-log",
+      0, SIMPLEPARSE_ARG_REQUIRED, 0, "Specify file for audit records" },
+    { opt_audit_commit_interval, "audit-commit-interval",
+      0, SIMPLEPARSE_ARG_REQUIRED, 0, "Specify group commit interval for audit records in milliseconds" },
+    { opt_reader, "reader",
+      0, SIMPLEPARSE_ARG_REQUIRED, 0, "Wait for the card also on this reader port" },
     { 0 }
   };
 
@@ -125,6 +260,66 @@ auth_method_lookup (const char *name)
     return -1;
 }
 
+/* Parse the log rate limit specification SPEC, which is of the form
+   "LEVEL:RATE/BURST" or "LEVEL:RATE"; store the results in *LEVEL,
+   *RATE and *BURST.  Returns proper error code.  */
+static gpg_error_t
+parse_log_rate_limit (const char *spec, log_level_t *level,
+		      unsigned int *rate, unsigned int *burst)
+{
+  static struct
+  {
+    const char *name;
+    log_level_t level;
+  } levels[] =
+    {
+      { "debug", LOG_LEVEL_DEBUG },
+      { "info",  LOG_LEVEL_INFO },
+      { "error", LOG_LEVEL_ERROR },
+      { "fatal", LOG_LEVEL_FATAL },
+      { NULL }
+    };
+  unsigned long value;
+  const char *colon;
+  char *end;
+  int i;
+
+  colon = strchr (spec, ':');
+  if (!colon)
+    return gpg_error (GPG_ERR_INV_VALUE);
+
+  for (i = 0; levels[i].name; i++)
+    if (strlen (levels[i].name) == colon - spec
+	&& !strncmp (levels[i].name, spec, colon - spec))
+      break;
+  if (!levels[i].name)
+    return gpg_error (GPG_ERR_INV_VALUE);
+  *level = levels[i].level;
+
+  errno = 0;
+  value = strtoul (colon + 1, &end, 10);
+  if (errno || end == colon + 1 || value > 100000)
+    return gpg_error (GPG_ERR_INV_VALUE);
+  *rate = value;
+
+  if (*end == '/')
+    {
+      const char *p = end + 1;
+
+      value = strtoul (p, &end, 10);
+      if (errno || end == p || value > 100000)
+	return gpg_error (GPG_ERR_INV_VALUE);
+      *burst = value;
+    }
+  else
+    *burst = 0;
+
+  if (*end)
+    return gpg_error (GPG_ERR_INV_VALUE);
+
+  return 0;
+}
+
 /* Callback for authentication method independent option parsing. */
 static gpg_error_t
 pam_poldi_options_cb (void *cookie, simpleparse_opt_spec_t spec, const char *arg)
@@ -132,8 +327,9 @@ pam_poldi_options_cb (void *cookie, simpleparse_opt_spec_t spec, const char *arg
   gpg_err_code_t err = GPG_ERR_NO_ERROR;
   poldi_ctx_t ctx = cookie;
 
-  if (!strcmp (spec.long_opt, "log-file"))
+  switch (spec.id)
     {
+    case opt_logfile:
       /* LOG-FILE.  */
       ctx->logfile = xtrystrdup (arg);
       if (!ctx->logfile)
@@ -143,11 +339,52 @@ pam_poldi_options_cb (void *cookie, simpleparse_opt_spec_t spec, const char *arg
 			 "failed to duplicate %s: %s",
 			 "logfile name", gpg_strerror (err));
 	}
-    }
-  else if (!strcmp (spec.long_opt, "scdaemon-program"))
-    {
-      /* SCDAEMON-PROGRAM.  */
+      break;
 
+    case opt_log_async:
+      /* LOG-ASYNC.  */
+      ctx->log_async = 1;
+      break;
+
+    case opt_log_format:
+      /* LOG-FORMAT.  */
+      if (!strcmp (arg, "text"))
+	log_set_format (ctx->loghandle, LOG_FORMAT_TEXT);
+      else if (!strcmp (arg, "json"))
+	log_set_format (ctx->loghandle, LOG_FORMAT_JSON);
+      else
+	{
+	  log_msg_error (ctx->loghandle,
+			 "unknown log format '%s'", arg);
+	  err = GPG_ERR_INV_VALUE;
+	}
+      break;
+
+    case opt_log_rate_limit:
+      {
+        /* LOG-RATE-LIMIT.  */
+        log_level_t level;
+        unsigned int rate, burst;
+
+        err = gpg_err_code (parse_log_rate_limit (arg, &level,
+						  &rate, &burst));
+        if (err)
+	  log_msg_error (ctx->loghandle,
+			 "invalid log rate limit '%s'", arg);
+        else
+	  {
+	    err = gpg_err_code (log_set_rate_limit (ctx->loghandle, level,
+						    NULL, rate, burst));
+	    if (err)
+	      log_msg_error (ctx->loghandle,
+			     "failed to set up log rate limit: %s",
+			     gpg_strerror (err));
+	  }
+      }
+      break;
+
+    case opt_scdaemon_program:
+      /* SCDAEMON-PROGRAM.  */
       ctx->scdaemon_program = strdup (arg);
       if (!ctx->scdaemon_program)
 	{
@@ -157,11 +394,10 @@ pam_poldi_options_cb (void *cookie, simpleparse_opt_spec_t spec, const char *arg
 			 "scdaemon program name",
 			 gpg_strerror (err));
 	}
-    }
-  else if (!strcmp (spec.long_opt, "scdaemon-options"))
-    {
-      /* SCDAEMON-OPTIONS.  */
+      break;
 
+    case opt_scdaemon_options:
+      /* SCDAEMON-OPTIONS.  */
       ctx->scdaemon_options = strdup (arg);
       if (!ctx->scdaemon_options)
 	{
@@ -171,37 +407,184 @@ pam_poldi_options_cb (void *cookie, simpleparse_opt_spec_t spec, const char *arg
 			 "scdaemon options name",
 			 gpg_strerror (err));
 	}
-    }
-  else if (!strcmp (spec.long_opt, "auth-method"))
-    {
-      /* AUTH-METHOD.  */
+      break;
 
-      int method = auth_method_lookup (arg);
-      if (method >= 0)
-	ctx->auth_method = method;
-      else
-	{
-	  log_msg_error (ctx->loghandle,
-			 "unknown authentication method '%s'",
-			 arg);
-	  err = GPG_ERR_INV_VALUE;
-	}
-    }
-  else if (!strcmp (spec.long_opt, "debug"))
-    {
+    case opt_auth_method:
+      {
+        /* AUTH-METHOD.  */
+        int method = auth_method_lookup (arg);
+        if (method >= 0)
+	  ctx->auth_method = method;
+        else
+	  {
+	    log_msg_error (ctx->loghandle,
+			   "unknown authentication method '%s'",
+			   arg);
+	    err = GPG_ERR_INV_VALUE;
+	  }
+      }
+      break;
+
+    case opt_debug:
       /* DEBUG.  */
       ctx->debug = 1;
       log_set_min_level (ctx->loghandle, LOG_LEVEL_DEBUG);
-    }
-  else if (!strcmp (spec.long_opt, "modify-environment"))
-    {
+      break;
+
+    case opt_modify_environment:
       /* MODIFY-ENVIRONMENT.  */
       ctx->modify_environment = 1;
-    }
-  else if (!strcmp (spec.long_opt, "quiet"))
-    {
+      break;
+
+    case opt_quiet:
       /* QUIET.  */
       ctx->quiet = 1;
+      break;
+
+    case opt_ticket_timeout:
+      {
+	/* TICKET-TIMEOUT.  */
+	unsigned long timeout;
+	char *end;
+
+	errno = 0;
+	timeout = strtoul (arg, &end, 10);
+	if (errno || *end || end == arg || timeout > 86400)
+	  {
+	    log_msg_error (ctx->loghandle,
+			   "invalid ticket timeout '%s'", arg);
+	    err = GPG_ERR_INV_VALUE;
+	  }
+	else
+	  ctx->ticket_timeout = timeout;
+      }
+      break;
+
+    case opt_ticket_scope:
+      /* TICKET-SCOPE.  */
+      if (!strcmp (arg, "tty"))
+	ctx->ticket_scope_global = 0;
+      else if (!strcmp (arg, "global"))
+	ctx->ticket_scope_global = 1;
+      else
+	{
+	  log_msg_error (ctx->loghandle,
+			 "unknown ticket scope '%s'", arg);
+	  err = GPG_ERR_INV_VALUE;
+	}
+      break;
+
+    case opt_throttle_delay:
+    case opt_throttle_lockout:
+    case opt_throttle_expire:
+      {
+	/* THROTTLE-DELAY, THROTTLE-LOCKOUT, THROTTLE-EXPIRE.  */
+	unsigned long value;
+	char *end;
+
+	errno = 0;
+	value = strtoul (arg, &end, 10);
+	if (errno || *end || end == arg || value > 86400)
+	  {
+	    log_msg_error (ctx->loghandle,
+			   "invalid value for %s: '%s'", spec.long_opt, arg);
+	    err = GPG_ERR_INV_VALUE;
+	  }
+	else if (spec.id == opt_throttle_delay)
+	  ctx->throttle_delay = value;
+	else if (spec.id == opt_throttle_lockout)
+	  ctx->throttle_lockout = value;
+	else
+	  ctx->throttle_expire = value;
+      }
+      break;
+
+    case opt_audit_log:
+      /* AUDIT-LOG.  */
+      xfree (ctx->audit_log);
+      ctx->audit_log = xtrystrdup (arg);
+      if (!ctx->audit_log)
+	{
+	  err = gpg_error_from_errno (errno);
+	  log_msg_error (ctx->loghandle,
+			 "failed to duplicate %s: %s",
+			 "audit log name", gpg_strerror (err));
+	}
+      break;
+
+    case opt_audit_commit_interval:
+      {
+	/* AUDIT-COMMIT-INTERVAL.  */
+	unsigned long interval;
+	char *end;
+
+	errno = 0;
+	interval = strtoul (arg, &end, 10);
+	if (errno || *end || end == arg || interval > 1000)
+	  {
+	    log_msg_error (ctx->loghandle,
+			   "invalid audit commit interval '%s'", arg);
+	    err = GPG_ERR_INV_VALUE;
+	  }
+	else
+	  ctx->audit_commit_interval = interval;
+      }
+      break;
+
+    case opt_ticket_directory:
+      /* TICKET-DIRECTORY.  */
+      xfree (ctx->ticket_directory);
+      ctx->ticket_directory = xtrystrdup (arg);
+      if (!ctx->ticket_directory)
+	{
+	  err = gpg_error_from_errno (errno);
+	  log_msg_error (ctx->loghandle,
+			 "failed to duplicate %s: %s",
+			 "ticket directory name", gpg_strerror (err));
+	}
+      break;
+
+    case opt_state_directory:
+      /* STATE-DIRECTORY.  */
+      xfree (ctx->state_directory);
+      ctx->state_directory = xtrystrdup (arg);
+      if (!ctx->state_directory)
+	{
+	  err = gpg_error_from_errno (errno);
+	  log_msg_error (ctx->loghandle,
+			 "failed to duplicate %s: %s",
+			 "state directory name", gpg_strerror (err));
+	}
+      break;
+
+    case opt_reader:
+      /* READER.  */
+      {
+	char **readers;
+
+	readers = xtryrealloc (ctx->readers,
+			       (ctx->nreaders + 1) * sizeof (*readers));
+	if (!readers)
+	  {
+	    err = gpg_error_from_errno (errno);
+	    log_msg_error (ctx->loghandle,
+			   "failed to duplicate %s: %s",
+			   "reader port", gpg_strerror (err));
+	    break;
+	  }
+	ctx->readers = readers;
+	ctx->readers[ctx->nreaders] = xtrystrdup (arg);
+	if (!ctx->readers[ctx->nreaders])
+	  {
+	    err = gpg_error_from_errno (errno);
+	    log_msg_error (ctx->loghandle,
+			   "failed to duplicate %s: %s",
+			   "reader port", gpg_strerror (err));
+	    break;
+	  }
+	ctx->nreaders++;
+      }
+      break;
     }
 
   return gpg_error (err);
@@ -236,113 +619,842 @@ create_context (poldi_ctx_t *context, pam_handle_t *pam_handle)
       goto out;
     }
 
-  /* Initialize. */
+  /* Initialize. */
+
+  *ctx = poldi_ctx_NULL;
+
+  ctx->auth_method = -1;
+  ctx->cardinfo = scd_cardinfo_null;
+  ctx->pam_handle = pam_handle;
+  ctx->throttle_delay = 3;
+  ctx->throttle_lockout = 0;
+  ctx->throttle_expire = 900;
+  ctx->audit_commit_interval = 20;
+  ctx->phase = -1;
+
+  err = log_create (&ctx->loghandle);
+  if (err)
+    goto out;
+
+  /* Generate an ID for this authentication attempt, which is attached
+     to all log records; this allows for correlating the records of a
+     single authentication on busy hosts.  */
+  {
+    unsigned char nonce[(sizeof (ctx->auth_id) - 1) / 2];
+    int i;
+
+    nonce_generate (nonce, sizeof (nonce));
+    for (i = 0; i < sizeof (nonce); i++)
+      sprintf (ctx->auth_id + 2 * i, "%02x", nonce[i]);
+    log_set_correlation_id (ctx->loghandle, ctx->auth_id);
+  }
+
+  err = simpleparse_create (&ctx->parsehandle);
+  if (err)
+    goto out;
+
+  simpleparse_set_loghandle (ctx->parsehandle, ctx->loghandle);
+  simpleparse_set_parse_cb (ctx->parsehandle, pam_poldi_options_cb, ctx);
+  simpleparse_set_specs (ctx->parsehandle, opt_specs);
+  simpleparse_set_i18n_cb (ctx->parsehandle, i18n_cb, NULL);
+
+  *context = ctx;
+
+ out:
+
+  if (err)
+    {
+      if (ctx)
+	{
+	  simpleparse_destroy (ctx->parsehandle);
+	  log_destroy (ctx->loghandle);
+	  xfree (ctx);
+	}
+    }
+
+  return err;
+}
+
+/* Deallocates resources associated with context CTX. */
+static void
+destroy_context (poldi_ctx_t ctx)
+{
+  if (ctx)
+    {
+      xfree (ctx->logfile);
+      simpleparse_destroy (ctx->parsehandle);
+      log_destroy (ctx->loghandle);
+      xfree (ctx->scdaemon_program);
+      xfree (ctx->scdaemon_options);
+      xfree (ctx->ticket_directory);
+      xfree (ctx->state_directory);
+      xfree (ctx->audit_log);
+      throttle_close (ctx->throttle);
+      scd_disconnect (ctx->scd);
+      reader_set_destroy (ctx->reader_set);
+      while (ctx->nreaders)
+	xfree (ctx->readers[--ctx->nreaders]);
+      xfree (ctx->readers);
+      scd_release_cardinfo (ctx->cardinfo);
+      /* FIXME: not very consistent: conv is (de-)allocated by caller. -mo */
+      xfree (ctx);
+    }
+}
+
+
+
+/*
+ * Environment setting.
+ */
+
+static void
+modify_environment_putenv (pam_handle_t *pam_handle, poldi_ctx_t ctx,
+			   const char *name, const char *value)
+{
+  char *str;
+  int ret;
+
+  str = NULL;
+  ret = asprintf (&str, "%s=%s", name, value);
+  if (ret < 0)
+    {
+      log_msg_error (ctx->loghandle,
+		     "asprintf() failed in modify_environment_putenv(): %s",
+		     errno);
+      return;
+    }
+
+  ret = pam_putenv (pam_handle, str);
+  if (ret != PAM_SUCCESS)
+    {
+      log_msg_error (ctx->loghandle,
+		     "pam_putenv() failed in modify_environment_putenv(): %s",
+		     pam_strerror (pam_handle, ret));
+    }
+  free (str);
+}
+
+static void
+modify_environment (pam_handle_t *pam_handle, poldi_ctx_t ctx)
+{
+  struct scd_cardinfo *cardinfo;
+
+  assert (pam_handle);
+  assert (ctx);
+
+  cardinfo = &ctx->cardinfo;
+
+  modify_environment_putenv (pam_handle, ctx,
+			     "PAM_POLDI_AUTHENTICATED", "");
+  modify_environment_putenv (pam_handle, ctx,
+			     "PAM_POLDI_SERIALNO", cardinfo->serialno);
+  if (cardinfo->disp_lang)
+    /* Not known when authenticated through a ticket.  */
+    modify_environment_putenv (pam_handle, ctx,
+			       "PAM_POLDI_LANGUAGE", cardinfo->disp_lang);
+}
+
+
+
+/*
+ * Authentication tickets.
+ */
+
+/* Store the start time of the process PID, in clock ticks since
+   boot, in *START.  Returns proper error code.  */
+static gpg_error_t
+process_start_time (pid_t pid, unsigned long long *start)
+{
+  char filename[64], line[1024];
+  unsigned int i;
+  char *p;
+  FILE *fp;
+
+  snprintf (filename, sizeof (filename), "/proc/%ld/stat", (long) pid);
+  fp = fopen (filename, "re");
+  if (!fp)
+    return gpg_error_from_syserror ();
+  p = fgets (line, sizeof (line), fp);
+  fclose (fp);
+
+  /* The command name in parentheses may contain anything; the start
+     time is the 20th field after it.  */
+  if (p)
+    p = strrchr (line, ')');
+  for (i = 0; p && i < 20; i++)
+    p = strchr (p + 1, ' ');
+  if (!p)
+    return gpg_error (GPG_ERR_INV_DATA);
+
+  *start = strtoull (p + 1, NULL, 10);
+
+  return 0;
+}
+
+/* Store the scope string for tickets issued in the current context
+   in BUFFER, which is of size SIZE.  Unless tickets are configured
+   to be global, they are bound to the terminal and the session; like
+   sudo, the start time of the session leader is included, so that a
+   later session which happens to get the same ID does not inherit
+   the tickets.  Returns proper error code.  */
+static gpg_error_t
+ticket_scope (poldi_ctx_t ctx, char *buffer, size_t size)
+{
+  const char *tty = NULL;
+  unsigned long long start;
+  gpg_error_t err;
+  pid_t sid;
+
+  if (ctx->ticket_scope_global)
+    {
+      snprintf (buffer, size, "global");
+      return 0;
+    }
+
+  sid = getsid (0);
+  if (sid == -1)
+    return gpg_error_from_syserror ();
+
+  err = process_start_time (sid, &start);
+  if (err)
+    {
+      log_msg_error (ctx->loghandle,
+		     "failed to get start time of session %ld: %s",
+		     (long) sid, gpg_strerror (err));
+      return err;
+    }
+
+  pam_get_item (ctx->pam_handle, PAM_TTY, (const void **) &tty);
+  snprintf (buffer, size, "tty=%s;sid=%ld;start=%llu",
+	    tty ? tty : "", (long) sid, start);
+
+  return 0;
+}
+
+/* Return the directory to use for tickets.  */
+static const char *
+ticket_directory (poldi_ctx_t ctx)
+{
+  return ctx->ticket_directory ? ctx->ticket_directory : POLDI_TICKET_DIRECTORY;
+}
+
+/* Return the directory to use for failure counters and reader
+   locks.  */
+static const char *
+state_directory (poldi_ctx_t ctx)
+{
+  return ctx->state_directory ? ctx->state_directory : POLDI_STATE_DIRECTORY;
+}
+
+/* Check whether USERNAME holds a valid ticket in the current scope,
+   which has been issued for the card currently present.  Returns
+   true if so, in which case the card's serial number is stored in
+   the context's cardinfo.  */
+static int
+ticket_check (poldi_ctx_t ctx, const char *username)
+{
+  char *ticket_serialno, *serialno;
+  char scope[256];
+  struct passwd *pw;
+  gpg_error_t err;
+  int valid;
+
+  ticket_serialno = serialno = NULL;
+  valid = 0;
+
+  pw = getpwnam (username);
+  if (!pw)
+    return 0;
+
+  if (ticket_scope (ctx, scope, sizeof (scope)))
+    goto out;
+  err = ticket_lookup (ticket_directory (ctx), pw->pw_uid, scope,
+		       &ticket_serialno);
+  if (err)
+    {
+      if (ctx->debug && gpg_err_code (err) != GPG_ERR_NOT_FOUND)
+	log_msg_debug (ctx->loghandle, "ignoring ticket of user `%s': %s",
+		       username, gpg_strerror (err));
+      goto out;
+    }
+
+  /* The ticket is only good as long as its card is present.  */
+  err = scd_serialno (ctx->scd, &serialno);
+  if (!err && !strcmp (serialno, ticket_serialno))
+    {
+      ctx->cardinfo.serialno = ticket_serialno;
+      ticket_serialno = NULL;
+      valid = 1;
+    }
+  else
+    ticket_remove (ticket_directory (ctx), pw->pw_uid, scope);
+
+ out:
+
+  xfree (ticket_serialno);
+  xfree (serialno);
+
+  return valid;
+}
+
+/* Issue a ticket for USERNAME after a successful authentication with
+   the card in the context's cardinfo.  */
+static void
+ticket_grant (poldi_ctx_t ctx, const char *username)
+{
+  char scope[256];
+  struct passwd *pw;
+  gpg_error_t err;
+
+  pw = getpwnam (username);
+  if (!pw)
+    return;
+
+  if (ticket_scope (ctx, scope, sizeof (scope)))
+    return;
+  err = ticket_issue (ticket_directory (ctx), pw->pw_uid, scope,
+		      ctx->cardinfo.serialno, ctx->ticket_timeout);
+  if (err)
+    log_msg_error (ctx->loghandle,
+		   "failed to issue ticket for user `%s': %s",
+		   username, gpg_strerror (err));
+}
+
+/* Remove the ticket of USERNAME in the current scope, if any.  */
+static void
+ticket_revoke (poldi_ctx_t ctx, const char *username)
+{
+  char scope[256];
+  struct passwd *pw;
+
+  pw = getpwnam (username);
+  if (!pw)
+    return;
+
+  if (ticket_scope (ctx, scope, sizeof (scope)))
+    return;
+  ticket_remove (ticket_directory (ctx), pw->pw_uid, scope);
+}
+
+
+/*
+ * Phases and audit records.
+ */
+
+/* Return the monotonic time in microseconds.  */
+static uint64_t
+now_us (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Account the time spent in the current phase of CTX.  */
+static void
+leave_phase (poldi_ctx_t ctx)
+{
+  uint64_t now = now_us ();
+
+  if (ctx->phase >= 0)
+    ctx->phase_us[ctx->phase] += now - ctx->phase_start;
+  ctx->phase = -1;
+  ctx->phase_start = now;
+}
+
+/* Enter PHASE of the authentication; this is reflected in log
+   messages and the audit record.  */
+static void
+enter_phase (poldi_ctx_t ctx, audit_phase_t phase)
+{
+  leave_phase (ctx);
+  ctx->phase = phase;
+  log_set_context_field (ctx->loghandle, "phase", audit_phase_name (phase));
+}
+
+/* Append a record of the authentication of USERNAME with the card
+   SERIALNO (either may be NULL) and result ERR to the audit log.  */
+static void
+audit_write (poldi_ctx_t ctx, const char *username, const char *serialno,
+	     gpg_error_t err, int ticket_used)
+{
+  struct audit_record record;
+  struct timespec ts;
+  struct passwd *pw;
+  audit_log_t log;
+  gpg_error_t rc;
+
+  leave_phase (ctx);
+
+  memset (&record, 0, sizeof (record));
+  record.magic = AUDIT_RECORD_MAGIC;
+  record.result = gpg_err_code (err);
+  clock_gettime (CLOCK_REALTIME, &ts);
+  record.time = (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  pw = username ? getpwnam (username) : NULL;
+  record.uid = pw ? pw->pw_uid : (uint32_t) -1;
+  record.pid = getpid ();
+  record.flags = ticket_used ? AUDIT_FLAG_TICKET : 0;
+  memcpy (record.phase_us, ctx->phase_us, sizeof (record.phase_us));
+  audit_record_set (record.auth_id, sizeof (record.auth_id), ctx->auth_id);
+  if (ctx->auth_method >= 0)
+    audit_record_set (record.method, sizeof (record.method),
+		      auth_methods[ctx->auth_method].name);
+  audit_record_set (record.username, sizeof (record.username), username);
+  audit_record_set (record.serialno, sizeof (record.serialno), serialno);
+
+  rc = audit_log_open (ctx->audit_log, &log);
+  if (!rc)
+    {
+      rc = audit_log_append (log, &record, ctx->audit_commit_interval);
+      audit_log_close (log);
+    }
+  if (rc)
+    log_msg_error (ctx->loghandle, "failed to write audit record to `%s': %s",
+		   ctx->audit_log, gpg_strerror (rc));
+}
+
+
+/*
+ * Throttling of failed authentications.
+ */
+
+/* Maximum delay in seconds.  */
+#define THROTTLE_DELAY_MAX 30
+
+/* Set up the throttle, unless disabled.  Without a throttle table
+   (e.g. when not running as root), authentication is not
+   throttled.  */
+static void
+throttle_setup (poldi_ctx_t ctx)
+{
+  gpg_error_t err;
+
+  if (!ctx->throttle_delay && !ctx->throttle_lockout)
+    return;
+
+  err = throttle_open (state_directory (ctx), &ctx->throttle);
+  if (err && ctx->debug)
+    log_msg_debug (ctx->loghandle, "not throttling authentication: %s",
+		   gpg_strerror (err));
+}
+
+/* Check the failures recorded for the identity ID of kind KIND: delay
+   the authentication if there are many of them, reject it if there
+   are too many.  Returns proper error code.  */
+static gpg_error_t
+throttle_check (poldi_ctx_t ctx, throttle_kind_t kind, const char *id)
+{
+  const char *what = kind == THROTTLE_USER ? "user" : "card";
+  unsigned int failures, shift, delay;
+  struct timespec ts;
+
+  if (!ctx->throttle)
+    return 0;
+
+  failures = throttle_failures (ctx->throttle, kind, id,
+				ctx->throttle_expire);
+
+  if (ctx->throttle_lockout && failures >= ctx->throttle_lockout)
+    {
+      log_msg_error (ctx->loghandle,
+		     "rejecting %s `%s' after %u failed authentications",
+		     what, id, failures);
+      return gpg_error (GPG_ERR_LOCKED);
+    }
+
+  if (ctx->throttle_delay && failures >= ctx->throttle_delay)
+    {
+      shift = failures - ctx->throttle_delay;
+      delay = shift < 5 ? 1U << shift : THROTTLE_DELAY_MAX;
+      if (delay > THROTTLE_DELAY_MAX)
+	delay = THROTTLE_DELAY_MAX;
+
+      log_msg_info (ctx->loghandle,
+		    "delaying %s `%s' for %u seconds after %u failed authentications",
+		    what, id, delay, failures);
+
+      ts.tv_sec = delay;
+      ts.tv_nsec = 0;
+      while (nanosleep (&ts, &ts) && errno == EINTR)
+	;
+    }
+
+  return 0;
+}
+
+/* Return the identity under which the failures of USERNAME with the
+   card SERIALNO are counted, or NULL on error.  Keying them on the
+   card, too, keeps others from running up the count of a user with
+   cards of their own.  The result has to be freed.  */
+static char *
+throttle_user_id (const char *username, const char *serialno)
+{
+  char *id;
+
+  /* Neither serial numbers nor usernames contain slashes.  */
+  id = xtrymalloc (strlen (serialno) + 1 + strlen (username) + 1);
+  if (id)
+    {
+      strcpy (id, serialno);
+      strcat (id, "/");
+      strcat (id, username);
+    }
+
+  return id;
+}
+
+/* Check the failures recorded for the card SERIALNO and, if USERNAME
+   is not NULL, for USERNAME with this card, as throttle_check does.
+   Returns proper error code.  */
+static gpg_error_t
+throttle_check_card (poldi_ctx_t ctx, const char *serialno,
+		     const char *username)
+{
+  gpg_error_t err;
+  char *id;
+
+  err = throttle_check (ctx, THROTTLE_SERIALNO, serialno);
+  if (err || !username || !ctx->throttle)
+    return err;
+
+  id = throttle_user_id (username, serialno);
+  if (!id)
+    return gpg_error_from_syserror ();
+  err = throttle_check (ctx, THROTTLE_USER, id);
+  xfree (id);
+
+  return err;
+}
+
+/* Record the outcome of an authentication with the card SERIALNO as
+   USERNAME; either may be NULL.  */
+static void
+throttle_update (poldi_ctx_t ctx, int failed,
+		 const char *serialno, const char *username)
+{
+  char *id;
+
+  if (!ctx->throttle || !serialno)
+    return;
+
+  id = username ? throttle_user_id (username, serialno) : NULL;
+
+  if (failed)
+    {
+      throttle_fail (ctx->throttle, THROTTLE_SERIALNO, serialno,
+		     ctx->throttle_expire);
+      if (id)
+	throttle_fail (ctx->throttle, THROTTLE_USER, id,
+		       ctx->throttle_expire);
+    }
+  else
+    {
+      throttle_clear (ctx->throttle, THROTTLE_SERIALNO, serialno);
+      if (id)
+	throttle_clear (ctx->throttle, THROTTLE_USER, id);
+    }
+
+  xfree (id);
+}
+
+
+/*
+ * Session data.
+ */
+
+/* After a successful authentication, the context - including the
+   connection to Scdaemon and the card info - is kept in the PAM
+   handle, so that the account and session entry points can use it
+   without connecting to Scdaemon and learning the card again.  */
+
+/* Name of the PAM data item holding the session.  */
+#define POLDI_SESSION_DATA "poldi-session"
+
+struct poldi_session
+{
+  poldi_ctx_t ctx;		/* Context of the authentication.  */
+  char *username;		/* The user authenticated.  */
+};
+
+/* Cleanup callback for the PAM data item; called by PAM when the item
+   is replaced or on pam_end().  */
+static void
+session_cleanup (pam_handle_t *pam_handle, void *data, int error_status)
+{
+  struct poldi_session *session = data;
+
+  if (!session)
+    return;
+
+#ifdef PAM_DATA_SILENT
+  /* We are in a process forked by the application, which only drops
+     its copy of the PAM state.  Neither talk to Scdaemon nor touch
+     logging threads on behalf of the parent; the memory goes away
+     with this process.  */
+  if (error_status & PAM_DATA_SILENT)
+    return;
+#endif
+
+  destroy_context (session->ctx);
+  xfree (session->username);
+  xfree (session);
+}
+
+/* Store the context CTX of a successful authentication of USERNAME in
+   the PAM handle.  On success, the session takes ownership of CTX.
+   Returns proper error code.  */
+static gpg_error_t
+session_store (poldi_ctx_t ctx, const char *username)
+{
+  struct poldi_session *session;
+  int ret;
+
+  session = xtrymalloc (sizeof (*session));
+  if (!session)
+    return gpg_error_from_syserror ();
+
+  session->username = xtrystrdup (username);
+  if (!session->username)
+    {
+      gpg_error_t err = gpg_error_from_syserror ();
+      xfree (session);
+      return err;
+    }
+  session->ctx = ctx;
+
+  /* These only live as long as pam_sm_authenticate.  */
+  ctx->conv = NULL;
+  ctx->cookie = NULL;
+  ctx->username = NULL;
+  if (ctx->scd)
+    scd_set_pincb (ctx->scd, NULL, NULL);
+
+  ret = pam_set_data (ctx->pam_handle, POLDI_SESSION_DATA,
+		      session, session_cleanup);
+  if (ret != PAM_SUCCESS)
+    {
+      xfree (session->username);
+      xfree (session);
+      return gpg_error (GPG_ERR_INTERNAL);
+    }
+
+  return 0;
+}
+
+/* Return the session stored in PAM_HANDLE or NULL if there is
+   none.  */
+static struct poldi_session *
+session_get (pam_handle_t *pam_handle)
+{
+  const void *data = NULL;
+
+  if (pam_get_data (pam_handle, POLDI_SESSION_DATA, &data) != PAM_SUCCESS)
+    return NULL;
+
+  return (struct poldi_session *) data;
+}
+
+/* Release the session stored in PAM_HANDLE, if any.  */
+static void
+session_drop (pam_handle_t *pam_handle)
+{
+  if (session_get (pam_handle))
+    pam_set_data (pam_handle, POLDI_SESSION_DATA, NULL, NULL);
+}
+
+/* Release the connection to Scdaemon held by SESSION; the card info
+   is kept.  */
+static void
+session_disconnect (struct poldi_session *session)
+{
+  scd_disconnect (session->ctx->scd);
+  session->ctx->scd = NULL;
+  reader_set_destroy (session->ctx->reader_set);
+  session->ctx->reader_set = NULL;
+}
+
+
+/* Run the ticket phase for USERNAME; returns true if USERNAME has
+   been authenticated through a ticket.  */
+static int
+ticket_authenticate (poldi_ctx_t ctx, const char *username)
+{
+  enter_phase (ctx, AUDIT_PHASE_TICKET);
+  if (!ticket_check (ctx, username))
+    return 0;
+
+  if (ctx->debug)
+    log_msg_debug (ctx->loghandle,
+		   "authenticated user `%s' through ticket", username);
+
+  return 1;
+}
+
+/* Reject the card described by CTX->CARDINFO right away if its status
+   tells that authentication cannot succeed, before the user is asked
+   for the PIN: the authentication key is missing or of an algorithm
+   not supported, or the PIN is blocked.  Returns proper error
+   code.  */
+static gpg_error_t
+check_card_status (poldi_ctx_t ctx)
+{
+  const struct scd_cardinfo *info = &ctx->cardinfo;
+  gpg_error_t err;
+
+  if (ctx->debug && info->chvvalid)
+    log_msg_debug (ctx->loghandle, "%i PIN tries left", info->chvretry[0]);
+
+  err = scd_check_cardinfo (info);
+  switch (gpg_err_code (err))
+    {
+    case GPG_ERR_NO_ERROR:
+      break;
+
+    case GPG_ERR_NO_SECKEY:
+      log_msg_error (ctx->loghandle,
+		     "card %s has no authentication key", info->serialno);
+      if (!ctx->quiet)
+	conv_tell (ctx->conv, _("The card has no authentication key"));
+      break;
 
-  *ctx = poldi_ctx_NULL;
+    case GPG_ERR_UNSUPPORTED_ALGORITHM:
+      log_msg_error (ctx->loghandle,
+		     "authentication key of card %s uses unsupported"
+		     " algorithm %i", info->serialno, info->key3algo);
+      if (!ctx->quiet)
+	conv_tell (ctx->conv,
+		   _("The authentication key of the card uses an"
+		     " unsupported algorithm"));
+      break;
 
-  ctx->auth_method = -1;
-  ctx->cardinfo = scd_cardinfo_null;
-  ctx->pam_handle = pam_handle;
+    case GPG_ERR_PIN_BLOCKED:
+      log_msg_error (ctx->loghandle,
+		     "PIN of card %s is blocked", info->serialno);
+      if (!ctx->quiet)
+	conv_tell (ctx->conv, _("The PIN of the card is blocked"));
+      break;
 
-  err = log_create (&ctx->loghandle);
-  if (err)
-    goto out;
+    default:
+      log_msg_error (ctx->loghandle, "failed to check card %s: %s",
+		     info->serialno, gpg_strerror (err));
+      break;
+    }
 
-  err = simpleparse_create (&ctx->parsehandle);
-  if (err)
-    goto out;
+  return err;
+}
 
-  simpleparse_set_loghandle (ctx->parsehandle, ctx->loghandle);
-  simpleparse_set_parse_cb (ctx->parsehandle, pam_poldi_options_cb, ctx);
-  simpleparse_set_specs (ctx->parsehandle, opt_specs);
-  simpleparse_set_i18n_cb (ctx->parsehandle, i18n_cb, NULL);
+/* Check whether USERNAME can authenticate with a card at all, without
+   accessing any card.  Returns PAM_USER_UNKNOWN if there is no such
+   user, PAM_AUTHINFO_UNAVAIL if the authentication method knows no
+   card for the user and PAM_SUCCESS otherwise.  */
+static int
+check_user (poldi_ctx_t ctx, const char *username)
+{
+  gpg_error_t err;
 
-  *context = ctx;
+  if (!getpwnam (username))
+    {
+      if (ctx->debug)
+	log_msg_debug (ctx->loghandle, "unknown user `%s'", username);
+      return PAM_USER_UNKNOWN;
+    }
 
- out:
+  if (!auth_methods[ctx->auth_method].method->func_check_user)
+    return PAM_SUCCESS;
 
-  if (err)
+  err = (*auth_methods[ctx->auth_method].method->func_check_user) (ctx, ctx->cookie,
+								   username);
+  if (gpg_err_code (err) == GPG_ERR_NOT_FOUND)
     {
-      if (ctx)
-	{
-	  simpleparse_destroy (ctx->parsehandle);
-	  log_destroy (ctx->loghandle);
-	  xfree (ctx);
-	}
+      if (ctx->debug)
+	log_msg_debug (ctx->loghandle, "no card known for user `%s'",
+		       username);
+      return PAM_AUTHINFO_UNAVAIL;
     }
+  else if (err && ctx->debug)
+    /* Leave the decision to the card.  */
+    log_msg_debug (ctx->loghandle, "failed to check user `%s': %s",
+		   username, gpg_strerror (err));
 
-  return err;
+  return PAM_SUCCESS;
 }
 
-/* Deallocates resources associated with context CTX. */
-static void
-destroy_context (poldi_ctx_t ctx)
+/* Arguments and result of scd_connect_task.  */
+struct scd_connect_job
 {
-  if (ctx)
-    {
-      xfree (ctx->logfile);
-      simpleparse_destroy (ctx->parsehandle);
-      log_destroy (ctx->loghandle);
-      xfree (ctx->scdaemon_program);
-      xfree (ctx->scdaemon_options);
-      scd_disconnect (ctx->scd);
-      scd_release_cardinfo (ctx->cardinfo);
-      /* FIXME: not very consistent: conv is (de-)allocated by caller. -mo */
-      xfree (ctx);
-    }
+  poldi_ctx_t ctx;
+  int use_agent;
+  scd_context_t scd;
+};
+
+/* Task connecting to Scdaemon for the job OPAQUE.  */
+static gpg_error_t
+scd_connect_task (void *opaque)
+{
+  struct scd_connect_job *job = opaque;
+
+  return scd_connect (&job->scd, job->use_agent,
+		      job->ctx->scdaemon_program, job->ctx->scdaemon_options,
+		      job->ctx->loghandle);
 }
 
-
+/* Task running the prefetch function of the authentication method of
+   the context OPAQUE.  */
+static gpg_error_t
+method_prefetch_task (void *opaque)
+{
+  poldi_ctx_t ctx = opaque;
 
-/*
- * Environment setting.
- */
+  return (*auth_methods[ctx->auth_method].method->func_prefetch) (ctx, ctx->cookie,
+								  ctx->username);
+}
 
-static void
-modify_environment_putenv (pam_handle_t *pam_handle, poldi_ctx_t ctx,
-			   const char *name, const char *value)
+/* Callback for reader_set_wait: accept the card SERIALNO if the
+   authentication method does.  The cards on the other readers are
+   none of the user's business, so this is done quietly.  */
+static gpg_error_t
+reader_accept_cb (void *opaque, const char *serialno)
 {
-  char *str;
-  int ret;
+  poldi_ctx_t ctx = opaque;
+  gpg_error_t err;
+  int quiet;
 
-  str = NULL;
-  ret = asprintf (&str, "%s=%s", name, value);
-  if (ret < 0)
-    {
-      log_msg_error (ctx->loghandle,
-		     "asprintf() failed in modify_environment_putenv(): %s",
-		     errno);
-      return;
-    }
+  if (!auth_methods[ctx->auth_method].method->func_check_card)
+    return 0;
 
-  ret = pam_putenv (pam_handle, str);
-  if (ret != PAM_SUCCESS)
-    {
-      log_msg_error (ctx->loghandle,
-		     "pam_putenv() failed in modify_environment_putenv(): %s",
-		     pam_strerror (pam_handle, ret));
-    }
-  free (str);
+  quiet = ctx->quiet;
+  ctx->quiet = 1;
+  err = (*auth_methods[ctx->auth_method].method->func_check_card) (ctx, ctx->cookie,
+								   serialno);
+  ctx->quiet = quiet;
+
+  return err;
 }
 
-static void
-modify_environment (pam_handle_t *pam_handle, poldi_ctx_t ctx)
+/* Wait for a card accepted by the authentication method on all
+   readers configured for CTX at once and connect to the Scdaemon of
+   the first reader holding one.  The serial number of the card is
+   stored in *SERIALNO.  Returns proper error code.  */
+static gpg_error_t
+wait_for_card_readers (poldi_ctx_t ctx, char **serialno)
 {
-  struct scd_cardinfo *cardinfo;
-
-  assert (pam_handle);
-  assert (ctx);
+  gpg_error_t err;
 
-  cardinfo = &ctx->cardinfo;
+  err = reader_set_create (&ctx->reader_set,
+			   (const char *const *) ctx->readers, ctx->nreaders,
+			   state_directory (ctx),
+			   ctx->scdaemon_program, ctx->scdaemon_options,
+			   ctx->loghandle);
+  if (err)
+    return err;
 
-  modify_environment_putenv (pam_handle, ctx,
-			     "PAM_POLDI_AUTHENTICATED", "");
-  modify_environment_putenv (pam_handle, ctx,
-			     "PAM_POLDI_SERIALNO", cardinfo->serialno);
-  modify_environment_putenv (pam_handle, ctx,
-			     "PAM_POLDI_LANGUAGE", cardinfo->disp_lang);
+  return reader_set_wait (ctx->reader_set, 0, reader_accept_cb, ctx,
+			  &ctx->scd, serialno);
 }
-
+
 
 /*
  * PAM interface.
@@ -358,32 +1470,33 @@ pam_sm_authenticate (pam_handle_t *pam_handle,
   gpg_error_t err; 
   poldi_ctx_t ctx;
   conv_t conv;
-  scd_context_t scd_ctx;
+  struct scd_connect_job connect_job;
+  task_t connect_task;
+  task_t prefetch_task;
   int ret;
   const char *pam_username;
   struct auth_method_parse_cookie method_parse_cookie = { NULL, NULL };
   simpleparse_handle_t method_parse;
   struct getpin_cb_data getpin_cb_data;
   int use_agent = 0;
+  int ticket_used = 0;
+  int card_presented = 0;
+  int auth_ret = PAM_AUTH_ERR;
+  char *serialno = NULL;
 
   pam_username = NULL;
-  scd_ctx = NULL;
+  connect_task = prefetch_task = NULL;
   conv = NULL;
   ctx = NULL;
   method_parse = NULL;
   err = 0;
 
-  /*** Basic initialization. ***/
-
-  bindtextdomain (PACKAGE, LOCALEDIR);
-
-  /* Initialize Libgcrypt.  Disable secure memory for now; because of
-     the implicit priviledge dropping, having secure memory enabled
-     causes the following error:
+  /*** Initialize Libgcrypt.  ***/
 
-     su: Authentication service cannot retrieve authentication
-     info. */
-  gcry_control (GCRYCTL_DISABLE_SECMEM);
+  /* This must come first, as even memory is allocated through
+     Libgcrypt.  Its random number generator is left alone and the
+     message catalog is only bound with the first message shown.  */
+  crypto_init ();
 
   /*** Setup main context.  ***/
 
@@ -393,7 +1506,9 @@ pam_sm_authenticate (pam_handle_t *pam_handle,
 
   /* Setup logging prefix.  */
   log_set_flags (ctx->loghandle,
-		 LOG_FLAG_WITH_PREFIX | LOG_FLAG_WITH_TIME | LOG_FLAG_WITH_PID);
+		 LOG_FLAG_WITH_PREFIX | LOG_FLAG_WITH_TIME | LOG_FLAG_WITH_PID
+		 | LOG_FLAG_WITH_FIELDS);
+  enter_phase (ctx, AUDIT_PHASE_CONFIGURE);
   log_set_prefix (ctx->loghandle, "Poldi");
   log_set_backend_syslog (ctx->loghandle);
 
@@ -434,7 +1549,10 @@ pam_sm_authenticate (pam_handle_t *pam_handle,
     {
       gpg_error_t rc;
 
-      rc = log_set_backend_file (ctx->loghandle, ctx->logfile);
+      if (ctx->log_async)
+	rc = log_set_backend_async (ctx->loghandle, ctx->logfile);
+      else
+	rc = log_set_backend_file (ctx->loghandle, ctx->logfile);
       if (rc != 0)
 	/* Last try...  */
 	log_set_backend_syslog (ctx->loghandle);
@@ -451,6 +1569,10 @@ pam_sm_authenticate (pam_handle_t *pam_handle,
       goto out;
     }
 
+  err = auth_method_load (ctx, ctx->auth_method);
+  if (err)
+    goto out;
+
   /* Authentication methods must provide a parser callback in case
      they have specific a configuration file.  */
   assert ((!auth_methods[ctx->auth_method].method->config)
@@ -471,9 +1593,9 @@ pam_sm_authenticate (pam_handle_t *pam_handle,
       err = (*auth_methods[ctx->auth_method].method->func_init) (&ctx->cookie);
       if (err)
 	{
-	  log_msg_error (ctx->loghandle,
-			 "failed to initialize authentication method %i: %s",
-			 -1, gpg_strerror (err));
+	  log_msg_error_code (ctx->loghandle, err,
+			      "failed to initialize authentication method %i: %s",
+			      -1, gpg_strerror (err));
 	  goto out;
 	}
     }
@@ -546,6 +1668,25 @@ pam_sm_authenticate (pam_handle_t *pam_handle,
       /* It's not fatal, username can be in the card.  */
       log_msg_error (ctx->loghandle, "Can't retrieve username from PAM");
     }
+  ctx->username = pam_username;
+
+  /*** Check whether the user has a card at all.  ***/
+
+  /* Users without a card are turned away before any Scdaemon is
+     started, so that PAM can move on to the next module.  */
+  if (pam_username)
+    {
+      ret = check_user (ctx, pam_username);
+      if (ret != PAM_SUCCESS)
+	{
+	  auth_ret = ret;
+	  if (ret == PAM_USER_UNKNOWN)
+	    err = gpg_error (GPG_ERR_UNKNOWN_NAME);
+	  else
+	    err = gpg_error (GPG_ERR_NOT_FOUND);
+	  goto out;
+	}
+    }
 
   /*** Check if we use gpg-agent. ***/
   {
@@ -567,22 +1708,59 @@ pam_sm_authenticate (pam_handle_t *pam_handle,
       use_agent = 1;
   }
 
+  /*** Start Scdaemon and prepare the authentication method.  ***/
+
+  /* Both run in the background while failures and tickets are
+     checked and the card is waited for.  With several readers, each
+     gets a Scdaemon of its own while waiting for the card.  */
+  if (!ctx->nreaders)
+    {
+      connect_job.ctx = ctx;
+      connect_job.use_agent = use_agent;
+      connect_job.scd = NULL;
+      err = task_start (&connect_task, scd_connect_task, &connect_job);
+      if (err)
+	goto out;
+    }
+  if (auth_methods[ctx->auth_method].method->func_prefetch)
+    {
+      err = task_start (&prefetch_task, method_prefetch_task, ctx);
+      if (err)
+	goto out;
+    }
+
+  /*** Throttle repeated failures.  ***/
+
+  throttle_setup (ctx);
+
   /*** Connect to Scdaemon. ***/
 
-  err = scd_connect (&scd_ctx, use_agent,
-		     ctx->scdaemon_program, ctx->scdaemon_options,
-		     ctx->loghandle);
-  if (err)
-    goto out;
+  if (connect_task)
+    {
+      enter_phase (ctx, AUDIT_PHASE_SCD_CONNECT);
+      err = task_join (connect_task);
+      connect_task = NULL;
+      ctx->scd = connect_job.scd;
+      if (err)
+	goto out;
+    }
 
-  ctx->scd = scd_ctx;
+  /*** Check for a ticket.  ***/
 
-  /* Install PIN retrival callback. */
-  getpin_cb_data.poldi_ctx = ctx;
-  scd_set_pincb (ctx->scd, getpin_cb, &getpin_cb_data);
+  /* With several readers, the card the ticket has been issued for is
+     not known before waiting.  */
+  if (ctx->ticket_timeout && pam_username && !ctx->nreaders
+      && ticket_authenticate (ctx, pam_username))
+    {
+      ticket_used = 1;
+      err = 0;
+      goto out;
+    }
 
   /*** Wait for card insertion.  ***/
 
+  enter_phase (ctx, AUDIT_PHASE_WAIT_FOR_CARD);
+
   if (pam_username)
     {
       if (ctx->debug)
@@ -598,27 +1776,95 @@ pam_sm_authenticate (pam_handle_t *pam_handle,
 	conv_tell (ctx->conv, _("Insert authentication card"));
     }
 
-  err = wait_for_card (ctx->scd, 0);
+  /* Do not block with the request to insert the card still queued;
+     when the card is present already, it is sent along with later
+     messages.  */
+  if (ctx->nreaders)
+    {
+      conv_flush (ctx->conv);
+      err = wait_for_card_readers (ctx, &serialno);
+    }
+  else
+    err = scd_serialno (ctx->scd, &serialno);
+  if (gpg_err_code (err) == GPG_ERR_CARD_NOT_PRESENT && !ctx->nreaders)
+    {
+      conv_flush (ctx->conv);
+      err = wait_for_card (ctx->scd, 0);
+      if (!err)
+	err = scd_serialno (ctx->scd, &serialno);
+    }
   if (err)
     {
-      log_msg_error (ctx->loghandle, "failed to wait for card insertion: %s",
-		     gpg_strerror (err));
+      log_msg_error_code (ctx->loghandle, err,
+			  "failed to wait for card insertion: %s",
+			  gpg_strerror (err));
+      goto out;
+    }
+
+  /* Install PIN retrival callback. */
+  getpin_cb_data.poldi_ctx = ctx;
+  scd_set_pincb (ctx->scd, getpin_cb, &getpin_cb_data);
+
+  if (ctx->ticket_timeout && pam_username && ctx->nreaders
+      && ticket_authenticate (ctx, pam_username))
+    {
+      ticket_used = 1;
+      err = 0;
       goto out;
     }
 
+  if (serialno)
+    {
+      enter_phase (ctx, AUDIT_PHASE_THROTTLE);
+      err = throttle_check_card (ctx, serialno, pam_username);
+      if (err)
+	goto out;
+    }
+  card_presented = 1;
+
+  /*** Reject unusable cards early.  ***/
+
+  if (auth_methods[ctx->auth_method].method->func_check_card && serialno)
+    {
+      enter_phase (ctx, AUDIT_PHASE_CHECK_CARD);
+      err = (*auth_methods[ctx->auth_method].method->func_check_card) (ctx, ctx->cookie,
+								       serialno);
+      if (err)
+	goto out;
+    }
+
   /*** Receive card info. ***/
 
+  enter_phase (ctx, AUDIT_PHASE_LEARN);
   err = scd_learn (ctx->scd, &ctx->cardinfo);
   if (err)
     goto out;
 
+  log_set_context_field (ctx->loghandle, "serialno", ctx->cardinfo.serialno);
+
   if (ctx->debug)
     log_msg_debug (ctx->loghandle,
 		   "connected to card; serial number is: %s",
 		   ctx->cardinfo.serialno);
 
+  err = check_card_status (ctx);
+  if (err)
+    goto out;
+
   /*** Authenticate.  ***/
 
+  enter_phase (ctx, AUDIT_PHASE_AUTHENTICATE);
+
+  /* The authentication method falls back to doing everything itself
+     if the preparation failed.  */
+  err = task_join (prefetch_task);
+  prefetch_task = NULL;
+  if (err && ctx->debug)
+    log_msg_debug (ctx->loghandle,
+		   "failed to prepare authentication method: %s",
+		   gpg_strerror (err));
+  err = 0;
+
   if (pam_username)
     {
       /* Try to authenticate user as PAM_USERNAME.  */
@@ -656,9 +1902,18 @@ pam_sm_authenticate (pam_handle_t *pam_handle,
 
  out:
 
+  /* Wait for the background tasks not needed anymore.  */
+  task_join (prefetch_task);
+  if (connect_task)
+    {
+      task_join (connect_task);
+      scd_disconnect (connect_job.scd);
+    }
+
   /* Log result.  */
   if (err)
-    log_msg_error (ctx->loghandle, "authentication failed: %s", gpg_strerror (err));
+    log_msg_error_code (ctx->loghandle, err,
+			"authentication failed: %s", gpg_strerror (err));
   else
     {
       if (ctx->debug)
@@ -667,18 +1922,70 @@ pam_sm_authenticate (pam_handle_t *pam_handle,
 	modify_environment (pam_handle, ctx);
     }
 
+  /* Update tickets.  */
+  if (ctx && ctx->ticket_timeout && !ticket_used)
+    {
+      const char *username = NULL;
+
+      pam_get_item (pam_handle, PAM_USER, (const void **) &username);
+      if (username && err && ctx->scd)
+	ticket_revoke (ctx, username);
+      else if (username && !err && ctx->cardinfo.serialno)
+	ticket_grant (ctx, username);
+    }
+
+  /* Update failure counters; only attempts which got as far as
+     presenting a card count as failures.  */
+  if (ctx && !ticket_used && (card_presented || !err))
+    {
+      const char *username = NULL;
+
+      pam_get_item (pam_handle, PAM_USER, (const void **) &username);
+      throttle_update (ctx, err != 0, serialno, username);
+    }
+
+  /* Record the outcome.  */
+  if (ctx && ctx->audit_log)
+    {
+      const char *username = NULL;
+
+      pam_get_item (pam_handle, PAM_USER, (const void **) &username);
+      audit_write (ctx, username,
+		   ctx->cardinfo.serialno ? ctx->cardinfo.serialno : serialno,
+		   err, ticket_used);
+    }
+
   /* Call authentication method's deinit callback. */
   if ((ctx->auth_method >= 0)
+      && auth_methods[ctx->auth_method].method
       && auth_methods[ctx->auth_method].method->func_deinit)
     (*auth_methods[ctx->auth_method].method->func_deinit) (ctx->cookie);
 
+  /* Deliver pending messages, e.g. the reason of a failure.  */
+  if (conv)
+    conv_flush (conv);
+
   /* FIXME, cosmetics? */
+  xfree (serialno);
   conv_destroy (conv);
+
+  /* Keep the context for the other PAM entry points.  A failed
+     authentication invalidates an earlier session.  */
+  if (ctx)
+    {
+      const char *username = NULL;
+
+      pam_get_item (pam_handle, PAM_USER, (const void **) &username);
+      if (!err && username && !session_store (ctx, username))
+	ctx = NULL;
+      else
+	session_drop (pam_handle);
+    }
   destroy_context (ctx);
 
   /* Return to PAM.  */
 
-  return err ? PAM_AUTH_ERR : PAM_SUCCESS;
+  return err ? auth_ret : PAM_SUCCESS;
 }
 
 /* PAM's `set-credentials' interface.  */
@@ -686,6 +1993,107 @@ PAM_EXTERN int
 pam_sm_setcred (pam_handle_t *pam_handle,
 		int flags, int argc, const char **argv)
 {
+  struct poldi_session *session;
+
+  session = session_get (pam_handle);
+  if (!session)
+    return PAM_SUCCESS;
+
+  if (flags & PAM_DELETE_CRED)
+    session_drop (pam_handle);
+  else if (session->ctx->modify_environment)
+    /* The application might have reset the environment since.  */
+    modify_environment (pam_handle, session->ctx);
+
+  return PAM_SUCCESS;
+}
+
+/* PAM's `account management' interface.  The account is valid if the
+   card used for authentication is still present.  */
+PAM_EXTERN int
+pam_sm_acct_mgmt (pam_handle_t *pam_handle,
+		  int flags, int argc, const char **argv)
+{
+  struct poldi_session *session;
+  const char *username = NULL;
+  char *serialno = NULL;
+  poldi_ctx_t ctx;
+  gpg_error_t err;
+  int ret;
+
+  session = session_get (pam_handle);
+  if (!session)
+    /* Not authenticated by us.  */
+    return PAM_IGNORE;
+
+  ctx = session->ctx;
+  log_set_context_field (ctx->loghandle, "phase", "account");
+
+  pam_get_item (pam_handle, PAM_USER, (const void **) &username);
+  if (!username || strcmp (username, session->username))
+    {
+      log_msg_error (ctx->loghandle,
+		     "user changed since authentication: `%s'",
+		     username ? username : "");
+      return PAM_PERM_DENIED;
+    }
+
+  if (!ctx->scd)
+    return PAM_SUCCESS;
+
+  err = scd_serialno (ctx->scd, &serialno);
+  if (!err && strcmp (serialno, ctx->cardinfo.serialno))
+    err = gpg_error (GPG_ERR_WRONG_CARD);
+  if (err)
+    {
+      log_msg_error_code (ctx->loghandle, err,
+			  "card of user `%s' not available: %s",
+			  username, gpg_strerror (err));
+      ret = PAM_PERM_DENIED;
+    }
+  else
+    ret = PAM_SUCCESS;
+
+  xfree (serialno);
+
+  return ret;
+}
+
+/* PAM's `open session' interface.  */
+PAM_EXTERN int
+pam_sm_open_session (pam_handle_t *pam_handle,
+		     int flags, int argc, const char **argv)
+{
+  struct poldi_session *session;
+
+  session = session_get (pam_handle);
+  if (!session)
+    return PAM_IGNORE;
+
+  log_set_context_field (session->ctx->loghandle, "phase", "session");
+  if (session->ctx->debug)
+    log_msg_debug (session->ctx->loghandle,
+		   "opening session for user `%s'", session->username);
+
+  if (session->ctx->modify_environment)
+    modify_environment (pam_handle, session->ctx);
+
+  /* Do not occupy the card reader for the lifetime of the session.  */
+  session_disconnect (session);
+
+  return PAM_SUCCESS;
+}
+
+/* PAM's `close session' interface.  */
+PAM_EXTERN int
+pam_sm_close_session (pam_handle_t *pam_handle,
+		      int flags, int argc, const char **argv)
+{
+  if (!session_get (pam_handle))
+    return PAM_IGNORE;
+
+  session_drop (pam_handle);
+
   return PAM_SUCCESS;
 }
 
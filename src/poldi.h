@@ -38,11 +38,13 @@
 #define xtryrealloc(p,n)     gcry_realloc(p,n)
 #define xfree(p)             gcry_free(p)
 
-/* Poldi allows for NLS. */
+/* Poldi allows for NLS.  Messages are translated with
+   poldi_gettext, which binds the message catalog on first use.  */
 
 #include <libintl.h>
 #include <locale.h>
-#define _(String) dgettext (PACKAGE, String)
+const char *poldi_gettext (const char *msgid);
+#define _(String) poldi_gettext (String)
 #define gettext_noop(String) String
 #define N_(String) gettext_noop (String)
 
@@ -31,6 +31,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <poll.h>
 
 #include <gpg-error.h>
 #include <gcrypt.h>
@@ -39,6 +40,7 @@
 #include "assuan.h"
 #include "util/util.h"
 #include "util/membuf.h"
+#include "util/secarena.h"
 #include "util/support.h"
 #include "util/simplelog.h"
 
@@ -50,6 +52,10 @@
 
 
 
+/* Flags of struct scd_context.  */
+#define SCD_FLAG_OWN_DAEMON 1	/* Scdaemon has been started for this
+				   context alone.  */
+
 /* Initializer objet for struct scd_cardinfo instances.  */
 struct scd_cardinfo scd_cardinfo_null;
 
@@ -62,6 +68,9 @@ struct scd_context
   log_handle_t loghandle;
   scd_pincb_t pincb;
   void *pincb_cookie;
+  int serialno_active;		/* A SERIALNO started with
+				   scd_serialno_start is in progress.  */
+  char *pending_serialno;	/* Its result.  */
 };
 
 /* Callback parameter for learn card */
@@ -210,6 +219,74 @@ restart_scd (scd_context_t ctx)
 
 
 
+/* Fork off scdaemon at SCD_PATH (the default one if NULL), using the
+   configuration file SCD_OPTIONS and the reader READER_PORT, if not
+   NULL, and connect to it in *ASSUAN_CTX.  Returns proper error
+   code.  */
+static gpg_error_t
+spawn_scd (assuan_context_t *assuan_ctx, const char *scd_path,
+	   const char *scd_options, const char *reader_port,
+	   log_handle_t loghandle)
+{
+  const char *pgmname;
+  const char *argv[7];
+  int no_close_list[3];
+  gpg_error_t err;
+  int i;
+
+  if (!scd_path || !*scd_path)
+    scd_path = GNUPG_DEFAULT_SCD;
+  if (!(pgmname = strrchr (scd_path, '/')))
+    pgmname = scd_path;
+  else
+    pgmname++;
+
+  /* Fill argument vector for scdaemon.  */
+
+  i = 0;
+  argv[i++] = pgmname;
+  argv[i++] = "--server";
+  if (scd_options)
+    {
+      argv[i++] = "--options";
+      argv[i++] = scd_options;
+    }
+  if (reader_port)
+    {
+      argv[i++] = "--reader-port";
+      argv[i++] = reader_port;
+    }
+  argv[i++] = NULL;
+
+  i=0;
+
+#if 0
+  /* FIXME! Am I right in assumung that we do not need this?
+     -mo */
+  if (log_get_fd () != -1)
+    no_close_list[i++] = log_get_fd ();
+#endif
+
+  /* FIXME: What about stderr? */
+  no_close_list[i++] = fileno (stderr);
+  no_close_list[i] = -1;
+
+  /* connect to the scdaemon and perform initial handshaking */
+  err = assuan_pipe_connect (assuan_ctx, scd_path, argv, no_close_list);
+  if (err)
+    {
+      log_msg_error_code (loghandle, err, "could not spawn scdaemon: %s",
+			  gpg_strerror (err));
+    }
+  else
+    {
+      log_msg_debug (loghandle, "spawned a new scdaemon (path: '%s')",
+		     scd_path);
+    }
+
+  return err;
+}
+
 /* Fork off scdaemon and work by pipes.  Returns proper error code or
    zero on success.  */
 gpg_error_t
@@ -225,8 +302,8 @@ scd_connect (scd_context_t *scd_ctx, int use_agent, const char *scd_path,
   if (fflush (NULL))
     {
       err = gpg_error_from_syserror ();
-      log_msg_error (loghandle, "error flushing pending output: %s",
-		     strerror (errno));
+      log_msg_error_code (loghandle, err, "error flushing pending output: %s",
+			  gpg_strerror (err));
       return err;
     }
 
@@ -262,57 +339,7 @@ scd_connect (scd_context_t *scd_ctx, int use_agent, const char *scd_path,
    * let Poldi invoke scdaemon.
    */
   if (!use_agent || err)
-    {
-      const char *pgmname;
-      const char *argv[5];
-      int no_close_list[3];
-      int i;
-
-      if (!scd_path || !*scd_path)
-        scd_path = GNUPG_DEFAULT_SCD;
-      if (!(pgmname = strrchr (scd_path, '/')))
-        pgmname = scd_path;
-      else
-        pgmname++;
-
-      /* Fill argument vector for scdaemon.  */
-
-      i = 0;
-      argv[i++] = pgmname;
-      argv[i++] = "--server";
-      if (scd_options)
-	{
-	  argv[i++] = "--options";
-	  argv[i++] = scd_options;
-	}
-      argv[i++] = NULL;
-
-      i=0;
-
-#if 0
-      /* FIXME! Am I right in assumung that we do not need this?
-	 -mo */
-      if (log_get_fd () != -1)
-        no_close_list[i++] = log_get_fd ();
-#endif
-
-      /* FIXME: What about stderr? */
-      no_close_list[i++] = fileno (stderr);
-      no_close_list[i] = -1;
-
-      /* connect to the scdaemon and perform initial handshaking */
-      err = assuan_pipe_connect (&assuan_ctx, scd_path, argv, no_close_list);
-      if (err)
-	{
-	  log_msg_error (loghandle, "could not spawn scdaemon: %s",
-			 gpg_strerror (err));
-	}
-      else
-	{
-	  log_msg_debug (loghandle, "spawned a new scdaemon (path: '%s')",
-			 scd_path);
-	}
-    }
+    err = spawn_scd (&assuan_ctx, scd_path, scd_options, NULL, loghandle);
 
   if (err)
     {
@@ -328,20 +355,159 @@ scd_connect (scd_context_t *scd_ctx, int use_agent, const char *scd_path,
       ctx->assuan_ctx = assuan_ctx;
       ctx->flags = 0;
       ctx->loghandle = loghandle;
+      ctx->pincb = NULL;
+      ctx->pincb_cookie = NULL;
+      ctx->serialno_active = 0;
+      ctx->pending_serialno = NULL;
       *scd_ctx = ctx;
     }
 
   return err;
 }
 
+/* Fork off a scdaemon of its own for the reader READER_PORT (see
+   scdaemon's --reader-port option) and work by pipes.  Unlike
+   scd_connect, this does not wait for the card.  Returns proper error
+   code or zero on success.  */
+gpg_error_t
+scd_connect_reader (scd_context_t *scd_ctx, const char *scd_path,
+		    const char *scd_options, const char *reader_port,
+		    log_handle_t loghandle)
+{
+  assuan_context_t assuan_ctx = NULL;
+  scd_context_t ctx;
+  gpg_error_t err;
+
+  if (fflush (NULL))
+    {
+      err = gpg_error_from_syserror ();
+      log_msg_error_code (loghandle, err, "error flushing pending output: %s",
+			  gpg_strerror (err));
+      return err;
+    }
+
+  ctx = xtrymalloc (sizeof (*ctx));
+  if (!ctx)
+    return gpg_error_from_syserror ();
+
+  err = spawn_scd (&assuan_ctx, scd_path, scd_options, reader_port,
+		   loghandle);
+  if (err)
+    {
+      xfree (ctx);
+      return err;
+    }
+
+  ctx->assuan_ctx = assuan_ctx;
+  ctx->flags = SCD_FLAG_OWN_DAEMON;
+  ctx->loghandle = loghandle;
+  ctx->pincb = NULL;
+  ctx->pincb_cookie = NULL;
+  ctx->serialno_active = 0;
+  ctx->pending_serialno = NULL;
+  *scd_ctx = ctx;
+
+  return 0;
+}
+
+/* Create a context in *SCD_CTX, which replays the trace file
+   FILENAME (see scd_record) instead of talking to Scdaemon.  If
+   REALTIME is true, the answers are delayed as they were when
+   recording.  Returns proper error code.  */
+gpg_error_t
+scd_connect_replay (scd_context_t *scd_ctx, const char *filename,
+		    int realtime, log_handle_t loghandle)
+{
+  scd_context_t ctx;
+  gpg_error_t err;
+
+  ctx = xtrymalloc (sizeof (*ctx));
+  if (!ctx)
+    return gpg_error_from_syserror ();
+
+  err = assuan_trace_replay (&ctx->assuan_ctx, filename,
+			     realtime ? ASSUAN_TRACE_REALTIME : 0);
+  if (err)
+    {
+      log_msg_error_code (loghandle, err, "could not replay trace '%s': %s",
+			  filename, gpg_strerror (err));
+      xfree (ctx);
+      return err;
+    }
+
+  ctx->flags = 0;
+  ctx->loghandle = loghandle;
+  ctx->pincb = NULL;
+  ctx->pincb_cookie = NULL;
+  ctx->serialno_active = 0;
+  ctx->pending_serialno = NULL;
+  *scd_ctx = ctx;
+
+  return 0;
+}
+
+/* Record all further traffic between SCD_CTX and Scdaemon into the
+   trace file FILENAME.  PINs are not recorded.  Returns proper error
+   code.  */
+gpg_error_t
+scd_record (scd_context_t scd_ctx, const char *filename)
+{
+  assert (scd_ctx);
+
+  return assuan_trace_record (scd_ctx->assuan_ctx, filename);
+}
+
 /* Disconnect from SCDaemon; destroy the context SCD_CTX.  */
 void
 scd_disconnect (scd_context_t scd_ctx)
 {
   if (scd_ctx)
     {
+      /* Finish a SERIALNO still in progress.  */
+      while (scd_ctx->serialno_active)
+	{
+	  struct pollfd pfd;
+	  int done;
+
+	  pfd.fd = scd_get_fd (scd_ctx);
+	  pfd.events = POLLIN;
+	  if (poll (&pfd, 1, -1) == -1 && errno != EINTR)
+	    break;
+	  scd_serialno_next (scd_ctx, &done, NULL);
+	}
       restart_scd (scd_ctx);
       assuan_disconnect (scd_ctx->assuan_ctx);
+      xfree (scd_ctx->pending_serialno);
+      xfree (scd_ctx);
+    }
+}
+
+/* Drop the connection SCD_CTX to a Scdaemon which does not answer,
+   without waiting for it; a Scdaemon started by scd_connect_reader is
+   killed.  */
+void
+scd_abort (scd_context_t scd_ctx)
+{
+  pid_t pid = (pid_t) -1;
+
+  if (scd_ctx)
+    {
+      /* The Scdaemon is killed only after the connection is closed:
+	 writing to a dead one would raise SIGPIPE, which we must not
+	 ignore on behalf of the application.  */
+      if (scd_ctx->flags & SCD_FLAG_OWN_DAEMON)
+	{
+	  pid = assuan_get_pid (scd_ctx->assuan_ctx);
+	  assuan_set_flag (scd_ctx->assuan_ctx, ASSUAN_NO_WAITPID, 1);
+	}
+      assuan_disconnect (scd_ctx->assuan_ctx);
+      if (pid != (pid_t) -1)
+	{
+	  kill (pid, SIGKILL);
+	  while (waitpid (pid, NULL, 0) == -1 && errno == EINTR)
+	    ;
+	}
+      xfree (scd_ctx->pending_serialno);
       xfree (scd_ctx);
     }
 }
@@ -490,6 +656,64 @@ learn_status_cb (void *opaque, const char *line)
       else if (no == 3)
         parm->fpr3valid = unhexify_fpr (line, parm->fpr3);
     }
+  else if (keywordlen == 8 && !memcmp (keyword, "KEY-TIME", keywordlen))
+    {
+      int no = atoi (line);
+      while (*line && !spacep (line))
+        line++;
+      while (spacep (line))
+        line++;
+      if (no == 1)
+        parm->fpr1time = strtoul (line, NULL, 10);
+      else if (no == 2)
+        parm->fpr2time = strtoul (line, NULL, 10);
+      else if (no == 3)
+        parm->fpr3time = strtoul (line, NULL, 10);
+    }
+  else if (keywordlen == 8 && !memcmp (keyword, "KEY-ATTR", keywordlen))
+    {
+      int no = atoi (line);
+      while (*line && !spacep (line))
+        line++;
+      while (spacep (line))
+        line++;
+      if (no == 1)
+        parm->key1algo = atoi (line);
+      else if (no == 2)
+        parm->key2algo = atoi (line);
+      else if (no == 3)
+        parm->key3algo = atoi (line);
+    }
+  else if (keywordlen == 10 && !memcmp (keyword, "CHV-STATUS", keywordlen))
+    {
+      /* The PIN caching flag, the maximum lengths of the three PINs
+	 and their retry counters.  */
+      int values[7];
+      char *buf, *p;
+      int i;
+
+      buf = p = unescape_status_string (line);
+      if (buf)
+	{
+	  while (spacep (p))
+	    p++;
+	  for (i = 0; *p && i < DIM (values); i++)
+	    {
+	      values[i] = atoi (p);
+	      while (*p && !spacep (p))
+		p++;
+	      while (spacep (p))
+		p++;
+	    }
+	  if (i == DIM (values))
+	    {
+	      for (i = 0; i < 3; i++)
+		parm->chvretry[i] = values[4 + i];
+	      parm->chvvalid = 1;
+	    }
+	  xfree (buf);
+	}
+    }
   
   return 0;
 }
@@ -521,6 +745,24 @@ scd_release_cardinfo (struct scd_cardinfo info)
   xfree (info.pubkey_url);
 }
 
+gpg_error_t
+scd_check_cardinfo (const struct scd_cardinfo *info)
+{
+  /* Scdaemon reports the fingerprints of the keys present and the
+     attributes of all key slots; without either, we cannot tell.  */
+  if (!info->fpr3valid
+      && (info->fpr1valid || info->fpr2valid || info->key3algo))
+    return gpg_error (GPG_ERR_NO_SECKEY);
+
+  if (info->key3algo && !challenge_card_algo_supported (info->key3algo))
+    return gpg_error (GPG_ERR_UNSUPPORTED_ALGORITHM);
+
+  if (info->chvvalid && !info->chvretry[0])
+    return gpg_error (GPG_ERR_PIN_BLOCKED);
+
+  return 0;
+}
+
 
 
 
@@ -592,6 +834,61 @@ scd_serialno (scd_context_t ctx, char **r_serialno)
   return err;
 }
 
+/* Send a SERIALNO command to Scdaemon without waiting for the answer;
+   the card is not necessarily present.  The answer is collected with
+   scd_serialno_next once the descriptor returned by scd_get_fd is
+   readable.  This allows for asking several Scdaemons at once.
+   Returns proper error code.  */
+gpg_error_t
+scd_serialno_start (scd_context_t ctx)
+{
+  gpg_error_t err;
+
+  xfree (ctx->pending_serialno);
+  ctx->pending_serialno = NULL;
+
+  err = assuan_transact_start (ctx->assuan_ctx, "SERIALNO", NULL, NULL,
+			       NULL, NULL,
+			       get_serialno_cb, &ctx->pending_serialno);
+  if (!err)
+    ctx->serialno_active = 1;
+
+  return err;
+}
+
+/* Return the descriptor to wait on for the answer to a SERIALNO
+   started with scd_serialno_start.  */
+int
+scd_get_fd (scd_context_t ctx)
+{
+  return assuan_transact_fd (ctx->assuan_ctx);
+}
+
+/* Process the answer to a SERIALNO started with scd_serialno_start,
+   as far as it has been received, without blocking.  Once it is
+   complete, *DONE is set and the result is returned as by
+   scd_serialno.  */
+gpg_error_t
+scd_serialno_next (scd_context_t ctx, int *done, char **r_serialno)
+{
+  gpg_error_t err;
+
+  err = assuan_transact_next (ctx->assuan_ctx, done);
+  if (!*done)
+    return 0;
+
+  ctx->serialno_active = 0;
+  if (!err && r_serialno)
+    {
+      *r_serialno = ctx->pending_serialno;
+      ctx->pending_serialno = NULL;
+    }
+  xfree (ctx->pending_serialno);
+  ctx->pending_serialno = NULL;
+
+  return err;
+}
+
 /* CMD: PKSIGN.  */
 
 
@@ -630,7 +927,7 @@ inq_needpin (void *opaque, const char *line)
         line++;
       
       pinlen = 90;
-      pin = xtrymalloc_secure (pinlen);
+      pin = secarena_malloc (pinlen);
       if (!pin)
 	{
 	  rc = gpg_error_from_errno (errno);
@@ -640,7 +937,7 @@ inq_needpin (void *opaque, const char *line)
       rc = parm->getpin_cb (parm->getpin_cb_arg, line, pin, pinlen);
       if (!rc)
         rc = assuan_send_data (parm->ctx->assuan_ctx, pin, pinlen);
-      xfree (pin);
+      secarena_free (pin);
     }
   else if (!strncmp (line, "POPUPPINPADPROMPT", 17)
            && (line[17] == ' ' || !line[17]))
@@ -670,10 +967,10 @@ inq_needpin (void *opaque, const char *line)
     }
   else
     {
-      log_msg_error (parm->ctx->loghandle,
-		     "received unsupported inquiry from scdaemon `%s'",
-		     line);
       rc = gpg_error (GPG_ERR_ASS_UNKNOWN_INQUIRE);
+      log_msg_error_code (parm->ctx->loghandle, rc,
+			  "received unsupported inquiry from scdaemon `%s'",
+			  line);
     }
 
  out:
@@ -687,12 +984,15 @@ inq_needpin (void *opaque, const char *line)
    signing. GETPIN_CB is the callback, which is called for querying of
    the PIN, GETPIN_CB_ARG is passed as opaque argument to
    GETPIN_CB. INDATA/INDATALEN is the input for the signature
-   function.  The signature created is written into newly allocated
-   memory in *R_BUF, *R_BUFLEN will hold the length of the
-   signature. */
+   function; it is the digest of a message hashed with MDALGO, or, if
+   MDALGO is zero, data which is to be signed as is by means of the
+   card's authentication function (as needed for ECC keys).  The
+   signature created is written into memory newly allocated from the
+   secure arena in *R_BUF, which is to be released with secarena_free;
+   *R_BUFLEN will hold the length of the signature. */
 gpg_error_t
 scd_pksign (scd_context_t ctx,
-	    const char *keyid,
+	    const char *keyid, int mdalgo,
 	    const unsigned char *indata, size_t indatalen,
 	    unsigned char **r_buf, size_t *r_buflen)
 {
@@ -701,14 +1001,12 @@ scd_pksign (scd_context_t ctx,
   membuf_t data;
   struct inq_needpin_s inqparm;
   size_t len;
-  unsigned char *sigbuf;
-  size_t sigbuflen;
 
   *r_buf = NULL;
   *r_buflen = 0;
   rc = 0;
 
-  init_membuf (&data, 1024);
+  init_membuf_secure (&data, 1024);
 
   if (indatalen*2 + 50 > DIM(line)) /* FIXME: Are such long inputs
 				       allowed? Should we handle them
@@ -737,7 +1035,20 @@ scd_pksign (scd_context_t ctx,
 
   /* Go, sign it. */
 
-  snprintf (line, DIM(line)-1, "PKSIGN %s", keyid);
+  if (mdalgo)
+    {
+      char hashname[16];
+      const char *s;
+
+      /* Scdaemon expects the name in lowercase.  */
+      for (s = gcry_md_algo_name (mdalgo), p = hashname;
+	   *s && p < hashname + sizeof (hashname) - 1; s++)
+	*p++ = tolower ((unsigned char) *s);
+      *p = 0;
+      snprintf (line, DIM(line)-1, "PKSIGN --hash=%s %s", hashname, keyid);
+    }
+  else
+    snprintf (line, DIM(line)-1, "PKAUTH %s", keyid);
   line[DIM(line)-1] = 0;
   rc = assuan_transact (ctx->assuan_ctx, line,
                         membuf_data_cb, &data,
@@ -746,24 +1057,15 @@ scd_pksign (scd_context_t ctx,
   if (rc)
     goto out;
 
-  /* Extract signature.  FIXME: can't we do this easier?  By reusing
-     membuf, without another alloc/free? */
+  /* Hand out the signature buffer itself.  */
 
-  sigbuf = get_membuf (&data, &sigbuflen);
-  *r_buflen = sigbuflen;
-  p = xtrymalloc (*r_buflen);
-  *r_buf = (unsigned char*)p;
-  if (!p)
-    {
-      rc = gpg_error_from_syserror ();
-      goto out;
-    }
+  *r_buf = get_membuf (&data, r_buflen);
+  if (!*r_buf)
+    rc = gpg_error_from_syserror ();
 
-  memcpy (p, sigbuf, sigbuflen);
-  
  out:
 
-  xfree (get_membuf (&data, &len));
+  secarena_free (get_membuf (&data, &len));
 
   return rc;
 }
@@ -852,10 +1154,10 @@ scd_getinfo (scd_context_t ctx, const char *what, char **result)
       res = xtrymalloc (datalen + 1);
       if (!res)
 	{
-	  log_msg_error (ctx->loghandle,
-			 "warning: can't store getinfo data: %s",
-			 strerror (errno));
 	  rc = gpg_error_from_syserror ();
+	  log_msg_error_code (ctx->loghandle, rc,
+			      "warning: can't store getinfo data: %s",
+			      gpg_strerror (rc));
 	}
       else
 	{
@@ -41,6 +41,15 @@ struct scd_cardinfo
   char fpr1[20];
   char fpr2[20];
   char fpr3[20];
+  unsigned long fpr1time;	/* Creation times of the keys, as */
+  unsigned long fpr2time;	/* used for their fingerprints; zero */
+  unsigned long fpr3time;	/* if unknown.  */
+  int key1algo;			/* OpenPGP algorithm IDs of the keys */
+  int key2algo;			/* (KEY-ATTR); zero if unknown.  */
+  int key3algo;
+  char chvvalid;		/* True if CHV-STATUS was reported.  */
+  int chvretry[3];		/* Tries left for PW1, the Reset Code
+				   and PW3 (CHV-STATUS).  */
 };
 
 typedef struct scd_cardinfo scd_cardinfo_t;
@@ -53,9 +62,36 @@ gpg_error_t scd_connect (scd_context_t *scd_ctx, int use_agent,
 			 const char *scd_path, const char *scd_options,
 			 log_handle_t loghandle);
 
+/* Fork off a Scdaemon of its own for the reader READER_PORT (see
+   scdaemon's --reader-port option) and work by pipes.  Unlike
+   scd_connect, this does not wait for the card.  Returns proper error
+   code or zero on success.  */
+gpg_error_t scd_connect_reader (scd_context_t *scd_ctx,
+				const char *scd_path, const char *scd_options,
+				const char *reader_port,
+				log_handle_t loghandle);
+
+/* Create a context in *SCD_CTX, which replays the trace file
+   FILENAME (see scd_record) instead of talking to Scdaemon.  If
+   REALTIME is true, the answers are delayed as they were when
+   recording.  Meant for benchmarks only.  Returns proper error
+   code.  */
+gpg_error_t scd_connect_replay (scd_context_t *scd_ctx,
+				const char *filename, int realtime,
+				log_handle_t loghandle);
+
+/* Record all further traffic between SCD_CTX and Scdaemon into the
+   trace file FILENAME, which is completed when SCD_CTX is
+   disconnected.  PINs are not recorded.  Returns proper error
+   code.  */
+gpg_error_t scd_record (scd_context_t scd_ctx, const char *filename);
+
 /* Disconnect from SCDaemon; destroy the context SCD_CTX.  */
 void scd_disconnect (scd_context_t scd_ctx);
 
+/* Like scd_disconnect, but for a Scdaemon which does not answer.  */
+void scd_abort (scd_context_t scd_ctx);
+
 typedef int (*scd_pincb_t) (void *data, const char *, char *, size_t);
 
 void scd_set_pincb (scd_context_t scd_ctx,
@@ -65,6 +101,23 @@ void scd_set_pincb (scd_context_t scd_ctx,
    serial number is returned as a hexstring. */
 gpg_error_t scd_serialno (scd_context_t ctx, char **r_serialno);
 
+/* Send a SERIALNO command without waiting for the answer, which is
+   collected with scd_serialno_next once the descriptor returned by
+   scd_get_fd is readable.  This allows for asking several Scdaemons
+   at once.  Returns proper error code.  */
+gpg_error_t scd_serialno_start (scd_context_t ctx);
+
+/* Return the descriptor to wait on for the answer to a SERIALNO
+   started with scd_serialno_start.  */
+int scd_get_fd (scd_context_t ctx);
+
+/* Process the answer to a SERIALNO started with scd_serialno_start,
+   as far as it has been received, without blocking.  Once it is
+   complete, *DONE is set and the result is returned as by
+   scd_serialno.  */
+gpg_error_t scd_serialno_next (scd_context_t ctx, int *done,
+			       char **r_serialno);
+
 /* Read information from card and fill the cardinfo structure
    CARDINFO.  Returns proper error code, zero on success.  */
 int scd_learn (scd_context_t ctx,
@@ -74,13 +127,23 @@ int scd_learn (scd_context_t ctx,
    okay.  */
 void scd_release_cardinfo (struct scd_cardinfo cardinfo);
 
+/* Check whether the card described by INFO, as filled by scd_learn,
+   can be used for authentication at all.  Returns GPG_ERR_NO_SECKEY
+   if the authentication key is missing, GPG_ERR_UNSUPPORTED_ALGORITHM
+   if it is of an algorithm not supported for challenge-response,
+   GPG_ERR_PIN_BLOCKED if the PIN is blocked and zero otherwise.  */
+gpg_error_t scd_check_cardinfo (const struct scd_cardinfo *info);
+
 /* Create a signature using the current card. CTX is the handle for
    the scd subsystem.  KEYID identifies the key on the card to use for
-   signing.  INDATA/INDATALEN is the input for the signature function.
-   The signature created is written into newly allocated memory in
-   *R_BUF, *R_BUFLEN will hold the length of the signature. */
+   signing.  INDATA/INDATALEN is the input for the signature function;
+   it is a digest created with the hash algorithm MDALGO, or data to
+   be signed as is (e.g. for ECC keys) if MDALGO is zero.
+   The signature created is written into memory newly allocated from
+   the secure arena in *R_BUF, which is to be released with
+   secarena_free; *R_BUFLEN will hold the length of the signature. */
 gpg_error_t scd_pksign (scd_context_t ctx,
-			const char *keyid,
+			const char *keyid, int mdalgo,
 			const unsigned char *indata, size_t indatalen,
 			unsigned char **r_buf, size_t *r_buflen);
 
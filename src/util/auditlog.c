@@ -0,0 +1,392 @@
+/* auditlog.c - Binary audit log of authentications
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of Poldi.
+
+   Poldi is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   Poldi is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.  */
+
+#include <util-local.h>
+
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+
+#include <gpg-error.h>
+
+#include "util.h"
+#include "auditlog.h"
+
+#define AUDIT_MAGIC "PLDAUD01"
+#define AUDIT_BYTEORDER 0x01020304
+
+/* Number of attempts to become the committer, one per millisecond,
+   before syncing without coordination.  */
+#define AUDIT_COMMIT_SPINS 1000
+
+/* Header of the audit log.  SYNCED and COMMITTER are accessed
+   atomically through a shared mapping.  */
+struct audit_header
+{
+  char magic[8];
+  uint32_t byteorder;
+  uint32_t record_size;
+  uint64_t synced;		/* Size of the file known to be synced.  */
+  uint32_t committer;		/* PID of the process syncing the file,
+				   or zero.  */
+  uint32_t pad;
+  unsigned char reserved[AUDIT_RECORD_SIZE - 32];
+};
+
+/* Both sizes are part of the file format.  */
+typedef char audit_record_size_check
+  [(sizeof (struct audit_record) == AUDIT_RECORD_SIZE
+    && sizeof (struct audit_header) == AUDIT_RECORD_SIZE) ? 1 : -1];
+
+struct audit_log_s
+{
+  int fd;
+  struct audit_header *header;	/* Shared mapping of the header.  */
+};
+
+static const char *phase_names[AUDIT_PHASES] =
+  {
+    "configure",
+    "throttle",
+    "scd-connect",
+    "ticket",
+    "wait-for-card",
+    "check-card",
+    "learn",
+    "authenticate"
+  };
+
+
+
+const char *
+audit_phase_name (audit_phase_t phase)
+{
+  if (phase < 0 || phase >= AUDIT_PHASES)
+    return "unknown";
+
+  return phase_names[phase];
+}
+
+void
+audit_record_set (char *dst, size_t size, const char *src)
+{
+  size_t len;
+
+  if (!src)
+    src = "";
+
+  len = strlen (src);
+  if (len > size)
+    len = size;
+  memcpy (dst, src, len);
+  if (len < size)
+    memset (dst + len, 0, size - len);
+}
+
+/* Sleep for a millisecond.  */
+static void
+sleep_ms (void)
+{
+  struct timespec ts = { 0, 1000000 };
+
+  nanosleep (&ts, NULL);
+}
+
+/* Return the monotonic time in milliseconds.  */
+static uint64_t
+now_ms (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Check the header HEADER of an audit log.  */
+static gpg_error_t
+check_header (const struct audit_header *header)
+{
+  if (memcmp (header->magic, AUDIT_MAGIC, sizeof (header->magic))
+      || header->byteorder != AUDIT_BYTEORDER
+      || header->record_size != AUDIT_RECORD_SIZE)
+    return gpg_error (GPG_ERR_INV_DATA);
+
+  return 0;
+}
+
+gpg_error_t
+audit_log_open (const char *filename, audit_log_t *log)
+{
+  struct audit_header header;
+  struct stat statbuf;
+  audit_log_t log_new;
+  gpg_error_t err;
+  void *p;
+  int fd;
+
+  log_new = NULL;
+  p = MAP_FAILED;
+  err = 0;
+
+  fd = open (filename, O_RDWR | O_APPEND | O_CREAT | O_NOFOLLOW | O_CLOEXEC,
+	     0600);
+  if (fd == -1)
+    return gpg_error_from_syserror ();
+
+  /* The header is written by the process creating the file; the lock
+     keeps others from appending records before it.  */
+  if (flock (fd, LOCK_EX))
+    {
+      err = gpg_error_from_syserror ();
+      goto out;
+    }
+
+  if (fstat (fd, &statbuf))
+    err = gpg_error_from_syserror ();
+  else if (statbuf.st_uid != geteuid ()
+	   || (statbuf.st_mode & (S_IWGRP | S_IWOTH))
+	   || !S_ISREG (statbuf.st_mode))
+    err = gpg_error (GPG_ERR_EPERM);
+  else if (!statbuf.st_size)
+    {
+      memset (&header, 0, sizeof (header));
+      memcpy (header.magic, AUDIT_MAGIC, sizeof (header.magic));
+      header.byteorder = AUDIT_BYTEORDER;
+      header.record_size = AUDIT_RECORD_SIZE;
+      if (write (fd, &header, sizeof (header)) != sizeof (header))
+	err = gpg_error_from_syserror ();
+      else if (fdatasync (fd))
+	err = gpg_error_from_syserror ();
+    }
+  else if (statbuf.st_size < sizeof (header))
+    err = gpg_error (GPG_ERR_INV_DATA);
+
+  flock (fd, LOCK_UN);
+  if (err)
+    goto out;
+
+  p = mmap (NULL, sizeof (header), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED)
+    {
+      err = gpg_error_from_syserror ();
+      goto out;
+    }
+
+  err = check_header (p);
+  if (err)
+    goto out;
+
+  log_new = xtrymalloc (sizeof (*log_new));
+  if (!log_new)
+    {
+      err = gpg_error_from_syserror ();
+      goto out;
+    }
+  log_new->fd = fd;
+  log_new->header = p;
+
+  *log = log_new;
+
+ out:
+
+  if (err)
+    {
+      if (p != MAP_FAILED)
+	munmap (p, sizeof (header));
+      close (fd);
+    }
+
+  return err;
+}
+
+void
+audit_log_close (audit_log_t log)
+{
+  if (log)
+    {
+      munmap (log->header, sizeof (*log->header));
+      close (log->fd);
+      xfree (log);
+    }
+}
+
+/* Sync LOG, unless it is known to be synced up to END already.  Only
+   one process at a time syncs the file; everybody else waits for it
+   and checks whether its sync covered their records.  */
+static gpg_error_t
+commit_upto (audit_log_t log, uint64_t end)
+{
+  struct audit_header *header = log->header;
+  uint32_t self = (uint32_t) getpid ();
+  uint32_t owner;
+  struct stat statbuf;
+  gpg_error_t err;
+  uint64_t synced;
+  unsigned int spins;
+  int locked;
+
+  for (spins = 0; ; spins++)
+    {
+      if (__atomic_load_n (&header->synced, __ATOMIC_ACQUIRE) >= end)
+	return 0;
+
+      owner = 0;
+      locked = __atomic_compare_exchange_n (&header->committer, &owner, self,
+					    0, __ATOMIC_ACQUIRE,
+					    __ATOMIC_RELAXED);
+      if (locked || spins >= AUDIT_COMMIT_SPINS)
+	break;
+
+      /* A process killed while syncing would block everybody.  */
+      if (kill ((pid_t) owner, 0) && errno == ESRCH)
+	__atomic_compare_exchange_n (&header->committer, &owner, 0, 0,
+				     __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+      else
+	sleep_ms ();
+    }
+
+  /* Everything appended before the sync starts is covered by it.  */
+  err = 0;
+  if (fstat (log->fd, &statbuf) || fdatasync (log->fd))
+    err = gpg_error_from_syserror ();
+  else
+    {
+      synced = __atomic_load_n (&header->synced, __ATOMIC_RELAXED);
+      while (synced < (uint64_t) statbuf.st_size
+	     && !__atomic_compare_exchange_n (&header->synced, &synced,
+					      statbuf.st_size, 0,
+					      __ATOMIC_RELEASE,
+					      __ATOMIC_RELAXED))
+	;
+    }
+
+  if (locked)
+    __atomic_store_n (&header->committer, 0, __ATOMIC_RELEASE);
+
+  return err;
+}
+
+gpg_error_t
+audit_log_append (audit_log_t log, const struct audit_record *record,
+		  unsigned int interval)
+{
+  uint64_t deadline;
+  ssize_t ret;
+  off_t end;
+
+  ret = write (log->fd, record, sizeof (*record));
+  if (ret != sizeof (*record))
+    return ret == -1 ? gpg_error_from_syserror () : gpg_error (GPG_ERR_EIO);
+
+  /* With O_APPEND, the file offset is now at the end of our
+     record.  */
+  end = lseek (log->fd, 0, SEEK_CUR);
+  if (end == (off_t) -1)
+    return gpg_error_from_syserror ();
+
+  /* Give others the chance to sync for us.  */
+  deadline = now_ms () + interval;
+  while (interval
+	 && __atomic_load_n (&log->header->synced, __ATOMIC_ACQUIRE) < end
+	 && now_ms () < deadline)
+    sleep_ms ();
+
+  return commit_upto (log, end);
+}
+
+gpg_error_t
+audit_log_commit (audit_log_t log)
+{
+  struct stat statbuf;
+
+  if (fstat (log->fd, &statbuf))
+    return gpg_error_from_syserror ();
+
+  return commit_upto (log, statbuf.st_size);
+}
+
+gpg_error_t
+audit_log_map (const char *filename, const struct audit_record **records,
+	       size_t *nrecords)
+{
+  struct stat statbuf;
+  gpg_error_t err;
+  size_t n, len;
+  void *p;
+  int fd;
+
+  fd = open (filename, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return gpg_error_from_syserror ();
+
+  if (fstat (fd, &statbuf))
+    {
+      err = gpg_error_from_syserror ();
+      close (fd);
+      return err;
+    }
+  if (statbuf.st_size < AUDIT_RECORD_SIZE)
+    {
+      close (fd);
+      return gpg_error (GPG_ERR_INV_DATA);
+    }
+
+  n = statbuf.st_size / AUDIT_RECORD_SIZE - 1;
+  len = (n + 1) * AUDIT_RECORD_SIZE;
+
+  p = mmap (NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+  err = p == MAP_FAILED ? gpg_error_from_syserror () : 0;
+  close (fd);
+  if (err)
+    return err;
+
+  err = check_header (p);
+  if (err)
+    {
+      munmap (p, len);
+      return err;
+    }
+
+  /* Records are read sequentially.  */
+  madvise (p, len, MADV_SEQUENTIAL);
+
+  *records = (const struct audit_record *) ((const char *) p
+					    + AUDIT_RECORD_SIZE);
+  *nrecords = n;
+
+  return 0;
+}
+
+void
+audit_log_unmap (const struct audit_record *records, size_t nrecords)
+{
+  if (records)
+    munmap ((char *) records - AUDIT_RECORD_SIZE,
+	    (nrecords + 1) * AUDIT_RECORD_SIZE);
+}
+
+/* END */
@@ -0,0 +1,124 @@
+/* auditlog.h - Binary audit log of authentications
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of Poldi.
+
+   Poldi is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   Poldi is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.  */
+
+#ifndef AUDITLOG_H
+#define AUDITLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <gpg-error.h>
+
+/* The audit log is an append-only file of fixed-size records, one per
+   authentication, preceded by a header of the same size.  Records are
+   appended with O_APPEND by many processes at once.
+
+   To make records durable without an fsync per authentication, writers
+   commit in groups: after appending, a writer waits a short interval
+   for another writer to sync the file, and only syncs it itself if
+   nobody did.  The size of the file known to be synced is kept in the
+   header, which is shared through a mapping; it never exceeds the
+   size actually synced, so that it stays valid after a crash.
+
+   Records are written in native byte order; the header tells readers
+   whether the file matches their byte order.  */
+
+/* Size of the header and of each record.  */
+#define AUDIT_RECORD_SIZE 256
+
+/* Phases of an authentication, for which the time spent is
+   recorded.  */
+typedef enum
+  {
+    AUDIT_PHASE_CONFIGURE,
+    AUDIT_PHASE_THROTTLE,
+    AUDIT_PHASE_SCD_CONNECT,
+    AUDIT_PHASE_TICKET,
+    AUDIT_PHASE_WAIT_FOR_CARD,
+    AUDIT_PHASE_CHECK_CARD,
+    AUDIT_PHASE_LEARN,
+    AUDIT_PHASE_AUTHENTICATE,
+    AUDIT_PHASES
+  } audit_phase_t;
+
+/* Flags of a record.  */
+#define AUDIT_FLAG_TICKET 1	/* Authenticated through a ticket.  */
+
+#define AUDIT_RECORD_MAGIC 0x31524150 /* "PAR1" */
+
+/* A record of the audit log.  Strings are NUL terminated unless they
+   fill their field, in which case they are truncated.  */
+struct audit_record
+{
+  uint32_t magic;		/* AUDIT_RECORD_MAGIC.  */
+  uint32_t result;		/* Error code, zero on success.  */
+  uint64_t time;		/* Microseconds since the epoch.  */
+  uint32_t uid;			/* User ID or (uint32_t) -1.  */
+  uint32_t pid;			/* Process ID of the PAM process.  */
+  uint32_t flags;		/* AUDIT_FLAG_*.  */
+  uint32_t phase_us[AUDIT_PHASES]; /* Microseconds spent per phase.  */
+  char auth_id[20];		/* ID of the authentication attempt.  */
+  char method[16];		/* Authentication method.  */
+  char username[64];
+  char serialno[48];
+  unsigned char reserved[AUDIT_RECORD_SIZE - 176 - 4 * AUDIT_PHASES];
+};
+
+typedef struct audit_log_s *audit_log_t;
+
+/* Return the name of PHASE, as used in log messages.  */
+const char *audit_phase_name (audit_phase_t phase);
+
+/* Copy the string SRC into the record field DST of size SIZE.  */
+void audit_record_set (char *dst, size_t size, const char *src);
+
+/* Open the audit log FILENAME for appending, creating it if
+   necessary, and store a handle for it in *LOG.  Returns proper
+   error code.  */
+gpg_error_t audit_log_open (const char *filename, audit_log_t *log);
+
+/* Close LOG.  LOG being NULL is okay.  */
+void audit_log_close (audit_log_t log);
+
+/* Append RECORD to LOG and make it durable.  Wait up to INTERVAL
+   milliseconds for another writer to sync the file before syncing it
+   ourself; with INTERVAL being zero, the file is synced at once.
+   Returns proper error code.  */
+gpg_error_t audit_log_append (audit_log_t log,
+			      const struct audit_record *record,
+			      unsigned int interval);
+
+/* Sync all records appended to LOG so far, by any writer.  Long-running
+   processes may call this periodically to commit for their clients.
+   Returns proper error code.  */
+gpg_error_t audit_log_commit (audit_log_t log);
+
+/* Open the audit log FILENAME for reading by mapping it into memory.
+   Store the records in *RECORDS and their number in *NRECORDS; the
+   mapping is to be released with audit_log_unmap.  A partial record
+   at the end is ignored.  Returns proper error code.  */
+gpg_error_t audit_log_map (const char *filename,
+			   const struct audit_record **records,
+			   size_t *nrecords);
+
+/* Release the mapping of NRECORDS records RECORDS as returned by
+   audit_log_map.  */
+void audit_log_unmap (const struct audit_record *records, size_t nrecords);
+
+#endif
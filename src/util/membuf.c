@@ -25,6 +25,7 @@
 #include "membuf.h"
 
 #include "util.h"
+#include "secarena.h"
 
 
 /* A simple implementation of a dynamic buffer.  Use init_membuf() to
@@ -39,19 +40,23 @@ init_membuf (membuf_t *mb, int initiallen)
   mb->len = 0;
   mb->size = initiallen;
   mb->out_of_core = 0;
+  mb->secure = 0;
   mb->buf = xtrymalloc (initiallen);
   if (!mb->buf)
     mb->out_of_core = errno;
 }
 
-/* Same as init_membuf but allocates the buffer in secure memory.  */
+/* Same as init_membuf but allocates the buffer from the secure arena.
+   The buffer returned by get_membuf must be released with
+   secarena_free.  */
 void
 init_membuf_secure (membuf_t *mb, int initiallen)
 {
   mb->len = 0;
   mb->size = initiallen;
   mb->out_of_core = 0;
-  mb->buf = xtrymalloc_secure (initiallen);
+  mb->secure = 1;
+  mb->buf = secarena_malloc (initiallen);
   if (!mb->buf)
     mb->out_of_core = errno;
 }
@@ -68,7 +73,10 @@ put_membuf (membuf_t *mb, const void *buf, size_t len)
       char *p;
       
       mb->size += len + 1024;
-      p = xtryrealloc (mb->buf, mb->size);
+      if (mb->secure)
+        p = secarena_realloc (mb->buf, mb->size);
+      else
+        p = xtryrealloc (mb->buf, mb->size);
       if (!p)
         {
           mb->out_of_core = errno ? errno : ENOMEM;
@@ -100,7 +108,10 @@ get_membuf (membuf_t *mb, size_t *len)
 
   if (mb->out_of_core)
     {
-      xfree (mb->buf);
+      if (mb->secure)
+        secarena_free (mb->buf);
+      else
+        xfree (mb->buf);
       mb->buf = NULL;
       errno = mb->out_of_core;
       return NULL;
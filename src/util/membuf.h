@@ -28,6 +28,7 @@ struct private_membuf_s
   size_t size;     
   char *buf;       
   int out_of_core; 
+  int secure;
 };
 
 typedef struct private_membuf_s membuf_t;
@@ -35,7 +36,7 @@ typedef struct private_membuf_s membuf_t;
 /* Return the current length of the membuf.  */
 #define get_membuf_len(a)  ((a)->len)
 #define is_membuf_ready(a) ((a)->buf || (a)->out_of_core)
-#define MEMBUF_ZERO        { 0, 0, NULL, 0}
+#define MEMBUF_ZERO        { 0, 0, NULL, 0, 0}
 
 void init_membuf (membuf_t *mb, int initiallen);
 void init_membuf_secure (membuf_t *mb, int initiallen);
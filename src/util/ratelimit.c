@@ -0,0 +1,428 @@
+/* ratelimit.c - Shared rate limiting of log messages for Poldi
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of Poldi.
+
+   Poldi is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   Poldi is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.  */
+
+#include <util-local.h>
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <gpg-error.h>
+
+#include "ratelimit.h"
+
+/* Prefix of the name of the shared memory segment, which is
+   followed by the effective user ID: processes of different users
+   do not share a table.  */
+#define RATELIMIT_SHM_PREFIX "/poldi-log-ratelimit-"
+
+/* Magic identifying the layout of the shared table.  */
+#define RATELIMIT_MAGIC "PLDRLT01"
+
+/* Number of slots in the table and maximum number of slots probed
+   for a site.  */
+#define RATELIMIT_SLOTS  256
+#define RATELIMIT_PROBES 8
+
+/* Identical messages at a site within this many milliseconds after
+   the last emitted one are suppressed as repetitions.  */
+#define RATELIMIT_REPEAT_WINDOW 30000
+
+/* Bucket contents are kept in thousandths of a token, so that a rate
+   of N tokens per second refills N units per millisecond.  */
+#define RATELIMIT_TOKEN 1000
+
+/* Number of attempts to take a slot lock before checking whether its
+   holder is still alive.  */
+#define RATELIMIT_LOCK_SPINS 4096
+
+/* State of a single message site.  A slot with SITE being zero is
+   free.  All fields but LOCK are protected by LOCK, which holds the
+   PID of the process owning it, or zero.  */
+struct ratelimit_slot
+{
+  uint32_t lock;
+  uint32_t pad;
+  uint64_t site;
+  uint64_t last_msg;		/* Hash of the last emitted message.  */
+  int64_t last_msg_ms;		/* Time it was emitted.  */
+  int64_t tokens;		/* Bucket contents.  */
+  int64_t refill_ms;		/* Time of the last refill.  */
+  uint32_t repeated;		/* Repetitions suppressed.  */
+  uint32_t dropped;		/* Messages dropped by the bucket.  */
+};
+
+/* Layout of the table.  A freshly created segment is zero-filled,
+   which is a valid, empty table.  */
+struct ratelimit_table
+{
+  char magic[8];
+  uint32_t nslots;
+  uint32_t pad;
+  struct ratelimit_slot slots[RATELIMIT_SLOTS];
+};
+
+struct ratelimit_s
+{
+  struct ratelimit_table *table;
+  int shared;			/* True if TABLE is mapped.  */
+};
+
+/* Prefix of the name of the shared memory segment, or NULL.  */
+static const char *shm_prefix = RATELIMIT_SHM_PREFIX;
+
+
+
+/* Return the current time in milliseconds.  The monotonic clock is
+   shared by all processes of the system.  */
+static int64_t
+now_ms (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Take the lock of SLOT.  A lock held by a process which no longer
+   exists is broken.  Returns zero on success.  */
+static int
+slot_lock (struct ratelimit_slot *slot)
+{
+  uint32_t self = (uint32_t) getpid ();
+  uint32_t owner;
+  int tries;
+
+  for (tries = 0; tries < 2; tries++)
+    {
+      unsigned int spins;
+
+      for (spins = 0; spins < RATELIMIT_LOCK_SPINS; spins++)
+	{
+	  owner = 0;
+	  if (__atomic_compare_exchange_n (&slot->lock, &owner, self, 0,
+					   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+	    return 0;
+	  if (spins % 64 == 63)
+	    sched_yield ();
+	}
+
+      /* A process killed while holding the lock would block the slot
+	 forever.  */
+      owner = __atomic_load_n (&slot->lock, __ATOMIC_RELAXED);
+      if (owner && kill ((pid_t) owner, 0) && errno == ESRCH)
+	__atomic_compare_exchange_n (&slot->lock, &owner, 0, 0,
+				     __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    }
+
+  return -1;
+}
+
+static void
+slot_unlock (struct ratelimit_slot *slot)
+{
+  __atomic_store_n (&slot->lock, 0, __ATOMIC_RELEASE);
+}
+
+/* Map the shared table, creating it if necessary, and store it in
+   *TABLE.  Returns proper error code.  */
+static gpg_error_t
+table_map_shared (struct ratelimit_table **table)
+{
+  struct ratelimit_table *table_new;
+  struct stat statbuf;
+  char name[64];
+  gpg_error_t err;
+  int created, tries;
+  int fd;
+
+  if (!shm_prefix)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  snprintf (name, sizeof (name), "%s%lu",
+	    shm_prefix, (unsigned long) geteuid ());
+
+  for (tries = 0; ; tries++)
+    {
+      created = 1;
+      fd = shm_open (name, O_RDWR | O_CREAT | O_EXCL, 0600);
+      if (fd == -1 && errno == EEXIST)
+	{
+	  created = 0;
+	  fd = shm_open (name, O_RDWR, 0);
+	}
+      if (fd == -1)
+	return gpg_error_from_errno (errno);
+
+      if (created)
+	break;
+
+      /* Never trust a segment which might have been created by
+	 someone else.  */
+      if (fstat (fd, &statbuf))
+	{
+	  err = gpg_error_from_errno (errno);
+	  goto out;
+	}
+      if (statbuf.st_uid == geteuid ()
+	  && !(statbuf.st_mode & (S_IWGRP | S_IWOTH)))
+	break;
+
+      /* Since anyone may create segments, another user may have
+	 taken our name; replace the segment if we are allowed to
+	 (e.g. as root).  Otherwise, or if it is taken again, we do
+	 without it.  */
+      close (fd);
+      if (tries || shm_unlink (name))
+	return gpg_error (GPG_ERR_BAD_DATA);
+    }
+
+  if (created)
+    {
+      if (ftruncate (fd, sizeof (*table_new)))
+	{
+	  err = gpg_error_from_errno (errno);
+	  shm_unlink (name);
+	  goto out;
+	}
+    }
+  else if (statbuf.st_size != sizeof (*table_new))
+    {
+      err = gpg_error (GPG_ERR_BAD_DATA);
+      goto out;
+    }
+
+  table_new = mmap (NULL, sizeof (*table_new), PROT_READ | PROT_WRITE,
+		    MAP_SHARED, fd, 0);
+  if (table_new == MAP_FAILED)
+    {
+      err = gpg_error_from_errno (errno);
+      goto out;
+    }
+
+  if (created)
+    {
+      table_new->nslots = RATELIMIT_SLOTS;
+      memcpy (table_new->magic, RATELIMIT_MAGIC, sizeof (table_new->magic));
+    }
+  else if (memcmp (table_new->magic, RATELIMIT_MAGIC, sizeof (table_new->magic))
+	   || table_new->nslots != RATELIMIT_SLOTS)
+    {
+      /* Either a table of a different version or one which is still
+	 being set up; in both cases we do without it.  */
+      munmap (table_new, sizeof (*table_new));
+      err = gpg_error (GPG_ERR_BAD_DATA);
+      goto out;
+    }
+
+  *table = table_new;
+  err = 0;
+
+ out:
+
+  close (fd);
+
+  return err;
+}
+
+gpg_error_t
+ratelimit_open (ratelimit_t *rl)
+{
+  ratelimit_t rl_new;
+  gpg_error_t err;
+
+  rl_new = xtrymalloc (sizeof (*rl_new));
+  if (!rl_new)
+    return gpg_error_from_errno (errno);
+
+  err = table_map_shared (&rl_new->table);
+  if (!err)
+    rl_new->shared = 1;
+  else
+    {
+      rl_new->shared = 0;
+      rl_new->table = xtrymalloc (sizeof (*rl_new->table));
+      if (!rl_new->table)
+	{
+	  err = gpg_error_from_errno (errno);
+	  xfree (rl_new);
+	  return err;
+	}
+      memset (rl_new->table, 0, sizeof (*rl_new->table));
+      rl_new->table->nslots = RATELIMIT_SLOTS;
+    }
+
+  *rl = rl_new;
+
+  return 0;
+}
+
+void
+ratelimit_close (ratelimit_t rl)
+{
+  if (rl)
+    {
+      if (rl->shared)
+	munmap (rl->table, sizeof (*rl->table));
+      else
+	xfree (rl->table);
+      xfree (rl);
+    }
+}
+
+int
+ratelimit_is_shared (ratelimit_t rl)
+{
+  return rl->shared;
+}
+
+void
+ratelimit_set_shm_prefix (const char *prefix)
+{
+  shm_prefix = prefix;
+}
+
+uint64_t
+ratelimit_hash (uint64_t seed, const void *data, size_t len)
+{
+  const unsigned char *p = data;
+  uint64_t h = seed;
+
+  while (len--)
+    {
+      h ^= *p++;
+      h *= 0x100000001b3ULL;
+    }
+
+  return h;
+}
+
+/* Find the slot for SITE in TABLE, claiming a free one if SITE has no
+   slot yet, and lock it.  Returns NULL if no slot could be locked.  */
+static struct ratelimit_slot *
+table_lookup (struct ratelimit_table *table, uint64_t site)
+{
+  struct ratelimit_slot *slot;
+  unsigned int i;
+
+  for (i = 0; i < RATELIMIT_PROBES; i++)
+    {
+      slot = &table->slots[(site + i) % RATELIMIT_SLOTS];
+      if (slot_lock (slot))
+	continue;
+      if (slot->site == site)
+	return slot;
+      if (!slot->site)
+	goto claim;
+      slot_unlock (slot);
+    }
+
+  /* The neighborhood is full; take over the home slot of SITE.  */
+  slot = &table->slots[site % RATELIMIT_SLOTS];
+  if (slot_lock (slot))
+    return NULL;
+
+ claim:
+
+  slot->site = site;
+  slot->last_msg = 0;
+  slot->last_msg_ms = 0;
+  slot->tokens = -1;		/* Filled on first use.  */
+  slot->refill_ms = 0;
+  slot->repeated = 0;
+  slot->dropped = 0;
+
+  return slot;
+}
+
+ratelimit_result_t
+ratelimit_check (ratelimit_t rl, uint64_t site, uint64_t msg,
+		 unsigned int rate, unsigned int burst,
+		 struct ratelimit_report *report)
+{
+  struct ratelimit_slot *slot;
+  ratelimit_result_t result;
+  int64_t now, capacity;
+
+  report->repeated = 0;
+  report->dropped = 0;
+
+  if (!site)
+    /* Zero marks free slots.  */
+    site = 1;
+
+  slot = table_lookup (rl->table, site);
+  if (!slot)
+    /* Better log too much than nothing at all.  */
+    return RATELIMIT_PASS;
+
+  now = now_ms ();
+
+  if (!burst)
+    burst = rate ? rate : 1;
+  capacity = (int64_t) burst * RATELIMIT_TOKEN;
+
+  /* Refill the bucket.  */
+  if (slot->tokens < 0)
+    slot->tokens = capacity;
+  else if (now > slot->refill_ms)
+    slot->tokens += (now - slot->refill_ms) * rate;
+  if (slot->tokens > capacity)
+    slot->tokens = capacity;
+  slot->refill_ms = now;
+
+  if (slot->last_msg_ms && msg == slot->last_msg
+      && now - slot->last_msg_ms < RATELIMIT_REPEAT_WINDOW)
+    {
+      slot->repeated++;
+      result = RATELIMIT_REPEATED;
+    }
+  else if (rate && slot->tokens < RATELIMIT_TOKEN)
+    {
+      slot->dropped++;
+      result = RATELIMIT_DROP;
+    }
+  else
+    {
+      if (rate)
+	slot->tokens -= RATELIMIT_TOKEN;
+      report->repeated = slot->repeated;
+      report->dropped = slot->dropped;
+      slot->repeated = 0;
+      slot->dropped = 0;
+      slot->last_msg = msg;
+      slot->last_msg_ms = now;
+      result = RATELIMIT_PASS;
+    }
+
+  slot_unlock (slot);
+
+  return result;
+}
+
+/* END */
@@ -0,0 +1,91 @@
+/* ratelimit.h - Shared rate limiting of log messages for Poldi
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of Poldi.
+
+   Poldi is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   Poldi is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.  */
+
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <gpg-error.h>
+
+/* A rate limiter keeps a token bucket and the state needed for
+   duplicate suppression for each message site.  Sites are identified
+   by 64 bit keys; messages are identified by 64 bit hashes of their
+   text.
+
+   The table holding this state lives in a small POSIX shared memory
+   segment of the effective user, so that limits hold across the many
+   short-lived processes using PAM.  If the segment cannot be used
+   (e.g. because another user has created it first and we cannot
+   remove it), a process-local table is used instead.  */
+
+/* Handle for a rate limiter table.  */
+typedef struct ratelimit_s *ratelimit_t;
+
+/* Result of ratelimit_check.  */
+typedef enum
+  {
+    RATELIMIT_PASS,		/* Emit the message.  */
+    RATELIMIT_DROP,		/* Suppress it, the bucket is empty.  */
+    RATELIMIT_REPEATED		/* Suppress it, it is a duplicate.  */
+  } ratelimit_result_t;
+
+/* Counters of suppressed messages, which are to be reported when
+   ratelimit_check returns RATELIMIT_PASS.  */
+struct ratelimit_report
+{
+  unsigned int repeated;	/* The previous message was repeated
+				   this many times.  */
+  unsigned int dropped;		/* This many messages were dropped.  */
+};
+
+/* Open the shared rate limiter table, falling back to a process-local
+   table, and store it in *RL.  Returns proper error code.  */
+gpg_error_t ratelimit_open (ratelimit_t *rl);
+
+/* Release RL.  RL being NULL is okay.  */
+void ratelimit_close (ratelimit_t rl);
+
+/* Return true if RL uses the shared table.  */
+int ratelimit_is_shared (ratelimit_t rl);
+
+/* Use PREFIX instead of the default prefix for the name of the shared
+   memory segment opened by ratelimit_open; with PREFIX being NULL, a
+   process-local table is used.  Meant for tests only.  */
+void ratelimit_set_shm_prefix (const char *prefix);
+
+/* Decide whether a message with hash MSG may be emitted at the site
+   SITE, which allows RATE messages per second with bursts of up to
+   BURST messages.  Identical messages at the same site within a
+   short window are suppressed as repetitions.  On RATELIMIT_PASS,
+   REPORT receives the counters of messages suppressed at the site
+   since the last message passed.  */
+ratelimit_result_t ratelimit_check (ratelimit_t rl, uint64_t site,
+				    uint64_t msg,
+				    unsigned int rate, unsigned int burst,
+				    struct ratelimit_report *report);
+
+/* Return the 64 bit FNV-1a hash of the LEN bytes at DATA, continuing
+   from the hash value SEED; use RATELIMIT_HASH_INIT to start a new
+   hash.  */
+#define RATELIMIT_HASH_INIT 0xcbf29ce484222325ULL
+uint64_t ratelimit_hash (uint64_t seed, const void *data, size_t len);
+
+#endif
@@ -0,0 +1,276 @@
+/* secarena.c - Locked memory arena for secrets
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of Poldi.
+
+   Poldi is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   Poldi is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.  */
+
+#include <util-local.h>
+
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "util.h"
+#include "secarena.h"
+
+/* Slot classes of the arena: PINs, challenges and the like; signature
+   responses (RSA 4096 and the membuf slack); larger buffers.  Each
+   class has at most 32 slots, so that a single word records which of
+   them are in use.  */
+static const struct
+{
+  size_t size;
+  unsigned int count;
+} slot_classes[] =
+  {
+    {  128, 32 },
+    { 1024,  8 },
+    { 4096,  2 }
+  };
+
+#define NCLASSES DIM (slot_classes)
+
+/* Buffers served from the heap are preceded by this header, which
+   records the size to wipe.  */
+union heap_header
+{
+  size_t size;
+  long double align;
+};
+
+static pthread_mutex_t arena_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The arena, its size and the offsets of the slot classes in it.  */
+static unsigned char *arena;
+static size_t arena_size;
+static size_t class_offset[NCLASSES];
+
+/* Bit I of SLOTS_USED[C] is set if slot I of class C is in use.  */
+static uint32_t slots_used[NCLASSES];
+
+/* True if setting up the arena failed; we do not try again.  */
+static int arena_failed;
+
+/* True if the arena is locked into memory.  */
+static int arena_locked;
+
+
+
+/* Overwrite the N bytes at P.  */
+static void
+wipe_buffer (void *p, size_t n)
+{
+  volatile unsigned char *vp = p;
+
+  while (n--)
+    *vp++ = 0;
+}
+
+/* Map and lock the arena.  Must be called with ARENA_LOCK held.
+   Returns zero on success.  */
+static int
+arena_setup (void)
+{
+  long pagesize;
+  size_t size;
+  unsigned int i;
+  void *p;
+
+  size = 0;
+  for (i = 0; i < NCLASSES; i++)
+    {
+      class_offset[i] = size;
+      size += slot_classes[i].size * slot_classes[i].count;
+    }
+
+  pagesize = sysconf (_SC_PAGESIZE);
+  if (pagesize <= 0)
+    pagesize = 4096;
+  size = (size + pagesize - 1) & ~((size_t) pagesize - 1);
+
+  p = mmap (NULL, size, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED)
+    return -1;
+
+  /* This is done once for the whole arena, not per allocation.  The
+     arena is set up lazily, so that it is locked with the privileges
+     in effect when the first secret is handled.  */
+  arena_locked = !mlock (p, size);
+#ifdef MADV_DONTDUMP
+  madvise (p, size, MADV_DONTDUMP);
+#endif
+
+  arena = p;
+  arena_size = size;
+
+  return 0;
+}
+
+/* Return the slot class of the arena buffer P, or -1 if P does not
+   belong to the arena.  */
+static int
+arena_class (const void *p)
+{
+  const unsigned char *cp = p;
+  unsigned int i;
+
+  if (!arena || cp < arena || cp >= arena + arena_size)
+    return -1;
+
+  for (i = NCLASSES; i-- > 0; )
+    if (cp >= arena + class_offset[i])
+      return i;
+
+  return -1;
+}
+
+/* Take a free slot of at least N bytes from the arena.  Returns NULL
+   if there is none.  */
+static void *
+arena_alloc (size_t n)
+{
+  void *p = NULL;
+  unsigned int i, slot;
+
+  pthread_mutex_lock (&arena_lock);
+
+  if (!arena && !arena_failed && arena_setup ())
+    arena_failed = 1;
+
+  if (arena)
+    for (i = 0; i < NCLASSES && !p; i++)
+      {
+	if (n > slot_classes[i].size)
+	  continue;
+	for (slot = 0; slot < slot_classes[i].count; slot++)
+	  if (!(slots_used[i] & (1U << slot)))
+	    {
+	      slots_used[i] |= 1U << slot;
+	      p = arena + class_offset[i] + slot * slot_classes[i].size;
+	      break;
+	    }
+      }
+
+  pthread_mutex_unlock (&arena_lock);
+
+  return p;
+}
+
+void *
+secarena_malloc (size_t n)
+{
+  union heap_header *h;
+  void *p;
+
+  p = arena_alloc (n);
+  if (p)
+    return p;
+
+  if (n > SIZE_MAX - sizeof (*h))
+    {
+      errno = ENOMEM;
+      return NULL;
+    }
+
+  h = xtrymalloc (sizeof (*h) + n);
+  if (!h)
+    return NULL;
+  h->size = n;
+
+  return h + 1;
+}
+
+char *
+secarena_strdup (const char *s)
+{
+  size_t n = strlen (s) + 1;
+  char *p;
+
+  p = secarena_malloc (n);
+  if (p)
+    memcpy (p, s, n);
+
+  return p;
+}
+
+void *
+secarena_realloc (void *p, size_t n)
+{
+  size_t size;
+  void *p_new;
+  int c;
+
+  if (!p)
+    return secarena_malloc (n);
+
+  c = arena_class (p);
+  if (c >= 0)
+    size = slot_classes[c].size;
+  else
+    size = ((union heap_header *) p - 1)->size;
+
+  if (n <= size)
+    return p;
+
+  p_new = secarena_malloc (n);
+  if (!p_new)
+    return NULL;
+
+  memcpy (p_new, p, size);
+  secarena_free (p);
+
+  return p_new;
+}
+
+void
+secarena_free (void *p)
+{
+  union heap_header *h;
+  unsigned int slot;
+  int c;
+
+  if (!p)
+    return;
+
+  c = arena_class (p);
+  if (c >= 0)
+    {
+      slot = ((unsigned char *) p - arena - class_offset[c])
+	/ slot_classes[c].size;
+      wipe_buffer (p, slot_classes[c].size);
+      pthread_mutex_lock (&arena_lock);
+      slots_used[c] &= ~(1U << slot);
+      pthread_mutex_unlock (&arena_lock);
+    }
+  else
+    {
+      h = (union heap_header *) p - 1;
+      wipe_buffer (h, sizeof (*h) + h->size);
+      xfree (h);
+    }
+}
+
+int
+secarena_is_locked (void)
+{
+  return arena_locked;
+}
+
+/* END */
@@ -0,0 +1,56 @@
+/* secarena.h - Locked memory arena for secrets
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of Poldi.
+
+   Poldi is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   Poldi is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.  */
+
+#ifndef SECARENA_H
+#define SECARENA_H
+
+#include <stddef.h>
+
+/* The secure arena holds short-lived secrets like PINs, challenges
+   and signatures.  It is a small, process-wide mapping divided into
+   slots of a few fixed sizes; it is set up and locked into memory
+   (mlock) on the first allocation, so that it costs nothing in
+   processes which never use it and the locking is done only once.
+   Slots are wiped when released.
+
+   Libgcrypt's secure memory cannot be used in the PAM module, since
+   it drops privileges when initialized.  If the arena cannot be
+   locked (e.g. because of RLIMIT_MEMLOCK), it is used unlocked.
+   Requests which do not fit into a free slot are served from the
+   heap; those buffers are wiped as well when released.  */
+
+/* Allocate a buffer of N bytes from the arena.  Returns NULL and sets
+   errno on failure.  */
+void *secarena_malloc (size_t n);
+
+/* Return a copy of the string S allocated from the arena.  */
+char *secarena_strdup (const char *s);
+
+/* Resize the buffer P, which must have been allocated from the arena,
+   to N bytes.  On failure, NULL is returned and P stays valid.  */
+void *secarena_realloc (void *p, size_t n);
+
+/* Wipe and release the buffer P, which must have been allocated from
+   the arena.  P being NULL is okay.  */
+void secarena_free (void *p);
+
+/* Return true if the arena has been locked into memory.  */
+int secarena_is_locked (void);
+
+#endif
@@ -27,21 +27,319 @@
 #include <assert.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <syslog.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/uio.h>
 
 #include <gpg-error.h>
 
 #include "simplelog.h"
+#include "ratelimit.h"
+
+/* Maximum length of a single formatted log record, including the
+   trailing newline.  Longer messages are truncated.  */
+#define LOG_RECORD_SIZE 1024
+
+/* Number of records the ring of the asynchronous backend can hold.  */
+#define LOG_RING_SLOTS 256
+
+/* Maximum number of records written by a single system call.  */
+#define LOG_BATCH_SIZE 64
+
+/* A record queued for the background writer.  */
+struct log_ring_slot
+{
+  size_t len;
+  char data[LOG_RECORD_SIZE];
+};
+
+/* Maximum number of message sites with their own rate limit.  */
+#define LOG_RATE_LIMIT_SITES 8
+
+/* A rate limit configured for a log level or a message site.  */
+struct log_rate_limit
+{
+  int enabled;
+  unsigned int rate;		/* Messages per second.  */
+  unsigned int burst;		/* Maximum burst.  */
+};
+
+/* State of the asynchronous backend.  The ring is a single-producer,
+   single-consumer queue: the consumer is the background writer, the
+   producer whichever thread holds the lock of the log handle, so
+   that threads sharing a handle take turns.  HEAD is only written
+   with that lock held, TAIL only by the writer; the writer takes no
+   locks.  */
+struct log_ring
+{
+  struct log_ring_slot slots[LOG_RING_SLOTS];
+  unsigned int head;		/* Next slot to fill.  */
+  unsigned int tail;		/* Next slot to write out.  */
+  unsigned long dropped;	/* Records dropped due to overflow.  */
+  int sleeping;			/* True while the writer waits on
+				   WAKEUP.  */
+  int stop;			/* Writer shall terminate.  */
+  sem_t wakeup;
+  pthread_t writer;
+  pid_t pid;			/* Process running the writer.  */
+  int fd;			/* Log file descriptor.  */
+};
 
 struct log_handle
 {
+  /* Serializes all use of the handle, which may be shared between
+     threads; everything below is protected by it.  */
+  pthread_mutex_t lock;
+
   log_backend_t backend;
   log_level_t min_level;
   unsigned int flags;
   char prefix[LOG_PREFIX_LENGTH];
   FILE *stream;
+  struct log_ring *ring;	/* For LOG_BACKEND_ASYNC.  */
+
+  /* Buffer for formatting records.  */
+  char record[LOG_RECORD_SIZE];
+
+  /* Cached timestamp string for STAMP_TIME.  */
+  time_t stamp_time;
+  char stamp[32];
+
+  /* Structured logging.  */
+  log_format_t format;
+  char correlation_id[LOG_CORRELATION_ID_LENGTH];
+  struct
+  {
+    char key[32];
+    char value[64];
+  } context[LOG_CONTEXT_FIELDS];
+
+  /* Rate limiting; RATELIMIT is NULL unless a limit has been
+     configured.  */
+  ratelimit_t ratelimit;
+  struct log_rate_limit level_limit[LOG_LEVEL_FATAL + 1];
+  struct
+  {
+    char *fmt;
+    log_level_t level;
+    struct log_rate_limit limit;
+  } site_limit[LOG_RATE_LIMIT_SITES];
+  int in_ratelimit;		/* True while reporting suppressed
+				   messages.  */
 };
 
+
+
+/*
+ * Asynchronous backend.
+ */
+
+/* Write the IOVCNT buffers described by IOV to FD, retrying on
+   partial writes.  IOV is modified.  */
+static void
+ring_write_all (int fd, struct iovec *iov, int iovcnt)
+{
+  ssize_t ret;
+
+  while (iovcnt)
+    {
+      ret = writev (fd, iov, iovcnt);
+      if (ret < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  /* Nothing sensible left to do about it.  */
+	  return;
+	}
+
+      while (iovcnt && (size_t) ret >= iov->iov_len)
+	{
+	  ret -= iov->iov_len;
+	  iov++;
+	  iovcnt--;
+	}
+      if (iovcnt)
+	{
+	  iov->iov_base = (char *) iov->iov_base + ret;
+	  iov->iov_len -= ret;
+	}
+    }
+}
+
+/* Main function of the background writer: drain the ring in batches,
+   so that each batch of records costs a single system call.  */
+static void *
+ring_writer (void *opaque)
+{
+  struct log_ring *ring = opaque;
+  struct iovec iov[LOG_BATCH_SIZE + 1];
+  unsigned long dropped, reported;
+  char notice[64];
+  unsigned int head, tail, n, i;
+  int iovcnt;
+
+  reported = 0;
+  tail = ring->tail;
+
+  for (;;)
+    {
+      head = __atomic_load_n (&ring->head, __ATOMIC_ACQUIRE);
+      if (head == tail)
+	{
+	  if (__atomic_load_n (&ring->stop, __ATOMIC_ACQUIRE))
+	    break;
+
+	  /* Announce that we are going to sleep and check again, so
+	     that a record queued concurrently is not missed.  */
+	  __atomic_store_n (&ring->sleeping, 1, __ATOMIC_SEQ_CST);
+	  if (__atomic_load_n (&ring->head, __ATOMIC_SEQ_CST) == tail
+	      && !__atomic_load_n (&ring->stop, __ATOMIC_SEQ_CST))
+	    while (sem_wait (&ring->wakeup) && errno == EINTR)
+	      ;
+	  __atomic_store_n (&ring->sleeping, 0, __ATOMIC_SEQ_CST);
+	  continue;
+	}
+
+      iovcnt = 0;
+
+      dropped = __atomic_load_n (&ring->dropped, __ATOMIC_RELAXED);
+      if (dropped != reported)
+	{
+	  iov[iovcnt].iov_base = notice;
+	  iov[iovcnt].iov_len = snprintf (notice, sizeof (notice),
+					  "%lu log messages dropped\n",
+					  dropped - reported);
+	  iovcnt++;
+	  reported = dropped;
+	}
+
+      n = head - tail;
+      if (n > LOG_BATCH_SIZE)
+	n = LOG_BATCH_SIZE;
+      for (i = 0; i < n; i++)
+	{
+	  struct log_ring_slot *slot = &ring->slots[(tail + i) % LOG_RING_SLOTS];
+
+	  iov[iovcnt].iov_base = slot->data;
+	  iov[iovcnt].iov_len = slot->len;
+	  iovcnt++;
+	}
+
+      ring_write_all (ring->fd, iov, iovcnt);
+
+      tail += n;
+      __atomic_store_n (&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+
+  return NULL;
+}
+
+/* Queue the record DATA/LEN in RING.  If the ring is full, the
+   record is dropped and counted.  */
+static void
+ring_push (struct log_ring *ring, const char *data, size_t len)
+{
+  struct log_ring_slot *slot;
+  unsigned int head, tail;
+
+  if (ring->pid != getpid ())
+    {
+      /* We are a forked child; the writer thread did not survive the
+	 fork, write synchronously.  */
+      struct iovec iov;
+
+      iov.iov_base = (void *) data;
+      iov.iov_len = len;
+      ring_write_all (ring->fd, &iov, 1);
+      return;
+    }
+
+  head = ring->head;
+  tail = __atomic_load_n (&ring->tail, __ATOMIC_ACQUIRE);
+  if (head - tail >= LOG_RING_SLOTS)
+    {
+      __atomic_add_fetch (&ring->dropped, 1, __ATOMIC_RELAXED);
+      return;
+    }
+
+  slot = &ring->slots[head % LOG_RING_SLOTS];
+  memcpy (slot->data, data, len);
+  slot->len = len;
+
+  __atomic_store_n (&ring->head, head + 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n (&ring->sleeping, __ATOMIC_SEQ_CST))
+    sem_post (&ring->wakeup);
+}
+
+/* Stop the writer of RING after it has written all queued records
+   and release RING.  */
+static void
+ring_destroy (struct log_ring *ring)
+{
+  if (ring->pid == getpid ())
+    {
+      __atomic_store_n (&ring->stop, 1, __ATOMIC_SEQ_CST);
+      sem_post (&ring->wakeup);
+      pthread_join (ring->writer, NULL);
+    }
+  sem_destroy (&ring->wakeup);
+  close (ring->fd);
+  xfree (ring);
+}
+
+/* Create a new ring writing to the file FILENAME and start its
+   writer; store the ring in *RING.  Returns proper error code.  */
+static gpg_error_t
+ring_create (struct log_ring **ring, const char *filename)
+{
+  struct log_ring *ring_new;
+  sigset_t all, old;
+  gpg_error_t err;
+  int ret;
+
+  ring_new = xtrymalloc (sizeof (*ring_new));
+  if (!ring_new)
+    return gpg_error_from_errno (errno);
+
+  ring_new->head = ring_new->tail = 0;
+  ring_new->dropped = 0;
+  ring_new->sleeping = 0;
+  ring_new->stop = 0;
+  ring_new->pid = getpid ();
+
+  ring_new->fd = open (filename, O_WRONLY | O_APPEND | O_CREAT, 0600);
+  if (ring_new->fd == -1)
+    {
+      err = gpg_error_from_errno (errno);
+      xfree (ring_new);
+      return err;
+    }
+
+  sem_init (&ring_new->wakeup, 0, 0);
+
+  /* The writer must not receive any signals meant for the
+     application.  */
+  sigfillset (&all);
+  pthread_sigmask (SIG_SETMASK, &all, &old);
+  ret = pthread_create (&ring_new->writer, NULL, ring_writer, ring_new);
+  pthread_sigmask (SIG_SETMASK, &old, NULL);
+  if (ret)
+    {
+      sem_destroy (&ring_new->wakeup);
+      close (ring_new->fd);
+      xfree (ring_new);
+      return gpg_error_from_errno (ret);
+    }
+
+  *ring = ring_new;
+
+  return 0;
+}
+
 static gpg_error_t
 internal_release_backend (log_handle_t handle)
 {
@@ -60,6 +358,12 @@ internal_release_backend (log_handle_t handle)
       assert (handle->stream);
       fclose (handle->stream);
       break;
+
+    case LOG_BACKEND_ASYNC:
+      assert (handle->ring);
+      ring_destroy (handle->ring);
+      handle->ring = NULL;
+      break;
     }
 
   handle->backend = LOG_BACKEND_NONE;
@@ -102,6 +406,20 @@ internal_set_backend_stream (log_handle_t handle, FILE *stream)
   return 0;
 }
 
+static gpg_error_t
+internal_set_backend_async (log_handle_t handle, const char *filename)
+{
+  gpg_error_t err;
+
+  assert (handle->backend == LOG_BACKEND_NONE);
+
+  err = ring_create (&handle->ring, filename);
+  if (!err)
+    handle->backend = LOG_BACKEND_ASYNC;
+
+  return err;
+}
+
 static gpg_error_t
 internal_set_backend_syslog (log_handle_t handle)
 {
@@ -128,6 +446,17 @@ log_create (log_handle_t *handle)
   (*handle)->min_level = LOG_LEVEL_INFO;
   (*handle)->flags = 0;
   (*handle)->prefix[0] = 0;
+  (*handle)->stream = NULL;
+  (*handle)->ring = NULL;
+  (*handle)->stamp_time = (time_t) -1;
+  (*handle)->format = LOG_FORMAT_TEXT;
+  (*handle)->correlation_id[0] = 0;
+  memset ((*handle)->context, 0, sizeof ((*handle)->context));
+  (*handle)->ratelimit = NULL;
+  memset ((*handle)->level_limit, 0, sizeof ((*handle)->level_limit));
+  memset ((*handle)->site_limit, 0, sizeof ((*handle)->site_limit));
+  (*handle)->in_ratelimit = 0;
+  pthread_mutex_init (&(*handle)->lock, NULL);
 
  out:
 
@@ -139,8 +468,14 @@ log_destroy (log_handle_t handle)
 {
   if (handle)
     {
+      int i;
+
       if (handle->backend != LOG_BACKEND_NONE)
 	internal_release_backend (handle);
+      ratelimit_close (handle->ratelimit);
+      for (i = 0; i < LOG_RATE_LIMIT_SITES; i++)
+	xfree (handle->site_limit[i].fmt);
+      pthread_mutex_destroy (&handle->lock);
       xfree (handle);
     }
 }
@@ -148,13 +483,17 @@ log_destroy (log_handle_t handle)
 void
 log_set_flags (log_handle_t handle, unsigned int flags)
 {
+  pthread_mutex_lock (&handle->lock);
   handle->flags |= flags;
+  pthread_mutex_unlock (&handle->lock);
 }
 
 void
 log_unset_flags (log_handle_t handle, unsigned int flags)
 {
+  pthread_mutex_lock (&handle->lock);
   handle->flags &= ~flags;
+  pthread_mutex_unlock (&handle->lock);
 }
 
 gpg_error_t
@@ -164,10 +503,12 @@ log_set_backend_file (log_handle_t handle, const char *filename)
 
   assert (handle);
 
+  pthread_mutex_lock (&handle->lock);
   if (handle->backend != LOG_BACKEND_NONE)
     internal_release_backend (handle);
 
   err = internal_set_backend_file (handle, filename);
+  pthread_mutex_unlock (&handle->lock);
 
   return err;
 }
@@ -179,14 +520,48 @@ log_set_backend_stream (log_handle_t handle, FILE *stream)
 
   assert (handle);
 
+  pthread_mutex_lock (&handle->lock);
   if (handle->backend != LOG_BACKEND_NONE)
     internal_release_backend (handle);
 
   err = internal_set_backend_stream (handle, stream);
+  pthread_mutex_unlock (&handle->lock);
 
   return err;
 }
 
+gpg_error_t
+log_set_backend_async (log_handle_t handle, const char *filename)
+{
+  gpg_error_t err;
+
+  assert (handle);
+
+  pthread_mutex_lock (&handle->lock);
+  if (handle->backend != LOG_BACKEND_NONE)
+    internal_release_backend (handle);
+
+  err = internal_set_backend_async (handle, filename);
+  pthread_mutex_unlock (&handle->lock);
+
+  return err;
+}
+
+unsigned long
+log_get_dropped (log_handle_t handle)
+{
+  unsigned long dropped = 0;
+
+  assert (handle);
+
+  pthread_mutex_lock (&handle->lock);
+  if (handle->backend == LOG_BACKEND_ASYNC)
+    dropped = __atomic_load_n (&handle->ring->dropped, __ATOMIC_RELAXED);
+  pthread_mutex_unlock (&handle->lock);
+
+  return dropped;
+}
+
 gpg_error_t
 log_set_backend_syslog (log_handle_t handle)
 {
@@ -194,10 +569,12 @@ log_set_backend_syslog (log_handle_t handle)
 
   assert (handle);
 
+  pthread_mutex_lock (&handle->lock);
   if (handle->backend != LOG_BACKEND_NONE)
     internal_release_backend (handle);
 
   err = internal_set_backend_syslog (handle);
+  pthread_mutex_unlock (&handle->lock);
 
   return err;
 }
@@ -208,8 +585,70 @@ log_set_prefix (log_handle_t handle, const char *prefix)
 {
   assert (handle);
 
+  pthread_mutex_lock (&handle->lock);
   strncpy (handle->prefix, prefix, sizeof (handle->prefix) - 1);
   handle->prefix[sizeof (handle->prefix) - 1] = 0;
+  pthread_mutex_unlock (&handle->lock);
+}
+
+void
+log_set_format (log_handle_t handle, log_format_t format)
+{
+  assert (handle);
+
+  pthread_mutex_lock (&handle->lock);
+  handle->format = format;
+  pthread_mutex_unlock (&handle->lock);
+}
+
+void
+log_set_correlation_id (log_handle_t handle, const char *id)
+{
+  assert (handle);
+
+  if (!id)
+    id = "";
+  pthread_mutex_lock (&handle->lock);
+  strncpy (handle->correlation_id, id, sizeof (handle->correlation_id) - 1);
+  handle->correlation_id[sizeof (handle->correlation_id) - 1] = 0;
+  pthread_mutex_unlock (&handle->lock);
+}
+
+void
+log_set_context_field (log_handle_t handle, const char *key, const char *value)
+{
+  int i, slot;
+
+  if (!handle)
+    return;
+
+  pthread_mutex_lock (&handle->lock);
+
+  slot = -1;
+  for (i = 0; i < LOG_CONTEXT_FIELDS; i++)
+    if (!strcmp (handle->context[i].key, key))
+      {
+	slot = i;
+	break;
+      }
+    else if (slot < 0 && !*handle->context[i].key)
+      slot = i;
+
+  if (slot < 0)
+    /* No room left; the field is silently ignored.  */
+    ;
+  else if (value)
+    {
+      strncpy (handle->context[slot].key, key,
+	       sizeof (handle->context[slot].key) - 1);
+      strncpy (handle->context[slot].value, value,
+	       sizeof (handle->context[slot].value) - 1);
+      handle->context[slot].value[sizeof (handle->context[slot].value) - 1] = 0;
+    }
+  else
+    memset (&handle->context[slot], 0, sizeof (handle->context[slot]));
+
+  pthread_mutex_unlock (&handle->lock);
 }
 
 void
@@ -221,11 +660,488 @@ log_set_min_level (log_handle_t handle, log_level_t min_level)
       || min_level == LOG_LEVEL_INFO
       || min_level == LOG_LEVEL_ERROR
       || min_level == LOG_LEVEL_FATAL)
-    handle->min_level = min_level;
+    {
+      pthread_mutex_lock (&handle->lock);
+      handle->min_level = min_level;
+      pthread_mutex_unlock (&handle->lock);
+    }
+}
+
+static gpg_error_t
+internal_set_rate_limit (log_handle_t handle, log_level_t level,
+			 const char *site, unsigned int rate,
+			 unsigned int burst)
+{
+  struct log_rate_limit *limit;
+  gpg_error_t err;
+  int i, slot;
+
+  if (level < LOG_LEVEL_DEBUG || level > LOG_LEVEL_FATAL)
+    return gpg_error (GPG_ERR_INV_VALUE);
+
+  if (!handle->ratelimit)
+    {
+      err = ratelimit_open (&handle->ratelimit);
+      if (err)
+	return err;
+    }
+
+  if (site)
+    {
+      slot = -1;
+      for (i = 0; i < LOG_RATE_LIMIT_SITES; i++)
+	if (handle->site_limit[i].fmt
+	    && handle->site_limit[i].level == level
+	    && !strcmp (handle->site_limit[i].fmt, site))
+	  {
+	    slot = i;
+	    break;
+	  }
+	else if (slot < 0 && !handle->site_limit[i].fmt)
+	  slot = i;
+
+      if (slot < 0)
+	return gpg_error (GPG_ERR_TOO_MANY);
+
+      if (!handle->site_limit[slot].fmt)
+	{
+	  handle->site_limit[slot].fmt = xtrystrdup (site);
+	  if (!handle->site_limit[slot].fmt)
+	    return gpg_error_from_errno (errno);
+	  handle->site_limit[slot].level = level;
+	}
+      limit = &handle->site_limit[slot].limit;
+    }
+  else
+    limit = &handle->level_limit[level];
+
+  limit->enabled = 1;
+  limit->rate = rate;
+  limit->burst = burst;
+
+  return 0;
+}
+
+gpg_error_t
+log_set_rate_limit (log_handle_t handle, log_level_t level, const char *site,
+		    unsigned int rate, unsigned int burst)
+{
+  gpg_error_t err;
+
+  assert (handle);
+
+  pthread_mutex_lock (&handle->lock);
+  err = internal_set_rate_limit (handle, level, site, rate, burst);
+  pthread_mutex_unlock (&handle->lock);
+
+  return err;
+}
+
+static gpg_error_t internal_log_write (log_handle_t handle, log_level_t level,
+				       const log_field_t *fields,
+				       size_t nfields,
+				       const char *fmt, va_list ap);
+
+/* Write a record for the message produced by FMT to HANDLE, bypassing
+   the rate limiter.  */
+static void
+internal_log_write_unlimited (log_handle_t handle, log_level_t level,
+			      const char *fmt, ...)
+{
+  va_list ap;
+
+  handle->in_ratelimit = 1;
+  va_start (ap, fmt);
+  internal_log_write (handle, level, NULL, 0, fmt, ap);
+  va_end (ap);
+  handle->in_ratelimit = 0;
+}
+
+/* Consult the rate limiter of HANDLE about a message of level LEVEL
+   produced by FMT/AP.  Every format string is a message site of its
+   own.  Returns true if the message is to be suppressed; before a
+   message passes, the messages suppressed at its site are
+   reported.  */
+static int
+internal_rate_limited (log_handle_t handle, log_level_t level,
+		       const char *fmt, va_list ap)
+{
+  struct ratelimit_report report;
+  struct log_rate_limit *limit;
+  ratelimit_result_t result;
+  unsigned char level_byte;
+  uint64_t site, msg;
+  va_list ap_copy;
+  int i, len;
+
+  limit = &handle->level_limit[level];
+  for (i = 0; i < LOG_RATE_LIMIT_SITES; i++)
+    if (handle->site_limit[i].fmt
+	&& handle->site_limit[i].level == level
+	&& !strcmp (handle->site_limit[i].fmt, fmt))
+      {
+	limit = &handle->site_limit[i].limit;
+	break;
+      }
+
+  if (!limit->enabled)
+    return 0;
+
+  /* Sites are keyed by the content of the format string rather than
+     its address, which differs between programs.  */
+  level_byte = level;
+  site = ratelimit_hash (RATELIMIT_HASH_INIT, &level_byte, 1);
+  site = ratelimit_hash (site, fmt, strlen (fmt));
+
+  /* Duplicate detection needs the actual message; the record buffer
+     is free for the moment.  */
+  va_copy (ap_copy, ap);
+  len = vsnprintf (handle->record, sizeof (handle->record), fmt, ap_copy);
+  va_end (ap_copy);
+  if (len < 0)
+    len = 0;
+  else if (len >= (int) sizeof (handle->record))
+    len = sizeof (handle->record) - 1;
+  msg = ratelimit_hash (RATELIMIT_HASH_INIT, handle->record, len);
+
+  result = ratelimit_check (handle->ratelimit, site, msg,
+			    limit->rate, limit->burst, &report);
+  if (result != RATELIMIT_PASS)
+    return 1;
+
+  if (report.repeated)
+    internal_log_write_unlimited (handle, level,
+				  "last message repeated %u times",
+				  report.repeated);
+  if (report.dropped)
+    internal_log_write_unlimited (handle, level,
+				  "%u similar messages suppressed",
+				  report.dropped);
+
+  return 0;
+}
+
+/* Append the string produced by FMT/AP to the record buffer of
+   HANDLE, which currently contains *LEN bytes.  */
+static void
+record_append_va (log_handle_t handle, size_t *len,
+		  const char *fmt, va_list ap)
+{
+  size_t size = sizeof (handle->record) - 1; /* Room for newline.  */
+  int ret;
+
+  if (*len >= size)
+    return;
+
+  ret = vsnprintf (handle->record + *len, size - *len, fmt, ap);
+  if (ret > 0)
+    *len += ret;
+  if (*len >= size)
+    /* Truncated.  */
+    *len = size - 1;
+}
+
+static void
+record_append (log_handle_t handle, size_t *len, const char *fmt, ...)
+{
+  va_list ap;
+
+  va_start (ap, fmt);
+  record_append_va (handle, len, fmt, ap);
+  va_end (ap);
+}
+
+/* Return the number of bytes needed for the JSON escaped form of the
+   character C.  */
+static size_t
+json_escaped_len (unsigned char c)
+{
+  if (c == '"' || c == '\\' || c == '\n' || c == '\r' || c == '\t')
+    return 2;
+  else if (c < 0x20)
+    return 6;
+  else
+    return 1;
+}
+
+/* Write the JSON escaped form of the character C to P, which must
+   provide json_escaped_len (C) bytes.  */
+static void
+json_escape_char (char *p, unsigned char c)
+{
+  static const char hex[] = "0123456789abcdef";
+
+  switch (c)
+    {
+    case '"':  p[0] = '\\'; p[1] = '"'; break;
+    case '\\': p[0] = '\\'; p[1] = '\\'; break;
+    case '\n': p[0] = '\\'; p[1] = 'n'; break;
+    case '\r': p[0] = '\\'; p[1] = 'r'; break;
+    case '\t': p[0] = '\\'; p[1] = 't'; break;
+    default:
+      if (c < 0x20)
+	{
+	  memcpy (p, "\\u00", 4);
+	  p[4] = hex[c >> 4];
+	  p[5] = hex[c & 15];
+	}
+      else
+	*p = c;
+      break;
+    }
+}
+
+/* Escape the STR_LEN bytes at offset START of the record buffer of
+   HANDLE in place for use inside a JSON string.  The buffer content
+   after the string is discarded.  Returns the new end of the
+   record.  */
+static size_t
+json_escape_inplace (log_handle_t handle, size_t start, size_t str_len)
+{
+  /* Leave room for the closing parts of the record.  */
+  size_t size = sizeof (handle->record) - 4;
+  char *s = handle->record + start;
+  size_t i, n, esc_len;
+
+  /* Determine how much of the string fits after escaping.  */
+  for (i = 0, esc_len = 0; i < str_len; i++)
+    {
+      n = json_escaped_len (s[i]);
+      if (start + esc_len + n > size)
+	break;
+      esc_len += n;
+    }
+  str_len = i;
+
+  /* Move from the end, so that nothing is overwritten before it has
+     been read.  */
+  n = esc_len;
+  while (str_len)
+    {
+      unsigned char c = s[--str_len];
+
+      n -= json_escaped_len (c);
+      json_escape_char (s + n, c);
+    }
+
+  return start + esc_len;
+}
+
+/* Append the JSON escaped string STR to the record buffer of
+   HANDLE.  */
+static void
+record_append_json_string (log_handle_t handle, size_t *len, const char *str)
+{
+  size_t size = sizeof (handle->record) - 4;
+  size_t n;
+
+  for (; *str; str++)
+    {
+      n = json_escaped_len (*str);
+      if (*len + n > size)
+	break;
+      json_escape_char (handle->record + *len, *str);
+      *len += n;
+    }
+}
+
+/* Return the name of log level LEVEL as used in structured output.  */
+static const char *
+level_name (log_level_t level)
+{
+  switch (level)
+    {
+    case LOG_LEVEL_DEBUG: return "debug";
+    case LOG_LEVEL_INFO:  return "info";
+    case LOG_LEVEL_ERROR: return "error";
+    case LOG_LEVEL_FATAL: return "fatal";
+    }
+
+  return "error";
+}
+
+/* Return the timestamp string for the current time, cached in
+   HANDLE.  */
+static const char *
+current_stamp (log_handle_t handle)
+{
+  time_t atime = time (NULL);
+
+  /* Converting the time is comparably expensive; do it only once per
+     second.  */
+  if (atime != handle->stamp_time)
+    {
+      struct tm tm;
+
+      localtime_r (&atime, &tm);
+      if (!strftime (handle->stamp, sizeof (handle->stamp),
+		     "%Y-%m-%d %H:%M:%S", &tm))
+	handle->stamp[0] = 0;
+      handle->stamp_time = atime;
+    }
+
+  return handle->stamp;
+}
+
+/* Format a record as JSON object into the record buffer of HANDLE.
+   The message produced by FMT/AP is formatted directly into the
+   buffer and escaped in place.  If FOR_SYSLOG is true, fields
+   provided by syslog itself are omitted.  Returns the length of the
+   record (without newline).  */
+static size_t
+internal_format_json (log_handle_t handle, log_level_t level,
+		      const log_field_t *fields, size_t nfields,
+		      int for_syslog, const char *fmt, va_list ap)
+{
+  size_t len, start, i;
+
+  len = 0;
+  record_append (handle, &len, "{");
+
+  if (!for_syslog)
+    {
+      if ((handle->flags & LOG_FLAG_WITH_PREFIX) && (*handle->prefix != 0))
+	{
+	  record_append (handle, &len, "\"ident\":\"");
+	  record_append_json_string (handle, &len, handle->prefix);
+	  record_append (handle, &len, "\",");
+	}
+      if (handle->flags & LOG_FLAG_WITH_TIME)
+	record_append (handle, &len, "\"time\":\"%s\",", current_stamp (handle));
+      if (handle->flags & LOG_FLAG_WITH_PID)
+	record_append (handle, &len, "\"pid\":%u,", (unsigned int) getpid ());
+    }
+
+  record_append (handle, &len, "\"level\":\"%s\"", level_name (level));
+
+  if (*handle->correlation_id)
+    record_append (handle, &len, ",\"auth_id\":\"%s\"",
+		   handle->correlation_id);
+
+  for (i = 0; i < LOG_CONTEXT_FIELDS; i++)
+    if (*handle->context[i].key)
+      {
+	record_append (handle, &len, ",\"%s\":\"", handle->context[i].key);
+	record_append_json_string (handle, &len, handle->context[i].value);
+	record_append (handle, &len, "\"");
+      }
+
+  for (i = 0; i < nfields; i++)
+    {
+      if (fields[i].type == LOG_FIELD_TYPE_UINT)
+	record_append (handle, &len, ",\"%s\":%llu",
+		       fields[i].key, fields[i].num);
+      else
+	{
+	  record_append (handle, &len, ",\"%s\":\"", fields[i].key);
+	  record_append_json_string (handle, &len,
+				     fields[i].str ? fields[i].str : "");
+	  record_append (handle, &len, "\"");
+	}
+    }
+
+  record_append (handle, &len, ",\"msg\":\"");
+  start = len;
+  record_append_va (handle, &len, fmt, ap);
+  len = json_escape_inplace (handle, start, len - start);
+
+  handle->record[len++] = '"';
+  handle->record[len++] = '}';
+
+  return len;
+}
+
+/* Format a record as plain text into the record buffer of HANDLE.
+   If FOR_SYSLOG is true, fields provided by syslog itself are
+   omitted.  Returns the length of the record (without newline).  */
+static size_t
+internal_format_text (log_handle_t handle, log_level_t level,
+		      const log_field_t *fields, size_t nfields,
+		      int for_syslog, const char *fmt, va_list ap)
+{
+  size_t len = 0;
+  size_t i;
+
+  if (!for_syslog)
+    {
+      if ((handle->flags & LOG_FLAG_WITH_PREFIX) && (*handle->prefix != 0))
+	record_append (handle, &len, "%s ", handle->prefix);
+
+      if (handle->flags & LOG_FLAG_WITH_TIME)
+	record_append (handle, &len, "%s ", current_stamp (handle));
+
+      if (handle->flags & LOG_FLAG_WITH_PID)
+	record_append (handle, &len, "[%u] ", (unsigned int) getpid ());
+
+      switch (level)
+	{
+	case LOG_LEVEL_ERROR:
+	case LOG_LEVEL_FATAL:
+	  record_append (handle, &len, "error: ");
+	  break;
+
+	case LOG_LEVEL_DEBUG:
+	  record_append (handle, &len, "debug: ");
+	  break;
+
+	case LOG_LEVEL_INFO:
+	  break;
+	}
+    }
+
+  record_append_va (handle, &len, fmt, ap);
+
+  if (handle->flags & LOG_FLAG_WITH_FIELDS)
+    {
+      if (*handle->correlation_id)
+	record_append (handle, &len, " auth_id=%s", handle->correlation_id);
+
+      for (i = 0; i < LOG_CONTEXT_FIELDS; i++)
+	if (*handle->context[i].key)
+	  record_append (handle, &len, " %s=%s",
+			 handle->context[i].key, handle->context[i].value);
+
+      for (i = 0; i < nfields; i++)
+	if (fields[i].type == LOG_FIELD_TYPE_UINT)
+	  record_append (handle, &len, " %s=%llu",
+			 fields[i].key, fields[i].num);
+	else
+	  record_append (handle, &len, " %s=%s",
+			 fields[i].key, fields[i].str ? fields[i].str : "");
+    }
+
+  return len;
+}
+
+/* Format a complete log record for a message of level LEVEL into the
+   record buffer of HANDLE, in the format configured for HANDLE.
+   Unless FOR_SYSLOG is true, a trailing newline is added.  Returns
+   the length of the record.  */
+static size_t
+internal_format_record (log_handle_t handle, log_level_t level,
+			const log_field_t *fields, size_t nfields,
+			int for_syslog, const char *fmt, va_list ap)
+{
+  size_t len;
+
+  if (handle->format == LOG_FORMAT_JSON)
+    len = internal_format_json (handle, level, fields, nfields,
+				for_syslog, fmt, ap);
+  else
+    len = internal_format_text (handle, level, fields, nfields,
+				for_syslog, fmt, ap);
+
+  if (for_syslog)
+    handle->record[len] = 0;
+  else
+    handle->record[len++] = '\n';
+
+  return len;
 }
 
 static gpg_error_t
 internal_log_write (log_handle_t handle, log_level_t level,
+		    const log_field_t *fields, size_t nfields,
 		    const char *fmt, va_list ap)
 {
   gpg_error_t err;
@@ -240,6 +1156,10 @@ internal_log_write (log_handle_t handle, log_level_t level,
        min_level. */
     return 0;
 
+  if (handle->ratelimit && !handle->in_ratelimit
+      && internal_rate_limited (handle, level, fmt, ap))
+    return 0;
+
   if (handle->backend == LOG_BACKEND_SYSLOG)
     {
       int syslog_priority;
@@ -268,54 +1188,62 @@ internal_log_write (log_handle_t handle, log_level_t level,
 	  syslog_priority = LOG_ERR;
 	  break;
 	}
-	  
-      vsyslog (LOG_MAKEPRI (LOG_AUTH, syslog_priority), fmt, ap);
+
+      if (handle->format == LOG_FORMAT_TEXT
+	  && !(handle->flags & LOG_FLAG_WITH_FIELDS))
+	vsyslog (LOG_MAKEPRI (LOG_AUTH, syslog_priority), fmt, ap);
+      else
+	{
+	  internal_format_record (handle, level, fields, nfields, 1, fmt, ap);
+	  syslog (LOG_MAKEPRI (LOG_AUTH, syslog_priority),
+		  "%s", handle->record);
+	}
       err = 0;
     }
   else if (handle->backend == LOG_BACKEND_STREAM
 	   || handle->backend == LOG_BACKEND_FILE)
     {
       FILE *stream = handle->stream;
+      size_t len;
 
       assert (stream);
 
-      if ((handle->flags & LOG_FLAG_WITH_PREFIX) && (*handle->prefix != 0))
-	fprintf (stream, "%s ", handle->prefix);
+      /* Emit the whole record at once, so that records of different
+	 processes logging to the same file do not get mixed up.  */
+      len = internal_format_record (handle, level, fields, nfields,
+				    0, fmt, ap);
+      fwrite (handle->record, len, 1, stream);
+      fflush (stream);
 
-      if (handle->flags & LOG_FLAG_WITH_TIME)
-	{
-	  struct tm *tp;
-	  time_t atime = time (NULL);
-          
-	  tp = localtime (&atime);
-	  fprintf (stream, "%04d-%02d-%02d %02d:%02d:%02d ",
-		   1900+tp->tm_year, tp->tm_mon+1, tp->tm_mday,
-		   tp->tm_hour, tp->tm_min, tp->tm_sec);
-	}
+      err = 0;
+    }
+  else if (handle->backend == LOG_BACKEND_ASYNC)
+    {
+      size_t len;
 
-      if (handle->flags & LOG_FLAG_WITH_PID)
-	fprintf (stream, "[%u] ", (unsigned int) getpid ());
+      len = internal_format_record (handle, level, fields, nfields,
+				    0, fmt, ap);
+      ring_push (handle->ring, handle->record, len);
 
-      switch (level)
-	{
-	case LOG_LEVEL_ERROR:
-	case LOG_LEVEL_FATAL:
-	  fprintf (stream, "error: ");
-	  break;
-
-	case LOG_LEVEL_DEBUG:
-	  fprintf (stream, "debug: ");
-	  break;
+      err = 0;
+    }
 
-	case LOG_LEVEL_INFO:
-	  break;
-	}
+  return err;
+}
 
-      vfprintf (stream, fmt, ap);
-      putc ('\n', stream);
+/* Like internal_log_write, but with the lock of HANDLE held, for
+   the entry points.  */
+static gpg_error_t
+locked_log_write (log_handle_t handle, log_level_t level,
+		  const log_field_t *fields, size_t nfields,
+		  const char *fmt, va_list ap)
+{
+  gpg_error_t err = 0;
 
-      err = 0;
-    }
+  pthread_mutex_lock (&handle->lock);
+  if (handle->backend != LOG_BACKEND_NONE)
+    err = internal_log_write (handle, level, fields, nfields, fmt, ap);
+  pthread_mutex_unlock (&handle->lock);
 
   return err;
 }
@@ -324,18 +1252,14 @@ gpg_error_t
 log_write (log_handle_t handle, log_level_t level,
 	   const char *fmt, ...)
 {
-  gpg_error_t err = 0;
+  gpg_error_t err;
+  va_list ap;
 
   assert (handle);
 
-  if (handle->backend != LOG_BACKEND_NONE)
-    {
-      va_list ap;
-
-      va_start (ap, fmt);
-      err = internal_log_write (handle, level, fmt, ap);
-      va_end (ap);
-    }
+  va_start (ap, fmt);
+  err = locked_log_write (handle, level, NULL, 0, fmt, ap);
+  va_end (ap);
 
   return err;
 }
@@ -344,12 +1268,52 @@ gpg_error_t
 log_write_va (log_handle_t handle, log_level_t level,
 	      const char *fmt, va_list ap)
 {
-  gpg_error_t err = 0;
-
   assert (handle);
 
-  if (handle->backend != LOG_BACKEND_NONE)
-    err = internal_log_write (handle, level, fmt, ap);
+  return locked_log_write (handle, level, NULL, 0, fmt, ap);
+}
+
+gpg_error_t
+log_write_fields (log_handle_t handle, log_level_t level,
+		  const log_field_t *fields, size_t nfields,
+		  const char *fmt, ...)
+{
+  gpg_error_t err;
+  va_list ap;
+
+  if (!handle)
+    return 0;
+
+  va_start (ap, fmt);
+  err = locked_log_write (handle, level, fields, nfields, fmt, ap);
+  va_end (ap);
+
+  return err;
+}
+
+gpg_error_t
+log_msg_error_code (log_handle_t handle, gpg_error_t code,
+		    const char *fmt, ...)
+{
+  log_field_t fields[2];
+  gpg_error_t err;
+  va_list ap;
+
+  if (!handle)
+    return 0;
+
+  fields[0].key = "error";
+  fields[0].type = LOG_FIELD_TYPE_UINT;
+  fields[0].str = NULL;
+  fields[0].num = gpg_err_code (code);
+  fields[1].key = "error_source";
+  fields[1].type = LOG_FIELD_TYPE_STR;
+  fields[1].str = gpg_strsource (code);
+  fields[1].num = 0;
+
+  va_start (ap, fmt);
+  err = locked_log_write (handle, LOG_LEVEL_ERROR, fields, 2, fmt, ap);
+  va_end (ap);
 
   return err;
 }
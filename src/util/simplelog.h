@@ -25,18 +25,22 @@
 
 #include <gpg-error.h>
 
+/* A log handle.  A handle may be used by several threads at once;
+   its records do not get mixed up.  */
 typedef struct log_handle *log_handle_t;
 
 #define LOG_FLAG_WITH_PREFIX (1 <<  0)
 #define LOG_FLAG_WITH_TIME   (1 <<  1)
 #define LOG_FLAG_WITH_PID    (1 <<  2)
+#define LOG_FLAG_WITH_FIELDS (1 <<  3) /* Append fields to text records. */
 
 typedef enum
   {
     LOG_BACKEND_NONE,
     LOG_BACKEND_STREAM,
     LOG_BACKEND_FILE,
-    LOG_BACKEND_SYSLOG
+    LOG_BACKEND_SYSLOG,
+    LOG_BACKEND_ASYNC
   } log_backend_t;
   
 typedef enum
@@ -47,8 +51,41 @@ typedef enum
     LOG_LEVEL_FATAL
   } log_level_t;
 
+/* Output formats.  */
+typedef enum
+  {
+    LOG_FORMAT_TEXT,		/* Traditional one-line text.  */
+    LOG_FORMAT_JSON		/* One JSON object per line.  */
+  } log_format_t;
+
 #define LOG_PREFIX_LENGTH 128
 
+/* Maximum length of a correlation ID, including terminating zero.  */
+#define LOG_CORRELATION_ID_LENGTH 33
+
+/* Maximum number of context fields per handle.  */
+#define LOG_CONTEXT_FIELDS 4
+
+/* Structured logging: a record can carry key/value fields in
+   addition to the message.  Keys must be plain identifiers; they are
+   not escaped.  */
+typedef enum
+  {
+    LOG_FIELD_TYPE_STR,
+    LOG_FIELD_TYPE_UINT
+  } log_field_type_t;
+
+typedef struct
+{
+  const char *key;
+  log_field_type_t type;
+  const char *str;
+  unsigned long long num;
+} log_field_t;
+
+#define LOG_FIELD_STR(key, value)  { (key), LOG_FIELD_TYPE_STR, (value), 0 }
+#define LOG_FIELD_UINT(key, value) { (key), LOG_FIELD_TYPE_UINT, NULL, (value) }
+
 gpg_error_t log_create (log_handle_t *handle);
 void log_destroy (log_handle_t handle);
 
@@ -56,19 +93,62 @@ void log_set_flags (log_handle_t handle, unsigned int flags);
 void log_unset_flags (log_handle_t handle, unsigned int flags);
 void log_set_prefix (log_handle_t handle, const char *prefix);
 void log_set_min_level (log_handle_t handle, log_level_t min_level);
+void log_set_format (log_handle_t handle, log_format_t format);
+
+/* Set the correlation ID, which is attached to every record of
+   HANDLE; ID being NULL removes it.  */
+void log_set_correlation_id (log_handle_t handle, const char *id);
+
+/* Set the context field KEY to VALUE; context fields are attached to
+   every record of HANDLE until changed.  VALUE being NULL removes the
+   field.  */
+void log_set_context_field (log_handle_t handle,
+			    const char *key, const char *value);
 
 gpg_error_t log_set_backend_stream (log_handle_t handle, FILE *fp);
 gpg_error_t log_set_backend_file (log_handle_t handle, const char *filename);
 gpg_error_t log_set_backend_syslog (log_handle_t handle);
 
+/* Log to the file FILENAME through a background writer thread:
+   records are queued in a fixed-size ring and written out in
+   batches.  When the ring is full, records are dropped; the writer
+   reports the number of dropped records in the log.  */
+gpg_error_t log_set_backend_async (log_handle_t handle, const char *filename);
+
+/* Return the number of records dropped by the asynchronous backend
+   of HANDLE so far.  */
+unsigned long log_get_dropped (log_handle_t handle);
+
+/* Limit the records of level LEVEL written to HANDLE to RATE per
+   second, allowing bursts of up to BURST records.  Limits apply per
+   message site, i.e. per format string; if SITE is not NULL, the
+   limit only applies to the site using SITE as format string and
+   overrides the limit for LEVEL.  A RATE of zero disables the token
+   bucket.  In any case, a message repeating the previous one at its
+   site is suppressed and reported later as "last message repeated N
+   times".  The limiter state is shared between processes if
+   possible.  */
+gpg_error_t log_set_rate_limit (log_handle_t handle, log_level_t level,
+				const char *site,
+				unsigned int rate, unsigned int burst);
+
 gpg_error_t log_write (log_handle_t handle, log_level_t level,
 		       const char *fmt, ...);
 gpg_error_t log_write_va (log_handle_t handle, log_level_t level,
 			  const char *fmt, va_list ap);
 
+/* Write a record with the NFIELDS fields FIELDS attached.  */
+gpg_error_t log_write_fields (log_handle_t handle, log_level_t level,
+			      const log_field_t *fields, size_t nfields,
+			      const char *fmt, ...);
+
 gpg_error_t log_msg_debug (log_handle_t handle, const char *fmt, ...);
 gpg_error_t log_msg_info  (log_handle_t handle, const char *fmt, ...);
 gpg_error_t log_msg_error (log_handle_t handle, const char *fmt, ...);
 gpg_error_t log_msg_fatal (log_handle_t handle, const char *fmt, ...);
 
+/* Like log_msg_error, but attach the error code ERR as field.  */
+gpg_error_t log_msg_error_code (log_handle_t handle, gpg_error_t err,
+				const char *fmt, ...);
+
 #endif
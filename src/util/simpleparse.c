@@ -34,6 +34,17 @@
 #include "simpleparse.h"
 #include "support.h"
 
+/* Token list.  Tokens are not copied; they point into the line
+   buffer, which is modified in place to terminate them.  The vector
+   of token pointers grows geometrically and is reused for all lines
+   of a stream.  */
+typedef struct
+{
+  char **tokens;
+  unsigned int size;		/* Number of tokens.  */
+  unsigned int capacity;	/* Number of allocated slots.  */
+} token_list_t;
+
 struct simpleparse_handle
 {
   unsigned flags;		   /* General flags. */
@@ -52,14 +63,15 @@ struct simpleparse_handle
   simpleparse_opt_spec_t *specs;   /* Specifications for the supported options. */
   FILE *stream_stdout;
   FILE *stream_stderr;
-};
-
-/** String list. **/
-
-#define TOKENSIZE 512
 
-/* For now, we use static allocation... */
-typedef char token_t[TOKENSIZE];
+  /* The specifications compiled for fast lookup: SPECS_SORTED holds
+     pointers to the NSPECS specifications sorted by long option
+     name; SHORT_INDEX maps short option characters to one plus the
+     index of their specification in SPECS, or zero.  */
+  simpleparse_opt_spec_t **specs_sorted;
+  unsigned int nspecs;
+  unsigned short short_index[UCHAR_MAX + 1];
+};
 
 /* Install the logging handle LOGHANDLE in HANDLE.  */
 void
@@ -70,67 +82,112 @@ simpleparse_set_loghandle (simpleparse_handle_t handle,
   handle->loghandle = loghandle;
 }
 
+/* qsort callback, ordering option specifications by long name.  */
+static int
+compare_specs (const void *a, const void *b)
+{
+  const simpleparse_opt_spec_t *spec_a = *(simpleparse_opt_spec_t * const *) a;
+  const simpleparse_opt_spec_t *spec_b = *(simpleparse_opt_spec_t * const *) b;
+
+  return strcmp (spec_a->long_opt, spec_b->long_opt);
+}
+
+/* Install the option specifications SPECS in HANDLE.  The
+   specifications are compiled into a sorted table once, so that
+   looking up options does not need to scan the whole list.  Returns
+   proper error code.  */
 gpg_error_t
 simpleparse_set_specs (simpleparse_handle_t handle, simpleparse_opt_spec_t *specs)
 {
+  simpleparse_opt_spec_t **sorted;
+  unsigned int i, n;
+
   assert (specs);
+
+  for (n = 0; specs[n].long_opt; n++)
+    if (n == USHRT_MAX - 1)
+      return gpg_error (GPG_ERR_TOO_LARGE);
+
+  sorted = xtrymalloc (sizeof (*sorted) * (n + 1));
+  if (!sorted)
+    return gpg_error_from_errno (errno);
+
+  for (i = 0; i < n; i++)
+    sorted[i] = &specs[i];
+  qsort (sorted, n, sizeof (*sorted), compare_specs);
+
+  xfree (handle->specs_sorted);
+  handle->specs_sorted = sorted;
+  handle->nspecs = n;
   handle->specs = specs;
-  /* FIXME, necessary to check for INT_MAX overflow? */
+
+  memset (handle->short_index, 0, sizeof (handle->short_index));
+  for (i = n; i > 0; i--)
+    if (specs[i - 1].short_opt > 0 && specs[i - 1].short_opt <= UCHAR_MAX)
+      /* Going backwards, so that the first one wins as before.  */
+      handle->short_index[specs[i - 1].short_opt] = i;
+
   return 0;
 }
 
+/* bsearch callback, comparing an option name with a
+   specification.  */
+static int
+compare_spec_name (const void *key, const void *elem)
+{
+  const simpleparse_opt_spec_t *spec = *(simpleparse_opt_spec_t * const *) elem;
+
+  return strcmp (key, spec->long_opt);
+}
+
 /* This function looks up the specification structure for a long
    option by it's name in the context of HANDLE.  The name is given as
-   NAME. On success the struct is stored in *SPEC. Returns proper
-   error code. The only non-zero error code returned by this function
-   is GPG_ERR_UNKNOWN_OPTION in case the option requested could not be
-   found. */
+   NAME. On success a pointer to the struct is stored in *SPEC. Returns
+   proper error code. The only non-zero error code returned by this
+   function is GPG_ERR_UNKNOWN_OPTION in case the option requested
+   could not be found. */
 static gpg_error_t
 lookup_opt_spec_long (simpleparse_handle_t handle,
-		      const char *name, simpleparse_opt_spec_t *spec)
+		      const char *name, const simpleparse_opt_spec_t **spec)
 {
-  gpg_error_t err = 0;
-  unsigned int i;
+  simpleparse_opt_spec_t **found;
 
   assert (name);
 
-  for (i = 0; handle->specs[i].long_opt; i++)
-    if (!strcmp (name, handle->specs[i].long_opt))
-      break;
+  if (!handle->specs_sorted)
+    return gpg_error (GPG_ERR_UNKNOWN_OPTION);
 
-  if (handle->specs[i].long_opt)
-    *spec = handle->specs[i];
-  else
-    err = gpg_error (GPG_ERR_UNKNOWN_OPTION);
+  found = bsearch (name, handle->specs_sorted, handle->nspecs,
+		   sizeof (*handle->specs_sorted), compare_spec_name);
+  if (!found)
+    return gpg_error (GPG_ERR_UNKNOWN_OPTION);
 
-  return err;
+  *spec = *found;
+
+  return 0;
 }
 
 /* This function looks up the specification structure for a long
    option by it's short one-letter name in the context of HANDLE.  The
-   name is given as NAME. On success the struct is stored in
-   *SPEC. Returns proper error code. The only non-zero error code
+   name is given as NAME. On success a pointer to the struct is stored
+   in *SPEC. Returns proper error code. The only non-zero error code
    returned by this function is GPG_ERR_UNKNOWN_OPTION in case the
    option requested could not be found. */
 static gpg_error_t
 lookup_opt_spec_short (simpleparse_handle_t handle,
-		       const char name, simpleparse_opt_spec_t *spec)
+		       const char name, const simpleparse_opt_spec_t **spec)
 {
-  gpg_error_t err = 0;
-  unsigned int i;
+  unsigned int idx;
 
   assert (name);
 
-  for (i = 0; handle->specs[i].long_opt; i++)
-    if (name == handle->specs[i].short_opt)
-      break;
+  idx = handle->short_index[(unsigned char) name];
+  if (!idx)
+    return gpg_error (GPG_ERR_UNKNOWN_OPTION);
 
-  if (handle->specs[i].long_opt)
-    *spec = handle->specs[i];
-  else
-    err = gpg_error (GPG_ERR_UNKNOWN_OPTION);
+  *spec = &handle->specs[idx - 1];
 
-  return err;
+  return 0;
 }
 
 static const char *
@@ -243,7 +300,7 @@ static gpg_error_t
 internal_parse_args (simpleparse_handle_t handle, unsigned int flags,
 		     unsigned int argc, const char **argv, const char ***rest_args)
 {
-  simpleparse_opt_spec_t spec;
+  const simpleparse_opt_spec_t *spec;
   gpg_error_t err;
   const char **arg;
 
@@ -309,17 +366,17 @@ internal_parse_args (simpleparse_handle_t handle, unsigned int flags,
 	  break;
 	}
 
-      if (spec.arg == SIMPLEPARSE_ARG_OPTIONAL)
+      if (spec->arg == SIMPLEPARSE_ARG_OPTIONAL)
 	{
 	  if (argc >= 2 && (*(arg+1)) && (*(arg+1))[0] != '-')
 	    {
-	      err = (*handle->parse_cb) (handle->parse_cookie, spec, *(arg + 1));
+	      err = (*handle->parse_cb) (handle->parse_cookie, *spec, *(arg + 1));
 	      if (err)
 		{
 		  log_msg_error (handle->loghandle,
 				 translate (handle,
 					    N_("parse-callback returned error '%s' for argument '%s'")),
-				 gpg_strerror (err), spec.long_opt);
+				 gpg_strerror (err), spec->long_opt);
 		  goto out;
 		}
 	      arg += 2;
@@ -327,30 +384,30 @@ internal_parse_args (simpleparse_handle_t handle, unsigned int flags,
 	    }
 	  else
 	    {
-	      err = (*handle->parse_cb) (handle->parse_cookie, spec, NULL);
+	      err = (*handle->parse_cb) (handle->parse_cookie, *spec, NULL);
 	      if (err)
 		{
 		  log_msg_error (handle->loghandle,
 				 translate (handle,
 					    N_("parse-callback returned error '%s' for argument '%s'")),
-				 gpg_strerror (err), spec.long_opt);
+				 gpg_strerror (err), spec->long_opt);
 		  goto out;
 		}
 	      arg++;
 	      argc--;
 	    }
 	}
-      else if (spec.arg == SIMPLEPARSE_ARG_REQUIRED)
+      else if (spec->arg == SIMPLEPARSE_ARG_REQUIRED)
 	{
 	  if (argc >= 2 && (*(arg+1)) && (*(arg+1))[0] != '-')
 	    {
-	      err = (*handle->parse_cb) (handle->parse_cookie, spec, *(arg + 1));
+	      err = (*handle->parse_cb) (handle->parse_cookie, *spec, *(arg + 1));
 	      if (err)
 		{
 		  log_msg_error (handle->loghandle,
 				 translate (handle,
 					    N_("parse-callback returned error '%s' for argument '%s'")),
-				 gpg_strerror (err), spec.long_opt);
+				 gpg_strerror (err), spec->long_opt);
 		  goto out;
 		}
 	      arg += 2;
@@ -363,20 +420,20 @@ internal_parse_args (simpleparse_handle_t handle, unsigned int flags,
 	      log_msg_error (handle->loghandle,
 			     translate (handle,
 					N_("missing required argument for '%s'")),
-			     spec.long_opt);
+			     spec->long_opt);
 	      goto out;
 	    }
 	}
-      else if (spec.arg == SIMPLEPARSE_ARG_NONE)
+      else if (spec->arg == SIMPLEPARSE_ARG_NONE)
 	{
 	  /* No arg allowed.  */
-	  err = (*handle->parse_cb) (handle->parse_cookie, spec, NULL);
+	  err = (*handle->parse_cb) (handle->parse_cookie, *spec, NULL);
 	  if (err)
 	    {
 	      log_msg_error (handle->loghandle,
 			     translate (handle,
 					N_("parse-callback returned error '%s' for argument '%s'")),
-			     gpg_strerror (err), spec.long_opt);
+			     gpg_strerror (err), spec->long_opt);
 	      goto out;
 	    }
 	  arg++;
@@ -394,93 +451,51 @@ internal_parse_args (simpleparse_handle_t handle, unsigned int flags,
   return err;
 }
 	    
-typedef struct
-{
-  token_t *tokens;
-  unsigned int size;
-} token_list_t;
-
+/* Append the token ITEM to LIST, growing the vector if necessary.
+   Returns proper error code.  */
 static gpg_error_t
-token_list_init (token_list_t *list)
+token_list_add (token_list_t *list, char *item)
 {
-  list->tokens = NULL;
-  list->size = 0;
-
-  return 0;
-}
-
-static gpg_error_t
-token_list_add (token_list_t *list, const char *item, int length)
-{
-  gpg_error_t err = 0;
-  int item_length;
-  token_t *tokens = NULL;
-
-  if (!item)
-    goto out;
-
-  if (list->size == UINT_MAX)
-    {
-      err = gpg_error (GPG_ERR_TOO_LARGE);
-      goto out;
-    }
+  char **tokens;
+  unsigned int capacity;
 
-  if (length == -1)
+  if (list->size == list->capacity)
     {
-      item_length = my_strlen (item);
-      if (item_length)
-	{
-	  err = gpg_error (GPG_ERR_TOO_LARGE);
-	  goto out;
-	}
-    }
-  else
-    item_length = length;
+      if (list->capacity > UINT_MAX / 2 / sizeof (*tokens))
+	return gpg_error (GPG_ERR_TOO_LARGE);
 
-  if (item_length >= TOKENSIZE)
-    {
-      err = gpg_error (GPG_ERR_TOO_LARGE);
-      goto out;
-    }
+      capacity = list->capacity ? list->capacity * 2 : 8;
+      tokens = xtryrealloc (list->tokens, sizeof (*tokens) * capacity);
+      if (!tokens)
+	return gpg_error_from_errno (errno);
 
-  tokens = xtryrealloc (list->tokens, sizeof (*list->tokens) * (list->size + 1));
-  if (!tokens)
-    {
-      err = gpg_error_from_errno (errno);
-      goto out;
+      list->tokens = tokens;
+      list->capacity = capacity;
     }
 
-  list->tokens = tokens;
-  assert (item_length < TOKENSIZE);
-  memcpy (list->tokens[list->size], item, item_length);
-  list->tokens[list->size][item_length] = 0;
-  list->size++;
+  list->tokens[list->size++] = item;
 
- out:
-
-  return err;
+  return 0;
 }
 
-static gpg_error_t
-token_list_clear (token_list_t *list)
+static void
+token_list_release (token_list_t *list)
 {
-  if (list->tokens)
-    xfree (list->tokens);
+  xfree (list->tokens);
   list->tokens = NULL;
-  list->size = 0;
-  return 0;
+  list->size = list->capacity = 0;
 }
 
+/* Split LINE into tokens, which are stored in TOKENS.  LINE is
+   modified: each token is terminated in place, replacing the
+   delimiter or the closing quote.  */
 static gpg_error_t
 internal_parse_line (char *line, token_list_t *tokens)
 {
-  token_list_t token_list;
   gpg_error_t err;
-  char *p;
+  char *p, *token;
 
-  err = token_list_init (&token_list);
-  if (err)
-    goto out;
+  tokens->size = 0;
 
   /* Start. */
   p = line;
@@ -489,20 +504,19 @@ internal_parse_line (char *line, token_list_t *tokens)
   while (isspace (*p))
     p++;
   if ((*p == '#') || (*p == '\n') || (*p == '\0'))
-    goto out;
+    return 0;
 
   /* This loops over the tokens contained in the line. */
   while (1)
     {
       int quoting_char = 0;
-      unsigned int i = 0;
 
       /* Skip whitespaces before tokens. */
       while ((*p == ' ') || (*p == '\t'))
 	p++;
 
       if (*p == '\0')
-	/* This was an empty line. */
+	/* End of line. */
 	break;
 
       /* There seems to be another token. */
@@ -514,119 +528,83 @@ internal_parse_line (char *line, token_list_t *tokens)
 	  p++;
 	}
 
-      /* The new token starts at P and is at least one byte long.  If
-	 quoting_char is positive, the current token is quoted. */
-      i = 1;
+      token = p;
 
-      while (1)
+      /* Find the end of the token: the terminating quote character
+	 for quoted tokens, whitespace otherwise.  */
+      while (*p
+	     && (quoting_char
+		 ? (*p != quoting_char)
+		 : ((*p != ' ') && (*p != '\t'))))
 	{
-	  if (!p[i])
-	    {
-	      if (quoting_char)
-		{
-		  /* Quoting not properly terminated.  */
-		  err = gpg_error (GPG_ERR_SYNTAX);
-		  goto out;
-		}
-	      else
-		break;
-	    }
-	  else if ((p[i] == ' ') || (p[i] == '\t'))
-	    {
-	      /* Whitespace! */
-	      if (!quoting_char)
-		/* Not inside of a quoted token, therefore this is a
-		   token delimiter. */
-		break;
-	    }
-	      
-	  else if (p[i] == '\\')
-	    {
-	      abort ();
-	      /* We do not allow escape characters yet. */
-	    }
-	  else if (p[i] == quoting_char)
-	    {
-	      /* Terminating quote characters, ends current token. */
-	      i++;
-	      break;
-	    }
-
-	  /* Move forward in current token. */
-	  i++;
+	  if (*p == '\\')
+	    /* We do not allow escape characters yet. */
+	    return gpg_error (GPG_ERR_SYNTAX);
+	  p++;
 	}
 
-      /* Now we have a new token in {p[0], p[1], ..., p[i-1]}; i is
-	 positive. In case of quoted tokens, we must subtract one
-	 byte, since the trailing quote character is not part of the
-	 token. */
+      if (quoting_char && !*p)
+	/* Quoting not properly terminated.  */
+	return gpg_error (GPG_ERR_SYNTAX);
 
-      err = token_list_add (&token_list, p, i - !!quoting_char);
-      if (err)
-	goto out;
+      if (*p)
+	*p++ = '\0';
 
-      p += i;
-    }
-	      
- out:
-
-  if (err)
-    {
-      token_list_clear (&token_list);
+      err = token_list_add (tokens, token);
+      if (err)
+	return err;
     }
-  else
-    *tokens = token_list;
 
-  return err;
+  return 0;
 }
 
 static gpg_error_t
-internal_process_tokens (simpleparse_handle_t handle, token_list_t tokens)
+internal_process_tokens (simpleparse_handle_t handle, token_list_t *tokens)
 {
-  simpleparse_opt_spec_t spec;
+  const simpleparse_opt_spec_t *spec;
   gpg_error_t err;
 
   err = 0;
 
-  assert (1 <= tokens.size);
+  assert (1 <= tokens->size);
 
-  err = lookup_opt_spec_long (handle, tokens.tokens[0], &spec);
+  err = lookup_opt_spec_long (handle, tokens->tokens[0], &spec);
   if (err)
     {
       log_msg_error (handle->loghandle,
-		     translate (handle, N_("unknown option '%s'")), tokens.tokens[0]);
+		     translate (handle, N_("unknown option '%s'")), tokens->tokens[0]);
       goto out;
     }
 
-  switch (spec.arg)
+  switch (spec->arg)
     {
     case SIMPLEPARSE_ARG_NONE:
-      if (tokens.size > 1)
+      if (tokens->size > 1)
 	{
 	  log_msg_error (handle->loghandle,
 			 translate (handle,
 				    N_("too many arguments specified for option '%s'")),
-			 tokens.tokens[0]);
+			 tokens->tokens[0]);
 	  err = gpg_error (GPG_ERR_SYNTAX);
 	  goto out;
 	}
       break;
     case SIMPLEPARSE_ARG_REQUIRED:
-      if (tokens.size < 2)
+      if (tokens->size < 2)
 	{
 	  log_msg_error (handle->loghandle,
 			 translate (handle,
 				    N_("missing required argument for '%s'")),
-			 tokens.tokens[0]);
+			 tokens->tokens[0]);
 	  err = gpg_error (GPG_ERR_SYNTAX);
 	  goto out;
 	}
-      else if (tokens.size > 2)
+      else if (tokens->size > 2)
 	{
 	  log_msg_error (handle->loghandle,
 			 translate (handle,
 				    N_("too many arguments specified for option '%s'")),
-			 tokens.tokens[0]);
+			 tokens->tokens[0]);
 	  err = gpg_error (GPG_ERR_SYNTAX);
 	  goto out;
 	}
@@ -636,8 +614,8 @@ internal_process_tokens (simpleparse_handle_t handle, token_list_t tokens)
       break;
     }
 
-  err = (*handle->parse_cb) (handle->parse_cookie, spec,
-			     (tokens.size == 2) ? tokens.tokens[1] : NULL);
+  err = (*handle->parse_cb) (handle->parse_cookie, *spec,
+			     (tokens->size == 2) ? tokens->tokens[1] : NULL);
 
  out:
 
@@ -664,17 +642,18 @@ internal_parse_stream (simpleparse_handle_t handle, unsigned int flags, FILE *st
   int length;
   token_list_t tokens;
   gpg_error_t err;
-  int ret;
+  ssize_t ret;
 
   tokens.tokens = NULL;
-  tokens.size = 0;
+  tokens.size = tokens.capacity = 0;
+  line = NULL;
+  line_size = 0;
   err = 0;
 
+  /* The line buffer and the token vector are reused for all
+     lines.  */
   while (1)
     {
-      line = NULL;
-      line_size = 0;
-
       ret = getline (&line, &line_size, stream);
       if (ret == -1)
 	{
@@ -703,22 +682,16 @@ internal_parse_stream (simpleparse_handle_t handle, unsigned int flags, FILE *st
       /* Process. */
       if (tokens.size > 0)
 	{
-	  err = internal_process_tokens (handle, tokens);
+	  err = internal_process_tokens (handle, &tokens);
 	  if (err)
 	    goto out;
 	}
-
-      /* Release. */
-
-      token_list_clear (&tokens);
-      free (line);
-      line = NULL;
     }
 
  out:
 
-  if (line)
-    free (line);		/* Allocated by getline, thus standard
+  token_list_release (&tokens);
+  free (line);			/* Allocated by getline, thus standard
 				   free. */
   return err;
 }
@@ -815,6 +788,7 @@ static void
 internal_release_handle (simpleparse_handle_t handle)
 {
   assert (handle);
+  xfree (handle->specs_sorted);
   xfree (handle);
 }
 
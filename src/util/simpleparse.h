@@ -58,6 +58,9 @@ void simpleparse_destroy (simpleparse_handle_t handle);
 void simpleparse_set_loghandle (simpleparse_handle_t handle,
 				log_handle_t loghandle);
 
+/* Parser callback, invoked for each option found with its
+   specification SPEC and its argument ARG (or NULL).  Callbacks are
+   expected to dispatch on SPEC.ID.  */
 typedef gpg_error_t (*simpleparse_parse_cb_t) (void *cookie,
 					       simpleparse_opt_spec_t spec, const char *arg);
 
@@ -69,6 +72,9 @@ typedef const char *(*simpleparse_i18n_cb_t) (void *cookie, const char *msg);
 void simpleparse_set_i18n_cb (simpleparse_handle_t handle,
 			      simpleparse_i18n_cb_t i18n_cb, void *cookie);
 
+/* Install the option specifications SPECS, terminated by an entry
+   with LONG_OPT being NULL, in HANDLE.  SPECS must stay valid as long
+   as HANDLE is in use.  */
 gpg_error_t simpleparse_set_specs (simpleparse_handle_t handle, simpleparse_opt_spec_t *specs);
 
 void simpleparse_set_name (simpleparse_handle_t handle, const char *program_name);
@@ -32,36 +32,236 @@
 #include <pwd.h>
 #include <dirent.h>
 #include <limits.h>
+#include <string.h>
+#include <pthread.h>
+#ifdef HAVE_GETRANDOM
+# include <sys/random.h>
+#endif
 
 #include <gcrypt.h>
 
 #include "support.h"
+#include "secarena.h"
 #include "defs.h"
 
-#define CHALLENGE_MD_ALGORITHM GCRY_MD_SHA1
+/* OpenPGP algorithm IDs as reported by the card's KEY-ATTR.  */
+#define OPENPGP_ALGO_RSA   1
+#define OPENPGP_ALGO_ECDSA 19
+#define OPENPGP_ALGO_EDDSA 22
 
 
 
 /* Note: it's expected that xtrymalloc, xtrystrdup and xfree are
    defined in util-local.h. */
 
-/* This function generates a challenge; the challenge will be stored
-   in newly allocated memory, which is to be stored in *CHALLENGE;
-   it's length in bytes is to be stored in *CHALLENGE_N.  Returns
-   proper error code.  */
+/* Return true if the ECC key parameter list LIST describes an EdDSA
+   key.  */
+static int
+key_is_eddsa (gcry_sexp_t list)
+{
+  gcry_sexp_t l;
+  const char *data;
+  size_t n;
+  int i, eddsa;
+
+  eddsa = 0;
+
+  l = gcry_sexp_find_token (list, "flags", 0);
+  for (i = 1; l && !eddsa && (data = gcry_sexp_nth_data (l, i, &n)); i++)
+    eddsa = (n == 5 && !memcmp (data, "eddsa", 5));
+  gcry_sexp_release (l);
+
+  if (!eddsa)
+    {
+      l = gcry_sexp_find_token (list, "curve", 0);
+      data = l ? gcry_sexp_nth_data (l, 1, &n) : NULL;
+      if (data)
+	eddsa = ((n == 7 && !memcmp (data, "Ed25519", 7))
+		 || (n == 22 && !memcmp (data, "1.3.6.1.4.1.11591.15.1", 22)));
+      gcry_sexp_release (l);
+    }
+
+  return eddsa;
+}
+
 gpg_error_t
-challenge_generate (unsigned char **challenge, size_t *challenge_n)
+challenge_params_from_key (gcry_sexp_t key, int card_algo,
+			   struct challenge_params *params)
+{
+  gcry_sexp_t list;
+  unsigned int nbits;
+  gpg_error_t err;
+
+  err = 0;
+
+  if ((list = gcry_sexp_find_token (key, "rsa", 0)))
+    {
+      /* Kept at SHA-1 for cards and keys set up with earlier
+	 versions; the challenge is random anyway.  */
+      params->pkalgo = GCRY_PK_RSA;
+      params->mdalgo = GCRY_MD_SHA1;
+      params->card_mdalgo = GCRY_MD_SHA1;
+    }
+  else if ((list = gcry_sexp_find_token (key, "eddsa", 0))
+	   || ((list = gcry_sexp_find_token (key, "ecc", 0))
+	       && key_is_eddsa (list)))
+    {
+      /* EdDSA signs the challenge itself, which is as long as a
+	 SHA-512 digest.  */
+      params->pkalgo = GCRY_PK_EDDSA;
+      params->mdalgo = GCRY_MD_SHA512;
+      params->card_mdalgo = 0;
+    }
+  else if (list			/* An "ecc" key which is not EdDSA.  */
+	   || (list = gcry_sexp_find_token (key, "ecdsa", 0)))
+    {
+      /* The challenge takes the place of a digest matching the size
+	 of the curve.  */
+      nbits = gcry_pk_get_nbits (key);
+      if (!nbits)
+	{
+	  err = gpg_error (GPG_ERR_BAD_PUBKEY);
+	  goto out;
+	}
+      params->pkalgo = GCRY_PK_ECDSA;
+      if (nbits <= 256)
+	params->mdalgo = GCRY_MD_SHA256;
+      else if (nbits <= 384)
+	params->mdalgo = GCRY_MD_SHA384;
+      else
+	params->mdalgo = GCRY_MD_SHA512;
+      params->card_mdalgo = 0;
+    }
+  else
+    {
+      err = gpg_error (GPG_ERR_PUBKEY_ALGO);
+      goto out;
+    }
+
+  /* Don't let a key of one type pass for a card key of another.  */
+  if (card_algo
+      && !((params->pkalgo == GCRY_PK_RSA
+	    && card_algo >= OPENPGP_ALGO_RSA && card_algo <= 3)
+	   || (params->pkalgo == GCRY_PK_ECDSA
+	       && card_algo == OPENPGP_ALGO_ECDSA)
+	   || (params->pkalgo == GCRY_PK_EDDSA
+	       && card_algo == OPENPGP_ALGO_EDDSA)))
+    err = gpg_error (GPG_ERR_WRONG_PUBKEY_ALGO);
+
+ out:
+
+  gcry_sexp_release (list);
+
+  return err;
+}
+
+static pthread_once_t crypto_once = PTHREAD_ONCE_INIT;
+static pthread_once_t textdomain_once = PTHREAD_ONCE_INIT;
+
+static void
+do_crypto_init (void)
+{
+  /* Leave Libgcrypt alone if the application has set it up.  */
+  if (gcry_control (GCRYCTL_INITIALIZATION_FINISHED_P))
+    return;
+
+  gcry_check_version (NEED_LIBGCRYPT_VERSION);
+
+  /* Disable secure memory; because of the implicit priviledge
+     dropping, having secure memory enabled causes the following
+     error:
+
+     su: Authentication service cannot retrieve authentication
+     info.
+
+     PINs, challenges and signatures are kept in Poldi's own secure
+     arena instead (see secarena.h).  */
+  gcry_control (GCRYCTL_DISABLE_SECMEM);
+}
+
+/* Initialize Libgcrypt, once per process.  Its random number
+   generator is left alone; it is only set up when first used.  */
+void
+crypto_init (void)
+{
+  pthread_once (&crypto_once, do_crypto_init);
+}
+
+static void
+do_bind_textdomain (void)
+{
+  bindtextdomain (PACKAGE, LOCALEDIR);
+}
+
+/* Return the translation of MSGID; the message catalog is bound on
+   the first call.  */
+const char *
+poldi_gettext (const char *msgid)
+{
+  pthread_once (&textdomain_once, do_bind_textdomain);
+
+  return dgettext (PACKAGE, msgid);
+}
+
+/* Fill BUFFER with LENGTH unpredictable bytes, as needed for nonces
+   and challenges.  They are taken from the kernel, which saves setting
+   up Libgcrypt's random number generator in every process; where
+   getrandom is not available, Libgcrypt's nonce generator is used.  */
+void
+nonce_generate (void *buffer, size_t length)
+{
+#ifdef HAVE_GETRANDOM
+  unsigned char *p = buffer;
+  ssize_t n;
+
+  while (length)
+    {
+      n = getrandom (p, length, 0);
+      if (n == -1)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  break;
+	}
+      p += n;
+      length -= n;
+    }
+  buffer = p;
+#endif
+
+  if (length)
+    gcry_create_nonce (buffer, length);
+}
+
+int
+challenge_card_algo_supported (int card_algo)
+{
+  return ((card_algo >= OPENPGP_ALGO_RSA && card_algo <= 3)
+	  || card_algo == OPENPGP_ALGO_ECDSA
+	  || card_algo == OPENPGP_ALGO_EDDSA);
+}
+
+/* This function generates a challenge suitable for PARAMS; the
+   challenge will be stored in memory newly allocated from the secure
+   arena, which is to be stored in *CHALLENGE; it's length in bytes is
+   to be stored in *CHALLENGE_N.  Returns proper error code.  */
+gpg_error_t
+challenge_generate (const struct challenge_params *params,
+		    unsigned char **challenge, size_t *challenge_n)
 {
   gpg_error_t err = GPG_ERR_NO_ERROR;
   unsigned char *challenge_new = NULL;
-  size_t challenge_new_n = gcry_md_get_algo_dlen (CHALLENGE_MD_ALGORITHM);
+  size_t challenge_new_n = gcry_md_get_algo_dlen (params->mdalgo);
+
+  if (!challenge_new_n)
+    return gpg_error (GPG_ERR_DIGEST_ALGO);
 
-  challenge_new = xtrymalloc (challenge_new_n);
+  challenge_new = secarena_malloc (challenge_new_n);
   if (! challenge_new)
     err = gpg_err_code_from_errno (errno);
   else
     {
-      gcry_create_nonce (challenge_new, challenge_new_n);
+      nonce_generate (challenge_new, challenge_new_n);
       *challenge = challenge_new;
       *challenge_n = challenge_new_n;
     }
@@ -74,12 +274,12 @@ challenge_generate (unsigned char **challenge, size_t *challenge_n)
 void
 challenge_release (unsigned char *challenge)
 {
-  if (challenge)
-    xfree (challenge);
+  secarena_free (challenge);
 }
 
 static gpg_error_t
 challenge_verify_sexp (gcry_sexp_t sexp_key,
+		       const struct challenge_params *params,
 		       unsigned char *challenge, size_t challenge_n,
 		       unsigned char *response, size_t response_n)
 {
@@ -87,24 +287,57 @@ challenge_verify_sexp (gcry_sexp_t sexp_key,
   gcry_sexp_t sexp_signature = NULL;
   gcry_sexp_t sexp_data = NULL;
   gcry_mpi_t mpi_signature = NULL;
+  size_t half = response_n / 2;
 
-  /* Convert buffers into MPIs.  */
-  if (! err)
+  /* Create according S-Expressions.  ECDSA and EdDSA signatures are
+     returned by the card as the concatenation of R and S.  */
+  switch (params->pkalgo)
     {
+    case GCRY_PK_RSA:
       if (gcry_mpi_scan (&mpi_signature, GCRYMPI_FMT_USG, response, response_n,
 			 NULL))
 	err = gpg_error (GPG_ERR_BAD_MPI);
+      if (! err)
+	err = gcry_sexp_build (&sexp_data, NULL,
+			       "(data (flags pkcs1) (hash %s %b))",
+			       gcry_md_algo_name (params->mdalgo),
+			       challenge_n, challenge);
+      if (! err)
+	err = gcry_sexp_build (&sexp_signature, NULL, "(sig-val (rsa (s %m)))",
+			       mpi_signature);
+      break;
+
+    case GCRY_PK_ECDSA:
+      if (!response_n || response_n % 2)
+	err = gpg_error (GPG_ERR_BAD_SIGNATURE);
+      if (! err)
+	err = gcry_sexp_build (&sexp_data, NULL,
+			       "(data (flags raw) (value %b))",
+			       challenge_n, challenge);
+      if (! err)
+	err = gcry_sexp_build (&sexp_signature, NULL,
+			       "(sig-val (ecdsa (r %b) (s %b)))",
+			       half, response, half, response + half);
+      break;
+
+    case GCRY_PK_EDDSA:
+      if (response_n != 64)
+	err = gpg_error (GPG_ERR_BAD_SIGNATURE);
+      if (! err)
+	err = gcry_sexp_build (&sexp_data, NULL,
+			       "(data (flags eddsa) (hash-algo sha512)"
+			       " (value %b))",
+			       challenge_n, challenge);
+      if (! err)
+	err = gcry_sexp_build (&sexp_signature, NULL,
+			       "(sig-val (eddsa (r %b) (s %b)))",
+			       half, response, half, response + half);
+      break;
+
+    default:
+      err = gpg_error (GPG_ERR_PUBKEY_ALGO);
     }
 
-  /* Create according S-Expressions.  */
-  if (! err)
-    err = gcry_sexp_build (&sexp_data, NULL,
-			   "(data (flags pkcs1) (hash sha1 %b))",
-			   challenge_n, challenge);
-  if (! err)
-    err = gcry_sexp_build (&sexp_signature, NULL, "(sig-val (rsa (s %m)))",
-			   mpi_signature);
-
   /* Verify.  */
   if (! err)
     err = gcry_pk_verify (sexp_signature, sexp_data, sexp_key);
@@ -122,16 +355,17 @@ challenge_verify_sexp (gcry_sexp_t sexp_key,
 /* This functions verifies that the signature contained in RESPONSE of
    size RESPONSE_N (in bytes) is indeed the result of signing the
    challenge given in CHALLENGE of size CHALLENGE_N (in bytes) with
-   the secret key belonging to the public key given as PUBLIC_KEY.
-   Returns proper error code.  */
+   the secret key belonging to the public key given as PUBLIC_KEY,
+   according to PARAMS.  Returns proper error code.  */
 gpg_error_t
 challenge_verify (gcry_sexp_t public_key,
+		  const struct challenge_params *params,
 		  unsigned char *challenge, size_t challenge_n,
 		  unsigned char *response, size_t response_n)
 {
   gpg_error_t err;
 
-  err = challenge_verify_sexp (public_key,
+  err = challenge_verify_sexp (public_key, params,
 			       challenge, challenge_n, response, response_n);
 
   return err;
@@ -24,11 +24,47 @@
 #include <gcrypt.h>
 #include <dirent.h>
 
-/* This function generates a challenge; the challenge will be stored
-   in newly allocated memory, which is to be stored in *CHALLENGE;
-   it's length in bytes is to be stored in *CHALLENGE_N.  Returns
-   proper error code.  */
-gpg_error_t challenge_generate (unsigned char **challenge, size_t *challenge_n);
+/* Parameters of the challenge-response protocol, which depend on the
+   type of the key used.  */
+struct challenge_params
+{
+  int pkalgo;			/* GCRY_PK_RSA, GCRY_PK_ECDSA or
+				   GCRY_PK_EDDSA.  */
+  int mdalgo;			/* Hash algorithm; the challenge has
+				   the size of its digest.  */
+  int card_mdalgo;		/* Hash algorithm to announce to the
+				   card, or zero if the card is to sign
+				   the challenge as is.  */
+};
+
+/* Figure out the challenge-response parameters for the public key
+   KEY and store them in *PARAMS.  CARD_ALGO is the OpenPGP algorithm
+   ID of the key as reported by the card (KEY-ATTR), or zero if not
+   known; if given, it has to match KEY.  Returns proper error
+   code.  */
+gpg_error_t challenge_params_from_key (gcry_sexp_t key, int card_algo,
+				       struct challenge_params *params);
+
+/* Return true if keys of the OpenPGP algorithm CARD_ALGO, as reported
+   by the card (KEY-ATTR), can be used for the challenge-response
+   protocol.  */
+int challenge_card_algo_supported (int card_algo);
+
+/* Initialize Libgcrypt, unless the application has done so; this is
+   done once per process and must precede any use of it, including
+   memory allocation.  */
+void crypto_init (void);
+
+/* Fill BUFFER with LENGTH unpredictable bytes, as needed for nonces
+   and challenges.  */
+void nonce_generate (void *buffer, size_t length);
+
+/* This function generates a challenge suitable for PARAMS; the
+   challenge will be stored in memory newly allocated from the secure
+   arena, which is to be stored in *CHALLENGE; it's length in bytes is
+   to be stored in *CHALLENGE_N.  Returns proper error code.  */
+gpg_error_t challenge_generate (const struct challenge_params *params,
+				unsigned char **challenge, size_t *challenge_n);
 
 /* Releases the challenge contained in CHALLENGE generated by
    challenge_generate().  */
@@ -37,9 +73,10 @@ void challenge_release (unsigned char *challenge);
 /* This functions verifies that the signature contained in RESPONSE of
    size RESPONSE_N (in bytes) is indeed the result of signing the
    challenge given in CHALLENGE of size CHALLENGE_N (in bytes) with
-   the secret key belonging to the public key given as PUBLIC_KEY.
-   Returns proper error code.  */
+   the secret key belonging to the public key given as PUBLIC_KEY,
+   according to PARAMS.  Returns proper error code.  */
 gpg_error_t challenge_verify (gcry_sexp_t public_key,
+			      const struct challenge_params *params,
 			      unsigned char *challenge, size_t challenge_n,
 			      unsigned char *response, size_t response_n);
 
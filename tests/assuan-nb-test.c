@@ -0,0 +1,361 @@
+/* assuan-nb-test.c - test the non-blocking Assuan client API
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of Poldi.
+
+   Poldi is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   Poldi is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.  */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "assuan.h"
+
+/* Two servers, answering after DELAY milliseconds each, are run
+   concurrently from a single thread; the second one is faster.  */
+#define DELAY_SLOW 400
+#define DELAY_FAST 100
+
+/* Maximum size of the data echoed by the servers.  */
+#define MAX_DATA 63
+
+struct server
+{
+  const char *name;
+  unsigned int delay;
+  char socket_name[256];
+  pid_t pid;
+
+  assuan_context_t ctx;
+  int done;
+  assuan_error_t rc;
+  unsigned int status_lines;
+  unsigned int inquiries;
+  char data[MAX_DATA + 1];
+  size_t datalen;
+  double finished;
+};
+
+static int failures;
+
+#define CHECK(cond, what)					\
+  do								\
+    {								\
+      if (!(cond))						\
+	{							\
+	  fprintf (stderr, "FAIL: %s\n", (what));		\
+	  failures++;						\
+	}							\
+    }								\
+  while (0)
+
+/* Return the monotonic time in seconds.  */
+static double
+now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+sleep_ms (unsigned int ms)
+{
+  struct timespec ts;
+
+  ts.tv_sec = ms / 1000;
+  ts.tv_nsec = (ms % 1000) * 1000000L;
+  nanosleep (&ts, NULL);
+}
+
+
+
+/* Server side.  */
+
+/* SLOW <ms>: send a status line, inquire ECHO and send back the
+   inquired data, with half of the delay before the status line and
+   the other half before the data.  */
+static int
+cmd_slow (assuan_context_t ctx, char *line)
+{
+  unsigned int ms = strtoul (line, NULL, 10);
+  unsigned char *buf;
+  size_t len;
+  int rc;
+
+  sleep_ms (ms / 2);
+  rc = assuan_write_status (ctx, "PROGRESS", "half");
+  if (!rc)
+    rc = assuan_inquire (ctx, "ECHO", &buf, &len, MAX_DATA);
+  if (rc)
+    return rc;
+
+  sleep_ms (ms / 2);
+  rc = assuan_send_data (ctx, buf, len);
+  if (!rc)
+    rc = assuan_send_data (ctx, NULL, 0);
+  if (!rc)
+    rc = assuan_write_line (ctx, "END");
+  free (buf);
+
+  return rc;
+}
+
+/* Serve one connection on the listening socket FD.  */
+static void
+run_server (int fd)
+{
+  assuan_context_t ctx;
+  int conn;
+  int rc;
+
+  conn = accept (fd, NULL, NULL);
+  if (conn == -1)
+    exit (1);
+  close (fd);
+
+  rc = assuan_init_socket_server_ext (&ctx, conn, 2);
+  if (!rc)
+    rc = assuan_register_command (ctx, "SLOW", cmd_slow);
+  if (rc)
+    exit (1);
+
+  while (!(rc = assuan_accept (ctx)))
+    if (assuan_process (ctx))
+      break;
+
+  assuan_deinit_server (ctx);
+  exit (0);
+}
+
+/* Fork a server listening on a socket below DIR.  */
+static int
+start_server (struct server *server, const char *dir)
+{
+  struct sockaddr_un addr;
+  int fd;
+
+  snprintf (server->socket_name, sizeof (server->socket_name),
+	    "%s/%s", dir, server->name);
+
+  memset (&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  strcpy (addr.sun_path, server->socket_name);
+
+  fd = socket (AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1
+      || bind (fd, (struct sockaddr *) &addr, sizeof (addr))
+      || listen (fd, 1))
+    {
+      perror ("socket");
+      return -1;
+    }
+
+  server->pid = fork ();
+  if (server->pid == -1)
+    {
+      perror ("fork");
+      return -1;
+    }
+  if (!server->pid)
+    run_server (fd);
+  close (fd);
+
+  return 0;
+}
+
+
+
+/* Client side.  */
+
+static int
+data_cb (void *opaque, const void *buffer, size_t length)
+{
+  struct server *server = opaque;
+
+  if (!buffer)
+    return 0;
+  if (server->datalen + length > MAX_DATA)
+    return ASSUAN_Too_Much_Data;
+  memcpy (server->data + server->datalen, buffer, length);
+  server->datalen += length;
+  server->data[server->datalen] = 0;
+
+  return 0;
+}
+
+static int
+inquire_cb (void *opaque, const char *line)
+{
+  struct server *server = opaque;
+
+  server->inquiries++;
+  if (strcmp (line, "ECHO"))
+    return ASSUAN_Inquire_Unknown;
+
+  return assuan_send_data (server->ctx, server->name, strlen (server->name));
+}
+
+static int
+status_cb (void *opaque, const char *line)
+{
+  struct server *server = opaque;
+
+  if (!strcmp (line, "PROGRESS half"))
+    server->status_lines++;
+
+  return 0;
+}
+
+int
+main (int argc, char **argv)
+{
+  struct server servers[2] =
+    {
+      { "slow", DELAY_SLOW },
+      { "fast", DELAY_FAST }
+    };
+  struct pollfd pfd[2];
+  char dir[] = "/tmp/assuan-nb-test.XXXXXX";
+  char command[32];
+  double start, elapsed;
+  unsigned int i, pending;
+  int rc;
+
+  signal (SIGPIPE, SIG_IGN);
+
+  if (!mkdtemp (dir))
+    {
+      perror ("mkdtemp");
+      return 1;
+    }
+
+  for (i = 0; i < 2; i++)
+    if (start_server (&servers[i], dir))
+      return 1;
+
+  for (i = 0; i < 2; i++)
+    {
+      rc = assuan_socket_connect (&servers[i].ctx,
+				  servers[i].socket_name, -1);
+      CHECK (!rc, "connect");
+      if (rc)
+	goto out;
+    }
+
+  /* Run both transactions at once.  */
+  start = now ();
+  for (i = 0; i < 2; i++)
+    {
+      snprintf (command, sizeof (command), "SLOW %u", servers[i].delay);
+      rc = assuan_transact_start (servers[i].ctx, command,
+				  data_cb, &servers[i],
+				  inquire_cb, &servers[i],
+				  status_cb, &servers[i]);
+      CHECK (!rc, "transact_start");
+      if (rc)
+	goto out;
+      pfd[i].fd = assuan_transact_fd (servers[i].ctx);
+      pfd[i].events = POLLIN;
+    }
+
+  /* A second transaction on the same context has to wait.  */
+  rc = assuan_transact (servers[0].ctx, "SLOW 0",
+			NULL, NULL, NULL, NULL, NULL, NULL);
+  CHECK (rc == ASSUAN_Nested_Commands, "nested transaction rejected");
+
+  pending = 2;
+  while (pending)
+    {
+      if (poll (pfd, 2, 5000) <= 0)
+	{
+	  CHECK (0, "poll timed out");
+	  goto out;
+	}
+
+      for (i = 0; i < 2; i++)
+	{
+	  if (servers[i].done || !(pfd[i].revents & (POLLIN | POLLHUP)))
+	    continue;
+
+	  servers[i].rc = assuan_transact_next (servers[i].ctx,
+						&servers[i].done);
+	  if (servers[i].done)
+	    {
+	      servers[i].finished = now () - start;
+	      pfd[i].fd = -1;
+	      pending--;
+	    }
+	}
+    }
+  elapsed = now () - start;
+
+  for (i = 0; i < 2; i++)
+    {
+      printf ("%s: rc=%d status=%u inquiries=%u data=`%s' after %.0f ms\n",
+	      servers[i].name, servers[i].rc, servers[i].status_lines,
+	      servers[i].inquiries, servers[i].data,
+	      servers[i].finished * 1000);
+      CHECK (!servers[i].rc, "transaction result");
+      CHECK (servers[i].status_lines == 1, "status line");
+      CHECK (servers[i].inquiries == 1, "inquiry");
+      CHECK (!strcmp (servers[i].data, servers[i].name), "data");
+    }
+  CHECK (servers[1].finished < servers[0].finished,
+	 "fast server finishes first");
+  CHECK (elapsed * 1000 < DELAY_SLOW + DELAY_FAST, "transactions overlap");
+
+  /* The context is usable for blocking transactions again.  */
+  servers[1].datalen = 0;
+  rc = assuan_transact (servers[1].ctx, "SLOW 0",
+			data_cb, &servers[1], inquire_cb, &servers[1],
+			NULL, NULL);
+  CHECK (!rc && !strcmp (servers[1].data, "fast"), "blocking transaction");
+
+ out:
+
+  for (i = 0; i < 2; i++)
+    {
+      assuan_disconnect (servers[i].ctx);
+      if (servers[i].pid > 0)
+	waitpid (servers[i].pid, NULL, 0);
+      unlink (servers[i].socket_name);
+    }
+  rmdir (dir);
+
+  if (failures)
+    {
+      fprintf (stderr, "%d check(s) failed\n", failures);
+      return 1;
+    }
+  printf ("PASS\n");
+
+  return 0;
+}
+
+/* end */
@@ -0,0 +1,487 @@
+/* assuan-serve-bench.c - measure the Assuan server loop under many
+   concurrent clients
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of Poldi.
+
+   Poldi is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   Poldi is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.  */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "assuan.h"
+
+
+
+#define PROGRAM_NAME    "assuan-serve-bench"
+#define PROGRAM_VERSION "0.1"
+
+static void
+print_help (void)
+{
+  printf ("\
+Usage: %s [options]\n\
+Run an Assuan server and many concurrent clients against it, and\n\
+report the throughput and latency of simple transactions.\n\
+\n\
+Options:\n\
+ -h, --help                 print help information\n\
+ -v, --version              print version information\n\
+ -c, --clients N            number of concurrent clients (default: 200)\n\
+ -n, --requests N           transactions per client (default: 100)\n\
+ -C, --commands N           additional commands registered by the\n\
+                            server (default: 40)\n\
+ -f, --fork                 fork a server process per connection\n\
+                            instead of using the server loop\n\
+\n\
+Report bugs to <moritz@gnu.org>.\n", PROGRAM_NAME);
+}
+
+static void
+print_version (void)
+{
+  printf (PROGRAM_NAME " " PROGRAM_VERSION "\n");
+}
+
+/* Return the monotonic time in seconds.  */
+static double
+now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+
+/* Server side.  */
+
+static unsigned int extra_commands;
+static assuan_server_loop_t server_loop;
+
+static int
+cmd_nop (assuan_context_t ctx, char *line)
+{
+  return 0;
+}
+
+/* ECHO <text>: send TEXT back as data.  */
+static int
+cmd_echo (assuan_context_t ctx, char *line)
+{
+  return assuan_send_data (ctx, line, strlen (line));
+}
+
+/* Register the commands of a server context; the benchmarked command
+   is registered last.  */
+static int
+setup_server (void *opaque, assuan_context_t ctx)
+{
+  static char names[1000][8];
+  unsigned int i;
+  int rc;
+
+  for (i = 0; i < extra_commands && i < 1000; i++)
+    {
+      snprintf (names[i], sizeof (names[i]), "CMD%03u", i);
+      rc = assuan_register_command (ctx, names[i], cmd_nop);
+      if (rc)
+	return rc;
+    }
+
+  return assuan_register_command (ctx, "ECHO", cmd_echo);
+}
+
+static void
+stop_server (int signo)
+{
+  assuan_server_loop_stop (server_loop);
+}
+
+/* Serve all clients of the listening socket FD from one process.  */
+static void
+run_server_loop (int fd)
+{
+  int rc;
+
+  rc = assuan_server_loop_new (&server_loop, fd, 0,
+			       setup_server, NULL, NULL);
+  if (rc)
+    {
+      fprintf (stderr, "error: failed to create server loop: %s\n",
+	       assuan_strerror (rc));
+      exit (1);
+    }
+  signal (SIGTERM, stop_server);
+
+  rc = assuan_server_loop_run (server_loop);
+  if (rc)
+    fprintf (stderr, "error: server loop failed: %s\n", assuan_strerror (rc));
+  assuan_server_loop_release (server_loop);
+
+  exit (!!rc);
+}
+
+/* Serve each client of the listening socket FD in its own process.  */
+static void
+run_server_fork (int fd)
+{
+  assuan_context_t ctx;
+  int conn;
+  int rc;
+
+  signal (SIGCHLD, SIG_IGN);
+  signal (SIGTERM, SIG_DFL);
+
+  for (;;)
+    {
+      conn = accept (fd, NULL, NULL);
+      if (conn == -1)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  exit (1);
+	}
+
+      switch (fork ())
+	{
+	case -1:
+	  close (conn);
+	  continue;
+
+	case 0:
+	  close (fd);
+	  rc = assuan_init_socket_server_ext (&ctx, conn, 2);
+	  if (!rc)
+	    rc = setup_server (NULL, ctx);
+	  if (rc)
+	    exit (1);
+	  while (!(rc = assuan_accept (ctx)))
+	    if (assuan_process (ctx))
+	      break;
+	  assuan_deinit_server (ctx);
+	  exit (0);
+
+	default:
+	  close (conn);
+	}
+    }
+}
+
+/* Fork a server listening on SOCKET_NAME.  */
+static pid_t
+start_server (const char *socket_name, int use_fork)
+{
+  struct sockaddr_un addr;
+  pid_t pid;
+  int fd;
+
+  memset (&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  strcpy (addr.sun_path, socket_name);
+
+  fd = socket (AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1
+      || bind (fd, (struct sockaddr *) &addr, sizeof (addr))
+      || listen (fd, SOMAXCONN))
+    {
+      fprintf (stderr, "error: failed to listen on `%s': %s\n",
+	       socket_name, strerror (errno));
+      exit (1);
+    }
+
+  pid = fork ();
+  if (pid == -1)
+    {
+      fprintf (stderr, "error: fork failed: %s\n", strerror (errno));
+      exit (1);
+    }
+  if (!pid)
+    {
+      if (use_fork)
+	run_server_fork (fd);
+      else
+	run_server_loop (fd);
+    }
+  close (fd);
+
+  return pid;
+}
+
+
+
+/* Client side.  */
+
+struct client
+{
+  assuan_context_t ctx;
+  unsigned int remaining;
+  double started;
+  size_t received;
+};
+
+static int
+data_cb (void *opaque, const void *buffer, size_t length)
+{
+  struct client *client = opaque;
+
+  client->received += length;
+
+  return 0;
+}
+
+static int
+compare_doubles (const void *a, const void *b)
+{
+  double x = *(const double *) a;
+  double y = *(const double *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+/* Start the next transaction of CLIENT.  */
+static int
+start_request (struct client *client)
+{
+  client->started = now ();
+  client->received = 0;
+
+  return assuan_transact_start (client->ctx, "ECHO ping", data_cb, client,
+				NULL, NULL, NULL, NULL);
+}
+
+/* Run REQUESTS transactions on each of the NCLIENTS connections to
+   SOCKET_NAME, all concurrently from this thread.  */
+static int
+run_clients (const char *socket_name, unsigned int nclients,
+	     unsigned int requests)
+{
+  struct client *clients;
+  struct pollfd *pfd;
+  double *latencies;
+  unsigned int i, pending, nlatencies, failures;
+  double start, elapsed;
+  int done;
+  int rc;
+
+  clients = calloc (nclients, sizeof (*clients));
+  pfd = calloc (nclients, sizeof (*pfd));
+  latencies = calloc ((size_t) nclients * requests, sizeof (*latencies));
+  if (!clients || !pfd || !latencies)
+    {
+      fprintf (stderr, "error: out of memory\n");
+      return 1;
+    }
+
+  start = now ();
+  for (i = 0; i < nclients; i++)
+    {
+      rc = assuan_socket_connect (&clients[i].ctx, socket_name, -1);
+      if (rc)
+	{
+	  fprintf (stderr, "error: client %u failed to connect: %s\n",
+		   i, assuan_strerror (rc));
+	  return 1;
+	}
+    }
+  printf ("connected %u clients in %.3f ms\n",
+	  nclients, (now () - start) * 1000);
+
+  nlatencies = failures = 0;
+  pending = 0;
+  start = now ();
+  for (i = 0; i < nclients; i++)
+    {
+      clients[i].remaining = requests;
+      pfd[i].fd = assuan_transact_fd (clients[i].ctx);
+      pfd[i].events = POLLIN;
+      if (start_request (&clients[i]))
+	{
+	  failures++;
+	  pfd[i].fd = -1;
+	}
+      else
+	pending++;
+    }
+
+  while (pending)
+    {
+      if (poll (pfd, nclients, 10000) <= 0)
+	{
+	  fprintf (stderr, "error: clients stalled\n");
+	  return 1;
+	}
+
+      for (i = 0; i < nclients; i++)
+	{
+	  if (!(pfd[i].revents & (POLLIN | POLLHUP | POLLERR)))
+	    continue;
+
+	  rc = assuan_transact_next (clients[i].ctx, &done);
+	  if (!done)
+	    continue;
+
+	  if (rc || clients[i].received != 4)
+	    failures++;
+	  else
+	    latencies[nlatencies++] = now () - clients[i].started;
+
+	  if (--clients[i].remaining && !start_request (&clients[i]))
+	    continue;
+
+	  pfd[i].fd = -1;
+	  pending--;
+	}
+    }
+  elapsed = now () - start;
+
+  for (i = 0; i < nclients; i++)
+    assuan_disconnect (clients[i].ctx);
+
+  printf ("%u transactions, %u failed, %.3f s\n",
+	  nlatencies + failures, failures, elapsed);
+  if (nlatencies)
+    {
+      qsort (latencies, nlatencies, sizeof (*latencies), compare_doubles);
+      printf ("throughput: %.0f transactions/s\n", nlatencies / elapsed);
+      printf ("latency: p50 %.3f ms, p90 %.3f ms, p99 %.3f ms,"
+	      " max %.3f ms\n",
+	      latencies[nlatencies / 2] * 1000,
+	      latencies[nlatencies * 9 / 10] * 1000,
+	      latencies[nlatencies * 99 / 100] * 1000,
+	      latencies[nlatencies - 1] * 1000);
+    }
+
+  free (latencies);
+  free (pfd);
+  free (clients);
+
+  return !!failures;
+}
+
+int
+main (int argc, char **argv)
+{
+  unsigned int nclients, requests;
+  char dir[] = "/tmp/assuan-serve-bench.XXXXXX";
+  char socket_name[256];
+  int use_fork;
+  pid_t pid;
+  int ret;
+  int c;
+
+  nclients = 200;
+  requests = 100;
+  extra_commands = 40;
+  use_fork = 0;
+
+  while (1)
+    {
+      static struct option long_options[] =
+	{
+	  { "version", no_argument, 0, 'v' },
+	  { "help", no_argument, 0, 'h' },
+	  { "clients", required_argument, 0, 'c' },
+	  { "requests", required_argument, 0, 'n' },
+	  { "commands", required_argument, 0, 'C' },
+	  { "fork", no_argument, 0, 'f' },
+	  { 0, 0, 0, 0 }
+	};
+      int option_index = 0;
+
+      c = getopt_long (argc, argv, "vhc:n:C:f",
+		       long_options, &option_index);
+
+      /* Detect the end of the options. */
+      if (c == -1)
+	break;
+
+      switch (c)
+	{
+	case 'c':
+	  nclients = strtoul (optarg, NULL, 10);
+	  break;
+	case 'n':
+	  requests = strtoul (optarg, NULL, 10);
+	  break;
+	case 'C':
+	  extra_commands = strtoul (optarg, NULL, 10);
+	  break;
+	case 'f': use_fork = 1; break;
+
+	case 'h':
+	  print_help ();
+	  exit (0);
+	  break;
+
+	case 'v':
+	  print_version ();
+	  exit (0);
+	  break;
+
+	case '?':
+	  /* `getopt_long' already printed an error message. */
+	  break;
+
+	default:
+	  abort ();
+	}
+    }
+
+  if (!nclients || !requests)
+    {
+      print_help ();
+      exit (1);
+    }
+
+  signal (SIGPIPE, SIG_IGN);
+
+  if (!mkdtemp (dir))
+    {
+      fprintf (stderr, "error: mkdtemp failed: %s\n", strerror (errno));
+      exit (1);
+    }
+  snprintf (socket_name, sizeof (socket_name), "%s/S.bench", dir);
+
+  pid = start_server (socket_name, use_fork);
+  printf ("%s server, %u clients, %u transactions each\n",
+	  use_fork ? "forking" : "loop", nclients, requests);
+
+  ret = run_clients (socket_name, nclients, requests);
+
+  kill (pid, SIGTERM);
+  waitpid (pid, NULL, 0);
+  unlink (socket_name);
+  rmdir (dir);
+
+  return ret;
+}
+
+/* end */
@@ -0,0 +1,504 @@
+/* auditlog-test.c - test the audit log
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of Poldi.
+
+   Poldi is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   Poldi is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.  */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <gcrypt.h>
+#include <gpg-error.h>
+
+#include "auditlog.h"
+
+/* This must match auditlog.c.  */
+struct audit_header
+{
+  char magic[8];
+  uint32_t byteorder;
+  uint32_t record_size;
+  uint64_t synced;
+  uint32_t committer;
+  uint32_t pad;
+  unsigned char reserved[AUDIT_RECORD_SIZE - 32];
+};
+
+/* Number of concurrent writers and records per writer.  */
+#define WRITERS 8
+#define RECORDS 50
+
+/* Every this many records of a writer are failed
+   authentications.  */
+#define FAILED_EVERY 5
+
+static int failures;
+
+#define CHECK(cond, what)					\
+  do								\
+    {								\
+      if (!(cond))						\
+	{							\
+	  fprintf (stderr, "FAIL: %s\n", (what));		\
+	  failures++;						\
+	}							\
+    }								\
+  while (0)
+
+/* Return the monotonic time in milliseconds.  */
+static long
+now_ms (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Read the header of the audit log FILENAME into HEADER and return
+   the size of the file, or -1.  */
+static off_t
+read_header (const char *filename, struct audit_header *header)
+{
+  struct stat statbuf;
+  int fd, ret;
+
+  fd = open (filename, O_RDONLY);
+  if (fd == -1)
+    return -1;
+  ret = (pread (fd, header, sizeof (*header), 0) != sizeof (*header)
+	 || fstat (fd, &statbuf));
+  close (fd);
+
+  return ret ? -1 : statbuf.st_size;
+}
+
+/* Set the field at OFFSET of the header of the audit log FILENAME to
+   the SIZE bytes at VALUE, as a crashed or concurrent process would.
+   Returns zero on success.  */
+static int
+write_header_field (const char *filename, size_t offset,
+		    const void *value, size_t size)
+{
+  int fd, ret;
+
+  fd = open (filename, O_WRONLY);
+  if (fd == -1)
+    return -1;
+  ret = pwrite (fd, value, size, offset) != size;
+  close (fd);
+
+  return ret;
+}
+
+static int
+set_committer (const char *filename, uint32_t pid)
+{
+  return write_header_field (filename,
+			     offsetof (struct audit_header, committer),
+			     &pid, sizeof (pid));
+}
+
+/* Fill RECORD as record SEQ of writer WRITER.  */
+static void
+make_record (struct audit_record *record, unsigned int writer,
+	     unsigned int seq)
+{
+  char buffer[64];
+
+  memset (record, 0, sizeof (*record));
+  record->magic = AUDIT_RECORD_MAGIC;
+  record->result = (seq % FAILED_EVERY) ? 0 : GPG_ERR_BAD_PIN;
+  record->time = (uint64_t) time (NULL) * 1000000;
+  record->uid = writer;
+  record->pid = getpid ();
+  record->phase_us[AUDIT_PHASE_AUTHENTICATE] = 1000 * (seq % 3 + 1);
+  snprintf (buffer, sizeof (buffer), "%u", seq);
+  audit_record_set (record->auth_id, sizeof (record->auth_id), buffer);
+  audit_record_set (record->method, sizeof (record->method), "localdb");
+  snprintf (buffer, sizeof (buffer), "user%u", writer);
+  audit_record_set (record->username, sizeof (record->username), buffer);
+  audit_record_set (record->serialno, sizeof (record->serialno),
+		    "D2760001240102000005000012340000");
+}
+
+/* Append RECORDS records as writer WRITER to the audit log FILENAME,
+   waiting up to INTERVAL milliseconds for others to sync; run in a
+   child process.  */
+static void
+writer (const char *filename, unsigned int writer, unsigned int interval)
+{
+  struct audit_record record;
+  audit_log_t log;
+  unsigned int i;
+
+  if (audit_log_open (filename, &log))
+    _exit (1);
+  for (i = 0; i < RECORDS; i++)
+    {
+      make_record (&record, writer, i);
+      if (audit_log_append (log, &record, interval))
+	_exit (1);
+    }
+  audit_log_close (log);
+
+  _exit (0);
+}
+
+/* Check the records written by the writers to FILENAME.  */
+static void
+check_records (const char *filename)
+{
+  const struct audit_record *records;
+  unsigned int count[WRITERS];
+  uint32_t pid[WRITERS];
+  size_t i, nrecords;
+  gpg_error_t err;
+  unsigned int w;
+  int ok;
+
+  err = audit_log_map (filename, &records, &nrecords);
+  CHECK (!err, "audit_log_map");
+  if (err)
+    return;
+  CHECK (nrecords == WRITERS * RECORDS, "number of records");
+
+  /* The records of each writer are complete and in order.  */
+  memset (count, 0, sizeof (count));
+  ok = 1;
+  for (i = 0; i < nrecords; i++)
+    {
+      const struct audit_record *record = &records[i];
+
+      w = record->uid;
+      if (record->magic != AUDIT_RECORD_MAGIC || w >= WRITERS
+	  || atoi (record->auth_id) != count[w]
+	  || (count[w] && record->pid != pid[w]))
+	ok = 0;
+      else
+	pid[w] = record->pid;
+      if (w < WRITERS)
+	count[w]++;
+    }
+  for (w = 0; w < WRITERS; w++)
+    if (count[w] != RECORDS)
+      ok = 0;
+  CHECK (ok, "records of writers");
+
+  audit_log_unmap (records, nrecords);
+}
+
+/* Run poldi-audit with the arguments and redirections ARGS and
+   compare its output with EXPECTED.  */
+static void
+check_poldi_audit (const char *args, const char *expected, const char *what)
+{
+  char command[512];
+  char output[4096];
+  size_t n;
+  FILE *fp;
+
+  snprintf (command, sizeof (command), "%s %s", POLDI_AUDIT, args);
+  fp = popen (command, "r");
+  if (!fp)
+    {
+      perror ("popen");
+      failures++;
+      return;
+    }
+  n = fread (output, 1, sizeof (output) - 1, fp);
+  output[n] = 0;
+  if (pclose (fp) || strcmp (output, expected))
+    {
+      fprintf (stderr, "FAIL: %s, output:\n%s", what, output);
+      failures++;
+    }
+}
+
+int
+main (int argc, char **argv)
+{
+  char dir[] = "/tmp/auditlog-test.XXXXXX";
+  char filename[256], args[512], expected[2048];
+  const struct audit_record *records;
+  struct audit_header header;
+  struct audit_record record;
+  audit_log_t log;
+  size_t nrecords;
+  pid_t pids[WRITERS];
+  gpg_error_t err;
+  int fds[2];
+  int status, fd;
+  unsigned int i;
+  off_t size;
+  uint64_t synced;
+  long t;
+  pid_t pid;
+  char c;
+
+  if (!gcry_check_version (NEED_LIBGCRYPT_VERSION))
+    {
+      fprintf (stderr, "error: libgcrypt too old\n");
+      return 1;
+    }
+  gcry_control (GCRYCTL_DISABLE_SECMEM);
+  gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
+
+  if (!mkdtemp (dir))
+    {
+      perror ("mkdtemp");
+      return 1;
+    }
+  snprintf (filename, sizeof (filename), "%s/audit.log", dir);
+  log = NULL;
+
+  /* Creation.  */
+  err = audit_log_open (filename, &log);
+  CHECK (!err, "audit_log_open");
+  if (err)
+    goto out;
+  size = read_header (filename, &header);
+  CHECK (size == AUDIT_RECORD_SIZE
+	 && !memcmp (header.magic, "PLDAUD01", 8)
+	 && header.byteorder == 0x01020304
+	 && header.record_size == AUDIT_RECORD_SIZE
+	 && !header.committer, "header of new log");
+  audit_log_close (log);
+  log = NULL;
+
+  /* Concurrent writers, committing in groups.  */
+  for (i = 0; i < WRITERS; i++)
+    {
+      pids[i] = fork ();
+      if (pids[i] == -1)
+	{
+	  perror ("fork");
+	  failures++;
+	  goto out;
+	}
+      if (!pids[i])
+	writer (filename, i, 5);
+    }
+  for (i = 0; i < WRITERS; i++)
+    CHECK (waitpid (pids[i], &status, 0) == pids[i]
+	   && WIFEXITED (status) && !WEXITSTATUS (status), "writer");
+
+  check_records (filename);
+  size = read_header (filename, &header);
+  CHECK (size == (WRITERS * RECORDS + 1) * AUDIT_RECORD_SIZE,
+	 "size of log");
+  CHECK (header.synced == size, "synced after writers");
+  CHECK (!header.committer, "no committer after writers");
+
+  /* The records as seen by poldi-audit.  */
+  if (!access (POLDI_AUDIT, X_OK))
+    {
+      snprintf (expected, sizeof (expected), "%-32s %8s %8s %10s %10s\n",
+		"key", "ok", "failed", "avg ms", "max ms");
+      for (i = 0; i < WRITERS; i++)
+	{
+	  char key[16];
+
+	  snprintf (key, sizeof (key), "user%u", i);
+	  snprintf (expected + strlen (expected),
+		    sizeof (expected) - strlen (expected),
+		    "%-32s %8u %8u %10.1f %10.1f\n", key,
+		    RECORDS - RECORDS / FAILED_EVERY, RECORDS / FAILED_EVERY,
+		    /* 17 records take 1 ms, 17 take 2 and 16 take 3.  */
+		    (17 * 1 + 17 * 2 + 16 * 3) / 50.0, 3.0);
+	}
+      snprintf (args, sizeof (args), "-a user %s 2>/dev/null", filename);
+      check_poldi_audit (args, expected, "poldi-audit aggregated by user");
+
+      snprintf (args, sizeof (args), "-f -u user3 %s 2>&1 >/dev/null",
+		filename);
+      snprintf (expected, sizeof (expected),
+		"poldi-audit: %u of %u records matched\n",
+		RECORDS / FAILED_EVERY, WRITERS * RECORDS);
+      check_poldi_audit (args, expected, "poldi-audit failed of user");
+    }
+  else
+    printf ("SKIP: poldi-audit (not built)\n");
+
+  err = audit_log_open (filename, &log);
+  CHECK (!err, "reopen");
+  if (err)
+    goto out;
+
+  /* audit_log_commit syncs the records of others.  */
+  synced = AUDIT_RECORD_SIZE;
+  write_header_field (filename, offsetof (struct audit_header, synced),
+		      &synced, sizeof (synced));
+  CHECK (!audit_log_commit (log), "audit_log_commit");
+  size = read_header (filename, &header);
+  CHECK (header.synced == size, "synced after commit");
+
+  /* A writer waiting for others to sync is done as soon as someone
+     has synced its record.  */
+  pid = fork ();
+  if (pid == -1)
+    {
+      perror ("fork");
+      failures++;
+      goto out;
+    }
+  if (!pid)
+    {
+      audit_log_close (log);
+      if (audit_log_open (filename, &log))
+	_exit (1);
+      make_record (&record, 0, 0);
+      t = now_ms ();
+      if (audit_log_append (log, &record, 5000))
+	_exit (1);
+      _exit (now_ms () - t >= 2500);
+    }
+  usleep (100000);
+  CHECK (!audit_log_commit (log), "commit for waiting writer");
+  CHECK (waitpid (pid, &status, 0) == pid
+	 && WIFEXITED (status) && !WEXITSTATUS (status),
+	 "writer done after commit of other process");
+
+  /* The lock of a committer which has died is broken.  */
+  pid = fork ();
+  if (pid == -1)
+    {
+      perror ("fork");
+      failures++;
+      goto out;
+    }
+  if (!pid)
+    _exit (0);
+  waitpid (pid, &status, 0);
+  set_committer (filename, pid);
+  make_record (&record, 0, 0);
+  t = now_ms ();
+  CHECK (!audit_log_append (log, &record, 0), "append with dead committer");
+  CHECK (now_ms () - t < 500, "lock of dead committer broken");
+  size = read_header (filename, &header);
+  CHECK (!header.committer, "no committer after breaking lock");
+  CHECK (header.synced == size, "synced after breaking lock");
+
+  /* The lock of a live committer is not broken; after waiting for it,
+     the file is synced without coordination.  */
+  if (pipe (fds))
+    {
+      perror ("pipe");
+      failures++;
+      goto out;
+    }
+  pid = fork ();
+  if (pid == -1)
+    {
+      perror ("fork");
+      failures++;
+      goto out;
+    }
+  if (!pid)
+    {
+      close (fds[1]);
+      _exit (read (fds[0], &c, 1) < 0);
+    }
+  close (fds[0]);
+  set_committer (filename, pid);
+  CHECK (!audit_log_append (log, &record, 0), "append with live committer");
+  size = read_header (filename, &header);
+  CHECK (header.committer == pid, "lock of live committer kept");
+  CHECK (header.synced == size, "synced despite live committer");
+  close (fds[1]);
+  waitpid (pid, &status, 0);
+  set_committer (filename, 0);
+
+  audit_log_close (log);
+  log = NULL;
+
+  /* A partial record at the end is ignored.  */
+  fd = open (filename, O_WRONLY | O_APPEND);
+  CHECK (fd != -1 && write (fd, "partial", 7) == 7, "write partial record");
+  if (fd != -1)
+    close (fd);
+  err = audit_log_map (filename, &records, &nrecords);
+  CHECK (!err && nrecords == WRITERS * RECORDS + 3, "partial record ignored");
+  if (!err)
+    audit_log_unmap (records, nrecords);
+
+  /* A log others may write to is refused.  */
+  chmod (filename, 0620);
+  err = audit_log_open (filename, &log);
+  CHECK (gpg_err_code (err) == GPG_ERR_EPERM, "writable log refused");
+  if (!err)
+    audit_log_close (log);
+  log = NULL;
+  unlink (filename);
+
+  /* So is a file which is no audit log.  */
+  fd = open (filename, O_WRONLY | O_CREAT | O_EXCL, 0600);
+  memset (&header, 'x', sizeof (header));
+  CHECK (fd != -1 && write (fd, &header, sizeof (header)) == sizeof (header),
+	 "write foreign file");
+  if (fd != -1)
+    close (fd);
+  err = audit_log_open (filename, &log);
+  CHECK (gpg_err_code (err) == GPG_ERR_INV_DATA, "foreign file refused");
+  if (!err)
+    audit_log_close (log);
+  log = NULL;
+  err = audit_log_map (filename, &records, &nrecords);
+  CHECK (gpg_err_code (err) == GPG_ERR_INV_DATA, "foreign file not mapped");
+  if (!err)
+    audit_log_unmap (records, nrecords);
+
+  /* And a file shorter than the header.  */
+  CHECK (!truncate (filename, 10), "truncate log");
+  err = audit_log_open (filename, &log);
+  CHECK (gpg_err_code (err) == GPG_ERR_INV_DATA, "short file refused");
+  if (!err)
+    audit_log_close (log);
+  log = NULL;
+  err = audit_log_map (filename, &records, &nrecords);
+  CHECK (gpg_err_code (err) == GPG_ERR_INV_DATA, "short file not mapped");
+  if (!err)
+    audit_log_unmap (records, nrecords);
+
+ out:
+
+  audit_log_close (log);
+  unlink (filename);
+  rmdir (dir);
+
+  if (failures)
+    {
+      fprintf (stderr, "%d check(s) failed\n", failures);
+      return 1;
+    }
+  printf ("PASS\n");
+
+  return 0;
+}
+
+/* end */
@@ -0,0 +1,265 @@
+/* challenge-test.c - test the challenge-response protocol
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of Poldi.
+
+   Poldi is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   Poldi is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.  */
+
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gcrypt.h>
+#include <gpg-error.h>
+
+#include "util/util.h"
+#include "util/support.h"
+
+/* The supported key types, with the parameters expected for them.
+   CARD_ALGO is the OpenPGP algorithm ID a card reports for such a
+   key.  */
+static struct
+{
+  const char *name;
+  const char *genkey;
+  int card_algo;
+  int pkalgo;
+  int mdalgo;
+  int card_mdalgo;
+} schemes[] =
+  {
+    { "RSA", "(genkey (rsa (nbits 4:1024)))",
+      1, GCRY_PK_RSA, GCRY_MD_SHA1, GCRY_MD_SHA1 },
+    { "ECDSA P-256", "(genkey (ecc (curve \"NIST P-256\")))",
+      19, GCRY_PK_ECDSA, GCRY_MD_SHA256, 0 },
+    { "ECDSA P-384", "(genkey (ecc (curve \"NIST P-384\")))",
+      19, GCRY_PK_ECDSA, GCRY_MD_SHA384, 0 },
+    { "EdDSA", "(genkey (ecc (curve Ed25519) (flags eddsa)))",
+      22, GCRY_PK_EDDSA, GCRY_MD_SHA512, 0 }
+  };
+
+/* Name of the scheme being tested, for messages.  */
+static const char *scheme;
+
+static int failures;
+
+#define CHECK(cond, what)					\
+  do								\
+    {								\
+      if (!(cond))						\
+	{							\
+	  fprintf (stderr, "FAIL: %s: %s\n", scheme, (what));	\
+	  failures++;						\
+	}							\
+    }								\
+  while (0)
+
+/* Store the value of the element NAME of the signature SIG in BUFFER,
+   left-padded with zeroes to LENGTH bytes.  Returns zero on
+   success.  */
+static int
+sig_element (gcry_sexp_t sig, const char *name,
+	     unsigned char *buffer, size_t length)
+{
+  const char *data;
+  gcry_sexp_t l;
+  size_t n;
+
+  l = gcry_sexp_find_token (sig, name, 0);
+  data = l ? gcry_sexp_nth_data (l, 1, &n) : NULL;
+  if (!data || n > length)
+    {
+      gcry_sexp_release (l);
+      return -1;
+    }
+  memset (buffer, 0, length - n);
+  memcpy (buffer + length - n, data, n);
+  gcry_sexp_release (l);
+
+  return 0;
+}
+
+/* Sign CHALLENGE with the secret key SECKEY the way an OpenPGP card
+   does when asked by Poldi, according to PARAMS, and store the
+   response in RESPONSE, which is of size 512, and its length in
+   *RESPONSE_N.  Returns zero on success.  */
+static int
+card_sign (gcry_sexp_t seckey, const struct challenge_params *params,
+	   const unsigned char *challenge, size_t challenge_n,
+	   unsigned char *response, size_t *response_n)
+{
+  gcry_sexp_t data, sig;
+  size_t length;
+  int ret;
+
+  switch (params->pkalgo)
+    {
+    case GCRY_PK_RSA:
+      /* The card wraps the digest in a DigestInfo of the announced
+	 hash algorithm.  */
+      ret = gcry_sexp_build (&data, NULL, "(data (flags pkcs1) (hash %s %b))",
+			     gcry_md_algo_name (params->card_mdalgo),
+			     (int) challenge_n, challenge);
+      break;
+    case GCRY_PK_ECDSA:
+      ret = gcry_sexp_build (&data, NULL, "(data (flags raw) (value %b))",
+			     (int) challenge_n, challenge);
+      break;
+    default:
+      ret = gcry_sexp_build (&data, NULL,
+			     "(data (flags eddsa) (hash-algo sha512)"
+			     " (value %b))",
+			     (int) challenge_n, challenge);
+      break;
+    }
+  if (ret)
+    return -1;
+
+  ret = gcry_pk_sign (&sig, data, seckey);
+  gcry_sexp_release (data);
+  if (ret)
+    return -1;
+
+  /* RSA signatures are as long as the modulus, ECDSA and EdDSA
+     signatures are R and S of the size of the curve, concatenated.  */
+  length = (gcry_pk_get_nbits (seckey) + 7) / 8;
+  if (params->pkalgo == GCRY_PK_RSA)
+    {
+      ret = sig_element (sig, "s", response, length);
+      *response_n = length;
+    }
+  else
+    {
+      ret = sig_element (sig, "r", response, length);
+      if (!ret)
+	ret = sig_element (sig, "s", response + length, length);
+      *response_n = 2 * length;
+    }
+  gcry_sexp_release (sig);
+
+  return ret;
+}
+
+static void
+test_scheme (unsigned int i)
+{
+  struct challenge_params params;
+  gcry_sexp_t spec, keypair, pubkey, seckey;
+  unsigned char *challenge;
+  unsigned char response[512];
+  size_t challenge_n, response_n;
+  int card_algo;
+
+  scheme = schemes[i].name;
+  keypair = pubkey = seckey = NULL;
+  challenge = NULL;
+
+  if (gcry_sexp_new (&spec, schemes[i].genkey, 0, 1))
+    {
+      CHECK (0, "key specification");
+      return;
+    }
+  if (gcry_pk_genkey (&keypair, spec))
+    {
+      CHECK (0, "key generation");
+      goto out;
+    }
+  pubkey = gcry_sexp_find_token (keypair, "public-key", 0);
+  seckey = gcry_sexp_find_token (keypair, "private-key", 0);
+
+  /* Parameters.  */
+  CHECK (!challenge_params_from_key (pubkey, 0, &params), "parameters");
+  CHECK (params.pkalgo == schemes[i].pkalgo, "public key algorithm");
+  CHECK (params.mdalgo == schemes[i].mdalgo, "hash algorithm");
+  CHECK (params.card_mdalgo == schemes[i].card_mdalgo,
+	 "hash algorithm for the card");
+
+  /* The key must match the algorithm reported by the card.  */
+  CHECK (!challenge_params_from_key (pubkey, schemes[i].card_algo, &params),
+	 "parameters with card algorithm");
+  card_algo = schemes[i].card_algo == 22 ? 19 : 22;
+  CHECK (gpg_err_code (challenge_params_from_key (pubkey, card_algo, &params))
+	 == GPG_ERR_WRONG_PUBKEY_ALGO, "parameters with other card algorithm");
+  CHECK (!challenge_params_from_key (pubkey, 0, &params), "parameters");
+
+  /* Challenge and response.  */
+  CHECK (!challenge_generate (&params, &challenge, &challenge_n),
+	 "challenge");
+  if (!challenge)
+    goto out;
+  CHECK (challenge_n == gcry_md_get_algo_dlen (schemes[i].mdalgo),
+	 "challenge length");
+
+  if (card_sign (seckey, &params, challenge, challenge_n,
+		 response, &response_n))
+    {
+      CHECK (0, "signing");
+      goto out;
+    }
+  CHECK (!challenge_verify (pubkey, &params, challenge, challenge_n,
+			    response, response_n), "verification");
+
+  /* Wrong challenge or response.  */
+  challenge[0] ^= 1;
+  CHECK (challenge_verify (pubkey, &params, challenge, challenge_n,
+			   response, response_n), "other challenge");
+  challenge[0] ^= 1;
+  response[response_n - 1] ^= 1;
+  CHECK (challenge_verify (pubkey, &params, challenge, challenge_n,
+			   response, response_n), "modified response");
+  response[response_n - 1] ^= 1;
+  CHECK (challenge_verify (pubkey, &params, challenge, challenge_n,
+			   response, response_n - 1), "truncated response");
+
+ out:
+
+  challenge_release (challenge);
+  gcry_sexp_release (seckey);
+  gcry_sexp_release (pubkey);
+  gcry_sexp_release (keypair);
+  gcry_sexp_release (spec);
+}
+
+int
+main (int argc, char **argv)
+{
+  unsigned int i;
+
+  if (!gcry_check_version (NEED_LIBGCRYPT_VERSION))
+    {
+      fprintf (stderr, "error: libgcrypt too old\n");
+      return 1;
+    }
+  gcry_control (GCRYCTL_DISABLE_SECMEM);
+  gcry_control (GCRYCTL_ENABLE_QUICK_RANDOM, 0);
+  gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
+
+  for (i = 0; i < DIM (schemes); i++)
+    test_scheme (i);
+
+  if (failures)
+    {
+      fprintf (stderr, "%d check(s) failed\n", failures);
+      return 1;
+    }
+  printf ("PASS\n");
+
+  return 0;
+}
+
+/* end */
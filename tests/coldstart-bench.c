@@ -0,0 +1,348 @@
+/* coldstart-bench.c - profile the start-up costs of a fresh PAM
+   process
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of Poldi.
+
+   Poldi is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   Poldi is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.  */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <gcrypt.h>
+#ifdef WITH_KSBA
+# include <ksba.h>
+#endif
+
+#include "poldi.h"
+#include "util/util.h"
+#include "util/support.h"
+
+
+
+#define PROGRAM_NAME    "coldstart-bench"
+#define PROGRAM_VERSION "0.1"
+
+static void
+print_help (void)
+{
+  printf ("\
+Usage: %s [options]\n\
+Measure, each in a fresh process, the steps a short-lived PAM\n\
+process like su or sudo goes through before Poldi does any real\n\
+work, and compare Poldi's former start-up with the current one.\n\
+\n\
+Options:\n\
+ -h, --help                 print help information\n\
+ -v, --version              print version information\n\
+ -n, --iterations N         processes per step (default: 50)\n\
+\n\
+Report bugs to <moritz@gnu.org>.\n", PROGRAM_NAME);
+}
+
+static void
+print_version (void)
+{
+  printf (PROGRAM_NAME " " PROGRAM_VERSION "\n");
+}
+
+/* Return the monotonic time in seconds.  */
+static double
+now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+
+/* The steps.  Each has to be done after the setup of its step, if
+   any, which is not measured.  */
+
+static unsigned char buffer[32];
+
+static void
+step_bindtextdomain (void)
+{
+  bindtextdomain (PACKAGE, LOCALEDIR);
+}
+
+static void
+step_first_message (void)
+{
+  dgettext (PACKAGE, "Waiting for card...");
+}
+
+static void
+step_gcry_check_version (void)
+{
+  gcry_check_version (NEED_LIBGCRYPT_VERSION);
+}
+
+static void
+step_gcry_disable_secmem (void)
+{
+  /* This is all Poldi used to do; it runs Libgcrypt's implicit
+     initialization.  */
+  gcry_control (GCRYCTL_DISABLE_SECMEM);
+}
+
+static void
+step_gcry_finished (void)
+{
+  gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
+}
+
+static void
+step_gcry_create_nonce (void)
+{
+  gcry_create_nonce (buffer, sizeof (buffer));
+}
+
+static void
+step_nonce_generate (void)
+{
+  nonce_generate (buffer, sizeof (buffer));
+}
+
+#ifdef WITH_KSBA
+static void
+step_ksba (void)
+{
+  ksba_cert_t cert;
+
+  ksba_check_version (NULL);
+  if (!ksba_cert_new (&cert))
+    ksba_cert_release (cert);
+}
+#endif
+
+/* Poldi's former start-up: binding the message catalog, implicit
+   initialization of Libgcrypt and two nonces from its generator (the
+   authentication ID and the challenge).  */
+static void
+step_poldi_before (void)
+{
+  bindtextdomain (PACKAGE, LOCALEDIR);
+  gcry_control (GCRYCTL_DISABLE_SECMEM);
+  gcry_create_nonce (buffer, 8);
+  gcry_create_nonce (buffer, sizeof (buffer));
+}
+
+/* The current one for a user turned away by the early checks:
+   Libgcrypt is set up without its random number generator, the
+   nonce comes from the kernel and the message catalog is only bound
+   when a message is shown.  */
+static void
+step_poldi_early (void)
+{
+  crypto_init ();
+  nonce_generate (buffer, 8);
+}
+
+/* The current one for a user going on to use the card, which also
+   takes the challenge from the kernel.  */
+static void
+step_poldi_full (void)
+{
+  crypto_init ();
+  nonce_generate (buffer, 8);
+  nonce_generate (buffer, sizeof (buffer));
+}
+
+static void
+setup_gcry (void)
+{
+  gcry_check_version (NEED_LIBGCRYPT_VERSION);
+  gcry_control (GCRYCTL_DISABLE_SECMEM);
+}
+
+static void
+setup_gcry_finished (void)
+{
+  setup_gcry ();
+  gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
+}
+
+static void
+setup_locale (void)
+{
+  setlocale (LC_ALL, "");
+  bindtextdomain (PACKAGE, LOCALEDIR);
+}
+
+static struct
+{
+  const char *name;
+  void (*setup) (void);
+  void (*step) (void);
+} steps[] =
+  {
+    { "bindtextdomain", NULL, step_bindtextdomain },
+    { "first message", setup_locale, step_first_message },
+    { "gcry_check_version", NULL, step_gcry_check_version },
+    { "implicit gcrypt init", NULL, step_gcry_disable_secmem },
+    { "INITIALIZATION_FINISHED", setup_gcry, step_gcry_finished },
+    { "gcry_create_nonce", setup_gcry, step_gcry_create_nonce },
+    { "gcry_create_nonce (init)", setup_gcry_finished,
+      step_gcry_create_nonce },
+    { "nonce_generate", NULL, step_nonce_generate },
+#ifdef WITH_KSBA
+    { "ksba first certificate", NULL, step_ksba },
+#endif
+    { "Poldi former start-up", NULL, step_poldi_before },
+    { "Poldi, early rejection", NULL, step_poldi_early },
+    { "Poldi, full start-up", NULL, step_poldi_full }
+  };
+
+/* Run step I in a child process and return the time it took in
+   seconds, or a negative value on error.  */
+static double
+run_step (unsigned int i)
+{
+  int fds[2];
+  pid_t pid;
+  int status;
+  ssize_t n;
+  double t;
+
+  if (pipe (fds))
+    return -1;
+
+  pid = fork ();
+  if (pid == -1)
+    return -1;
+  if (!pid)
+    {
+      close (fds[0]);
+      if (steps[i].setup)
+	(*steps[i].setup) ();
+      t = now ();
+      (*steps[i].step) ();
+      t = now () - t;
+      if (write (fds[1], &t, sizeof (t)) != sizeof (t))
+	_exit (1);
+      _exit (0);
+    }
+
+  close (fds[1]);
+  n = read (fds[0], &t, sizeof (t));
+  close (fds[0]);
+  waitpid (pid, &status, 0);
+
+  if (n != sizeof (t) || !WIFEXITED (status) || WEXITSTATUS (status))
+    return -1;
+
+  return t;
+}
+
+int
+main (int argc, char **argv)
+{
+  unsigned int iterations;
+  unsigned int i, j;
+  double t, sum, min;
+  int c;
+
+  iterations = 50;
+
+  while (1)
+    {
+      static struct option long_options[] =
+	{
+	  { "version", no_argument, 0, 'v' },
+	  { "help", no_argument, 0, 'h' },
+	  { "iterations", required_argument, 0, 'n' },
+	  { 0, 0, 0, 0 }
+	};
+      int option_index = 0;
+
+      c = getopt_long (argc, argv, "vhn:",
+		       long_options, &option_index);
+
+      /* Detect the end of the options. */
+      if (c == -1)
+	break;
+
+      switch (c)
+	{
+	case 'n':
+	  iterations = strtoul (optarg, NULL, 10);
+	  break;
+
+	case 'h':
+	  print_help ();
+	  exit (0);
+	  break;
+
+	case 'v':
+	  print_version ();
+	  exit (0);
+	  break;
+
+	case '?':
+	  /* `getopt_long' already printed an error message. */
+	  break;
+
+	default:
+	  abort ();
+	}
+    }
+
+  if (!iterations)
+    {
+      print_help ();
+      exit (1);
+    }
+
+  printf ("%u processes per step\n", iterations);
+  printf ("%-26s %10s %10s\n", "step", "avg [us]", "min [us]");
+
+  for (i = 0; i < DIM (steps); i++)
+    {
+      sum = 0;
+      min = -1;
+      for (j = 0; j < iterations; j++)
+	{
+	  t = run_step (i);
+	  if (t < 0)
+	    {
+	      fprintf (stderr, "error: step `%s' failed\n", steps[i].name);
+	      exit (1);
+	    }
+	  sum += t;
+	  if (min < 0 || t < min)
+	    min = t;
+	}
+      printf ("%-26s %10.1f %10.1f\n", steps[i].name,
+	      sum / iterations * 1e6, min * 1e6);
+    }
+
+  return 0;
+}
+
+/* end */
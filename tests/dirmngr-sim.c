@@ -0,0 +1,534 @@
+/* dirmngr-sim.c - stand-in for Dirmngr serving local certificates
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of Poldi.
+
+   Poldi is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   Poldi is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.  */
+
+#include <config.h>
+
+/* Errors are reported to clients as coming from Dirmngr.  */
+#define GPG_ERR_SOURCE_DEFAULT GPG_ERR_SOURCE_DIRMNGR
+
+#include <poldi.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <gpg-error.h>
+#include <gcrypt.h>
+#include <ksba.h>
+
+#include "assuan.h"
+#include "util/simplelog.h"
+#include "util/support.h"
+#include "auth-method-x509/x509-offline.h"
+
+
+
+#define PROGRAM_NAME    "dirmngr-sim"
+#define PROGRAM_VERSION "0.1"
+
+/* Maximum size of a certificate sent by a client.  */
+#define MAX_CERT_SIZE 65536
+
+static void
+print_help (void)
+{
+  printf ("\
+Usage: %s [options] SOCKET\n\
+Serve the Dirmngr commands used by Poldi on the local socket SOCKET,\n\
+from local files instead of LDAP and OCSP servers:\n\
+\n\
+  LOOKUP --url URL  sends every certificate whose file name starts\n\
+                    with the last path component of URL\n\
+  LOOKUP PATTERN    sends every certificate whose subject contains\n\
+                    PATTERN\n\
+  VALIDATE          validates the inquired certificate against the\n\
+                    CA bundle and CRL\n\
+\n\
+Every connection is served by a process of its own.\n\
+\n\
+Options:\n\
+ -h, --help                 print help information\n\
+ -v, --version              print version information\n\
+ -c, --cert-dir DIR         directory of certificates (DER) to serve\n\
+ -a, --ca-bundle FILE       CA bundle for validation\n\
+ -r, --crl FILE             CRL for validation\n\
+ -I, --inquire-issuer       send a SENDISSUERCERT inquiry on VALIDATE\n\
+ -C, --connect-latency MS   delay the greeting by MS milliseconds\n\
+ -L, --lookup-latency MS    delay LOOKUP by MS milliseconds\n\
+ -V, --validate-latency MS  delay VALIDATE by MS milliseconds\n\
+\n\
+Report bugs to <moritz@gnu.org>.\n", PROGRAM_NAME);
+}
+
+static void
+print_version (void)
+{
+  printf (PROGRAM_NAME " " PROGRAM_VERSION "\n");
+}
+
+/* A certificate served by LOOKUP.  */
+struct sim_cert
+{
+  char *name;			/* File name.  */
+  char *subject;
+  void *image;
+  size_t image_len;
+};
+
+static struct sim_cert *certs;
+static size_t ncerts;
+
+static x509_offline_t offline;
+static int inquire_issuer;
+static unsigned int connect_latency;
+static unsigned int lookup_latency;
+static unsigned int validate_latency;
+
+
+
+/* Sleep for MS milliseconds.  */
+static void
+delay (unsigned int ms)
+{
+  struct timespec ts;
+
+  ts.tv_sec = ms / 1000;
+  ts.tv_nsec = (ms % 1000) * 1000000L;
+  while (nanosleep (&ts, &ts) && errno == EINTR)
+    ;
+}
+
+/* Load all certificates in the directory DIR.  Files which do not
+   contain a certificate are skipped.  */
+static gpg_error_t
+load_certs (const char *dir)
+{
+  struct sim_cert *cert;
+  struct dirent *entry;
+  ksba_cert_t ksba;
+  gpg_error_t err;
+  char *path;
+  DIR *d;
+
+  d = opendir (dir);
+  if (!d)
+    return gpg_error_from_syserror ();
+
+  err = 0;
+  while (!err && (entry = readdir (d)))
+    {
+      if (entry->d_name[0] == '.')
+	continue;
+
+      if (!(ncerts % 64))
+	{
+	  cert = realloc (certs, (ncerts + 64) * sizeof (*certs));
+	  if (!cert)
+	    {
+	      err = gpg_error_from_syserror ();
+	      break;
+	    }
+	  certs = cert;
+	}
+      cert = &certs[ncerts];
+
+      path = malloc (strlen (dir) + strlen (entry->d_name) + 2);
+      if (!path)
+	{
+	  err = gpg_error_from_syserror ();
+	  break;
+	}
+      sprintf (path, "%s/%s", dir, entry->d_name);
+
+      ksba = NULL;
+      cert->image = NULL;
+      if (file_to_binstring (path, &cert->image, &cert->image_len)
+	  || ksba_cert_new (&ksba)
+	  || ksba_cert_init_from_mem (ksba, cert->image, cert->image_len))
+	{
+	  fprintf (stderr, "%s: skipping `%s'\n", PROGRAM_NAME, path);
+	  xfree (cert->image);
+	}
+      else
+	{
+	  cert->name = strdup (entry->d_name);
+	  cert->subject = ksba_cert_get_subject (ksba, 0);
+	  if (!cert->name || !cert->subject)
+	    err = gpg_error_from_syserror ();
+	  else
+	    ncerts++;
+	}
+
+      ksba_cert_release (ksba);
+      free (path);
+    }
+
+  closedir (d);
+
+  return err;
+}
+
+/* Send the certificate CERT as the next item of a LOOKUP result.  */
+static gpg_error_t
+send_cert (assuan_context_t ctx, const struct sim_cert *cert)
+{
+  gpg_error_t err;
+
+  err = assuan_send_data (ctx, cert->image, cert->image_len);
+  if (!err)
+    err = assuan_send_data (ctx, NULL, 0);
+  if (!err)
+    err = assuan_write_line (ctx, "END");
+
+  return err;
+}
+
+/* LOOKUP [--url] [--single] PATTERN */
+static int
+cmd_lookup (assuan_context_t ctx, char *line)
+{
+  const char *key;
+  gpg_error_t err;
+  int url, single;
+  size_t i, n;
+
+  url = single = 0;
+  while (!strncmp (line, "--", 2))
+    {
+      if (!strncmp (line, "--url", 5) && (line[5] == ' ' || !line[5]))
+	url = 1;
+      else if (!strncmp (line, "--single", 8) && (line[8] == ' ' || !line[8]))
+	single = 1;
+      while (*line && *line != ' ')
+	line++;
+      while (*line == ' ')
+	line++;
+    }
+
+  if (!*line)
+    return gpg_error (GPG_ERR_INV_ARG);
+
+  delay (lookup_latency);
+
+  /* Map the URL to a file name: the last path component without the
+     query.  */
+  key = line;
+  if (url)
+    {
+      char *p;
+
+      p = strrchr (line, '/');
+      if (p)
+	key = p + 1;
+      p = strchr (key, '?');
+      if (p)
+	*p = 0;
+    }
+
+  err = 0;
+  n = 0;
+  for (i = 0; !err && i < ncerts; i++)
+    {
+      if (url
+	  ? strncmp (certs[i].name, key, strlen (key))
+	  : !strcasestr (certs[i].subject, key))
+	continue;
+
+      err = send_cert (ctx, &certs[i]);
+      n++;
+      if (single)
+	break;
+    }
+
+  if (!err && !n)
+    err = gpg_error (GPG_ERR_NOT_FOUND);
+
+  return err;
+}
+
+/* VALIDATE */
+static int
+cmd_validate (assuan_context_t ctx, char *line)
+{
+  unsigned char *image;
+  ksba_cert_t cert;
+  gpg_error_t err;
+  size_t len;
+
+  cert = NULL;
+  image = NULL;
+
+  delay (validate_latency);
+
+  err = assuan_inquire (ctx, "TARGETCERT", &image, &len, MAX_CERT_SIZE);
+  if (err)
+    goto out;
+
+  err = ksba_cert_new (&cert);
+  if (!err)
+    err = ksba_cert_init_from_mem (cert, image, len);
+  if (err)
+    goto out;
+
+  /* Dirmngr asks for the issuer certificate if it does not have it;
+     the answer (empty, in case of Poldi) is not used.  */
+  if (inquire_issuer)
+    {
+      char keyword[ASSUAN_LINELENGTH / 2];
+      unsigned char *issuer_image;
+      size_t issuer_len;
+      char *issuer;
+
+      issuer = ksba_cert_get_issuer (cert, 0);
+      snprintf (keyword, sizeof (keyword), "SENDISSUERCERT %s",
+		issuer ? issuer : "");
+      ksba_free (issuer);
+
+      issuer_image = NULL;
+      err = assuan_inquire (ctx, keyword, &issuer_image, &issuer_len,
+			    MAX_CERT_SIZE);
+      free (issuer_image);
+      if (err)
+	goto out;
+    }
+
+  if (offline)
+    {
+      err = x509_offline_validate (offline, cert);
+      if (err)
+	err = gpg_error (gpg_err_code (err));
+    }
+  else
+    err = gpg_error (GPG_ERR_NOT_TRUSTED);
+
+ out:
+
+  ksba_cert_release (cert);
+  free (image);
+
+  return err;
+}
+
+/* Serve the client connected through the socket FD.  */
+static void
+serve (int fd)
+{
+  assuan_context_t ctx;
+  int rc;
+
+  rc = assuan_init_socket_server_ext (&ctx, fd, 2);
+  if (!rc)
+    rc = assuan_register_command (ctx, "LOOKUP", cmd_lookup);
+  if (!rc)
+    rc = assuan_register_command (ctx, "VALIDATE", cmd_validate);
+  if (!rc)
+    rc = assuan_set_hello_line (ctx, "Dirmngr simulator ready");
+  if (rc)
+    {
+      fprintf (stderr, "%s: failed to set up server: %s\n",
+	       PROGRAM_NAME, gpg_strerror (rc));
+      return;
+    }
+
+  delay (connect_latency);
+
+  while (!(rc = assuan_accept (ctx)))
+    {
+      rc = assuan_process (ctx);
+      if (rc)
+	break;
+    }
+
+  assuan_deinit_server (ctx);
+}
+
+int
+main (int argc, char **argv)
+{
+  const char *cert_dir, *ca_bundle, *crl, *socket_name;
+  struct sockaddr_un addr;
+  log_handle_t loghandle;
+  gpg_error_t err;
+  int fd, listen_fd;
+  int c;
+
+  cert_dir = ca_bundle = crl = NULL;
+
+  while (1)
+    {
+      static struct option long_options[] =
+	{
+	  { "version", no_argument, 0, 'v' },
+	  { "help", no_argument, 0, 'h' },
+	  { "cert-dir", required_argument, 0, 'c' },
+	  { "ca-bundle", required_argument, 0, 'a' },
+	  { "crl", required_argument, 0, 'r' },
+	  { "inquire-issuer", no_argument, 0, 'I' },
+	  { "connect-latency", required_argument, 0, 'C' },
+	  { "lookup-latency", required_argument, 0, 'L' },
+	  { "validate-latency", required_argument, 0, 'V' },
+	  { 0, 0, 0, 0 }
+	};
+      int option_index = 0;
+
+      c = getopt_long (argc, argv, "vhc:a:r:IC:L:V:",
+		       long_options, &option_index);
+
+      /* Detect the end of the options. */
+      if (c == -1)
+	break;
+
+      switch (c)
+	{
+	case 'c': cert_dir = optarg; break;
+	case 'a': ca_bundle = optarg; break;
+	case 'r': crl = optarg; break;
+	case 'I': inquire_issuer = 1; break;
+	case 'C': connect_latency = strtoul (optarg, NULL, 10); break;
+	case 'L': lookup_latency = strtoul (optarg, NULL, 10); break;
+	case 'V': validate_latency = strtoul (optarg, NULL, 10); break;
+
+	case 'h':
+	  print_help ();
+	  exit (0);
+	  break;
+
+	case 'v':
+	  print_version ();
+	  exit (0);
+	  break;
+
+	case '?':
+	  /* `getopt_long' already printed an error message. */
+	  break;
+
+	default:
+	  abort ();
+	}
+    }
+
+  if (argc - optind != 1)
+    {
+      print_help ();
+      exit (1);
+    }
+  socket_name = argv[optind];
+
+  gcry_check_version (NULL);
+
+  err = log_create (&loghandle);
+  if (!err)
+    err = log_set_backend_stream (loghandle, stderr);
+  if (err)
+    {
+      fprintf (stderr, "error: failed to set up logging: %s\n",
+	       gpg_strerror (err));
+      exit (1);
+    }
+
+  if (cert_dir)
+    {
+      err = load_certs (cert_dir);
+      if (err)
+	{
+	  fprintf (stderr, "error: failed to load certificates from `%s': %s\n",
+		   cert_dir, gpg_strerror (err));
+	  exit (1);
+	}
+    }
+
+  if (ca_bundle)
+    {
+      err = x509_offline_create (&offline, ca_bundle, crl, NULL, loghandle);
+      if (err)
+	{
+	  fprintf (stderr, "error: failed to set up validation: %s\n",
+		   gpg_strerror (err));
+	  exit (1);
+	}
+    }
+
+  memset (&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen (socket_name) >= sizeof (addr.sun_path))
+    {
+      fprintf (stderr, "error: socket name too long\n");
+      exit (1);
+    }
+  strcpy (addr.sun_path, socket_name);
+
+  listen_fd = socket (AF_UNIX, SOCK_STREAM, 0);
+  unlink (socket_name);
+  if (listen_fd == -1
+      || bind (listen_fd, (struct sockaddr *) &addr, sizeof (addr))
+      || listen (listen_fd, SOMAXCONN))
+    {
+      fprintf (stderr, "error: failed to listen on `%s': %s\n",
+	       socket_name, strerror (errno));
+      exit (1);
+    }
+
+  printf ("%s: serving %lu certificates on `%s'\n",
+	  PROGRAM_NAME, (unsigned long) ncerts, socket_name);
+  fflush (stdout);
+
+  /* Children are not waited for.  */
+  signal (SIGCHLD, SIG_IGN);
+
+  while (1)
+    {
+      fd = accept (listen_fd, NULL, NULL);
+      if (fd == -1)
+	{
+	  if (errno == EINTR || errno == ECONNABORTED)
+	    continue;
+	  fprintf (stderr, "error: accept failed: %s\n", strerror (errno));
+	  break;
+	}
+
+      switch (fork ())
+	{
+	case -1:
+	  fprintf (stderr, "error: fork failed: %s\n", strerror (errno));
+	  close (fd);
+	  break;
+
+	case 0:
+	  close (listen_fd);
+	  serve (fd);
+	  _exit (0);
+
+	default:
+	  close (fd);
+	}
+    }
+
+  return 1;
+}
+
+/* end */
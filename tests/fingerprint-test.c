@@ -0,0 +1,154 @@
+/* fingerprint-test.c - test the OpenPGP fingerprints of card keys
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of Poldi.
+
+   Poldi is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   Poldi is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.  */
+
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gcrypt.h>
+#include <gpg-error.h>
+
+#include "util/util.h"
+#include "key-lookup.h"
+
+/* Known answers: card keys, as returned by Scdaemon's READKEY, and
+   the fingerprints GnuPG computes for them as OpenPGP keys created at
+   CREATED.  */
+
+#define CREATED 1767268800	/* 2026-01-01 12:00:00 UTC.  */
+
+#define RSA_N "00E231FD5725DCCE3CE8330999A1E41F544E349A4FFA98DEBD1C3A6B38908A" \
+  "A06596D535019E20F24C06F8A651446B98FF301A132549957180FE0C1C9448DA423C"   \
+  "914A013A943399F770134E1392D48A0F013DA134DA0A7BBCE83F0E663D3A9F489052"   \
+  "D2F3B23BFDEF0C10B810BE72C7CFCC94EFA0B4B1D4856AF5075C0F281969"
+
+#define P256_Q "04070A70560F351F06EF37A26BB6EF2A9202667697FBD7A679882ECBAE9C99" \
+  "00AA0D874692528DC231D18F60F03C82E44AC5D0B44A907F8D928B09D2D50129356F"
+
+#define ED25519_Q "8DE168A34967D596BA9D7F3C4379DD44CFAD6E055507667992B20F41FD" \
+  "80B47A"
+
+static struct
+{
+  const char *name;
+  const char *key;
+  const char *fpr;
+} vectors[] =
+  {
+    { "RSA",
+      "(public-key (rsa (n #" RSA_N "#) (e #010001#)))",
+      "9661A1D0142080983E9A7F5893A3865A3693BC5A" },
+    { "NIST P-256",
+      "(public-key (ecc (curve \"NIST P-256\") (q #" P256_Q "#)))",
+      "18613AD6A63AA02D78899C6757E97970F507BE56" },
+    { "NIST P-256 by OID",
+      "(public-key (ecc (curve \"1.2.840.10045.3.1.7\") (q #" P256_Q "#)))",
+      "18613AD6A63AA02D78899C6757E97970F507BE56" },
+    { "Ed25519",
+      "(public-key (ecc (curve Ed25519) (flags eddsa) (q #" ED25519_Q "#)))",
+      "1BF1B1433BC9F62B9AE4A508D027D9619AF5846F" },
+    { "Ed25519 with prefix",
+      "(public-key (ecc (curve Ed25519) (flags eddsa) (q #40" ED25519_Q "#)))",
+      "1BF1B1433BC9F62B9AE4A508D027D9619AF5846F" }
+  };
+
+static int failures;
+
+#define CHECK(cond, what)					\
+  do								\
+    {								\
+      if (!(cond))						\
+	{							\
+	  fprintf (stderr, "FAIL: %s\n", (what));		\
+	  failures++;						\
+	}							\
+    }								\
+  while (0)
+
+/* Compute the fingerprint of the key given as string KEY, created at
+   CREATED, as hex string in FPR_HEX, which must provide room for 41
+   bytes.  Returns the error code.  */
+static gpg_err_code_t
+fingerprint (const char *key, unsigned long created, char *fpr_hex)
+{
+  unsigned char fpr[20];
+  gcry_sexp_t sexp;
+  gpg_error_t err;
+  unsigned int i;
+
+  err = gcry_sexp_sscan (&sexp, NULL, key, strlen (key));
+  if (err)
+    return gpg_err_code (err);
+
+  err = key_fingerprint (sexp, created, fpr);
+  gcry_sexp_release (sexp);
+  if (err)
+    return gpg_err_code (err);
+
+  for (i = 0; i < 20; i++)
+    sprintf (fpr_hex + 2 * i, "%02X", fpr[i]);
+
+  return 0;
+}
+
+int
+main (int argc, char **argv)
+{
+  char fpr[41];
+  unsigned int i;
+
+  if (!gcry_check_version (NEED_LIBGCRYPT_VERSION))
+    {
+      fprintf (stderr, "error: libgcrypt too old\n");
+      return 1;
+    }
+  gcry_control (GCRYCTL_DISABLE_SECMEM);
+  gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
+
+  for (i = 0; i < DIM (vectors); i++)
+    {
+      if (fingerprint (vectors[i].key, CREATED, fpr))
+	CHECK (0, vectors[i].name);
+      else
+	CHECK (!strcmp (fpr, vectors[i].fpr), vectors[i].name);
+    }
+
+  /* The creation time is part of the fingerprint.  */
+  CHECK (!fingerprint (vectors[0].key, CREATED + 1, fpr)
+	 && strcmp (fpr, vectors[0].fpr), "other creation time");
+
+  /* Curves OpenPGP cards do not use for Poldi are rejected.  */
+  CHECK (fingerprint ("(public-key (ecc (curve brainpoolP256r1) (q #"
+		      P256_Q "#)))", CREATED, fpr) == GPG_ERR_UNKNOWN_CURVE,
+	 "unknown curve");
+
+  if (failures)
+    {
+      fprintf (stderr, "%d check(s) failed\n", failures);
+      return 1;
+    }
+  printf ("PASS\n");
+
+  return 0;
+}
+
+/* end */
@@ -0,0 +1,241 @@
+/* learn-test.c - test reading and checking the card status
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of Poldi.
+
+   Poldi is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   Poldi is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.  */
+
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+
+#include <gcrypt.h>
+#include <gpg-error.h>
+
+#include "util/util.h"
+#include "util/simplelog.h"
+#include "scd/scd.h"
+
+/* The LEARN output of the cards in the fixture files, as sent by
+   Scdaemon, and the status the cards are expected to have.  */
+static struct
+{
+  const char *fixture;
+  gpg_err_code_t status;
+  const char *serialno;
+  int fpr3valid;
+  int key3algo;
+  int pw1_tries;
+} cards[] =
+  {
+    { "learn-empty-slot3.txt", GPG_ERR_NO_SECKEY,
+      "D2760001240102010006041234560000", 0, 1, 3 },
+    { "learn-ecdh.txt", GPG_ERR_UNSUPPORTED_ALGORITHM,
+      "D2760001240102010006041234570000", 1, 18, 3 },
+    { "learn-pw1-blocked.txt", GPG_ERR_PIN_BLOCKED,
+      "D2760001240102010006041234580000", 1, 1, 0 },
+    { "learn-2-tries.txt", GPG_ERR_NO_ERROR,
+      "D2760001240102010006041234590000", 1, 22, 2 }
+  };
+
+/* Name of the fixture being tested, for messages.  */
+static const char *fixture;
+
+static int failures;
+
+#define CHECK(cond, what)					\
+  do								\
+    {								\
+      if (!(cond))						\
+	{							\
+	  fprintf (stderr, "FAIL: %s: %s\n", fixture, (what));	\
+	  failures++;						\
+	}							\
+    }								\
+  while (0)
+
+static void
+put_number (FILE *fp, unsigned long value)
+{
+  do
+    {
+      unsigned char c = value & 0x7f;
+
+      value >>= 7;
+      if (value)
+	c |= 0x80;
+      putc (c, fp);
+    }
+  while (value);
+}
+
+/* Write a trace (see assuan-trace.c) of a LEARN command answered with
+   the status lines in the file FIXTURE to the file TRACE.  Returns
+   zero on success.  */
+static int
+make_trace (const char *fixture, const char *trace)
+{
+  static const char command[] = "LEARN --force";
+  char answer[4096];
+  size_t length;
+  FILE *fp;
+
+  fp = fopen (fixture, "r");
+  if (!fp)
+    {
+      perror (fixture);
+      return -1;
+    }
+  length = fread (answer, 1, sizeof (answer) - 4, fp);
+  fclose (fp);
+  memcpy (answer + length, "OK\n", 3);
+  length += 3;
+
+  fp = fopen (trace, "w");
+  if (!fp)
+    return -1;
+  fputs ("ASNTRC01", fp);
+  put_number (fp, 0);
+  /* Assuan writes the line and its end separately.  */
+  putc ('W', fp);
+  put_number (fp, 0);
+  put_number (fp, strlen (command));
+  fputs (command, fp);
+  putc ('W', fp);
+  put_number (fp, 0);
+  put_number (fp, 1);
+  putc ('\n', fp);
+  putc ('R', fp);
+  put_number (fp, 0);
+  put_number (fp, length);
+  fwrite (answer, 1, length, fp);
+
+  return fclose (fp) ? -1 : 0;
+}
+
+static void
+test_card (unsigned int i, const char *srcdir, const char *trace,
+	   log_handle_t loghandle)
+{
+  struct scd_cardinfo info;
+  char filename[1024];
+  scd_context_t scd;
+  gpg_error_t err;
+
+  fixture = cards[i].fixture;
+
+  snprintf (filename, sizeof (filename), "%s/%s", srcdir, fixture);
+  if (make_trace (filename, trace))
+    {
+      CHECK (0, "trace");
+      return;
+    }
+
+  err = scd_connect_replay (&scd, trace, 0, loghandle);
+  if (err)
+    {
+      CHECK (0, "replay");
+      return;
+    }
+
+  err = scd_learn (scd, &info);
+  CHECK (!err, "LEARN");
+  if (!err)
+    {
+      CHECK (info.serialno && !strcmp (info.serialno, cards[i].serialno),
+	     "serial number");
+      CHECK (!info.fpr3valid == !cards[i].fpr3valid,
+	     "authentication key fingerprint");
+      CHECK (info.key3algo == cards[i].key3algo,
+	     "authentication key algorithm");
+      CHECK (info.chvvalid, "CHV-STATUS");
+      CHECK (info.chvretry[0] == cards[i].pw1_tries, "PIN tries");
+      CHECK (gpg_err_code (scd_check_cardinfo (&info)) == cards[i].status,
+	     "card status");
+      scd_release_cardinfo (info);
+    }
+
+  scd_disconnect (scd);
+}
+
+int
+main (int argc, char **argv)
+{
+  char trace[] = "/tmp/learn-test.XXXXXX";
+  struct scd_cardinfo info;
+  log_handle_t loghandle;
+  const char *srcdir;
+  gpg_error_t err;
+  unsigned int i;
+  int fd;
+
+  if (!gcry_check_version (NEED_LIBGCRYPT_VERSION))
+    {
+      fprintf (stderr, "error: libgcrypt too old\n");
+      return 1;
+    }
+  gcry_control (GCRYCTL_DISABLE_SECMEM);
+  gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
+
+  err = log_create (&loghandle);
+  if (!err)
+    err = log_set_backend_stream (loghandle, stderr);
+  if (err)
+    {
+      fprintf (stderr, "error: failed to set up logging: %s\n",
+	       gpg_strerror (err));
+      return 1;
+    }
+
+  /* The fixtures are in the source directory.  */
+  srcdir = getenv ("srcdir");
+  if (!srcdir)
+    srcdir = ".";
+
+  fd = mkstemp (trace);
+  if (fd == -1)
+    {
+      perror ("mkstemp");
+      return 1;
+    }
+  close (fd);
+
+  for (i = 0; i < DIM (cards); i++)
+    test_card (i, srcdir, trace, loghandle);
+
+  /* Scdaemons reporting neither fingerprints nor key attributes leave
+     the card to be tried.  */
+  fixture = "no key information";
+  memset (&info, 0, sizeof (info));
+  CHECK (!scd_check_cardinfo (&info), "card status");
+
+  unlink (trace);
+  log_destroy (loghandle);
+
+  if (failures)
+    {
+      fprintf (stderr, "%d check(s) failed\n", failures);
+      return 1;
+    }
+  printf ("PASS\n");
+
+  return 0;
+}
+
+/* end */
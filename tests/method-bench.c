@@ -0,0 +1,308 @@
+/* method-bench.c - measure loading the PAM module and the
+   authentication method plugins
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of Poldi.
+
+   Poldi is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   Poldi is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.  */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "auth-methods.h"
+#include "util/defs.h"
+
+
+
+#define PROGRAM_NAME    "method-bench"
+#define PROGRAM_VERSION "0.1"
+
+static void
+print_help (void)
+{
+  printf ("\
+Usage: %s [options] [METHOD...]\n\
+Measure the time taken to load the PAM module and to load and\n\
+initialize the plugins of the authentication methods METHOD\n\
+(default: localdb x509), each in a fresh process.\n\
+\n\
+Options:\n\
+ -h, --help                 print help information\n\
+ -v, --version              print version information\n\
+ -d, --directory DIR        directory of the plugins\n\
+                            (default: %s)\n\
+ -m, --module FILE          load the PAM module FILE first\n\
+ -n, --iterations N         processes per method (default: 20)\n\
+\n\
+The time of the first authentication itself, which needs a card, is\n\
+measured with `pam-test --time'.\n\
+\n\
+Report bugs to <moritz@gnu.org>.\n", PROGRAM_NAME, POLDI_AUTH_METHOD_DIRECTORY);
+}
+
+static void
+print_version (void)
+{
+  printf (PROGRAM_NAME " " PROGRAM_VERSION "\n");
+}
+
+/* Return the monotonic time in seconds.  */
+static double
+now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+
+/* Times measured in one process, in seconds.  */
+struct sample
+{
+  double module;		/* Loading the PAM module.  */
+  double method;		/* Loading and initializing the method.  */
+  double cached;		/* Doing so again in the same process.  */
+};
+
+/* Load the plugin of METHOD from DIRECTORY, then initialize and
+   release a cookie as pam_poldi.so does.  Returns zero on success.  */
+static int
+load_method (const char *directory, const char *method)
+{
+  char filename[256];
+  char symbol[64];
+  auth_method_t m;
+  void *handle;
+  void *cookie;
+
+  snprintf (filename, sizeof (filename), "%s/poldi-auth-%s.so",
+	    directory, method);
+  snprintf (symbol, sizeof (symbol), "auth_method_%s", method);
+
+  handle = dlopen (filename, RTLD_NOW | RTLD_LOCAL);
+  if (!handle)
+    {
+      fprintf (stderr, "error: %s\n", dlerror ());
+      return 1;
+    }
+  m = dlsym (handle, symbol);
+  if (!m)
+    {
+      fprintf (stderr, "error: %s\n", dlerror ());
+      return 1;
+    }
+
+  cookie = NULL;
+  if (m->func_init && m->func_init (&cookie))
+    {
+      fprintf (stderr, "error: failed to initialize method `%s'\n", method);
+      return 1;
+    }
+  if (m->func_deinit)
+    m->func_deinit (cookie);
+
+  return 0;
+}
+
+/* Take one sample in a child process and store it in *SAMPLE.
+   Returns zero on success.  */
+static int
+run_sample (const char *module, const char *directory, const char *method,
+	    struct sample *sample)
+{
+  int fds[2];
+  pid_t pid;
+  int status;
+  ssize_t n;
+  double t;
+
+  if (pipe (fds))
+    {
+      fprintf (stderr, "error: pipe failed: %s\n", strerror (errno));
+      return 1;
+    }
+
+  pid = fork ();
+  if (pid == -1)
+    {
+      fprintf (stderr, "error: fork failed: %s\n", strerror (errno));
+      return 1;
+    }
+  if (!pid)
+    {
+      close (fds[0]);
+      memset (sample, 0, sizeof (*sample));
+
+      if (module)
+	{
+	  t = now ();
+	  if (!dlopen (module, RTLD_NOW | RTLD_LOCAL))
+	    {
+	      fprintf (stderr, "error: %s\n", dlerror ());
+	      _exit (1);
+	    }
+	  sample->module = now () - t;
+	}
+
+      t = now ();
+      if (load_method (directory, method))
+	_exit (1);
+      sample->method = now () - t;
+
+      t = now ();
+      if (load_method (directory, method))
+	_exit (1);
+      sample->cached = now () - t;
+
+      if (write (fds[1], sample, sizeof (*sample)) != sizeof (*sample))
+	_exit (1);
+      _exit (0);
+    }
+
+  close (fds[1]);
+  n = read (fds[0], sample, sizeof (*sample));
+  close (fds[0]);
+  waitpid (pid, &status, 0);
+
+  return !(n == sizeof (*sample)
+	   && WIFEXITED (status) && !WEXITSTATUS (status));
+}
+
+/* Take ITERATIONS samples for METHOD and print their averages.  */
+static int
+bench_method (const char *module, const char *directory, const char *method,
+	      unsigned int iterations)
+{
+  struct sample sample, sum;
+  unsigned int i;
+
+  memset (&sum, 0, sizeof (sum));
+  for (i = 0; i < iterations; i++)
+    {
+      if (run_sample (module, directory, method, &sample))
+	return 1;
+      sum.module += sample.module;
+      sum.method += sample.method;
+      sum.cached += sample.cached;
+    }
+
+  printf ("%-10s", method);
+  if (module)
+    printf (" module %8.3f ms,", sum.module / iterations * 1000);
+  printf (" method %8.3f ms, cached %8.3f ms\n",
+	  sum.method / iterations * 1000, sum.cached / iterations * 1000);
+
+  return 0;
+}
+
+int
+main (int argc, char **argv)
+{
+  static const char *default_methods[] = { "localdb", "x509" };
+  const char *directory;
+  const char *module;
+  unsigned int iterations;
+  int ret;
+  int c;
+  int i;
+
+  directory = POLDI_AUTH_METHOD_DIRECTORY;
+  module = NULL;
+  iterations = 20;
+
+  while (1)
+    {
+      static struct option long_options[] =
+	{
+	  { "version", no_argument, 0, 'v' },
+	  { "help", no_argument, 0, 'h' },
+	  { "directory", required_argument, 0, 'd' },
+	  { "module", required_argument, 0, 'm' },
+	  { "iterations", required_argument, 0, 'n' },
+	  { 0, 0, 0, 0 }
+	};
+      int option_index = 0;
+
+      c = getopt_long (argc, argv, "vhd:m:n:",
+		       long_options, &option_index);
+
+      /* Detect the end of the options. */
+      if (c == -1)
+	break;
+
+      switch (c)
+	{
+	case 'd':
+	  directory = optarg;
+	  break;
+	case 'm':
+	  module = optarg;
+	  break;
+	case 'n':
+	  iterations = strtoul (optarg, NULL, 10);
+	  break;
+
+	case 'h':
+	  print_help ();
+	  exit (0);
+	  break;
+
+	case 'v':
+	  print_version ();
+	  exit (0);
+	  break;
+
+	case '?':
+	  /* `getopt_long' already printed an error message. */
+	  break;
+
+	default:
+	  abort ();
+	}
+    }
+
+  if (!iterations)
+    {
+      print_help ();
+      exit (1);
+    }
+
+  printf ("%u processes per method\n", iterations);
+
+  ret = 0;
+  if (optind < argc)
+    for (i = optind; i < argc; i++)
+      ret |= bench_method (module, directory, argv[i], iterations);
+  else
+    for (i = 0; i < 2; i++)
+      ret |= bench_method (module, directory, default_methods[i], iterations);
+
+  return ret;
+}
+
+/* end */
@@ -26,11 +26,12 @@
 #include <getopt.h>
 #include <errno.h>
 #include <string.h>
+#include <time.h>
 
 
 
 #define PROGRAM_NAME    "pam-test"
-#define PROGRAM_VERSION "0.2"
+#define PROGRAM_VERSION "0.3"
 
 /* Use the standard conversation function from libpam-misc. */
 static struct pam_conv conv =
@@ -50,6 +51,7 @@ Options:\n\
  -h, --help      print help information\n\
  -v, --version   print version information\n\
  -u, --username  specify username for authentication\n\
+ -t, --time      print the time taken by the authentication\n\
 \n\
 Report bugs to <moritz@gnu.org>.\n", PROGRAM_NAME);
 }
@@ -60,12 +62,24 @@ print_version (void)
   printf (PROGRAM_NAME " " PROGRAM_VERSION "\n");
 }
 
+/* Return the monotonic time in seconds.  */
+static double
+now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
 static void
-test_auth (const char *servicename, const char *username)
+test_auth (const char *servicename, const char *username, int show_time)
 {
   const void *user_opaque;
   const char *user;
   pam_handle_t *handle;
+  double start;
   int rc;
 
   /* Connect to PAM.  */
@@ -77,7 +91,10 @@ test_auth (const char *servicename, const char *username)
     }
 
   /* Try authentication.  */
+  start = now ();
   rc = pam_authenticate (handle, 0);
+  if (show_time)
+    printf ("Authentication took %.3f ms\n", (now () - start) * 1000);
   if (rc != PAM_SUCCESS)
     {
       printf ("Authentication failed\n");
@@ -113,9 +130,11 @@ main (int argc, char **argv)
 {
   const char *servicename;
   const char *username;
+  int show_time;
   int c;
 
   servicename = username = NULL;
+  show_time = 0;
 
   while (1)
     {
@@ -124,11 +143,12 @@ main (int argc, char **argv)
 	  { "version", no_argument, 0, 'v' },
 	  { "help", no_argument, 0, 'h' },
 	  { "user", required_argument, 0, 'u' },
+	  { "time", no_argument, 0, 't' },
 	  { 0, 0, 0, 0 }
 	};
       int option_index = 0;
 
-      c = getopt_long (argc, argv, "vhu:",
+      c = getopt_long (argc, argv, "vhu:t",
 		       long_options, &option_index);
 
       /* Detect the end of the options. */
@@ -146,6 +166,10 @@ main (int argc, char **argv)
 	    }
 	  break;
 
+	case 't':
+	  show_time = 1;
+	  break;
+
 	case 'h':
 	  print_help ();
 	  exit (0);
@@ -172,7 +196,7 @@ main (int argc, char **argv)
     }
 
   servicename = argv[optind];
-  test_auth (servicename, username);
+  test_auth (servicename, username, show_time);
 
   return 0;
 }
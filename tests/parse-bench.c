@@ -0,0 +1,298 @@
+/* parse-bench.c - benchmark simpleparse on large configuration files
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of Poldi.
+
+   Poldi is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   Poldi is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.  */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include <gpg-error.h>
+
+#include <simpleparse.h>
+#include <simplelog.h>
+
+
+
+#define PROGRAM_NAME    "parse-bench"
+#define PROGRAM_VERSION "0.1"
+
+static void
+print_help (void)
+{
+  printf ("\
+Usage: %s [options]\n\
+Benchmark simpleparse: generate a configuration file and parse it\n\
+repeatedly.\n\
+\n\
+Options:\n\
+ -h, --help                 print help information\n\
+ -v, --version              print version information\n\
+ -l, --lines N              number of configuration lines (default: 100000)\n\
+ -o, --options N            number of known options (default: 64)\n\
+ -n, --iterations N         number of parser runs (default: 10)\n\
+\n\
+Report bugs to <moritz@gnu.org>.\n", PROGRAM_NAME);
+}
+
+static void
+print_version (void)
+{
+  printf (PROGRAM_NAME " " PROGRAM_VERSION "\n");
+}
+
+/* Return the current value of the monotonic clock in seconds.  */
+static double
+now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* State of the parser callback.  */
+struct bench_cookie
+{
+  unsigned long calls;
+  unsigned long bad_ids;
+};
+
+/* Parser callback; checks that the option ID matches the option
+   name, which is generated from it.  */
+static gpg_error_t
+parsecb (void *opaque, simpleparse_opt_spec_t spec, const char *arg)
+{
+  struct bench_cookie *cookie = opaque;
+
+  cookie->calls++;
+  if ((unsigned int) atoi (spec.long_opt + 7) + 1 != spec.id)
+    cookie->bad_ids++;
+
+  return 0;
+}
+
+/* Create a table of NOPTIONS option specifications named
+   "option-N".  Returns NULL on failure.  */
+static simpleparse_opt_spec_t *
+make_specs (unsigned int noptions)
+{
+  simpleparse_opt_spec_t *specs;
+  unsigned int i;
+  char *name;
+
+  specs = calloc (noptions + 1, sizeof (*specs));
+  if (!specs)
+    return NULL;
+
+  /* Register them in reverse order, so that the table is not sorted
+     already.  */
+  for (i = 0; i < noptions; i++)
+    {
+      unsigned int n = noptions - 1 - i;
+
+      if (asprintf (&name, "option-%u", n) < 0)
+	return NULL;
+      specs[i].id = n + 1;
+      specs[i].long_opt = name;
+      specs[i].arg = (n % 3 == 0) ? SIMPLEPARSE_ARG_NONE
+	: (n % 3 == 1) ? SIMPLEPARSE_ARG_REQUIRED : SIMPLEPARSE_ARG_OPTIONAL;
+    }
+
+  return specs;
+}
+
+/* Write a configuration file of NLINES lines using options of SPECS
+   to a temporary stream and return it.  */
+static FILE *
+make_config (simpleparse_opt_spec_t *specs, unsigned int noptions,
+	     unsigned int nlines)
+{
+  unsigned int i, n;
+  FILE *fp;
+
+  fp = tmpfile ();
+  if (!fp)
+    return NULL;
+
+  srand (1);
+  for (i = 0; i < nlines; i++)
+    {
+      if (i % 16 == 0)
+	{
+	  fprintf (fp, "# comment line %u\n", i);
+	  continue;
+	}
+
+      n = rand () % noptions;
+      switch (specs[n].arg)
+	{
+	case SIMPLEPARSE_ARG_NONE:
+	  fprintf (fp, "%s\n", specs[n].long_opt);
+	  break;
+	case SIMPLEPARSE_ARG_REQUIRED:
+	  fprintf (fp, "%s /some/path/to/a/file-%u\n", specs[n].long_opt, i);
+	  break;
+	case SIMPLEPARSE_ARG_OPTIONAL:
+	  fprintf (fp, "  %s \"a quoted value %u\"\n", specs[n].long_opt, i);
+	  break;
+	}
+    }
+
+  fflush (fp);
+
+  return fp;
+}
+
+int
+main (int argc, char **argv)
+{
+  unsigned int nlines, noptions, iterations, i;
+  simpleparse_opt_spec_t *specs;
+  simpleparse_handle_t handle;
+  struct bench_cookie cookie;
+  log_handle_t loghandle;
+  double start, elapsed;
+  gpg_error_t err;
+  FILE *fp;
+  int c;
+
+  nlines = 100000;
+  noptions = 64;
+  iterations = 10;
+
+  while (1)
+    {
+      static struct option long_options[] =
+	{
+	  { "version", no_argument, 0, 'v' },
+	  { "help", no_argument, 0, 'h' },
+	  { "lines", required_argument, 0, 'l' },
+	  { "options", required_argument, 0, 'o' },
+	  { "iterations", required_argument, 0, 'n' },
+	  { 0, 0, 0, 0 }
+	};
+      int option_index = 0;
+
+      c = getopt_long (argc, argv, "vhl:o:n:",
+		       long_options, &option_index);
+
+      /* Detect the end of the options. */
+      if (c == -1)
+	break;
+
+      switch (c)
+	{
+	case 'l':
+	  nlines = strtoul (optarg, NULL, 10);
+	  break;
+	case 'o':
+	  noptions = strtoul (optarg, NULL, 10);
+	  break;
+	case 'n':
+	  iterations = strtoul (optarg, NULL, 10);
+	  break;
+
+	case 'h':
+	  print_help ();
+	  exit (0);
+	  break;
+
+	case 'v':
+	  print_version ();
+	  exit (0);
+	  break;
+
+	case '?':
+	  /* `getopt_long' already printed an error message. */
+	  break;
+
+	default:
+	  abort ();
+	}
+    }
+
+  if (!nlines || !noptions || !iterations)
+    {
+      print_help ();
+      exit (1);
+    }
+
+  err = log_create (&loghandle);
+  if (!err)
+    err = log_set_backend_stream (loghandle, stderr);
+  if (!err)
+    err = simpleparse_create (&handle);
+  if (err)
+    {
+      fprintf (stderr, "error: failed to set up parser: %s\n",
+	       gpg_strerror (err));
+      exit (1);
+    }
+
+  specs = make_specs (noptions);
+  fp = specs ? make_config (specs, noptions, nlines) : NULL;
+  if (!fp)
+    {
+      fprintf (stderr, "error: failed to generate configuration: %s\n",
+	       strerror (errno));
+      exit (1);
+    }
+
+  memset (&cookie, 0, sizeof (cookie));
+  simpleparse_set_loghandle (handle, loghandle);
+  simpleparse_set_parse_cb (handle, parsecb, &cookie);
+  err = simpleparse_set_specs (handle, specs);
+  if (err)
+    {
+      fprintf (stderr, "error: failed to install option specs: %s\n",
+	       gpg_strerror (err));
+      exit (1);
+    }
+
+  start = now ();
+  for (i = 0; i < iterations; i++)
+    {
+      rewind (fp);
+      err = simpleparse_parse_stream (handle, 0, fp);
+      if (err)
+	{
+	  fprintf (stderr, "error: parsing failed: %s\n", gpg_strerror (err));
+	  exit (1);
+	}
+    }
+  elapsed = now () - start;
+
+  printf ("%u lines, %u options, %u runs: %10.3f ms total, %8.1f ns/line\n",
+	  nlines, noptions, iterations, elapsed * 1000,
+	  elapsed * 1e9 / ((double) nlines * iterations));
+  printf ("%lu options processed, %lu with mismatching IDs\n",
+	  cookie.calls, cookie.bad_ids);
+
+  fclose (fp);
+  simpleparse_destroy (handle);
+  log_destroy (loghandle);
+
+  return !!cookie.bad_ids;
+}
@@ -0,0 +1,419 @@
+/* ratelimit-test.c - test the rate limiter of log messages
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of Poldi.
+
+   Poldi is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   Poldi is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.  */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include <gcrypt.h>
+#include <gpg-error.h>
+
+#include "ratelimit.h"
+
+/* These must match ratelimit.c.  */
+#define RATELIMIT_SLOTS  256
+#define RATELIMIT_PROBES 8
+
+/* User the segment of which is squatted when running as root.  */
+#define OTHER_UID 65534
+
+static int failures;
+
+#define CHECK(cond, what)					\
+  do								\
+    {								\
+      if (!(cond))						\
+	{							\
+	  fprintf (stderr, "FAIL: %s\n", (what));		\
+	  failures++;						\
+	}							\
+    }								\
+  while (0)
+
+/* Prefix of the shared memory segments used here.  */
+static char prefix[64];
+
+/* Store the name of the segment of user UID in NAME.  */
+static void
+segment_name (char *name, size_t size, uid_t uid)
+{
+  snprintf (name, size, "%s%lu", prefix, (unsigned long) uid);
+}
+
+/* Create the segment of user UID, owned by OWNER, with mode MODE and
+   SIZE bytes of garbage.  Returns zero on success.  */
+static int
+segment_create (uid_t uid, uid_t owner, mode_t mode, size_t size)
+{
+  char name[128];
+  char *garbage;
+  int fd, ret;
+
+  segment_name (name, sizeof (name), uid);
+  shm_unlink (name);
+  fd = shm_open (name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd == -1)
+    return -1;
+
+  garbage = malloc (size);
+  ret = !garbage;
+  if (!ret)
+    {
+      memset (garbage, 'x', size);
+      ret = (write (fd, garbage, size) != size
+	     || fchown (fd, owner, -1) || fchmod (fd, mode));
+      free (garbage);
+    }
+  close (fd);
+
+  return ret;
+}
+
+/* Return the owner of the segment of user UID, or -1.  */
+static long
+segment_owner (uid_t uid)
+{
+  struct stat statbuf;
+  char name[128];
+  int fd, ret;
+
+  segment_name (name, sizeof (name), uid);
+  fd = shm_open (name, O_RDONLY, 0);
+  if (fd == -1)
+    return -1;
+  ret = fstat (fd, &statbuf);
+  close (fd);
+
+  return ret ? -1 : (long) statbuf.st_uid;
+}
+
+/* Open a rate limiter and return it, or NULL.  */
+static ratelimit_t
+open_table (void)
+{
+  ratelimit_t rl;
+  gpg_error_t err;
+
+  err = ratelimit_open (&rl);
+  if (err)
+    {
+      fprintf (stderr, "error: ratelimit_open: %s\n", gpg_strerror (err));
+      return NULL;
+    }
+
+  return rl;
+}
+
+/* Check the token bucket of a fresh site of RL.  */
+static void
+check_bucket (ratelimit_t rl, uint64_t site)
+{
+  struct ratelimit_report report;
+  unsigned int i;
+  uint64_t msg;
+
+  /* A burst of two messages passes, four tokens are refilled per
+     second.  */
+  msg = 1;
+  CHECK (ratelimit_check (rl, site, msg++, 4, 2, &report) == RATELIMIT_PASS,
+	 "first of burst");
+  CHECK (ratelimit_check (rl, site, msg++, 4, 2, &report) == RATELIMIT_PASS,
+	 "second of burst");
+  CHECK (ratelimit_check (rl, site, msg++, 4, 2, &report) == RATELIMIT_DROP,
+	 "bucket empty");
+  CHECK (ratelimit_check (rl, site, msg++, 4, 2, &report) == RATELIMIT_DROP,
+	 "bucket still empty");
+
+  /* More than two tokens are refilled meanwhile, but the bucket holds
+     only two.  */
+  usleep (600000);
+  CHECK (ratelimit_check (rl, site, msg++, 4, 2, &report) == RATELIMIT_PASS,
+	 "first after refill");
+  CHECK (report.dropped == 2 && !report.repeated, "dropped messages reported");
+  CHECK (ratelimit_check (rl, site, msg++, 4, 2, &report) == RATELIMIT_PASS,
+	 "second after refill");
+  CHECK (!report.dropped, "dropped messages reported once");
+  CHECK (ratelimit_check (rl, site, msg++, 4, 2, &report) == RATELIMIT_DROP,
+	 "refill capped at burst");
+
+  /* A rate of zero means no limit.  */
+  for (i = 0; i < 100; i++)
+    CHECK (ratelimit_check (rl, site + 1, msg++, 0, 0, &report)
+	   == RATELIMIT_PASS, "unlimited site");
+}
+
+/* Check the suppression of repeated messages at a fresh site of
+   RL.  */
+static void
+check_repeated (ratelimit_t rl, uint64_t site)
+{
+  struct ratelimit_report report;
+
+  CHECK (ratelimit_check (rl, site, 1, 0, 0, &report) == RATELIMIT_PASS,
+	 "first message");
+  CHECK (ratelimit_check (rl, site, 1, 0, 0, &report) == RATELIMIT_REPEATED,
+	 "repetition");
+  CHECK (ratelimit_check (rl, site, 1, 0, 0, &report) == RATELIMIT_REPEATED,
+	 "second repetition");
+  CHECK (ratelimit_check (rl, site, 2, 0, 0, &report) == RATELIMIT_PASS,
+	 "other message");
+  CHECK (report.repeated == 2 && !report.dropped, "repeated 2 times");
+  CHECK (ratelimit_check (rl, site, 1, 0, 0, &report) == RATELIMIT_PASS,
+	 "first message again");
+  CHECK (!report.repeated, "repetitions reported once");
+
+  /* Repetitions are not taken from the bucket.  */
+  CHECK (ratelimit_check (rl, site + 1, 1, 1, 1, &report) == RATELIMIT_PASS,
+	 "first limited message");
+  CHECK (ratelimit_check (rl, site + 1, 1, 1, 1, &report)
+	 == RATELIMIT_REPEATED, "limited repetition");
+  CHECK (ratelimit_check (rl, site + 1, 2, 1, 1, &report) == RATELIMIT_DROP,
+	 "limited other message");
+}
+
+/* Check that one site more than fit into the neighborhood of slot
+   HOME of RL takes over that slot.  */
+static void
+check_eviction (ratelimit_t rl, unsigned int home)
+{
+  struct ratelimit_report report;
+  unsigned int i;
+
+  /* The sites all have HOME as home slot; each empties its
+     bucket.  */
+  for (i = 0; i < RATELIMIT_PROBES; i++)
+    {
+      CHECK (ratelimit_check (rl, home + i * RATELIMIT_SLOTS, 1, 1, 1,
+			      &report) == RATELIMIT_PASS,
+	     "site in full neighborhood");
+      CHECK (ratelimit_check (rl, home + i * RATELIMIT_SLOTS, 2, 1, 1,
+			      &report) == RATELIMIT_DROP,
+	     "empty bucket in full neighborhood");
+    }
+
+  CHECK (ratelimit_check (rl, home + RATELIMIT_PROBES * RATELIMIT_SLOTS, 1,
+			  1, 1, &report) == RATELIMIT_PASS, "new site");
+
+  /* The site in the home slot has lost its state, the others have
+     kept theirs.  */
+  for (i = 1; i < RATELIMIT_PROBES; i++)
+    CHECK (ratelimit_check (rl, home + i * RATELIMIT_SLOTS, 3, 1, 1,
+			    &report) == RATELIMIT_DROP,
+	   "empty bucket after eviction");
+  CHECK (ratelimit_check (rl, home, 3, 1, 1, &report) == RATELIMIT_PASS,
+	 "evicted site");
+  CHECK (!report.dropped, "counters of evicted site");
+}
+
+/* Check that RL shares its table with other processes.  */
+static void
+check_shared (ratelimit_t rl, uint64_t site)
+{
+  struct ratelimit_report report;
+  ratelimit_t rl2;
+  int status;
+  pid_t pid;
+
+  CHECK (ratelimit_check (rl, site, 1, 1, 1, &report) == RATELIMIT_PASS,
+	 "message before fork");
+
+  pid = fork ();
+  if (pid == -1)
+    {
+      perror ("fork");
+      failures++;
+      return;
+    }
+  if (!pid)
+    {
+      rl2 = open_table ();
+      _exit (!(rl2 && ratelimit_is_shared (rl2)
+	       && (ratelimit_check (rl2, site, 2, 1, 1, &report)
+		   == RATELIMIT_DROP)));
+    }
+
+  CHECK (waitpid (pid, &status, 0) == pid
+	 && WIFEXITED (status) && !WEXITSTATUS (status),
+	 "bucket shared with other process");
+
+  /* The message dropped by the child is reported here.  */
+  usleep (1100000);
+  CHECK (ratelimit_check (rl, site, 3, 1, 1, &report) == RATELIMIT_PASS
+	 && report.dropped == 1, "message dropped by other process");
+}
+
+/* Check that the segment of another user, who cannot replace it, is
+   not used.  */
+static void
+check_foreign (void)
+{
+  struct ratelimit_report report;
+  ratelimit_t rl;
+  int status;
+  pid_t pid;
+
+  /* The segment belongs to root, not to OTHER_UID.  */
+  if (segment_create (OTHER_UID, 0, 0600, 4096))
+    {
+      perror ("segment_create");
+      failures++;
+      return;
+    }
+
+  pid = fork ();
+  if (pid == -1)
+    {
+      perror ("fork");
+      failures++;
+      return;
+    }
+  if (!pid)
+    {
+      if (setgid (OTHER_UID) || setuid (OTHER_UID))
+	_exit (2);
+      rl = open_table ();
+      _exit (!(rl && !ratelimit_is_shared (rl)
+	       && (ratelimit_check (rl, 1, 1, 1, 1, &report)
+		   == RATELIMIT_PASS)));
+    }
+
+  CHECK (waitpid (pid, &status, 0) == pid
+	 && WIFEXITED (status) && !WEXITSTATUS (status),
+	 "process-local table instead of foreign segment");
+  CHECK (segment_owner (OTHER_UID) == 0, "foreign segment left alone");
+}
+
+int
+main (int argc, char **argv)
+{
+  struct ratelimit_report report;
+  char name[128];
+  ratelimit_t rl;
+
+  if (!gcry_check_version (NEED_LIBGCRYPT_VERSION))
+    {
+      fprintf (stderr, "error: libgcrypt too old\n");
+      return 1;
+    }
+  gcry_control (GCRYCTL_DISABLE_SECMEM);
+  gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
+
+  /* FNV-1a test vector.  */
+  CHECK (ratelimit_hash (RATELIMIT_HASH_INIT, "a", 1)
+	 == 0xaf63dc4c8601ec8cULL, "hash");
+
+  /* Process-local table.  */
+  ratelimit_set_shm_prefix (NULL);
+  rl = open_table ();
+  if (!rl)
+    return 1;
+  CHECK (!ratelimit_is_shared (rl), "process-local table");
+  check_bucket (rl, 1000);
+  check_repeated (rl, 2000);
+  check_eviction (rl, 5);
+  ratelimit_close (rl);
+
+  /* Shared table, in segments of our own.  */
+  snprintf (prefix, sizeof (prefix), "/poldi-ratelimit-test-%lu-",
+	    (unsigned long) getpid ());
+  ratelimit_set_shm_prefix (prefix);
+
+  rl = open_table ();
+  if (!rl)
+    goto out;
+  CHECK (ratelimit_is_shared (rl), "shared table");
+  check_repeated (rl, 2000);
+  check_eviction (rl, 5);
+  check_shared (rl, 3000);
+  ratelimit_close (rl);
+
+  /* A segment others may write to is replaced.  */
+  if (segment_create (geteuid (), geteuid (), 0666, 4096))
+    {
+      perror ("segment_create");
+      failures++;
+    }
+  rl = open_table ();
+  if (!rl)
+    goto out;
+  CHECK (ratelimit_is_shared (rl), "writable segment replaced");
+  CHECK (ratelimit_check (rl, 3000, 1, 1, 1, &report) == RATELIMIT_PASS,
+	 "fresh table after replacement");
+  ratelimit_close (rl);
+
+  /* A segment with unknown contents is not used.  */
+  if (segment_create (geteuid (), geteuid (), 0600, 4096))
+    {
+      perror ("segment_create");
+      failures++;
+    }
+  rl = open_table ();
+  if (!rl)
+    goto out;
+  CHECK (!ratelimit_is_shared (rl), "corrupt segment not used");
+  check_repeated (rl, 2000);
+  ratelimit_close (rl);
+
+  if (!geteuid ())
+    {
+      /* A segment squatted by another user is replaced by root.  */
+      if (segment_create (0, OTHER_UID, 0600, 4096))
+	{
+	  perror ("segment_create");
+	  failures++;
+	}
+      rl = open_table ();
+      if (!rl)
+	goto out;
+      CHECK (ratelimit_is_shared (rl), "squatted segment replaced");
+      CHECK (segment_owner (0) == 0, "owner of replaced segment");
+      ratelimit_close (rl);
+
+      check_foreign ();
+    }
+  else
+    printf ("SKIP: squatted segments (not running as root)\n");
+
+ out:
+
+  segment_name (name, sizeof (name), geteuid ());
+  shm_unlink (name);
+  segment_name (name, sizeof (name), OTHER_UID);
+  shm_unlink (name);
+
+  if (failures)
+    {
+      fprintf (stderr, "%d check(s) failed\n", failures);
+      return 1;
+    }
+  printf ("PASS\n");
+
+  return 0;
+}
+
+/* end */
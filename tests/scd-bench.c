@@ -0,0 +1,309 @@
+/* scd-bench.c - measure Poldi's own cost per login against a replayed
+   Scdaemon
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of Poldi.
+
+   Poldi is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   Poldi is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.  */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include <gcrypt.h>
+
+#include "util/simplelog.h"
+#include "util/support.h"
+#include "scd/scd.h"
+
+
+
+#define PROGRAM_NAME    "scd-bench"
+#define PROGRAM_VERSION "0.1"
+
+static void
+print_help (void)
+{
+  printf ("\
+Usage: %s [options]\n\
+Record the Scdaemon conversation of a login once, then replay it to\n\
+benchmark Poldi's own cost per login (parsing, allocation, signature\n\
+verification) without a card.\n\
+\n\
+Options:\n\
+ -h, --help                 print help information\n\
+ -v, --version              print version information\n\
+ -R, --record FILE          record a login against Scdaemon to FILE\n\
+ -P, --pin PIN              PIN to use when recording\n\
+ -s, --scdaemon PATH        Scdaemon program to use when recording\n\
+ -a, --use-agent            use the Scdaemon of gpg-agent when recording\n\
+ -p, --replay FILE          benchmark logins replaying FILE\n\
+ -t, --realtime             replay with the recorded Scdaemon latency\n\
+ -n, --iterations N         number of logins (default: 1000)\n\
+\n\
+The challenge is random, so the signatures of a replayed login do not\n\
+verify; the verification is still done and counted as a mismatch.\n\
+\n\
+Report bugs to <moritz@gnu.org>.\n", PROGRAM_NAME);
+}
+
+static void
+print_version (void)
+{
+  printf (PROGRAM_NAME " " PROGRAM_VERSION "\n");
+}
+
+/* Return the current value of the clock CLOCK in seconds.  */
+static double
+now (clockid_t clock)
+{
+  struct timespec ts;
+
+  clock_gettime (clock, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* PIN callback handing out the PIN passed in DATA.  */
+static int
+getpin (void *data, const char *info, char *buf, size_t maxbuf)
+{
+  const char *pin = data;
+
+  /* Pinpad prompts need no answer.  */
+  if (!buf)
+    return 0;
+
+  if (strlen (pin) >= maxbuf)
+    return GPG_ERR_INV_VALUE;
+  strcpy (buf, pin);
+
+  return 0;
+}
+
+/* Run the card conversation of a login through the local database,
+   the way the localdb authentication method does it.  */
+static gpg_error_t
+login (scd_context_t scd, const char *pin)
+{
+  struct scd_cardinfo cardinfo;
+  struct challenge_params params;
+  unsigned char *challenge;
+  unsigned char *response;
+  size_t challenge_n;
+  size_t response_n;
+  gcry_sexp_t key;
+  char *serialno;
+  gpg_error_t err;
+
+  cardinfo = scd_cardinfo_null;
+  serialno = NULL;
+  challenge = NULL;
+  response = NULL;
+  key = NULL;
+
+  scd_set_pincb (scd, getpin, (void *) pin);
+
+  err = scd_serialno (scd, &serialno);
+  if (!err)
+    err = scd_learn (scd, &cardinfo);
+  if (!err)
+    err = scd_readkey (scd, "OPENPGP.3", &key);
+  if (!err)
+    err = challenge_params_from_key (key, cardinfo.key3algo, &params);
+  if (!err)
+    err = challenge_generate (&params, &challenge, &challenge_n);
+  if (!err)
+    err = scd_pksign (scd, "OPENPGP.3", params.card_mdalgo,
+		      challenge, challenge_n, &response, &response_n);
+  if (!err)
+    err = challenge_verify (key, &params,
+			    challenge, challenge_n, response, response_n);
+
+  challenge_release (challenge);
+  xfree (response);
+  gcry_sexp_release (key);
+  scd_release_cardinfo (cardinfo);
+  xfree (serialno);
+
+  return err;
+}
+
+/* Record a login against Scdaemon into the trace file TRACE.  */
+static void
+record (log_handle_t loghandle, int use_agent, const char *scd_path,
+	const char *pin, const char *trace)
+{
+  scd_context_t scd;
+  gpg_error_t err;
+
+  scd = NULL;
+  err = scd_connect (&scd, use_agent, scd_path, NULL, loghandle);
+  if (!err)
+    err = scd_record (scd, trace);
+  if (!err)
+    {
+      err = login (scd, pin);
+      printf ("recorded login result: %s\n", gpg_strerror (err));
+      err = 0;
+    }
+  scd_disconnect (scd);
+  if (err)
+    fprintf (stderr, "error: failed to record `%s': %s\n",
+	     trace, gpg_strerror (err));
+}
+
+/* Benchmark ITERATIONS logins replaying the trace file TRACE.  */
+static void
+bench_replay (log_handle_t loghandle, const char *trace, int realtime,
+	      unsigned int iterations)
+{
+  unsigned int i, failures, mismatches;
+  double start, start_cpu, elapsed, elapsed_cpu;
+  scd_context_t scd;
+  gpg_error_t err;
+
+  failures = mismatches = 0;
+  start = now (CLOCK_MONOTONIC);
+  start_cpu = now (CLOCK_PROCESS_CPUTIME_ID);
+  for (i = 0; i < iterations; i++)
+    {
+      scd = NULL;
+      err = scd_connect_replay (&scd, trace, realtime, loghandle);
+      if (!err)
+	err = login (scd, "");
+      scd_disconnect (scd);
+      if (gpg_err_code (err) == GPG_ERR_BAD_SIGNATURE)
+	mismatches++;
+      else if (err)
+	failures++;
+    }
+  elapsed = now (CLOCK_MONOTONIC) - start;
+  elapsed_cpu = now (CLOCK_PROCESS_CPUTIME_ID) - start_cpu;
+
+  printf ("%u logins, %u failed, %u signature mismatches\n",
+	  iterations, failures, mismatches);
+  printf ("wall: %10.3f ms total, %8.3f ms/login\n",
+	  elapsed * 1000, elapsed * 1000 / iterations);
+  printf ("cpu:  %10.3f ms total, %8.3f ms/login\n",
+	  elapsed_cpu * 1000, elapsed_cpu * 1000 / iterations);
+}
+
+int
+main (int argc, char **argv)
+{
+  const char *record_file, *replay_file, *scd_path, *pin;
+  unsigned int iterations;
+  log_handle_t loghandle;
+  int use_agent, realtime;
+  gpg_error_t err;
+  int c;
+
+  record_file = replay_file = scd_path = NULL;
+  pin = "";
+  use_agent = realtime = 0;
+  iterations = 1000;
+
+  while (1)
+    {
+      static struct option long_options[] =
+	{
+	  { "version", no_argument, 0, 'v' },
+	  { "help", no_argument, 0, 'h' },
+	  { "record", required_argument, 0, 'R' },
+	  { "pin", required_argument, 0, 'P' },
+	  { "scdaemon", required_argument, 0, 's' },
+	  { "use-agent", no_argument, 0, 'a' },
+	  { "replay", required_argument, 0, 'p' },
+	  { "realtime", no_argument, 0, 't' },
+	  { "iterations", required_argument, 0, 'n' },
+	  { 0, 0, 0, 0 }
+	};
+      int option_index = 0;
+
+      c = getopt_long (argc, argv, "vhR:P:s:ap:tn:",
+		       long_options, &option_index);
+
+      /* Detect the end of the options. */
+      if (c == -1)
+	break;
+
+      switch (c)
+	{
+	case 'R': record_file = optarg; break;
+	case 'P': pin = optarg; break;
+	case 's': scd_path = optarg; break;
+	case 'a': use_agent = 1; break;
+	case 'p': replay_file = optarg; break;
+	case 't': realtime = 1; break;
+	case 'n':
+	  iterations = strtoul (optarg, NULL, 10);
+	  break;
+
+	case 'h':
+	  print_help ();
+	  exit (0);
+	  break;
+
+	case 'v':
+	  print_version ();
+	  exit (0);
+	  break;
+
+	case '?':
+	  /* `getopt_long' already printed an error message. */
+	  break;
+
+	default:
+	  abort ();
+	}
+    }
+
+  if ((!record_file && !replay_file) || !iterations)
+    {
+      print_help ();
+      exit (1);
+    }
+
+  gcry_check_version (NULL);
+  gcry_control (GCRYCTL_DISABLE_SECMEM);
+
+  err = log_create (&loghandle);
+  if (!err)
+    err = log_set_backend_stream (loghandle, stderr);
+  if (err)
+    {
+      fprintf (stderr, "error: failed to set up logging: %s\n",
+	       gpg_strerror (err));
+      exit (1);
+    }
+
+  if (record_file)
+    record (loghandle, use_agent, scd_path, pin, record_file);
+  if (replay_file)
+    bench_replay (loghandle, replay_file, realtime, iterations);
+
+  log_destroy (loghandle);
+
+  return 0;
+}
+
+/* end */
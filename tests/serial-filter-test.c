@@ -0,0 +1,350 @@
+/* serial-filter-test.c - test the serial number filter of localdb
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of Poldi.
+
+   Poldi is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   Poldi is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.  */
+
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <gcrypt.h>
+#include <gpg-error.h>
+
+#include "serial-filter.h"
+#include "usersdb.h"
+
+/* Number of enrolled and of unknown serial numbers.  */
+#define ENROLLED 2000
+#define UNKNOWN  20000
+
+static int failures;
+
+#define CHECK(cond, what)					\
+  do								\
+    {								\
+      if (!(cond))						\
+	{							\
+	  fprintf (stderr, "FAIL: %s\n", (what));		\
+	  failures++;						\
+	}							\
+    }								\
+  while (0)
+
+/* Store the serial number of an OpenPGP card with card number I in
+   SERIALNO, which must provide room for 33 bytes.  */
+static void
+make_serialno (char *serialno, unsigned int i)
+{
+  snprintf (serialno, 33, "D27600012401020000050000%04X0000", i);
+}
+
+/* Store the modification time (in nanoseconds) and size of FILENAME,
+   as used by the users database, in *MTIME and *SIZE.  */
+static int
+stamp (const char *filename,
+       unsigned long long *mtime, unsigned long long *size)
+{
+  struct stat statbuf;
+
+  if (stat (filename, &statbuf))
+    return -1;
+  *mtime = ((unsigned long long) statbuf.st_mtim.tv_sec * 1000000000
+	    + statbuf.st_mtim.tv_nsec);
+  *size = statbuf.st_size;
+
+  return 0;
+}
+
+/* Write COUNT entries, starting with card number FIRST, to the users
+   database FILENAME.  */
+static int
+write_usersdb (const char *filename, unsigned int first, unsigned int count)
+{
+  char serialno[33];
+  unsigned int i;
+  FILE *fp;
+
+  fp = fopen (filename, "w");
+  if (!fp)
+    return -1;
+  fprintf (fp, "# Test users\n");
+  for (i = first; i < first + count; i++)
+    {
+      make_serialno (serialno, i);
+      fprintf (fp, "%s\tuser%u\n", serialno, i);
+    }
+
+  return fclose (fp) ? -1 : 0;
+}
+
+/* Return true if usersdb_serialno_known reports the card number I as
+   possibly known.  */
+static int
+known (unsigned int i)
+{
+  char serialno[33];
+  int ret;
+
+  make_serialno (serialno, i);
+  ret = -1;
+  if (usersdb_serialno_known (serialno, &ret))
+    return -1;
+
+  return ret;
+}
+
+/* Checks of filters built in memory and written to files.  */
+static void
+test_filter (const char *filename)
+{
+  static char serialnos[ENROLLED][33];
+  const char *list[ENROLLED];
+  char serialno[33];
+  serial_filter_t filter;
+  size_t image_len;
+  void *image;
+  unsigned int i, positives;
+  FILE *fp;
+
+  for (i = 0; i < ENROLLED; i++)
+    {
+      make_serialno (serialnos[i], i);
+      list[i] = serialnos[i];
+    }
+
+  if (serial_filter_build (list, ENROLLED, 1234, 5678, &image, &image_len))
+    {
+      CHECK (0, "build");
+      return;
+    }
+
+  /* Written and mapped again.  */
+  CHECK (!serial_filter_write (filename, image, image_len), "write");
+  if (serial_filter_open (&filter, filename))
+    CHECK (0, "open");
+  else
+    {
+      CHECK (serial_filter_is_current (filter, 1234, 5678), "current");
+      CHECK (!serial_filter_is_current (filter, 1235, 5678),
+	     "current after change");
+      for (i = 0; i < ENROLLED; i++)
+	if (!serial_filter_lookup (filter, serialnos[i]))
+	  break;
+      CHECK (i == ENROLLED, "no false negatives in mapped filter");
+      serial_filter_close (filter);
+    }
+
+  /* In memory.  */
+  if (serial_filter_open_mem (&filter, image, image_len))
+    {
+      CHECK (0, "open in memory");
+      free (image);
+      return;
+    }
+  for (i = 0; i < ENROLLED; i++)
+    if (!serial_filter_lookup (filter, serialnos[i]))
+      break;
+  CHECK (i == ENROLLED, "no false negatives");
+
+  /* About one percent of unknown cards pass.  */
+  for (i = 0, positives = 0; i < UNKNOWN; i++)
+    {
+      make_serialno (serialno, ENROLLED + i);
+      positives += serial_filter_lookup (filter, serialno);
+    }
+  CHECK (positives < UNKNOWN / 25, "false positive rate");
+  serial_filter_close (filter);
+
+  /* An empty filter knows no card.  */
+  if (serial_filter_build (NULL, 0, 0, 0, &image, &image_len)
+      || serial_filter_open_mem (&filter, image, image_len))
+    CHECK (0, "empty filter");
+  else
+    {
+      CHECK (!serial_filter_lookup (filter, serialnos[0]),
+	     "lookup in empty filter");
+      serial_filter_close (filter);
+    }
+
+  /* Corrupt files are rejected.  */
+  fp = fopen (filename, "r+");
+  if (fp)
+    {
+      fputs ("PLDBLM99", fp);
+      fclose (fp);
+    }
+  CHECK (gpg_err_code (serial_filter_open (&filter, filename))
+	 == GPG_ERR_INV_DATA, "open of file with bad magic");
+
+  if (truncate (filename, image_len - 1))
+    CHECK (0, "truncate");
+  CHECK (serial_filter_open (&filter, filename), "open of truncated file");
+
+  /* Files writable by others are rejected.  */
+  if (serial_filter_build (list, ENROLLED, 1234, 5678, &image, &image_len))
+    CHECK (0, "build");
+  else
+    {
+      CHECK (!serial_filter_write (filename, image, image_len), "write");
+      free (image);
+    }
+  if (chmod (filename, 0666))
+    CHECK (0, "chmod");
+  CHECK (gpg_err_code (serial_filter_open (&filter, filename))
+	 == GPG_ERR_BAD_DATA, "open of file writable by others");
+
+  /* As are files of other users, when running as root.  */
+  if (!geteuid ())
+    {
+      if (chmod (filename, 0644) || chown (filename, 1, 1))
+	CHECK (0, "chown");
+      CHECK (gpg_err_code (serial_filter_open (&filter, filename))
+	     == GPG_ERR_BAD_DATA, "open of file owned by other user");
+    }
+
+  unlink (filename);
+}
+
+/* Checks of the filter kept by the users database.  */
+static void
+test_usersdb (const char *db_file, const char *filter_file)
+{
+  unsigned long long mtime, size;
+  serial_filter_t filter;
+  size_t image_len;
+  void *image;
+  unsigned int i;
+
+  usersdb_set_files (db_file, filter_file);
+
+  /* The filter is built on first use and stored.  */
+  CHECK (!write_usersdb (db_file, 0, 100), "write users database");
+  for (i = 0; i < 100; i++)
+    if (known (i) != 1)
+      break;
+  CHECK (i == 100, "enrolled cards known");
+  CHECK (!access (filter_file, F_OK), "filter file written");
+
+  /* A stored filter is used by a new process.  */
+  usersdb_set_files (db_file, filter_file);
+  CHECK (known (99) == 1, "enrolled card known through filter file");
+
+  /* New cards are known at once after the database changed.  */
+  CHECK (!write_usersdb (db_file, 0, 101), "update users database");
+  CHECK (known (100) == 1, "new card known after update");
+  if (!serial_filter_open (&filter, filter_file))
+    {
+      CHECK (!stamp (db_file, &mtime, &size)
+	     && serial_filter_is_current (filter, mtime, size),
+	     "filter file rebuilt");
+      serial_filter_close (filter);
+    }
+  else
+    CHECK (0, "filter file rebuilt");
+
+  /* A stale filter file is not used either.  */
+  CHECK (!write_usersdb (db_file, 0, 102), "update users database");
+  usersdb_set_files (db_file, filter_file);
+  CHECK (known (101) == 1, "new card known with stale filter file");
+
+  /* A corrupt filter file is replaced.  */
+  if (truncate (filter_file, 10))
+    CHECK (0, "truncate");
+  usersdb_set_files (db_file, filter_file);
+  CHECK (known (101) == 1, "card known with corrupt filter file");
+  CHECK (!serial_filter_open (&filter, filter_file),
+	 "corrupt filter file replaced");
+  serial_filter_close (filter);
+
+  /* A filter file writable by others, which claims to be current but
+     lacks the enrolled cards, is not trusted.  */
+  if (stamp (db_file, &mtime, &size)
+      || serial_filter_build (NULL, 0, mtime, size, &image, &image_len))
+    {
+      CHECK (0, "build forged filter");
+      return;
+    }
+  CHECK (!serial_filter_write (filter_file, image, image_len),
+	 "write forged filter");
+  free (image);
+  if (chmod (filter_file, 0666))
+    CHECK (0, "chmod");
+  usersdb_set_files (db_file, filter_file);
+  CHECK (known (0) == 1, "card known with foreign filter file");
+
+  /* Whereas a trusted one is used as is.  */
+  if (stamp (db_file, &mtime, &size)
+      || serial_filter_build (NULL, 0, mtime, size, &image, &image_len))
+    {
+      CHECK (0, "build empty filter");
+      return;
+    }
+  CHECK (!serial_filter_write (filter_file, image, image_len),
+	 "write empty filter");
+  free (image);
+  usersdb_set_files (db_file, filter_file);
+  CHECK (known (0) == 0, "trusted filter file used");
+
+  unlink (filter_file);
+  unlink (db_file);
+}
+
+int
+main (int argc, char **argv)
+{
+  char dir[] = "/tmp/serial-filter-test.XXXXXX";
+  char filename[256], db_file[256];
+
+  if (!gcry_check_version (NEED_LIBGCRYPT_VERSION))
+    {
+      fprintf (stderr, "error: libgcrypt too old\n");
+      return 1;
+    }
+  gcry_control (GCRYCTL_DISABLE_SECMEM);
+  gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
+
+  if (!mkdtemp (dir))
+    {
+      perror ("mkdtemp");
+      return 1;
+    }
+
+  snprintf (filename, sizeof (filename), "%s/users.bloom", dir);
+  test_filter (filename);
+
+  snprintf (db_file, sizeof (db_file), "%s/users", dir);
+  test_usersdb (db_file, filename);
+
+  rmdir (dir);
+
+  if (failures)
+    {
+      fprintf (stderr, "%d check(s) failed\n", failures);
+      return 1;
+    }
+  printf ("PASS\n");
+
+  return 0;
+}
+
+/* end */
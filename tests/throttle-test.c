@@ -0,0 +1,211 @@
+/* throttle-test.c - test the failure counters
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of Poldi.
+
+   Poldi is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   Poldi is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.  */
+
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <gcrypt.h>
+#include <gpg-error.h>
+
+#include "throttle.h"
+
+/* These must match throttle.c.  */
+#define THROTTLE_SLOTS  1024
+#define THROTTLE_PROBES 8
+
+/* Time after which failures expire in most checks.  */
+#define EXPIRE 600
+
+static int failures;
+
+#define CHECK(cond, what)					\
+  do								\
+    {								\
+      if (!(cond))						\
+	{							\
+	  fprintf (stderr, "FAIL: %s\n", (what));		\
+	  failures++;						\
+	}							\
+    }								\
+  while (0)
+
+/* Return the slot the identity ID of kind KIND is probed at first, as
+   throttle.c does.  */
+static unsigned int
+home_slot (throttle_kind_t kind, const char *id)
+{
+  unsigned char digest[32];
+  gcry_md_hd_t md;
+  unsigned char k;
+  uint64_t key;
+
+  k = kind;
+  if (gcry_md_open (&md, GCRY_MD_SHA256, 0))
+    return 0;
+  gcry_md_write (md, &k, 1);
+  gcry_md_write (md, id, strlen (id));
+  memcpy (digest, gcry_md_read (md, GCRY_MD_SHA256), sizeof (digest));
+  gcry_md_close (md);
+
+  memcpy (&key, digest, sizeof (key));
+
+  return (key ? key : 1) % THROTTLE_SLOTS;
+}
+
+int
+main (int argc, char **argv)
+{
+  char dir[] = "/tmp/throttle-test.XXXXXX";
+  char ids[THROTTLE_PROBES + 1][32];
+  char name[256];
+  throttle_t throttle;
+  gpg_error_t err;
+  unsigned int home, i, n;
+
+  if (!gcry_check_version (NEED_LIBGCRYPT_VERSION))
+    {
+      fprintf (stderr, "error: libgcrypt too old\n");
+      return 1;
+    }
+  gcry_control (GCRYCTL_DISABLE_SECMEM);
+  gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
+
+  /* The table is only available to root.  */
+  if (geteuid ())
+    {
+      printf ("SKIP: not running as root\n");
+      return 77;
+    }
+
+  if (!mkdtemp (dir))
+    {
+      perror ("mkdtemp");
+      return 1;
+    }
+
+  err = throttle_open (dir, &throttle);
+  if (err)
+    {
+      fprintf (stderr, "error: throttle_open: %s\n", gpg_strerror (err));
+      rmdir (dir);
+      return 1;
+    }
+
+  /* Counting.  */
+  CHECK (!throttle_failures (throttle, THROTTLE_SERIALNO, "card1", EXPIRE),
+	 "no failures");
+  for (i = 0; i < 3; i++)
+    throttle_fail (throttle, THROTTLE_SERIALNO, "card1", EXPIRE);
+  CHECK (throttle_failures (throttle, THROTTLE_SERIALNO, "card1", EXPIRE) == 3,
+	 "three failures");
+
+  /* Identities of different kinds and names are counted apart.  */
+  CHECK (!throttle_failures (throttle, THROTTLE_USER, "card1", EXPIRE),
+	 "failures of other kind");
+  CHECK (!throttle_failures (throttle, THROTTLE_SERIALNO, "card2", EXPIRE),
+	 "failures of other card");
+  throttle_fail (throttle, THROTTLE_USER, "card1/alice", EXPIRE);
+  CHECK (throttle_failures (throttle, THROTTLE_USER, "card1/alice", EXPIRE)
+	 == 1, "user failure");
+  CHECK (!throttle_failures (throttle, THROTTLE_USER, "card2/alice", EXPIRE),
+	 "user failure with other card");
+
+  /* Clearing.  */
+  throttle_clear (throttle, THROTTLE_SERIALNO, "card1");
+  CHECK (!throttle_failures (throttle, THROTTLE_SERIALNO, "card1", EXPIRE),
+	 "cleared failures");
+  CHECK (throttle_failures (throttle, THROTTLE_USER, "card1/alice", EXPIRE)
+	 == 1, "user failure after clearing card");
+
+  /* Expiry: with an expiry time of zero, every failure is already
+     expired and a new one starts over.  */
+  throttle_fail (throttle, THROTTLE_SERIALNO, "card3", EXPIRE);
+  throttle_fail (throttle, THROTTLE_SERIALNO, "card3", EXPIRE);
+  CHECK (!throttle_failures (throttle, THROTTLE_SERIALNO, "card3", 0),
+	 "expired failures");
+  CHECK (throttle_failures (throttle, THROTTLE_SERIALNO, "card3", EXPIRE) == 2,
+	 "unexpired failures");
+  throttle_fail (throttle, THROTTLE_SERIALNO, "card3", 0);
+  CHECK (throttle_failures (throttle, THROTTLE_SERIALNO, "card3", EXPIRE) == 1,
+	 "failure after expiry");
+
+  /* The table is shared: a second handle sees the same counters.  */
+  throttle_close (throttle);
+  throttle = NULL;
+  err = throttle_open (dir, &throttle);
+  CHECK (!err, "reopen");
+  if (err)
+    goto out;
+  CHECK (throttle_failures (throttle, THROTTLE_USER, "card1/alice", EXPIRE)
+	 == 1, "failure after reopening");
+
+  /* Eviction: find one identity more than fit into the neighborhood
+     of a slot, all having that slot as home slot.  */
+  home = home_slot (THROTTLE_SERIALNO, "evict0");
+  strcpy (ids[0], "evict0");
+  for (i = 1, n = 1; i <= THROTTLE_PROBES; n++)
+    {
+      snprintf (ids[i], sizeof (ids[i]), "evict%u", n);
+      if (home_slot (THROTTLE_SERIALNO, ids[i]) == home)
+	i++;
+    }
+
+  for (i = 0; i < THROTTLE_PROBES; i++)
+    throttle_fail (throttle, THROTTLE_SERIALNO, ids[i], EXPIRE);
+  for (i = 0; i < THROTTLE_PROBES; i++)
+    CHECK (throttle_failures (throttle, THROTTLE_SERIALNO, ids[i], EXPIRE)
+	   == 1, "failure in full neighborhood");
+
+  /* The failures are equally old, so the first slot probed is
+     reused.  */
+  throttle_fail (throttle, THROTTLE_SERIALNO, ids[THROTTLE_PROBES], EXPIRE);
+  CHECK (throttle_failures (throttle, THROTTLE_SERIALNO,
+			    ids[THROTTLE_PROBES], EXPIRE) == 1,
+	 "failure of new identity");
+  CHECK (!throttle_failures (throttle, THROTTLE_SERIALNO, ids[0], EXPIRE),
+	 "evicted identity");
+  for (i = 1; i < THROTTLE_PROBES; i++)
+    CHECK (throttle_failures (throttle, THROTTLE_SERIALNO, ids[i], EXPIRE)
+	   == 1, "failure after eviction");
+
+ out:
+
+  throttle_close (throttle);
+  snprintf (name, sizeof (name), "%s/%s", dir, POLDI_THROTTLE_FILE);
+  unlink (name);
+  rmdir (dir);
+
+  if (failures)
+    {
+      fprintf (stderr, "%d check(s) failed\n", failures);
+      return 1;
+    }
+  printf ("PASS\n");
+
+  return 0;
+}
+
+/* end */
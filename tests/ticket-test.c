@@ -0,0 +1,253 @@
+/* ticket-test.c - test the authentication tickets
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of Poldi.
+
+   Poldi is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   Poldi is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.  */
+
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <gcrypt.h>
+#include <gpg-error.h>
+
+#include "ticket.h"
+
+#define SERIALNO "D2760001240102000005000012340000"
+
+static int failures;
+
+#define CHECK(cond, what)					\
+  do								\
+    {								\
+      if (!(cond))						\
+	{							\
+	  fprintf (stderr, "FAIL: %s\n", (what));		\
+	  failures++;						\
+	}							\
+    }								\
+  while (0)
+
+/* Look up the ticket of UID for SCOPE in DIR; return the error code
+   and check the serial number on success.  */
+static gpg_err_code_t
+lookup (const char *dir, uid_t uid, const char *scope)
+{
+  char *serialno;
+  gpg_error_t err;
+
+  serialno = NULL;
+  err = ticket_lookup (dir, uid, scope, &serialno);
+  if (!err)
+    {
+      CHECK (!strcmp (serialno, SERIALNO), "serial number of ticket");
+      free (serialno);
+    }
+
+  return gpg_err_code (err);
+}
+
+/* Store the name of the only ticket in DIR in NAME, which is of size
+   SIZE.  Returns zero on success.  */
+static int
+find_ticket (const char *dir, char *name, size_t size)
+{
+  struct dirent *entry;
+  DIR *d;
+  int found;
+
+  d = opendir (dir);
+  if (!d)
+    return -1;
+
+  found = 0;
+  while ((entry = readdir (d)))
+    if (entry->d_name[0] != '.' && strcmp (entry->d_name, "ticket.key"))
+      {
+	snprintf (name, size, "%s/%s", dir, entry->d_name);
+	found++;
+      }
+  closedir (d);
+
+  return found == 1 ? 0 : -1;
+}
+
+/* Let EDIT modify the contents of the file NAME.  Returns zero on
+   success.  */
+static int
+edit_file (const char *name, void (*edit) (char *buffer, size_t *length))
+{
+  char buffer[1024];
+  size_t length;
+  FILE *fp;
+
+  fp = fopen (name, "r");
+  if (!fp)
+    return -1;
+  length = fread (buffer, 1, sizeof (buffer) - 1, fp);
+  fclose (fp);
+  buffer[length] = 0;
+
+  (*edit) (buffer, &length);
+
+  fp = fopen (name, "w");
+  if (!fp)
+    return -1;
+  if (fwrite (buffer, 1, length, fp) != length)
+    {
+      fclose (fp);
+      return -1;
+    }
+
+  return fclose (fp) ? -1 : 0;
+}
+
+/* Replace the serial number by another one of the same length.  */
+static void
+edit_serialno (char *buffer, size_t *length)
+{
+  char *p;
+
+  p = strstr (buffer, SERIALNO);
+  if (p)
+    p[strlen (SERIALNO) - 1] = '1';
+}
+
+/* Move the expiry time ahead by a day.  */
+static void
+edit_expiry (char *buffer, size_t *length)
+{
+  char magic[32], scope[64], serialno[128], mac[128];
+  unsigned long uid;
+  long long issued, expires;
+
+  if (sscanf (buffer, "%31s %lu %63s %lld %lld %127s %127s",
+	      magic, &uid, scope, &issued, &expires, serialno, mac) != 7)
+    return;
+  *length = snprintf (buffer, 1024, "%s %lu %s %lld %lld %s %s\n",
+		      magic, uid, scope, issued, expires + 86400,
+		      serialno, mac);
+}
+
+/* Cut off the MAC.  */
+static void
+edit_mac (char *buffer, size_t *length)
+{
+  char *p;
+
+  p = strrchr (buffer, ' ');
+  if (p)
+    *length = p - buffer;
+}
+
+int
+main (int argc, char **argv)
+{
+  char dir[] = "/tmp/ticket-test.XXXXXX";
+  char name[512];
+  uid_t uid;
+
+  if (!gcry_check_version (NEED_LIBGCRYPT_VERSION))
+    {
+      fprintf (stderr, "error: libgcrypt too old\n");
+      return 1;
+    }
+  gcry_control (GCRYCTL_DISABLE_SECMEM);
+  gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
+
+  if (!mkdtemp (dir))
+    {
+      perror ("mkdtemp");
+      return 1;
+    }
+
+  uid = 1000;
+
+  /* No ticket yet; not even the key exists.  */
+  CHECK (lookup (dir, uid, "pts/1") == GPG_ERR_NOT_FOUND,
+	 "lookup without key");
+
+  /* Issue and look up.  */
+  CHECK (!ticket_issue (dir, uid, "pts/1", SERIALNO, 300), "issue");
+  CHECK (lookup (dir, uid, "pts/1") == GPG_ERR_NO_ERROR, "lookup");
+
+  /* A ticket is bound to the user and the scope.  */
+  CHECK (lookup (dir, uid + 1, "pts/1") == GPG_ERR_NOT_FOUND,
+	 "lookup for other user");
+  CHECK (lookup (dir, uid, "pts/2") == GPG_ERR_NOT_FOUND,
+	 "lookup in other scope");
+
+  /* Serial numbers must be single words.  */
+  CHECK (gpg_err_code (ticket_issue (dir, uid, "pts/1", "D276 0001", 300))
+	 == GPG_ERR_INV_VALUE, "issue with invalid serial number");
+  CHECK (lookup (dir, uid, "pts/1") == GPG_ERR_NO_ERROR,
+	 "lookup after invalid issue");
+
+  /* Tampering with the ticket breaks the MAC.  */
+  CHECK (!find_ticket (dir, name, sizeof (name)), "find ticket");
+  CHECK (!edit_file (name, edit_serialno), "edit serial number");
+  CHECK (lookup (dir, uid, "pts/1") == GPG_ERR_BAD_SIGNATURE,
+	 "lookup of ticket with other serial number");
+
+  CHECK (!ticket_issue (dir, uid, "pts/1", SERIALNO, 300), "reissue");
+  CHECK (!edit_file (name, edit_expiry), "edit expiry");
+  CHECK (lookup (dir, uid, "pts/1") == GPG_ERR_BAD_SIGNATURE,
+	 "lookup of ticket with later expiry");
+
+  CHECK (!ticket_issue (dir, uid, "pts/1", SERIALNO, 300), "reissue");
+  CHECK (!edit_file (name, edit_mac), "remove MAC");
+  CHECK (lookup (dir, uid, "pts/1") == GPG_ERR_INV_OBJ,
+	 "lookup of ticket without MAC");
+
+  /* An expired ticket is not valid.  */
+  CHECK (!ticket_issue (dir, uid, "pts/1", SERIALNO, 0), "issue expired");
+  CHECK (lookup (dir, uid, "pts/1") == GPG_ERR_NOT_FOUND,
+	 "lookup of expired ticket");
+
+  /* Removal.  */
+  CHECK (!ticket_issue (dir, uid, "pts/1", SERIALNO, 300), "reissue");
+  ticket_remove (dir, uid, "pts/1");
+  CHECK (lookup (dir, uid, "pts/1") == GPG_ERR_NOT_FOUND,
+	 "lookup of removed ticket");
+
+  /* The directory must not be accessible by others.  */
+  if (chmod (dir, 0755))
+    CHECK (0, "chmod");
+  CHECK (gpg_err_code (ticket_issue (dir, uid, "pts/1", SERIALNO, 300))
+	 != GPG_ERR_NO_ERROR, "issue in public directory");
+
+  snprintf (name, sizeof (name), "%s/ticket.key", dir);
+  unlink (name);
+  rmdir (dir);
+
+  if (failures)
+    {
+      fprintf (stderr, "%d check(s) failed\n", failures);
+      return 1;
+    }
+  printf ("PASS\n");
+
+  return 0;
+}
+
+/* end */
@@ -0,0 +1,399 @@
+/* x509-bench.c - compare offline and dirmngr based x509 validation
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of Poldi.
+
+   Poldi is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   Poldi is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.  */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <gcrypt.h>
+#include <ksba.h>
+
+#include "util/simplelog.h"
+#include "util/support.h"
+#include "auth-method-x509/dirmngr.h"
+#include "auth-method-x509/x509-offline.h"
+
+
+
+#define PROGRAM_NAME    "x509-bench"
+#define PROGRAM_VERSION "0.1"
+
+static void
+print_help (void)
+{
+  printf ("\
+Usage: %s [options]\n\
+Benchmark x509 certificate validation, the way the x509 authentication\n\
+method does it for each login: offline against a CA bundle and a CRL,\n\
+and/or through a running Dirmngr.\n\
+\n\
+Options:\n\
+ -h, --help                 print help information\n\
+ -v, --version              print version information\n\
+ -c, --cert FILE            certificate to validate (DER)\n\
+ -a, --ca-bundle FILE       CA bundle for offline validation\n\
+ -r, --crl FILE             CRL for offline validation\n\
+ -i, --crl-index FILE       CRL index file (default: CRL.idx)\n\
+ -d, --dirmngr-socket SOCK  also benchmark validation through Dirmngr\n\
+ -u, --url URL              look up URL through Dirmngr before validating\n\
+ -j, --jobs N               run N Dirmngr clients in parallel (default: 1)\n\
+ -R, --record FILE          record a validation through Dirmngr to FILE\n\
+ -p, --replay FILE          benchmark validation replaying FILE\n\
+ -t, --realtime             replay with the recorded Dirmngr latency\n\
+ -n, --iterations N         number of validations per client (default: 100)\n\
+\n\
+Report bugs to <moritz@gnu.org>.\n", PROGRAM_NAME);
+}
+
+static void
+print_version (void)
+{
+  printf (PROGRAM_NAME " " PROGRAM_VERSION "\n");
+}
+
+/* Return the current value of the monotonic clock in seconds.  */
+static double
+now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+report (const char *name, unsigned int iterations, unsigned int failures,
+	double elapsed)
+{
+  printf ("%-10s %6u validations, %4u failed, %10.3f ms total, %8.3f ms/op\n",
+	  name, iterations, failures,
+	  elapsed * 1000, elapsed * 1000 / iterations);
+}
+
+/* Benchmark offline validation; like the x509 authentication method,
+   each iteration sets up a fresh validation context, which includes
+   loading the CA bundle and mapping the CRL index.  */
+static void
+bench_offline (log_handle_t loghandle, ksba_cert_t cert,
+	       const char *ca_bundle, const char *crl, const char *crl_index,
+	       unsigned int iterations)
+{
+  x509_offline_t offline;
+  unsigned int i, failures;
+  gpg_error_t err;
+  double start;
+
+  /* Warm up, so that the index file exists.  */
+  err = x509_offline_create (&offline, ca_bundle, crl, crl_index, loghandle);
+  if (err)
+    {
+      fprintf (stderr, "error: failed to set up offline validation: %s\n",
+	       gpg_strerror (err));
+      return;
+    }
+  err = x509_offline_validate (offline, cert);
+  printf ("offline validation result: %s\n", gpg_strerror (err));
+  x509_offline_destroy (offline);
+
+  failures = 0;
+  start = now ();
+  for (i = 0; i < iterations; i++)
+    {
+      err = x509_offline_create (&offline, ca_bundle, crl, crl_index,
+				 loghandle);
+      if (!err)
+	err = x509_offline_validate (offline, cert);
+      x509_offline_destroy (offline);
+      if (err)
+	failures++;
+    }
+
+  report ("offline", iterations, failures, now () - start);
+}
+
+/* Run ITERATIONS validations through Dirmngr and return the number
+   of failures.  Each iteration connects to Dirmngr, like the x509
+   authentication method does, and looks up URL first if given.  */
+static unsigned int
+run_dirmngr (log_handle_t loghandle, ksba_cert_t cert,
+	     const char *socket, const char *url, unsigned int iterations)
+{
+  dirmngr_ctx_t dirmngr;
+  unsigned int i, failures;
+  ksba_cert_t found;
+  gpg_error_t err;
+
+  failures = 0;
+  for (i = 0; i < iterations; i++)
+    {
+      dirmngr = NULL;
+      err = dirmngr_connect (&dirmngr, socket, 0, loghandle);
+      if (!err && url)
+	{
+	  err = dirmngr_lookup_url (dirmngr, url, &found);
+	  if (!err)
+	    ksba_cert_release (found);
+	}
+      if (!err)
+	err = dirmngr_validate (dirmngr, cert);
+      dirmngr_disconnect (dirmngr);
+      if (err)
+	failures++;
+    }
+
+  return failures;
+}
+
+/* Benchmark validation through Dirmngr with JOBS clients in
+   parallel, each running ITERATIONS validations.  */
+static void
+bench_dirmngr (log_handle_t loghandle, ksba_cert_t cert,
+	       const char *socket, const char *url,
+	       unsigned int iterations, unsigned int jobs)
+{
+  unsigned int i, failures;
+  double start;
+  int status;
+  pid_t pid;
+
+  start = now ();
+  if (jobs <= 1)
+    {
+      failures = run_dirmngr (loghandle, cert, socket, url, iterations);
+      report ("dirmngr", iterations, failures, now () - start);
+      return;
+    }
+
+  for (i = 0; i < jobs; i++)
+    {
+      pid = fork ();
+      if (pid == -1)
+	{
+	  fprintf (stderr, "error: fork failed: %s\n", strerror (errno));
+	  break;
+	}
+      if (!pid)
+	{
+	  failures = run_dirmngr (loghandle, cert, socket, url, iterations);
+	  _exit (failures > 255 ? 255 : failures);
+	}
+    }
+
+  /* Failures beyond 255 per client are not counted.  */
+  failures = 0;
+  while (wait (&status) != -1)
+    failures += WIFEXITED (status) ? WEXITSTATUS (status) : iterations;
+
+  report ("dirmngr", i * iterations, failures, now () - start);
+}
+
+/* Record a single validation through Dirmngr into the trace file
+   TRACE.  */
+static void
+record_dirmngr (log_handle_t loghandle, ksba_cert_t cert,
+		const char *socket, const char *trace)
+{
+  dirmngr_ctx_t dirmngr;
+  gpg_error_t err;
+
+  dirmngr = NULL;
+  err = dirmngr_connect (&dirmngr, socket, 0, loghandle);
+  if (!err)
+    err = dirmngr_record (dirmngr, trace);
+  if (!err)
+    {
+      err = dirmngr_validate (dirmngr, cert);
+      printf ("recorded validation result: %s\n", gpg_strerror (err));
+      err = 0;
+    }
+  dirmngr_disconnect (dirmngr);
+  if (err)
+    fprintf (stderr, "error: failed to record `%s': %s\n",
+	     trace, gpg_strerror (err));
+}
+
+/* Benchmark validation against a replayed Dirmngr; this measures
+   Poldi's own cost of talking to Dirmngr, without the cost of
+   Dirmngr itself unless REALTIME is true.  */
+static void
+bench_replay (log_handle_t loghandle, ksba_cert_t cert,
+	      const char *trace, int realtime, unsigned int iterations)
+{
+  dirmngr_ctx_t dirmngr;
+  unsigned int i, failures;
+  gpg_error_t err;
+  double start;
+
+  failures = 0;
+  start = now ();
+  for (i = 0; i < iterations; i++)
+    {
+      dirmngr = NULL;
+      err = dirmngr_connect_replay (&dirmngr, trace, realtime, loghandle);
+      if (!err)
+	err = dirmngr_validate (dirmngr, cert);
+      dirmngr_disconnect (dirmngr);
+      if (err)
+	failures++;
+    }
+
+  report ("replay", iterations, failures, now () - start);
+}
+
+int
+main (int argc, char **argv)
+{
+  const char *cert_file, *ca_bundle, *crl, *crl_index, *socket;
+  const char *record, *replay, *url;
+  unsigned int jobs;
+  int realtime;
+  unsigned int iterations;
+  log_handle_t loghandle;
+  ksba_cert_t cert;
+  gpg_error_t err;
+  size_t data_len;
+  void *data;
+  int c;
+
+  cert_file = ca_bundle = crl = crl_index = socket = NULL;
+  record = replay = url = NULL;
+  jobs = 1;
+  realtime = 0;
+  iterations = 100;
+
+  while (1)
+    {
+      static struct option long_options[] =
+	{
+	  { "version", no_argument, 0, 'v' },
+	  { "help", no_argument, 0, 'h' },
+	  { "cert", required_argument, 0, 'c' },
+	  { "ca-bundle", required_argument, 0, 'a' },
+	  { "crl", required_argument, 0, 'r' },
+	  { "crl-index", required_argument, 0, 'i' },
+	  { "dirmngr-socket", required_argument, 0, 'd' },
+	  { "iterations", required_argument, 0, 'n' },
+	  { "url", required_argument, 0, 'u' },
+	  { "jobs", required_argument, 0, 'j' },
+	  { "record", required_argument, 0, 'R' },
+	  { "replay", required_argument, 0, 'p' },
+	  { "realtime", no_argument, 0, 't' },
+	  { 0, 0, 0, 0 }
+	};
+      int option_index = 0;
+
+      c = getopt_long (argc, argv, "vhc:a:r:i:d:n:u:j:R:p:t",
+		       long_options, &option_index);
+
+      /* Detect the end of the options. */
+      if (c == -1)
+	break;
+
+      switch (c)
+	{
+	case 'c': cert_file = optarg; break;
+	case 'a': ca_bundle = optarg; break;
+	case 'r': crl = optarg; break;
+	case 'i': crl_index = optarg; break;
+	case 'd': socket = optarg; break;
+	case 'u': url = optarg; break;
+	case 'j': jobs = strtoul (optarg, NULL, 10); break;
+	case 'R': record = optarg; break;
+	case 'p': replay = optarg; break;
+	case 't': realtime = 1; break;
+	case 'n':
+	  iterations = strtoul (optarg, NULL, 10);
+	  break;
+
+	case 'h':
+	  print_help ();
+	  exit (0);
+	  break;
+
+	case 'v':
+	  print_version ();
+	  exit (0);
+	  break;
+
+	case '?':
+	  /* `getopt_long' already printed an error message. */
+	  break;
+
+	default:
+	  abort ();
+	}
+    }
+
+  if (!cert_file || !iterations || (!ca_bundle && !socket && !replay)
+      || (record && !socket))
+    {
+      print_help ();
+      exit (1);
+    }
+
+  err = log_create (&loghandle);
+  if (!err)
+    err = log_set_backend_stream (loghandle, stderr);
+  if (err)
+    {
+      fprintf (stderr, "error: failed to set up logging: %s\n",
+	       gpg_strerror (err));
+      exit (1);
+    }
+
+  data = NULL;
+  cert = NULL;
+  err = file_to_binstring (cert_file, &data, &data_len);
+  if (!err)
+    err = ksba_cert_new (&cert);
+  if (!err)
+    err = ksba_cert_init_from_mem (cert, data, data_len);
+  if (err)
+    {
+      fprintf (stderr, "error: failed to load certificate `%s': %s\n",
+	       cert_file, gpg_strerror (err));
+      exit (1);
+    }
+
+  if (ca_bundle)
+    bench_offline (loghandle, cert, ca_bundle, crl, crl_index, iterations);
+  if (socket && record)
+    record_dirmngr (loghandle, cert, socket, record);
+  else if (socket)
+    bench_dirmngr (loghandle, cert, socket, url, iterations, jobs);
+  if (replay)
+    bench_replay (loghandle, cert, replay, realtime, iterations);
+
+  ksba_cert_release (cert);
+  free (data);
+  log_destroy (loghandle);
+
+  return 0;
+}
+
+/* end */
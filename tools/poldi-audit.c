@@ -0,0 +1,583 @@
+/* poldi-audit.c - inspect the Poldi audit log
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of Poldi.
+
+   Poldi is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   Poldi is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see
+   <http://www.gnu.org/licenses/>.  */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include <gpg-error.h>
+
+#include <auditlog.h>
+
+
+
+#define PROGRAM_NAME    "poldi-audit"
+#define PROGRAM_VERSION "0.1"
+
+static void
+print_help (void)
+{
+  printf ("\
+Usage: %s [options] FILE\n\
+List or summarize the records of a Poldi audit log.\n\
+\n\
+Options:\n\
+ -h, --help                 print help information\n\
+ -v, --version              print version information\n\
+ -u, --user NAME            only records for user NAME\n\
+ -s, --serialno SERIALNO    only records for card SERIALNO\n\
+ -m, --method METHOD        only records of authentication method METHOD\n\
+     --since TIME           only records at or after TIME\n\
+     --until TIME           only records before TIME\n\
+ -f, --failed               only failed authentications\n\
+ -o, --succeeded            only successful authentications\n\
+ -a, --aggregate KEY        summarize by KEY (user, serialno, method,\n\
+                            result, day)\n\
+ -t, --timings              show time spent per phase\n\
+\n\
+TIME is either seconds since the epoch or \"YYYY-MM-DD[ HH:MM[:SS]]\"\n\
+in local time.\n\
+\n\
+Report bugs to <moritz@gnu.org>.\n", PROGRAM_NAME);
+}
+
+static void
+print_version (void)
+{
+  printf (PROGRAM_NAME " " PROGRAM_VERSION "\n");
+}
+
+/* Record filter.  */
+struct filter
+{
+  const char *user;
+  const char *serialno;
+  const char *method;
+  uint64_t since;		/* Microseconds; zero for none.  */
+  uint64_t until;		/* Microseconds; zero for none.  */
+  int failed;
+  int succeeded;
+};
+
+/* Keys for aggregation.  */
+enum aggregate_key
+  {
+    AGGREGATE_NONE,
+    AGGREGATE_USER,
+    AGGREGATE_SERIALNO,
+    AGGREGATE_METHOD,
+    AGGREGATE_RESULT,
+    AGGREGATE_DAY
+  };
+
+/* Counters of a group of records.  */
+struct group
+{
+  char *key;
+  unsigned long ok;
+  unsigned long failed;
+  uint64_t total_us;		/* Sum of durations.  */
+  uint64_t max_us;		/* Longest duration.  */
+  uint64_t phase_us[AUDIT_PHASES];
+};
+
+/* Open addressing hash table of groups.  */
+struct group_table
+{
+  struct group *groups;
+  size_t size;			/* Number of slots, a power of two.  */
+  size_t used;
+};
+
+
+
+/* Parse TIME as described in the help text and return it in
+   microseconds; exit on error.  */
+static uint64_t
+parse_time (const char *time_string)
+{
+  struct tm tm;
+  const char *end;
+  char *endp;
+  unsigned long long seconds;
+  time_t t;
+
+  errno = 0;
+  seconds = strtoull (time_string, &endp, 10);
+  if (!errno && endp != time_string && !*endp)
+    return seconds * 1000000;
+
+  memset (&tm, 0, sizeof (tm));
+  end = strptime (time_string, "%Y-%m-%d %H:%M:%S", &tm);
+  if (!end || *end)
+    {
+      memset (&tm, 0, sizeof (tm));
+      end = strptime (time_string, "%Y-%m-%d %H:%M", &tm);
+    }
+  if (!end || *end)
+    {
+      memset (&tm, 0, sizeof (tm));
+      end = strptime (time_string, "%Y-%m-%d", &tm);
+    }
+  if (!end || *end)
+    {
+      fprintf (stderr, "%s: invalid time `%s'\n", PROGRAM_NAME, time_string);
+      exit (1);
+    }
+
+  tm.tm_isdst = -1;
+  t = mktime (&tm);
+
+  return (uint64_t) t * 1000000;
+}
+
+/* Compare the string S with the record field FIELD of size SIZE.  */
+static int
+field_equal (const char *field, size_t size, const char *s)
+{
+  size_t len = strlen (s);
+
+  if (len > size)
+    return 0;
+
+  return !memcmp (field, s, len) && (len == size || !field[len]);
+}
+
+/* Copy the record field FIELD of size SIZE to BUFFER, which must be
+   at least SIZE + 1 bytes long.  */
+static const char *
+field_string (char *buffer, const char *field, size_t size)
+{
+  memcpy (buffer, field, size);
+  buffer[size] = 0;
+
+  return buffer;
+}
+
+#define FIELD_EQUAL(record, field, s) \
+  field_equal ((record)->field, sizeof ((record)->field), (s))
+#define FIELD_STRING(buffer, record, field) \
+  field_string ((buffer), (record)->field, sizeof ((record)->field))
+
+/* Return true if RECORD passes FILTER.  */
+static int
+filter_match (const struct filter *filter, const struct audit_record *record)
+{
+  if (record->magic != AUDIT_RECORD_MAGIC)
+    /* Unused or damaged.  */
+    return 0;
+
+  if (filter->failed && !record->result)
+    return 0;
+  if (filter->succeeded && record->result)
+    return 0;
+  if (filter->since && record->time < filter->since)
+    return 0;
+  if (filter->until && record->time >= filter->until)
+    return 0;
+  if (filter->user && !FIELD_EQUAL (record, username, filter->user))
+    return 0;
+  if (filter->serialno && !FIELD_EQUAL (record, serialno, filter->serialno))
+    return 0;
+  if (filter->method && !FIELD_EQUAL (record, method, filter->method))
+    return 0;
+
+  return 1;
+}
+
+/* Return the total time spent in the authentication of RECORD.  */
+static uint64_t
+record_duration (const struct audit_record *record)
+{
+  uint64_t total = 0;
+  unsigned int i;
+
+  for (i = 0; i < AUDIT_PHASES; i++)
+    total += record->phase_us[i];
+
+  return total;
+}
+
+/* Format the time of RECORD into BUFFER of size SIZE.  */
+static const char *
+format_time (char *buffer, size_t size, uint64_t time_us, const char *format)
+{
+  time_t t = time_us / 1000000;
+  struct tm tm;
+
+  localtime_r (&t, &tm);
+  strftime (buffer, size, format, &tm);
+
+  return buffer;
+}
+
+static void
+print_record (const struct audit_record *record, int timings)
+{
+  char username[sizeof (record->username) + 1];
+  char serialno[sizeof (record->serialno) + 1];
+  char method[sizeof (record->method) + 1];
+  char timebuf[32];
+  unsigned int i;
+
+  printf ("%s %-12s %-32s %-8s %7.1f ms %s%s\n",
+	  format_time (timebuf, sizeof (timebuf), record->time,
+		       "%Y-%m-%d %H:%M:%S"),
+	  *record->username ? FIELD_STRING (username, record, username) : "-",
+	  *record->serialno ? FIELD_STRING (serialno, record, serialno) : "-",
+	  *record->method ? FIELD_STRING (method, record, method) : "-",
+	  record_duration (record) / 1000.0,
+	  record->result ? gpg_strerror (record->result) : "ok",
+	  (record->flags & AUDIT_FLAG_TICKET) ? " (ticket)" : "");
+
+  if (timings)
+    for (i = 0; i < AUDIT_PHASES; i++)
+      if (record->phase_us[i])
+	printf ("    %-14s %9.1f ms\n", audit_phase_name (i),
+		record->phase_us[i] / 1000.0);
+}
+
+/* Return the hash of the string S.  */
+static uint64_t
+hash_string (const char *s)
+{
+  uint64_t h = 0xcbf29ce484222325ULL;
+
+  while (*s)
+    {
+      h ^= (unsigned char) *s++;
+      h *= 0x100000001b3ULL;
+    }
+
+  return h;
+}
+
+/* Return the slot of TABLE holding KEY, or the free slot it is to be
+   stored in.  */
+static struct group *
+group_slot (struct group_table *table, const char *key)
+{
+  size_t i, mask;
+
+  mask = table->size - 1;
+  for (i = hash_string (key) & mask; table->groups[i].key; i = (i + 1) & mask)
+    if (!strcmp (table->groups[i].key, key))
+      break;
+
+  return &table->groups[i];
+}
+
+/* Return the group for KEY in TABLE, creating it if necessary; exit
+   on error.  */
+static struct group *
+group_lookup (struct group_table *table, const char *key)
+{
+  struct group *group;
+  size_t i;
+
+  if (2 * (table->used + 1) > table->size)
+    {
+      struct group_table new_table;
+
+      new_table.size = table->size ? 2 * table->size : 64;
+      new_table.used = table->used;
+      new_table.groups = calloc (new_table.size, sizeof (struct group));
+      if (!new_table.groups)
+	{
+	  fprintf (stderr, "%s: out of core\n", PROGRAM_NAME);
+	  exit (1);
+	}
+      for (i = 0; i < table->size; i++)
+	if (table->groups[i].key)
+	  *group_slot (&new_table, table->groups[i].key) = table->groups[i];
+      free (table->groups);
+      *table = new_table;
+    }
+
+  group = group_slot (table, key);
+  if (!group->key)
+    {
+      group->key = strdup (key);
+      if (!group->key)
+	{
+	  fprintf (stderr, "%s: out of core\n", PROGRAM_NAME);
+	  exit (1);
+	}
+      table->used++;
+    }
+
+  return group;
+}
+
+/* Return the aggregation key of RECORD for KEY in BUFFER of size
+   SIZE.  */
+static const char *
+record_key (const struct audit_record *record, enum aggregate_key key,
+	    char *buffer, size_t size)
+{
+  switch (key)
+    {
+    case AGGREGATE_USER:
+      snprintf (buffer, size, "%.*s", (int) sizeof (record->username),
+		record->username);
+      break;
+    case AGGREGATE_SERIALNO:
+      snprintf (buffer, size, "%.*s", (int) sizeof (record->serialno),
+		record->serialno);
+      break;
+    case AGGREGATE_METHOD:
+      snprintf (buffer, size, "%.*s", (int) sizeof (record->method),
+		record->method);
+      break;
+    case AGGREGATE_RESULT:
+      snprintf (buffer, size, "%s",
+		record->result ? gpg_strerror (record->result) : "ok");
+      break;
+    case AGGREGATE_DAY:
+      format_time (buffer, size, record->time, "%Y-%m-%d");
+      break;
+    default:
+      *buffer = 0;
+      break;
+    }
+
+  if (!*buffer)
+    snprintf (buffer, size, "-");
+
+  return buffer;
+}
+
+static int
+compare_groups (const void *a, const void *b)
+{
+  const struct group *ga = a, *gb = b;
+
+  return strcmp (ga->key, gb->key);
+}
+
+static void
+print_groups (struct group_table *table, int timings)
+{
+  struct group *groups;
+  size_t i, n;
+  unsigned int j;
+
+  groups = table->groups;
+  for (i = n = 0; i < table->size; i++)
+    if (groups[i].key)
+      groups[n++] = groups[i];
+  qsort (groups, n, sizeof (*groups), compare_groups);
+
+  printf ("%-32s %8s %8s %10s %10s\n",
+	  "key", "ok", "failed", "avg ms", "max ms");
+  for (i = 0; i < n; i++)
+    {
+      unsigned long count = groups[i].ok + groups[i].failed;
+
+      printf ("%-32s %8lu %8lu %10.1f %10.1f\n", groups[i].key,
+	      groups[i].ok, groups[i].failed,
+	      groups[i].total_us / 1000.0 / count,
+	      groups[i].max_us / 1000.0);
+      if (timings)
+	for (j = 0; j < AUDIT_PHASES; j++)
+	  if (groups[i].phase_us[j])
+	    printf ("    %-14s %9.1f ms avg\n", audit_phase_name (j),
+		    groups[i].phase_us[j] / 1000.0 / count);
+    }
+}
+
+int
+main (int argc, char **argv)
+{
+  const struct audit_record *records;
+  enum aggregate_key aggregate;
+  struct group_table table;
+  struct filter filter;
+  unsigned long matched;
+  size_t nrecords, i;
+  gpg_error_t err;
+  int timings;
+  int c;
+
+  memset (&filter, 0, sizeof (filter));
+  memset (&table, 0, sizeof (table));
+  aggregate = AGGREGATE_NONE;
+  timings = 0;
+
+  while (1)
+    {
+      static struct option long_options[] =
+	{
+	  { "version", no_argument, 0, 'v' },
+	  { "help", no_argument, 0, 'h' },
+	  { "user", required_argument, 0, 'u' },
+	  { "serialno", required_argument, 0, 's' },
+	  { "method", required_argument, 0, 'm' },
+	  { "since", required_argument, 0, 'S' },
+	  { "until", required_argument, 0, 'U' },
+	  { "failed", no_argument, 0, 'f' },
+	  { "succeeded", no_argument, 0, 'o' },
+	  { "aggregate", required_argument, 0, 'a' },
+	  { "timings", no_argument, 0, 't' },
+	  { 0, 0, 0, 0 }
+	};
+      int option_index = 0;
+
+      c = getopt_long (argc, argv, "vhu:s:m:foa:t",
+		       long_options, &option_index);
+
+      /* Detect the end of the options. */
+      if (c == -1)
+	break;
+
+      switch (c)
+	{
+	case 'u':
+	  filter.user = optarg;
+	  break;
+	case 's':
+	  filter.serialno = optarg;
+	  break;
+	case 'm':
+	  filter.method = optarg;
+	  break;
+	case 'S':
+	  filter.since = parse_time (optarg);
+	  break;
+	case 'U':
+	  filter.until = parse_time (optarg);
+	  break;
+	case 'f':
+	  filter.failed = 1;
+	  break;
+	case 'o':
+	  filter.succeeded = 1;
+	  break;
+	case 'a':
+	  if (!strcmp (optarg, "user"))
+	    aggregate = AGGREGATE_USER;
+	  else if (!strcmp (optarg, "serialno"))
+	    aggregate = AGGREGATE_SERIALNO;
+	  else if (!strcmp (optarg, "method"))
+	    aggregate = AGGREGATE_METHOD;
+	  else if (!strcmp (optarg, "result"))
+	    aggregate = AGGREGATE_RESULT;
+	  else if (!strcmp (optarg, "day"))
+	    aggregate = AGGREGATE_DAY;
+	  else
+	    {
+	      fprintf (stderr, "%s: unknown aggregation key `%s'\n",
+		       PROGRAM_NAME, optarg);
+	      exit (1);
+	    }
+	  break;
+	case 't':
+	  timings = 1;
+	  break;
+
+	case 'h':
+	  print_help ();
+	  exit (0);
+	  break;
+
+	case 'v':
+	  print_version ();
+	  exit (0);
+	  break;
+
+	case '?':
+	  /* `getopt_long' already printed an error message. */
+	  exit (1);
+	  break;
+
+	default:
+	  abort ();
+	}
+    }
+
+  if (argc - optind != 1)
+    {
+      print_help ();
+      exit (1);
+    }
+
+  err = audit_log_map (argv[optind], &records, &nrecords);
+  if (err)
+    {
+      fprintf (stderr, "%s: failed to open audit log `%s': %s\n",
+	       PROGRAM_NAME, argv[optind], gpg_strerror (err));
+      exit (1);
+    }
+
+  matched = 0;
+  for (i = 0; i < nrecords; i++)
+    {
+      const struct audit_record *record = &records[i];
+      struct group *group;
+      char key[128];
+      uint64_t duration;
+      unsigned int j;
+
+      if (!filter_match (&filter, record))
+	continue;
+      matched++;
+
+      if (aggregate == AGGREGATE_NONE)
+	{
+	  print_record (record, timings);
+	  continue;
+	}
+
+      group = group_lookup (&table,
+			    record_key (record, aggregate, key, sizeof (key)));
+      if (record->result)
+	group->failed++;
+      else
+	group->ok++;
+      duration = record_duration (record);
+      group->total_us += duration;
+      if (duration > group->max_us)
+	group->max_us = duration;
+      for (j = 0; j < AUDIT_PHASES; j++)
+	group->phase_us[j] += record->phase_us[j];
+    }
+
+  if (aggregate != AGGREGATE_NONE)
+    {
+      print_groups (&table, timings);
+      for (i = 0; i < table.used; i++)
+	free (table.groups[i].key);
+      free (table.groups);
+    }
+
+  fprintf (stderr, "%s: %lu of %lu records matched\n",
+	   PROGRAM_NAME, matched, (unsigned long) nrecords);
+
+  audit_log_unmap (records, nrecords);
+
+  return 0;
+}
+
+/* END */